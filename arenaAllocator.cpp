@@ -0,0 +1,141 @@
+/*
+ * arenaAllocator.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "arenaAllocator.h"
+#include <new>
+
+/**
+ * Chunks are CHUNK_SIZE aligned, so release() can find the chunk header by
+ * masking the pointer.  Allocations bigger than a chunk get a chunk of
+ * their own, which starts with the same header.
+ *
+ * refs counts live allocations, plus one while a thread is still carving
+ * new allocations out of the chunk.
+ *
+ * live is the number of bytes allocated from the chunk and not yet
+ * released, plus RETIRED once nobody carves from it any more.  A chunk's
+ * live bytes count against bytes_held() until it is retired; from then on
+ * the whole chunk does, until it is freed.
+ */
+struct arenaAllocator::chunk {
+  arenaAllocator * owner;
+  std::atomic<int64_t> refs;
+  std::atomic<int64_t> live;
+  size_t size;
+  size_t offset; // only touched by the thread that owns the chunk.
+  chunk * prev;
+  chunk * next;
+};
+
+typedef uint64_t alloc_header_t; // length of the allocation, including this header.
+
+static const int64_t RETIRED = 1LL << 62;
+
+static inline size_t round_up(size_t len) {
+  return (len + sizeof(alloc_header_t) - 1) & ~(sizeof(alloc_header_t) - 1);
+}
+
+arenaAllocator::arenaAllocator() : chunks_(NULL), bytes_in_use_(0), bytes_held_(0) {
+  pthread_key_create(&key_, &arenaAllocator::thread_exit);
+  pthread_mutex_init(&mut_, 0);
+}
+
+arenaAllocator::~arenaAllocator() {
+  pthread_key_delete(key_);
+  while(chunks_) {
+    chunk * c = chunks_;
+    chunks_ = c->next;
+    free(c);
+  }
+  pthread_mutex_destroy(&mut_);
+}
+
+arenaAllocator::chunk * arenaAllocator::new_chunk(size_t len) {
+  void * mem;
+  int err = posix_memalign(&mem, CHUNK_SIZE, len);
+  if(err) { perror("Could not allocate C0 arena chunk"); abort(); }
+  chunk * c = (chunk*)mem;
+  c->owner = this;
+  new (&c->refs) std::atomic<int64_t>(0);
+  new (&c->live) std::atomic<int64_t>(0);
+  c->size = len;
+  c->offset = round_up(sizeof(chunk));
+  c->prev = NULL;
+  pthread_mutex_lock(&mut_);
+  c->next = chunks_;
+  if(chunks_) { chunks_->prev = c; }
+  chunks_ = c;
+  pthread_mutex_unlock(&mut_);
+  return c;
+}
+
+void arenaAllocator::unref(chunk * c) {
+  if(--(c->refs) == 0) {
+    arenaAllocator * a = c->owner;
+    pthread_mutex_lock(&a->mut_);
+    if(c->prev) { c->prev->next = c->next; } else { a->chunks_ = c->next; }
+    if(c->next) { c->next->prev = c->prev; }
+    pthread_mutex_unlock(&a->mut_);
+    a->bytes_held_ -= c->size;
+    free(c);
+  }
+}
+
+void arenaAllocator::retire(chunk * c) {
+  int64_t live = c->live.fetch_add(RETIRED);
+  // The chunk's live bytes were already held; now the rest of it is too.
+  c->owner->bytes_held_ += c->size - live;
+  unref(c);
+}
+
+void arenaAllocator::thread_exit(void * c) {
+  retire((chunk*)c);
+}
+
+void * arenaAllocator::alloc(size_t len) {
+  len = round_up(len + sizeof(alloc_header_t));
+  chunk * c;
+  if(len > CHUNK_SIZE - round_up(sizeof(chunk))) {
+    c = new_chunk(round_up(sizeof(chunk)) + len);
+    c->live = RETIRED; // nothing else will be carved from it.
+    bytes_held_ += c->size;
+  } else {
+    c = (chunk*)pthread_getspecific(key_);
+    if(!c || c->offset + len > c->size) {
+      if(c) { retire(c); } // we are done carving up the old chunk.
+      c = new_chunk(CHUNK_SIZE);
+      c->refs++;
+      pthread_setspecific(key_, c);
+    }
+  }
+  alloc_header_t * h = (alloc_header_t*)(((byte*)c) + c->offset);
+  c->offset += len;
+  c->refs++;
+  *h = len;
+  bytes_in_use_ += len;
+  if(c->live.fetch_add(len) < RETIRED) { bytes_held_ += len; }
+  return h + 1;
+}
+
+void arenaAllocator::release(void * p) {
+  alloc_header_t * h = ((alloc_header_t*)p) - 1;
+  chunk * c = (chunk*)(((uintptr_t)h) & ~(uintptr_t)(CHUNK_SIZE - 1));
+  c->owner->bytes_in_use_ -= *h;
+  if(c->live.fetch_sub(*h) < RETIRED) { c->owner->bytes_held_ -= *h; }
+  unref(c);
+}
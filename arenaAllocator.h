@@ -0,0 +1,98 @@
+/*
+ * arenaAllocator.h
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef ARENAALLOCATOR_H_
+#define ARENAALLOCATOR_H_
+
+#include <atomic>
+#include <pthread.h>
+#include "dataTuple.h"
+
+/**
+ * Bump allocator for the tuples and tree nodes of a single C0.
+ *
+ * Each thread carves allocations out of its own CHUNK_SIZE chunk, so the
+ * allocation fast path takes no locks and does no atomic read-modify-write
+ * on shared state other than the chunk's reference count.  Chunks are
+ * returned to the system as soon as every allocation in them has been
+ * released (i.e., once the C0-C1 merge has drained them); whatever is left
+ * is freed in bulk when the arena is deleted along with its tree.
+ *
+ * bytes_in_use() counts live allocations, including tree nodes and
+ * per-allocation headers.  A chunk stays allocated as long as any of its
+ * allocations is live, so bytes_held() also counts the released space in
+ * chunks no thread is carving from any more; that is what C0 is charged
+ * for.  Neither counts the rest of each thread's current chunk (at most
+ * CHUNK_SIZE per thread).
+ */
+class arenaAllocator {
+public:
+  static const size_t CHUNK_SIZE = 256 * 1024;
+
+  arenaAllocator();
+  ~arenaAllocator();
+
+  void * alloc(size_t len);
+  /** Release memory returned by alloc() on any arenaAllocator. */
+  static void release(void * p);
+
+  dataTuple * copy_tuple(const dataTuple * t) {
+    return t->copy_to(alloc(t->mem_length()));
+  }
+
+  pageid_t bytes_in_use() { return bytes_in_use_.load(); }
+  pageid_t bytes_held() { return bytes_held_.load(); }
+
+  /** Lets STL containers (memTreeComponent::rbtree_t) keep their nodes in the arena. */
+  template<class T>
+  class stl_allocator {
+  public:
+    typedef T value_type;
+    stl_allocator(arenaAllocator * arena = NULL) : arena(arena) { }
+    template<class U> stl_allocator(const stl_allocator<U> & o) : arena(o.arena) { }
+    T * allocate(size_t n) {
+      return (T*)(arena ? arena->alloc(n * sizeof(T)) : malloc(n * sizeof(T)));
+    }
+    void deallocate(T * p, size_t n) {
+      if(arena) { arenaAllocator::release(p); } else { free(p); }
+    }
+    template<class U> bool operator==(const stl_allocator<U> & o) const { return arena == o.arena; }
+    template<class U> bool operator!=(const stl_allocator<U> & o) const { return arena != o.arena; }
+
+    arenaAllocator * arena; // NULL means use malloc.
+  };
+
+private:
+  struct chunk;
+
+  chunk * new_chunk(size_t len);
+  static void unref(chunk * c);
+  static void retire(chunk * c);
+  static void thread_exit(void * c);
+
+  arenaAllocator(const arenaAllocator&);
+  void operator=(const arenaAllocator&);
+
+  pthread_key_t key_; // each thread's current chunk
+  pthread_mutex_t mut_; // protects chunks_
+  chunk * chunks_; // every chunk we have not returned yet, for bulk free.
+  std::atomic<pageid_t> bytes_in_use_;
+  std::atomic<pageid_t> bytes_held_;
+};
+
+#endif /* ARENAALLOCATOR_H_ */
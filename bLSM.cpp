@@ -26,6 +26,8 @@
 #include <stasis/logger/logHandle.h>
 #include <stasis/logger/filePool.h>
 #include "mergeStats.h"
+#include "latencyStats.h"
+#include <algorithm>
 
 
 int bLSM::limit = 0;
@@ -43,7 +45,7 @@ static inline double tv_to_double(struct timeval tv)
 // LOG TABLE IMPLEMENTATION
 /////////////////////////////////////////////////////////////////
 
-bLSM::bLSM(int log_mode, pageid_t max_c0_size, pageid_t internal_region_size, pageid_t datapage_region_size, pageid_t datapage_size)
+bLSM::bLSM(int log_mode, pageid_t max_c0_size, pageid_t internal_region_size, pageid_t datapage_region_size, pageid_t datapage_size, bool concurrent_c0)
 {
     recovering = true;
     this->max_c0_size = max_c0_size;
@@ -51,8 +53,9 @@ bLSM::bLSM(int log_mode, pageid_t max_c0_size, pageid_t internal_region_size, pa
     this->num_c0_mergers = 0;
 
     r_val = 10.0; // MIN_R
-    tree_c0 = NULL;
     tree_c0_mergeable = NULL;
+    skiplist_c0 = NULL;
+    this->concurrent_c0 = concurrent_c0;
     c0_is_merging = false;
     tree_c1_prime = NULL;
     tree_c1 = NULL;
@@ -76,16 +79,24 @@ bLSM::bLSM(int log_mode, pageid_t max_c0_size, pageid_t internal_region_size, pa
     pthread_cond_init(&c1_ready, 0);
 
     epoch = 0;
+    next_range_tombstone_id = 1;
 
     this->internal_region_size = internal_region_size;
     this->datapage_region_size = datapage_region_size;
     this->datapage_size = datapage_size;
+    this->c2_merge_partitions = 1;
+    this->c2_merge_ranges = 1;
+    this->merge_prefetch_bytes = 0;
+    this->merge_write_behind_bytes = 0;
+    this->c0_partitions = 1;
+    this->disk_levels = 2;
 
     this->log_mode = log_mode;
     this->batch_size = 0;
     log_file = stasis_log_file_pool_open("lsm_log",
     									 stasis_log_file_mode,
     									 stasis_log_file_permissions);
+    log_committer = new groupCommitter(log_file);
 }
 
 bLSM::~bLSM()
@@ -96,12 +107,29 @@ bLSM::~bLSM()
         delete tree_c1;
     if(tree_c2 != NULL)
         delete tree_c2;
+    for(size_t i = 0; i < deep_levels.size(); i++)
+    {
+      delete deep_levels[i]->tree;
+      if(deep_levels[i]->mergeable) { delete deep_levels[i]->mergeable; }
+      pthread_cond_destroy(&deep_levels[i]->needed);
+      pthread_cond_destroy(&deep_levels[i]->ready);
+      delete deep_levels[i];
+    }
 
-    if(tree_c0 != NULL)
+    for(size_t i = 0; i < c0_shards.size(); i++)
     {
-      memTreeComponent::tearDownTree(tree_c0);
+      memTreeComponent::tearDownTree(c0_shards[i].tree);
+      if(c0_shards[i].mut != &rb_mut) {
+        pthread_mutex_destroy(c0_shards[i].mut);
+        delete c0_shards[i].mut;
+      }
+    }
+    if(skiplist_c0 != NULL)
+    {
+      memTreeComponent::tearDownTree(skiplist_c0);
     }
 
+    delete log_committer; // forces anything the committer still owes its callers.
     log_file->close(log_file);
 
     pthread_mutex_destroy(&rb_mut);
@@ -111,6 +139,9 @@ bLSM::~bLSM()
     pthread_cond_destroy(&c1_needed);
     pthread_cond_destroy(&c1_ready);
     delete tmerger;
+    for(size_t i = 0; i < compaction_filters.size(); i++) {
+      delete compaction_filters[i];
+    }
 }
 
 void bLSM::init_stasis() {
@@ -133,11 +164,15 @@ recordid bLSM::allocTable(int xid)
     //create the small tree
     tree_c1 = new diskTreeComponent(xid, internal_region_size, datapage_region_size, datapage_size, stats, 10);
 
+    //and the levels below c2, if any
+    create_deep_levels(xid);
+    tbl_header.deep_levels = NULLRID;
+
     merge_mgr = new mergeManager(this);
     merge_mgr->set_c0_size(max_c0_size);
     merge_mgr->new_merge(0);
 
-    tree_c0 = new memTreeComponent::rbtree_t;
+    create_c0();
     tbl_header.merge_manager = merge_mgr->talloc(xid);
     tbl_header.log_trunc = 0;
     update_persistent_header(xid);
@@ -145,45 +180,499 @@ recordid bLSM::allocTable(int xid)
     return table_rec;
 }
 
+void bLSM::read_header(int xid) {
+  // Headers written before bloom filters were persisted are shorter, and leave these alone.
+  tbl_header.c2_bloom = INVALID_PAGE;
+  tbl_header.c1_bloom = INVALID_PAGE;
+  tbl_header.c2_dead_ranges = NULLRID;
+  tbl_header.c1_dead_ranges = NULLRID;
+  tbl_header.deep_levels = NULLRID;
+  Tread(xid, table_rec, &tbl_header);
+}
+
+// A header record that is too short for the current table_header is
+// replaced by a full sized one.  The servers find the table through
+// ROOT_RECORD, whose size cannot change, so if that is the short record,
+// it is overwritten with a forwarding header: c2_root is NULLRID, and
+// c2_state is the record that holds the real header.
+
+void bLSM::migrate_header(int xid, recordid root) {
+  recordid old = table_rec;
+  table_rec = Talloc(xid, sizeof(tbl_header));
+  Tset(xid, table_rec, &tbl_header);
+  if(old.page != root.page || old.slot != root.slot) {
+    Tdealloc(xid, old);
+  }
+  table_header fwd;
+  memset(&fwd, 0, sizeof(fwd));
+  fwd.c2_root = NULLRID;
+  fwd.c2_state = table_rec;
+  Tset(xid, root, &fwd);
+}
+
 void bLSM::openTable(int xid, recordid rid) {
   table_rec = rid;
-  Tread(xid, table_rec, &tbl_header);
-  tree_c2 = new diskTreeComponent(xid, tbl_header.c2_root, tbl_header.c2_state, tbl_header.c2_dp_state, 0);
-  tree_c1 = new diskTreeComponent(xid, tbl_header.c1_root, tbl_header.c1_state, tbl_header.c1_dp_state, 0);
-  tree_c0 = new memTreeComponent::rbtree_t;
+  read_header(xid);
+  if(table_rec.size < (int64_t)sizeof(tbl_header) && tbl_header.c2_root.size == NULLRID.size) {
+    table_rec = tbl_header.c2_state;
+    read_header(xid);
+  }
+  if(table_rec.size < (int64_t)sizeof(tbl_header)) {
+    // Otherwise, update_persistent_header() would cut off the fields the old header does not have.
+    migrate_header(xid, rid);
+  }
+  tree_c2 = new diskTreeComponent(xid, tbl_header.c2_root, tbl_header.c2_state, tbl_header.c2_dp_state, 0, tbl_header.c2_bloom, tbl_header.c2_dead_ranges);
+  tree_c1 = new diskTreeComponent(xid, tbl_header.c1_root, tbl_header.c1_state, tbl_header.c1_dp_state, 0, tbl_header.c1_bloom, tbl_header.c1_dead_ranges);
+  open_deep_levels(xid);
+  create_deep_levels(xid);
+  disk_levels = get_num_disk_levels();
+  next_range_tombstone_id = 1 + std::max(tree_c2->get_dead_ranges()->max_id(), tree_c1->get_dead_ranges()->max_id());
+  std::vector<diskTreeComponent*> deep;
+  get_deep_components(&deep);
+  for(size_t i = 0; i < deep.size(); i++) {
+    next_range_tombstone_id = std::max(next_range_tombstone_id, 1 + deep[i]->get_dead_ranges()->max_id());
+  }
 
   merge_mgr = new mergeManager(this, xid, tbl_header.merge_manager);
   merge_mgr->set_c0_size(max_c0_size);
+  create_c0();
 
   merge_mgr->new_merge(0);
 
 }
 
-void bLSM::logUpdate(dataTuple * tup) {
+void bLSM::create_c0() {
+  mergeStats * stats = merge_mgr->get_merge_stats(0);
+  if(concurrent_c0) {
+    skiplist_c0 = new memTreeComponent::skiplist_t;
+    stats->add_arena(skiplist_c0->get_arena());
+    return;
+  }
+  int n = c0_partitions > 1 ? c0_partitions : 1;
+  c0_shards.resize(n);
+  for(int i = 0; i < n; i++) {
+    c0_shards[i].tree = memTreeComponent::createTree();
+    if(i == 0) {
+      c0_shards[i].mut = &rb_mut;
+    } else {
+      c0_shards[i].mut = new pthread_mutex_t;
+      pthread_mutex_init(c0_shards[i].mut, 0);
+    }
+    stats->add_arena(memTreeComponent::get_arena(c0_shards[i].tree));
+  }
+}
+
+namespace {
+/** How persist_deep_levels() stores a component.  root is NULLRID if there is no such component. */
+struct deep_component_header {
+  recordid root;
+  recordid state;
+  recordid dp_state;
+  pageid_t bloom;
+  recordid dead_ranges;
+};
+}
+
+void bLSM::create_deep_levels(int xid) {
+  while(get_num_disk_levels() < disk_levels) {
+    disk_level * l = new disk_level;
+    l->tree = new diskTreeComponent(xid, internal_region_size, datapage_region_size, datapage_size, 0, 10);
+    l->mergeable = NULL;
+    pthread_cond_init(&l->needed, 0);
+    pthread_cond_init(&l->ready, 0);
+    l->flushing = false;
+    deep_levels.push_back(l);
+  }
+}
+
+// format: a (tree, mergeable) pair of deep_component_headers per level, starting with C3.
+
+void bLSM::open_deep_levels(int xid) {
+  if(tbl_header.deep_levels.size == NULLRID.size) { return; }
+  int n = tbl_header.deep_levels.size / (2 * sizeof(deep_component_header));
+  deep_component_header * h = (deep_component_header*)malloc(tbl_header.deep_levels.size);
+  Tread(xid, tbl_header.deep_levels, h);
+  for(int i = 0; i < n; i++) {
+    disk_level * l = new disk_level;
+    l->tree = new diskTreeComponent(xid, h[2*i].root, h[2*i].state, h[2*i].dp_state, 0, h[2*i].bloom, h[2*i].dead_ranges);
+    l->mergeable = NULL;
+    const deep_component_header & m = h[2*i+1];
+    if(m.root.size != NULLRID.size) {
+      l->mergeable = new diskTreeComponent(xid, m.root, m.state, m.dp_state, 0, m.bloom, m.dead_ranges);
+    }
+    pthread_cond_init(&l->needed, 0);
+    pthread_cond_init(&l->ready, 0);
+    l->flushing = false;
+    deep_levels.push_back(l);
+  }
+  free(h);
+}
+
+recordid bLSM::persist_deep_levels(int xid) {
+  recordid rid = tbl_header.deep_levels;
+  if(deep_levels.empty()) { return rid; }
+  size_t len = 2 * deep_levels.size() * sizeof(deep_component_header);
+  deep_component_header * h = (deep_component_header*)malloc(len);
+  for(size_t i = 0; i < 2 * deep_levels.size(); i++) {
+    diskTreeComponent * c = i % 2 ? deep_levels[i/2]->mergeable : deep_levels[i/2]->tree;
+    if(c) {
+      h[i].root = c->get_root_rid();
+      h[i].state = c->get_internal_node_allocator_rid();
+      h[i].dp_state = c->get_datapage_allocator_rid();
+      h[i].bloom = c->get_bloom_filter_pid();
+      h[i].dead_ranges = c->persist_dead_ranges(xid);
+    } else {
+      h[i].root = NULLRID;
+      h[i].state = NULLRID;
+      h[i].dp_state = NULLRID;
+      h[i].bloom = INVALID_PAGE;
+      h[i].dead_ranges = NULLRID;
+    }
+  }
+  if(rid.size != (int64_t)len) {
+    // levels are only ever added, so the record only grows.
+    if(rid.size != NULLRID.size) { Tdealloc(xid, rid); }
+    rid = Talloc(xid, len);
+  }
+  Tset(xid, rid, h);
+  free(h);
+  return rid;
+}
+
+void bLSM::get_deep_components(std::vector<diskTreeComponent*> * out) {
+  for(size_t i = 0; i < deep_levels.size(); i++) {
+    if(deep_levels[i]->mergeable) { out->push_back(deep_levels[i]->mergeable); }
+    out->push_back(deep_levels[i]->tree);
+  }
+}
+
+double bLSM::get_level_size_ratio(int n) {
+  if(n >= 2 && n - 2 < (int)level_size_ratios.size() && level_size_ratios[n-2] > 1.0) {
+    return level_size_ratios[n-2];
+  }
+  return r_val;
+}
+
+static uint32_t key_hash(const dataTuple * t) {
+  uint32_t h = 2166136261U; // FNV-1a
+  const byte * k = t->strippedkey();
+  for(len_t i = 0; i < t->strippedkeylen(); i++) { h = (h ^ k[i]) * 16777619U; }
+  return h;
+}
+
+int bLSM::c0_shard_of(const dataTuple * t) {
+  return c0_shards.size() == 1 ? 0 : key_hash(t) % c0_shards.size();
+}
+
+int64_t bLSM::get_c0_tuple_count() {
+  if(skiplist_c0) { return skiplist_c0->size(); }
+  int64_t ret = 0;
+  for(size_t i = 0; i < c0_shards.size(); i++) { ret += c0_shards[i].tree->size(); }
+  return ret;
+}
+
+bLSM::c0_iterator_t * bLSM::open_c0_iterator(dataTuple * key, bool reverse) {
+  int (*cmp)(const dataTuple*,const dataTuple*) = reverse ? dataTuple::compare_obj_desc : dataTuple::compare_obj;
+  if(skiplist_c0) {
+    return new c0_iterator_t(new memTreeComponent::batchedRevalidatingIterator(skiplist_c0, 100, key, reverse), NULL, 0, NULL, cmp);
+  }
+  std::vector<memTreeComponent::batchedRevalidatingIterator*> rest;
+  for(size_t i = 1; i < c0_shards.size(); i++) {
+    rest.push_back(new memTreeComponent::batchedRevalidatingIterator(c0_shards[i].tree, 100, c0_shards[i].mut, key, reverse));
+  }
+  return new c0_iterator_t(new memTreeComponent::batchedRevalidatingIterator(c0_shards[0].tree, 100, c0_shards[0].mut, key, reverse),
+                           rest.empty() ? NULL : &rest[0], rest.size(), NULL, cmp);
+}
+
+bLSM::c0_iterator_t * bLSM::open_c0_merge_iterator() {
+  if(skiplist_c0) {
+    return new c0_iterator_t(new memTreeComponent::batchedRevalidatingIterator(skiplist_c0, merge_mgr, max_c0_size, &c0_flushing, 100),
+                             NULL, 0, NULL, dataTuple::compare_obj);
+  }
+  // Each shard's iterator waits on the size of all of C0, so they all wake up together.
+  std::vector<memTreeComponent::batchedRevalidatingIterator*> rest;
+  for(size_t i = 1; i < c0_shards.size(); i++) {
+    rest.push_back(new memTreeComponent::batchedRevalidatingIterator(c0_shards[i].tree, merge_mgr, max_c0_size, &c0_flushing, 100, c0_shards[i].mut));
+  }
+  return new c0_iterator_t(new memTreeComponent::batchedRevalidatingIterator(c0_shards[0].tree, merge_mgr, max_c0_size, &c0_flushing, 100, c0_shards[0].mut),
+                           rest.empty() ? NULL : &rest[0], rest.size(), NULL, dataTuple::compare_obj);
+}
+
+lsn_t bLSM::logUpdate(dataTuple * tup) {
   byte * buf = tup->to_bytes();
   LogEntry * e = stasis_log_write_update(log_file, 0, INVALID_PAGE, 0/*Page**/, 0/*op*/, buf, tup->byte_length());
+  lsn_t ret = e->LSN;
+  log_file->write_entry_done(log_file,e);
+  free(buf);
+  return ret;
+}
+
+// A key length no tuple can have; marks the log entries written by logRangeDrop().
+static const len_t RANGE_DROP_LOG_MARKER = DELETE;
+
+// format: marker _ start _ has end _ [end], with the keys in dataTuple::to_bytes() format.
+lsn_t bLSM::logRangeDrop(dataTuple * start, dataTuple * end) {
+  size_t len = sizeof(len_t) + start->byte_length() + 1 + (end ? end->byte_length() : 0);
+  byte * buf = (byte*)malloc(len);
+  byte * p = buf;
+  *(len_t*)p = RANGE_DROP_LOG_MARKER;
+  p += sizeof(len_t);
+  byte * b = start->to_bytes();
+  memcpy(p, b, start->byte_length());
+  p += start->byte_length();
+  free(b);
+  *p = end ? 1 : 0;
+  p++;
+  if(end) {
+    b = end->to_bytes();
+    memcpy(p, b, end->byte_length());
+    free(b);
+  }
+  LogEntry * e = stasis_log_write_update(log_file, 0, INVALID_PAGE, 0/*Page**/, 0/*op*/, buf, len);
+  lsn_t ret = e->LSN;
   log_file->write_entry_done(log_file,e);
   free(buf);
+  return ret;
+}
+
+/** Replay a logRangeDrop() entry. */
+static void replay_range_drop(bLSM * ltable, const byte * buf) {
+  buf += sizeof(len_t);
+  dataTuple * start = dataTuple::from_bytes((byte*)buf);
+  buf += start->byte_length();
+  dataTuple * end = *buf ? dataTuple::from_bytes((byte*)buf + 1) : NULL;
+  ltable->dropRange(start, end);
+  dataTuple::freetuple(start);
+  if(end) { dataTuple::freetuple(end); }
+}
+
+void bLSM::commitLog(lsn_t lsn) {
+  if(log_mode == 1) {
+    // durable per operation; share the force with any other writers.
+    log_committer->wait_durable(lsn);
+  } else {
+    // force every log_mode batches, without holding up the caller.
+    int n = __sync_add_and_fetch(&batch_size, 1);
+    if(n >= log_mode && __sync_bool_compare_and_swap(&batch_size, n, 0)) {
+      log_committer->request_force(lsn);
+    }
+  }
+}
+
+/*
+ * Parallel log replay.  The log can only be read sequentially, so one thread
+ * reads it, decoding entries straight into REPLAY_CHUNK_SIZE slabs.  Worker
+ * threads split each chunk into hash partitions by key, sort each partition
+ * (stably, so versions of a key stay in log order), and bulk load it into C0.
+ * A partition of chunk n is only applied after the same partition of chunk
+ * n-1, which is enough to preserve last-writer-wins: two versions of a key
+ * always land in the same partition.
+ */
+static const size_t REPLAY_CHUNK_SIZE = 8 * 1024 * 1024;
+static const uint64_t REPLAY_REPORT_INTERVAL = 256 * 1024 * 1024;
+
+struct replay_chunk {
+  uint64_t seq;
+  byte * buf;
+  size_t len;
+  size_t cap;
+  std::vector<size_t> offsets;
+};
+
+struct replay_state {
+  bLSM * ltable;
+  int num_parts;
+  pthread_mutex_t mut;
+  pthread_cond_t queue_cond;   // a chunk was queued, or the reader is done.
+  pthread_cond_t space_cond;   // a chunk was dequeued.
+  pthread_cond_t applied_cond; // a partition of a chunk was applied.
+  std::vector<replay_chunk*> queue;
+  size_t queue_head;
+  bool done;
+  std::vector<uint64_t> applied; // per partition, the seq of the next chunk to apply.
+};
+
+static int replay_partition(const dataTuple * t, int num_parts) {
+  return key_hash(t) % num_parts;
+}
+
+static replay_chunk * replay_new_chunk(uint64_t seq, size_t min_cap) {
+  replay_chunk * c = new replay_chunk;
+  c->seq = seq;
+  c->len = 0;
+  c->cap = min_cap > REPLAY_CHUNK_SIZE ? min_cap : REPLAY_CHUNK_SIZE;
+  c->buf = (byte*)malloc(c->cap);
+  return c;
+}
+
+static void replay_enqueue(replay_state * s, replay_chunk * c) {
+  pthread_mutex_lock(&s->mut);
+  while(s->queue.size() - s->queue_head >= 2 * (size_t)s->num_parts) {
+    pthread_cond_wait(&s->space_cond, &s->mut);
+  }
+  s->queue.push_back(c);
+  pthread_cond_signal(&s->queue_cond);
+  pthread_mutex_unlock(&s->mut);
+}
+
+/** Wait until the workers have applied every chunk before seq. */
+static void replay_drain(replay_state * s, uint64_t seq) {
+  pthread_mutex_lock(&s->mut);
+  for(int p = 0; p < s->num_parts; p++) {
+    while(s->applied[p] != seq) {
+      pthread_cond_wait(&s->applied_cond, &s->mut);
+    }
+  }
+  pthread_mutex_unlock(&s->mut);
+}
+
+static void * replay_worker(void * arg) {
+  replay_state * s = (replay_state*)arg;
+  std::vector<std::vector<dataTuple*> > parts(s->num_parts);
+  while(true) {
+    pthread_mutex_lock(&s->mut);
+    while(s->queue_head == s->queue.size() && !s->done) {
+      pthread_cond_wait(&s->queue_cond, &s->mut);
+    }
+    if(s->queue_head == s->queue.size()) {
+      pthread_mutex_unlock(&s->mut);
+      break;
+    }
+    replay_chunk * c = s->queue[s->queue_head++];
+    pthread_cond_signal(&s->space_cond);
+    pthread_mutex_unlock(&s->mut);
+
+    for(int p = 0; p < s->num_parts; p++) { parts[p].clear(); }
+    for(size_t i = 0; i < c->offsets.size(); i++) {
+      dataTuple * t = (dataTuple*)(c->buf + c->offsets[i]);
+      parts[replay_partition(t, s->num_parts)].push_back(t);
+    }
+    for(int p = 0; p < s->num_parts; p++) {
+      std::stable_sort(parts[p].begin(), parts[p].end(), dataTuple());
+    }
+    // start at a different partition than the workers holding the chunks
+    // just before and after this one, so they are not all queued up behind
+    // the same partition.
+    for(int i = 0; i < s->num_parts; i++) {
+      int p = (c->seq + i) % s->num_parts;
+      pthread_mutex_lock(&s->mut);
+      while(s->applied[p] != c->seq) {
+        pthread_cond_wait(&s->applied_cond, &s->mut);
+      }
+      pthread_mutex_unlock(&s->mut);
+      if(!parts[p].empty()) {
+        s->ltable->insertManyTuples(&parts[p][0], parts[p].size());
+      }
+      pthread_mutex_lock(&s->mut);
+      s->applied[p]++;
+      pthread_cond_broadcast(&s->applied_cond);
+      pthread_mutex_unlock(&s->mut);
+    }
+    free(c->buf);
+    delete c;
+  }
+  return 0;
 }
 
-void bLSM::replayLog() {
+void bLSM::replayLog(int num_threads) {
   lsn_t start = tbl_header.log_trunc;
   LogHandle * lh = start ? getLSNHandle(log_file, start) : getLogHandle(log_file);
+
+  replay_state * s = 0;
+  std::vector<pthread_t> workers;
+  replay_chunk * c = 0;
+  uint64_t next_seq = 0;
+  if(num_threads > 1) {
+    s = new replay_state;
+    s->ltable = this;
+    s->num_parts = num_threads;
+    pthread_mutex_init(&s->mut, 0);
+    pthread_cond_init(&s->queue_cond, 0);
+    pthread_cond_init(&s->space_cond, 0);
+    pthread_cond_init(&s->applied_cond, 0);
+    s->queue_head = 0;
+    s->done = false;
+    s->applied.resize(num_threads, 0);
+    workers.resize(num_threads);
+    for(int i = 0; i < num_threads; i++) {
+      pthread_create(&workers[i], 0, replay_worker, s);
+    }
+  }
+
+  struct timeval start_tv;
+  gettimeofday(&start_tv, 0);
+  uint64_t num_entries = 0;
+  uint64_t num_bytes = 0;
+  uint64_t next_report = REPLAY_REPORT_INTERVAL;
+
   const LogEntry * e;
   while((e = nextInLog(lh))) {
     switch(e->type) {
     case UPDATELOG: {
-      dataTuple * tup = dataTuple::from_bytes((byte*)stasis_log_entry_update_args_cptr(e));
-      insertTuple(tup);
-      dataTuple::freetuple(tup);
+      const byte * buf = (const byte*)stasis_log_entry_update_args_cptr(e);
+      if(*(const len_t*)buf == RANGE_DROP_LOG_MARKER) {
+        // The drop has to see everything logged before it, and nothing after.
+        if(s) {
+          if(c) { replay_enqueue(s, c); c = 0; }
+          replay_drain(s, next_seq);
+        }
+        replay_range_drop(this, buf);
+        num_entries++;
+        break;
+      }
+      size_t mem_len = dataTuple::mem_length_from_bytes(buf);
+      if(!s) {
+        dataTuple * tup = dataTuple::from_bytes((byte*)buf);
+        insertTuple(tup);
+        dataTuple::freetuple(tup);
+      } else {
+        size_t slot_len = (mem_len + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+        if(c && c->len + slot_len > c->cap) {
+          replay_enqueue(s, c);
+          c = 0;
+        }
+        if(!c) { c = replay_new_chunk(next_seq++, slot_len); }
+        dataTuple::from_bytes_to(c->buf + c->len, buf);
+        c->offsets.push_back(c->len);
+        c->len += slot_len;
+      }
+      num_entries++;
+      num_bytes += mem_len;
+      if(num_bytes >= next_report) {
+        struct timeval now;
+        gettimeofday(&now, 0);
+        printf("Log replay: %lld entries, %lld MB read in %.1f seconds\n",
+               (long long)num_entries, (long long)(num_bytes >> 20), tv_to_double(now) - tv_to_double(start_tv));
+        next_report += REPLAY_REPORT_INTERVAL;
+      }
     } break;
     case INTERNALLOG: { } break;
     default: assert(e->type == UPDATELOG); abort();
     }
   }
   freeLogHandle(lh);
+
+  if(s) {
+    if(c) { replay_enqueue(s, c); }
+    pthread_mutex_lock(&s->mut);
+    s->done = true;
+    pthread_cond_broadcast(&s->queue_cond);
+    pthread_mutex_unlock(&s->mut);
+    for(int i = 0; i < num_threads; i++) {
+      pthread_join(workers[i], 0);
+    }
+    pthread_mutex_destroy(&s->mut);
+    pthread_cond_destroy(&s->queue_cond);
+    pthread_cond_destroy(&s->space_cond);
+    pthread_cond_destroy(&s->applied_cond);
+    delete s;
+  }
+
   recovering = false;
-  printf("\nLog replay complete.\n");
+  struct timeval now;
+  gettimeofday(&now, 0);
+  printf("\nLog replay complete: %lld entries, %lld MB in %.1f seconds.\n",
+         (long long)num_entries, (long long)(num_bytes >> 20), tv_to_double(now) - tv_to_double(start_tv));
 
 }
 
@@ -203,6 +692,18 @@ void bLSM::truncate_log() {
   }
 }
 
+void bLSM::add_compaction_filter(compactionFilter * filter) {
+  rwlc_writelock(header_mut);
+  compaction_filters.push_back(filter);
+  rwlc_unlock(header_mut);
+}
+
+void bLSM::get_compaction_filters(std::vector<compactionFilter*> * filters) {
+  rwlc_readlock(header_mut);
+  *filters = compaction_filters;
+  rwlc_unlock(header_mut);
+}
+
 void bLSM::update_persistent_header(int xid, lsn_t trunc_lsn) {
 
     tbl_header.c2_root = tree_c2->get_root_rid();
@@ -211,6 +712,11 @@ void bLSM::update_persistent_header(int xid, lsn_t trunc_lsn) {
     tbl_header.c1_root = tree_c1->get_root_rid();
     tbl_header.c1_dp_state = tree_c1->get_datapage_allocator_rid();
     tbl_header.c1_state = tree_c1->get_internal_node_allocator_rid();
+    tbl_header.c2_bloom = tree_c2->get_bloom_filter_pid();
+    tbl_header.c1_bloom = tree_c1->get_bloom_filter_pid();
+    tbl_header.c2_dead_ranges = tree_c2->persist_dead_ranges(xid);
+    tbl_header.c1_dead_ranges = tree_c1->persist_dead_ranges(xid);
+    tbl_header.deep_levels = persist_deep_levels(xid);
     
     merge_mgr->marshal(xid, tbl_header.merge_manager);
 
@@ -262,6 +768,10 @@ void bLSM::flushTable()
     merge_count ++;
     merge_mgr->get_merge_stats(0)->starting_merge();
 
+    if(blocked) {
+      latencyStats::record(latencyStats::FLUSH_STALL, (uint64_t)((stop - start) * 1000000.0));
+    }
+
     if(blocked && stop - start > 1.0) {
       if(first)
       {
@@ -280,6 +790,35 @@ void bLSM::flushTable()
     c0_flushing = false;
 }
 
+/**
+ * @return true if a dropRange() deleted key after c was written.  The
+ * components older than c were around for the drop too, so the lookup can
+ * stop here, as if it had found a tombstone.
+ */
+static inline bool is_dead(diskTreeComponent * c, const byte * key, size_t keySize)
+{
+    return c && c->get_dead_ranges()->covers(key, keySize);
+}
+
+/**
+ * Fold a tuple from an older component into the result of a lookup, the way
+ * findTuple() does.  Takes ownership of older if it is a copy.
+ */
+static void merge_older_tuple(tupleMerger * tmerger, dataTuple ** ret, bool * done, dataTuple * older, bool is_copy)
+{
+    if(older->isDelete()) {
+        *done = true;
+    } else if(*ret) {
+        dataTuple *mtuple = tmerger->merge(older, *ret);
+        dataTuple::freetuple(*ret);
+        *ret = mtuple;
+    } else {
+        *ret = is_copy ? older : older->create_copy();
+        return;
+    }
+    if(is_copy) { dataTuple::freetuple(older); }
+}
+
 dataTuple * bLSM::findTuple(int xid, const dataTuple::key_t key, size_t keySize)
 {
     // Apply proportional backpressure to reads as well as writes.  This prevents
@@ -292,19 +831,9 @@ dataTuple * bLSM::findTuple(int xid, const dataTuple::key_t key, size_t keySize)
     dataTuple *search_tuple = dataTuple::create(key, keySize);
 
 
-    pthread_mutex_lock(&rb_mut);
-
-    dataTuple *ret_tuple=0; 
-
     //step 1: look in tree_c0
-    memTreeComponent::rbtree_t::iterator rbitr = get_tree_c0()->find(search_tuple);
-    if(rbitr != get_tree_c0()->end())
-    {
-        DEBUG("tree_c0 size %d\n", get_tree_c0()->size());
-        ret_tuple = (*rbitr)->create_copy();
-    }
+    dataTuple *ret_tuple = findTuple_c0(search_tuple);
 
-    pthread_mutex_unlock(&rb_mut);
     rwlc_readlock(header_mut);  // XXX: FIXME with optimisitic concurrency control.  Has to be before rb_mut, or we could merge the tuple with itself due to an intervening merge
 
     bool done = false;
@@ -312,7 +841,7 @@ dataTuple * bLSM::findTuple(int xid, const dataTuple::key_t key, size_t keySize)
     if(get_tree_c0_mergeable() != 0)
     {
         DEBUG("old mem tree not null %d\n", (*(mergedata->old_c0))->size());
-        rbitr = get_tree_c0_mergeable()->find(search_tuple);
+        memTreeComponent::rbtree_t::iterator rbitr = get_tree_c0_mergeable()->find(search_tuple);
         if(rbitr != get_tree_c0_mergeable()->end())
         {
             dataTuple *tuple = *rbitr;
@@ -334,6 +863,7 @@ dataTuple * bLSM::findTuple(int xid, const dataTuple::key_t key, size_t keySize)
     }
 
     //step 2.5: check new c1 if exists
+    if(!done && is_dead(get_tree_c1_prime(), key, keySize)) { done = true; }
     if(!done && get_tree_c1_prime() != 0)
     {
         DEBUG("old c1 tree not null\n");
@@ -364,6 +894,7 @@ dataTuple * bLSM::findTuple(int xid, const dataTuple::key_t key, size_t keySize)
     }
 
     //step 3: check c1
+    if(!done && is_dead(get_tree_c1(), key, keySize)) { done = true; }
     if(!done)
     {
         dataTuple *tuple_c1 = get_tree_c1()->findTuple(xid, key, keySize);
@@ -392,6 +923,7 @@ dataTuple * bLSM::findTuple(int xid, const dataTuple::key_t key, size_t keySize)
     }
 
     //step 4: check old c1 if exists
+    if(!done && is_dead(get_tree_c1_mergeable(), key, keySize)) { done = true; }
     if(!done && get_tree_c1_mergeable() != 0)
     {
         DEBUG("old c1 tree not null\n");
@@ -422,6 +954,7 @@ dataTuple * bLSM::findTuple(int xid, const dataTuple::key_t key, size_t keySize)
     }
 
     //step 5: check c2
+    if(!done && is_dead(get_tree_c2(), key, keySize)) { done = true; }
     if(!done)
     {
         DEBUG("Not in old first disk tree\n");        
@@ -451,6 +984,22 @@ dataTuple * bLSM::findTuple(int xid, const dataTuple::key_t key, size_t keySize)
         }        
     }     
 
+    //step 6: check the levels below c2, if any
+    if(!done && !deep_levels.empty())
+    {
+        std::vector<diskTreeComponent*> deep;
+        get_deep_components(&deep);
+        for(size_t c = 0; !done && c < deep.size(); c++)
+        {
+            if(is_dead(deep[c], key, keySize)) { done = true; break; }
+            dataTuple *tuple_cn = deep[c]->findTuple(xid, key, keySize);
+            if(tuple_cn != NULL)
+            {
+                merge_older_tuple(tmerger, &ret_tuple, &done, tuple_cn, true);
+            }
+        }
+    }
+
     rwlc_unlock(header_mut);
     dataTuple::freetuple(search_tuple);
     if (ret_tuple != NULL && ret_tuple->isDelete()) {
@@ -462,6 +1011,109 @@ dataTuple * bLSM::findTuple(int xid, const dataTuple::key_t key, size_t keySize)
 
 }
 
+namespace {
+struct key_index_lt {
+    dataTuple ** keys;
+    bool operator()(int a, int b) const { return dataTuple::compare_obj(keys[a], keys[b]) < 0; }
+};
+}
+
+void bLSM::findTuples(int xid, dataTuple ** keys, int n, dataTuple ** results)
+{
+#ifdef BACKPRESSURE_READS
+    merge_mgr->tick(merge_mgr->get_merge_stats(0));
+#endif
+    if(n <= 0) { return; }
+
+    // Sort the batch, so that each component can answer it in a single pass.
+    std::vector<int> order(n);
+    for(int i = 0; i < n; i++) { order[i] = i; }
+    key_index_lt lt = { keys };
+    std::sort(order.begin(), order.end(), lt);
+    std::vector<dataTuple*> sorted(n);
+    for(int i = 0; i < n; i++) { sorted[i] = keys[order[i]]; }
+
+    std::vector<dataTuple*> ret(n, (dataTuple*)0);
+    bool * done = new bool[n];
+    for(int i = 0; i < n; i++) { done[i] = false; }
+
+    //step 1: look in C0, holding each shard's mutex (or the skiplist guard) once for the whole batch.
+    if(skiplist_c0) {
+        memTreeComponent::skiplist_t::readGuard g(skiplist_c0);
+        for(int i = 0; i < n; i++) {
+            dataTuple * t = skiplist_c0->find(sorted[i]);
+            if(t) { ret[i] = t->create_copy(); }
+        }
+    } else {
+        std::vector<int> shard(n, 0);
+        if(c0_shards.size() > 1) {
+            for(int i = 0; i < n; i++) { shard[i] = c0_shard_of(sorted[i]); }
+        }
+        for(size_t s = 0; s < c0_shards.size(); s++) {
+            memTreeComponent::rbtree_ptr_t tree = c0_shards[s].tree;
+            pthread_mutex_lock(c0_shards[s].mut);
+            for(int i = 0; i < n; i++) {
+                if(shard[i] != (int)s) { continue; }
+                memTreeComponent::rbtree_t::iterator rbitr = tree->find(sorted[i]);
+                if(rbitr != tree->end()) { ret[i] = (*rbitr)->create_copy(); }
+            }
+            pthread_mutex_unlock(c0_shards[s].mut);
+        }
+    }
+
+    rwlc_readlock(header_mut);
+
+    //step 2: c0_mergeable
+    if(get_tree_c0_mergeable() != 0) {
+        for(int i = 0; i < n; i++) {
+            memTreeComponent::rbtree_t::iterator rbitr = get_tree_c0_mergeable()->find(sorted[i]);
+            if(rbitr != get_tree_c0_mergeable()->end()) {
+                merge_older_tuple(tmerger, &ret[i], &done[i], *rbitr, false);
+            }
+        }
+    }
+
+    //steps 3-6: the disk components, newest first.
+    std::vector<diskTreeComponent*> disk;
+    disk.push_back(get_tree_c1_prime());
+    disk.push_back(get_tree_c1());
+    disk.push_back(get_tree_c1_mergeable());
+    disk.push_back(get_tree_c2());
+    get_deep_components(&disk);
+    std::vector<dataTuple*> probe;
+    std::vector<int> probe_idx;
+    std::vector<dataTuple*> hits;
+    for(size_t c = 0; c < disk.size(); c++) {
+        if(!disk[c]) { continue; }
+        probe.clear();
+        probe_idx.clear();
+        for(int i = 0; i < n; i++) {
+            if(!done[i] && is_dead(disk[c], sorted[i]->strippedkey(), sorted[i]->strippedkeylen())) { done[i] = true; }
+            if(!done[i]) { probe.push_back(sorted[i]); probe_idx.push_back(i); }
+        }
+        if(probe.empty()) { break; }
+        hits.assign(probe.size(), (dataTuple*)0);
+        disk[c]->findTuples(xid, &probe[0], probe.size(), &hits[0]);
+        for(size_t j = 0; j < probe.size(); j++) {
+            if(hits[j]) {
+                merge_older_tuple(tmerger, &ret[probe_idx[j]], &done[probe_idx[j]], hits[j], true);
+            }
+        }
+    }
+
+    rwlc_unlock(header_mut);
+    delete [] done;
+
+    for(int i = 0; i < n; i++) {
+        if(ret[i] != NULL && ret[i]->isDelete()) {
+            // this is a tombstone. don't return it
+            dataTuple::freetuple(ret[i]);
+            ret[i] = NULL;
+        }
+        results[order[i]] = ret[i];
+    }
+}
+
 /*
  * returns the first record found with the matching key
  * (not to be used together with diffs)
@@ -477,25 +1129,12 @@ dataTuple * bLSM::findTuple_first(int xid, dataTuple::key_t key, size_t keySize)
     //prepare a search tuple
     dataTuple * search_tuple = dataTuple::create(key, keySize);
 
-    dataTuple *ret_tuple=0;
     //step 1: look in tree_c0
+    dataTuple *ret_tuple = findTuple_c0(search_tuple);
 
-    pthread_mutex_lock(&rb_mut);
-
-    memTreeComponent::rbtree_t::iterator rbitr = get_tree_c0()->find(search_tuple);
-    if(rbitr != get_tree_c0()->end())
-    {
-        DEBUG("tree_c0 size %d\n", tree_c0->size());
-        ret_tuple = (*rbitr)->create_copy();
-
-        pthread_mutex_unlock(&rb_mut);
-        
-    }
-    else
+    if(ret_tuple == 0)
     {
-        DEBUG("Not in mem tree %d\n", tree_c0->size());
-
-        pthread_mutex_unlock(&rb_mut);
+        DEBUG("Not in mem tree\n");
 
         rwlc_readlock(header_mut); // XXX FIXME WITH OCC!!
 
@@ -503,19 +1142,22 @@ dataTuple * bLSM::findTuple_first(int xid, dataTuple::key_t key, size_t keySize)
         if(get_tree_c0_mergeable() != NULL)
         {
             DEBUG("old mem tree not null %d\n", (*(mergedata->old_c0))->size());
-            rbitr = get_tree_c0_mergeable()->find(search_tuple);
+            memTreeComponent::rbtree_t::iterator rbitr = get_tree_c0_mergeable()->find(search_tuple);
             if(rbitr != get_tree_c0_mergeable()->end())
             {
                 ret_tuple = (*rbitr)->create_copy();
             }            
         }
 
+        bool dead = false; // see is_dead()
+
         if(ret_tuple == 0)
         {
             DEBUG("Not in first disk tree\n");
 
             //step 4: check in progress c1 if exists
-            if( get_tree_c1_prime() != 0)
+            dead = is_dead(get_tree_c1_prime(), key, keySize);
+            if( !dead && get_tree_c1_prime() != 0)
             {
               DEBUG("old c1 tree not null\n");
               ret_tuple = get_tree_c1_prime()->findTuple(xid, key, keySize);
@@ -523,20 +1165,24 @@ dataTuple * bLSM::findTuple_first(int xid, dataTuple::key_t key, size_t keySize)
 
         }
 
-        if(ret_tuple == 0)
+        if(ret_tuple == 0 && !dead)
         {
             DEBUG("Not in old mem tree\n");
 
             //step 3: check c1
-            ret_tuple = get_tree_c1()->findTuple(xid, key, keySize);
+            dead = is_dead(get_tree_c1(), key, keySize);
+            if(!dead) {
+              ret_tuple = get_tree_c1()->findTuple(xid, key, keySize);
+            }
         }
 
-        if(ret_tuple == 0)
+        if(ret_tuple == 0 && !dead)
         {
             DEBUG("Not in first disk tree\n");
 
             //step 4: check old c1 if exists
-            if( get_tree_c1_mergeable() != 0)
+            dead = is_dead(get_tree_c1_mergeable(), key, keySize);
+            if( !dead && get_tree_c1_mergeable() != 0)
             {
               DEBUG("old c1 tree not null\n");
               ret_tuple = get_tree_c1_mergeable()->findTuple(xid, key, keySize);
@@ -544,12 +1190,29 @@ dataTuple * bLSM::findTuple_first(int xid, dataTuple::key_t key, size_t keySize)
                 
         }
 
-        if(ret_tuple == 0)
+        if(ret_tuple == 0 && !dead)
         {
             DEBUG("Not in old first disk tree\n");
 
             //step 5: check c2
-            ret_tuple = get_tree_c2()->findTuple(xid, key, keySize);
+            dead = is_dead(get_tree_c2(), key, keySize);
+            if(!dead) {
+              ret_tuple = get_tree_c2()->findTuple(xid, key, keySize);
+            }
+        }
+
+        if(ret_tuple == 0 && !dead && !deep_levels.empty())
+        {
+            //step 6: check the levels below c2
+            std::vector<diskTreeComponent*> deep;
+            get_deep_components(&deep);
+            for(size_t c = 0; ret_tuple == 0 && !dead && c < deep.size(); c++)
+            {
+                dead = is_dead(deep[c], key, keySize);
+                if(!dead) {
+                  ret_tuple = deep[c]->findTuple(xid, key, keySize);
+                }
+            }
         }
         rwlc_unlock(header_mut);
     }
@@ -566,7 +1229,28 @@ dataTuple * bLSM::findTuple_first(int xid, dataTuple::key_t key, size_t keySize)
 
 }
 
-dataTuple * bLSM::insertTupleHelper(dataTuple *tuple)
+dataTuple * bLSM::findTuple_c0(dataTuple * search_tuple)
+{
+    dataTuple * ret_tuple = 0;
+    if(skiplist_c0) {
+        memTreeComponent::skiplist_t::readGuard g(skiplist_c0);
+        dataTuple * t = skiplist_c0->find(search_tuple);
+        if(t) { ret_tuple = t->create_copy(); }  // has to happen before we drop the guard.
+    } else {
+        c0_shard * shard = &c0_shards[c0_shard_of(search_tuple)];
+        pthread_mutex_lock(shard->mut);
+        memTreeComponent::rbtree_t::iterator rbitr = shard->tree->find(search_tuple);
+        if(rbitr != shard->tree->end())
+        {
+            DEBUG("tree_c0 size %d\n", shard->tree->size());
+            ret_tuple = (*rbitr)->create_copy();
+        }
+        pthread_mutex_unlock(shard->mut);
+    }
+    return ret_tuple;
+}
+
+len_t bLSM::insertTupleHelper(dataTuple *tuple)
 {
   bool need_free = false;
   if(!tuple->isDelete() && expiry != 0) {
@@ -585,8 +1269,35 @@ dataTuple * bLSM::insertTupleHelper(dataTuple *tuple)
     assert(!dataTuple::compare_obj(tuple, old));
     free(newkey);
     need_free = true;
-  }  //find the previous tuple with same key in the memtree if exists
-  pthread_mutex_lock(&rb_mut);
+  }
+  len_t pre_len = 0;
+  if(skiplist_c0) {
+    // Optimistic version of the locked path below.  If another writer beats
+    // us to this key, re-read the tuple it left behind and merge again.
+    memTreeComponent::skiplist_t::readGuard g(skiplist_c0);
+    while(true) {
+      dataTuple * pre_t = skiplist_c0->find(tuple);
+      if(pre_t) {
+        dataTuple *new_t = tmerger->merge(pre_t, tuple);
+        dataTuple *t = skiplist_c0->replace(pre_t, new_t);
+        dataTuple::freetuple(new_t);
+        if(t) {
+          merge_mgr->get_merge_stats(0)->merged_tuples(t, tuple, pre_t);
+          pre_len = pre_t->byte_length();  // pre_t is retired, but stays valid until we drop the guard.
+          break;
+        }
+      } else {
+        if(skiplist_c0->insert(tuple)) { break; }
+      }
+    }
+    if(need_free) { dataTuple::freetuple(tuple); }
+    return pre_len;
+  }
+  //find the previous tuple with same key in the memtree if exists
+  c0_shard * shard = &c0_shards[c0_shard_of(tuple)];
+  memTreeComponent::rbtree_ptr_t tree_c0 = shard->tree;
+  arenaAllocator * arena = memTreeComponent::get_arena(tree_c0);
+  pthread_mutex_lock(shard->mut);
   memTreeComponent::rbtree_t::iterator rbitr = tree_c0->find(tuple);
   dataTuple * t  = 0;
   dataTuple * pre_t = 0;
@@ -594,7 +1305,9 @@ dataTuple * bLSM::insertTupleHelper(dataTuple *tuple)
   {
       pre_t = *rbitr;
       //do the merging
-      dataTuple *new_t = tmerger->merge(pre_t, tuple);
+      dataTuple *merged_t = tmerger->merge(pre_t, tuple);
+      dataTuple *new_t = arena->copy_tuple(merged_t);
+      dataTuple::freetuple(merged_t);
       merge_mgr->get_merge_stats(0)->merged_tuples(new_t, tuple, pre_t);
       t = new_t;
 
@@ -604,41 +1317,41 @@ dataTuple * bLSM::insertTupleHelper(dataTuple *tuple)
   else //no tuple with same key exists in mem-tree
   {
 
-    t = tuple->create_copy();
+    t = arena->copy_tuple(tuple);
 
     //insert tuple into the rbtree
     tree_c0->insert(t);
   }
-  pthread_mutex_unlock(&rb_mut);
+  pthread_mutex_unlock(shard->mut);
 
   if(need_free) { dataTuple::freetuple(tuple); }
 
-  return pre_t;
+  if(pre_t) {
+    pre_len = pre_t->byte_length();
+    arenaAllocator::release(pre_t); //free the previous tuple
+  }
+  return pre_len;
 }
 
 void bLSM::insertManyTuples(dataTuple ** tuples, int tuple_count) {
   for(int i = 0; i < tuple_count; i++) {
     merge_mgr->read_tuple_from_small_component(0, tuples[i]);
   }
-  if(log_mode && !recovering) {
+  if(log_mode && !recovering && tuple_count) {
+	  lsn_t lsn = INVALID_LSN;
 	  for(int i = 0; i < tuple_count; i++) {
-	    logUpdate(tuples[i]);
-	  }
-	  batch_size ++;
-	  if(batch_size >= log_mode) {
-		  log_file->force_tail(log_file, LOG_FORCE_COMMIT);
-		  batch_size = 0;
+	    lsn = logUpdate(tuples[i]);
 	  }
+	  commitLog(lsn);
   }
 
   int num_old_tups = 0;
   pageid_t sum_old_tup_lens = 0;
   for(int i = 0; i < tuple_count; i++) {
-    dataTuple * old_tup = insertTupleHelper(tuples[i]);
-    if(old_tup) {
+    len_t old_len = insertTupleHelper(tuples[i]);
+    if(old_len) {
       num_old_tups++;
-      sum_old_tup_lens += old_tup->byte_length();
-      dataTuple::freetuple(old_tup);
+      sum_old_tup_lens += old_len;
     }
   }
 
@@ -648,25 +1361,18 @@ void bLSM::insertManyTuples(dataTuple ** tuples, int tuple_count) {
 void bLSM::insertTuple(dataTuple *tuple)
 {
     if(log_mode && !recovering) {
-        logUpdate(tuple);
-        batch_size++;
-        if(batch_size >= log_mode) {
-        	log_file->force_tail(log_file, LOG_FORCE_COMMIT);
-        	batch_size = 0;
-        }
+        commitLog(logUpdate(tuple));
     }
     // Note, this is where we block for backpressure.  Do this without holding
     // any locks!
     merge_mgr->read_tuple_from_small_component(0, tuple);
 
-    dataTuple * pre_t = 0; // this is a pointer to any data tuples that we'll be deleting below.  We need to update the merge_mgr statistics with it, but have to do so outside of the rb_mut region.
-
-    pre_t = insertTupleHelper(tuple);
+    // the size of any data tuple that we replaced below.  We need to update the merge_mgr statistics with it, but have to do so outside of the C0 shard's mutex.
+    len_t pre_len = insertTupleHelper(tuple);
 
-    if(pre_t) {
+    if(pre_len) {
       // needs to be here; calls update_progress, which sometimes grabs mutexes..
-      merge_mgr->read_tuple_from_large_component(0, pre_t);  // was interspersed with the erase, insert above...
-      dataTuple::freetuple(pre_t); //free the previous tuple
+      merge_mgr->read_tuple_from_large_component(0, 1, pre_len);  // was interspersed with the erase, insert above...
     }
 
     DEBUG("tree size %d tuples %lld bytes.\n", tsize, tree_bytes);
@@ -700,6 +1406,66 @@ bool bLSM::testAndSetTuple(dataTuple *tuple, dataTuple *tuple2)
     return succ;
 }
 
+void bLSM::dropRange(dataTuple * start, dataTuple * end)
+{
+    if(log_mode && !recovering) {
+        commitLog(logRangeDrop(start, end));
+    }
+    int num_erased = 0;
+    pageid_t erased_bytes = 0;
+
+    rwlc_writelock(header_mut);
+    uint64_t id = next_range_tombstone_id++;
+    // Everything on disk predates the drop.  tree_c1_prime also gets tuples
+    // from C0 as the merge reads them, but the merge leaves C0's tuples in
+    // the range where they are until the next one (see merge_iterators()).
+    std::vector<diskTreeComponent*> disk;
+    disk.push_back(get_tree_c1_prime());
+    disk.push_back(get_tree_c1());
+    disk.push_back(get_tree_c1_mergeable());
+    disk.push_back(get_tree_c2());
+    get_deep_components(&disk);
+    for(size_t c = 0; c < disk.size(); c++) {
+        if(disk[c]) { disk[c]->get_dead_ranges()->add(start, end, id); }
+    }
+
+    // C0 holds one version per key, so its copies of the range just go away.
+    if(skiplist_c0) {
+        memTreeComponent::skiplist_t::readGuard g(skiplist_c0);
+        concurrentSkiplist::node * n = skiplist_c0->seek(start, true);
+        while(n) {
+            dataTuple * t = concurrentSkiplist::tuple_of(n);
+            if(end && dataTuple::compare_obj(t, end) >= 0) { break; }
+            n = skiplist_c0->next(n);
+            if(skiplist_c0->erase(t)) {  // fails if a writer got there first; its write comes after the drop.
+                num_erased++;
+                erased_bytes += t->byte_length();
+            }
+        }
+    } else {
+        // The shards are hash partitioned, so each of them can hold part of the range.
+        for(size_t s = 0; s < c0_shards.size(); s++) {
+            memTreeComponent::rbtree_ptr_t tree = c0_shards[s].tree;
+            pthread_mutex_lock(c0_shards[s].mut);
+            memTreeComponent::rbtree_t::iterator rbitr = tree->lower_bound(start);
+            while(rbitr != tree->end() && (!end || dataTuple::compare_obj(*rbitr, end) < 0)) {
+                dataTuple * t = *rbitr;
+                tree->erase(rbitr++);
+                num_erased++;
+                erased_bytes += t->byte_length();
+                arenaAllocator::release(t);
+            }
+            pthread_mutex_unlock(c0_shards[s].mut);
+        }
+    }
+    bump_epoch();
+    rwlc_unlock(header_mut);
+
+    if(num_erased) {
+        merge_mgr->read_tuple_from_large_component(0, num_erased, erased_bytes);
+    }
+}
+
 void bLSM::registerIterator(iterator * it) {
   its.push_back(it);
 }
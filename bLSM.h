@@ -26,8 +26,10 @@
 #include "diskTreeComponent.h"
 #include "memTreeComponent.h"
 #include "tupleMerger.h"
+#include "compactionFilter.h"
 #include "mergeManager.h"
 #include "mergeStats.h"
+#include "groupCommitter.h"
 
 class bLSM {
 public:
@@ -47,7 +49,9 @@ public:
   //  6GB ~= 100B * 500 GB / (datapage_size * 4KB)
   //  (100B * 500GB) / (6GB * 4KB) = 2.035
   // RCS: Set this to 1 so that we do (on average) one seek per b-tree read.
-  bLSM(int log_mode = 0, pageid_t max_c0_size = 100 * 1024 * 1024, pageid_t internal_region_size = 16384, pageid_t datapage_region_size = 256000, pageid_t datapage_size = 1);
+  //
+  // If concurrent_c0 is true, C0 is a lock-free skiplist instead of mutex protected std::sets (see c0_partitions).
+  bLSM(int log_mode = 0, pageid_t max_c0_size = 100 * 1024 * 1024, pageid_t internal_region_size = 16384, pageid_t datapage_region_size = 256000, pageid_t datapage_size = 1, bool concurrent_c0 = false);
 
     ~bLSM();
 
@@ -58,8 +62,19 @@ public:
 
     dataTuple * findTuple_first(int xid, dataTuple::key_t key, size_t keySize);
 
+    /**
+     * Look up n keys at once.  Equivalent to calling findTuple() on each key,
+     * but takes the C0 and header locks once per batch, and probes each disk
+     * component with all of the keys in a single pass.  results[i] is the
+     * (caller-freed) answer for keys[i], or NULL.
+     */
+    void findTuples(int xid, dataTuple ** keys, int n, dataTuple ** results);
+
 private:
-    dataTuple * insertTupleHelper(dataTuple *tuple);
+    /** @return the byte_length() of the tuple this write replaced in C0, or zero. */
+    len_t insertTupleHelper(dataTuple *tuple);
+    /** @return a copy of the tuple stored in C0 under search_tuple's key, or NULL. */
+    dataTuple * findTuple_c0(dataTuple * search_tuple);
 public:
     void insertManyTuples(struct dataTuple **tuples, int tuple_count);
     void insertTuple(struct dataTuple *tuple);
@@ -69,14 +84,34 @@ public:
      * 2) If tuple2 is not null, it looks at tuple2's key instead of tuple's key.  This means you can atomically set the value of one key based on the value of another (if you want to...)
      */
     bool testAndSetTuple(struct dataTuple *tuple, struct dataTuple *tuple2);
+    /**
+     * Delete every key in [start, end), in time independent of how many
+     * keys that is.  end == NULL means there is no upper bound.
+     *
+     * Matching tuples are removed from C0, and each disk component marks the
+     * range as dead (see rangeTombstones).  The merges drop the dead tuples
+     * as they read them; the C1-C2 merge gets rid of the last of them.
+     */
+    void dropRange(dataTuple * start, dataTuple * end);
 
     //other class functions
     recordid allocTable(int xid);
+    /** Open the table whose header is at rid.  Headers written by older versions are upgraded in place. */
     void openTable(int xid, recordid rid);
     void flushTable();    
 
-    void replayLog();
-    void logUpdate(dataTuple * tup);
+    /**
+     * Reinsert everything logged since the last truncation point.  With
+     * num_threads > 1, entries are sorted and bulk loaded into C0 by that
+     * many threads.
+     */
+    void replayLog(int num_threads = 1);
+    /** @return the LSN of tup's log entry, for commitLog(). */
+    lsn_t logUpdate(dataTuple * tup);
+    /** Log a dropRange().  @return the LSN of the log entry, for commitLog(). */
+    lsn_t logRangeDrop(dataTuple * start, dataTuple * end);
+    /** Make the log entry at lsn as durable as log_mode asks for; see groupCommitter. */
+    void commitLog(lsn_t lsn);
 
     static void init_stasis();
     static void deinit_stasis();
@@ -96,14 +131,55 @@ public:
     inline void set_tree_c1_mergeable(diskTreeComponent *t){tree_c1_mergeable=t;  bump_epoch(); }
     inline void set_tree_c1_prime(diskTreeComponent *t){tree_c1_prime=t;  bump_epoch(); }
     inline void set_tree_c2(diskTreeComponent *t){tree_c2=t;                      bump_epoch(); }
+
+    /**
+     * A disk level below C2; see disk_levels.  mergeable is the level above,
+     * handed off once it outgrew its target size, and waiting to be merged
+     * into tree.  Like the other components, these are guarded by header_mut.
+     */
+    struct disk_level {
+      diskTreeComponent * tree;
+      diskTreeComponent * mergeable;
+      pthread_cond_t needed;  // mergeable is gone; the level above may hand off again.
+      pthread_cond_t ready;   // mergeable is set.
+      bool flushing;          // the level above is waiting for needed, so the merge should not throttle itself.
+    };
+    /** @return the number of disk levels, C1 through Cn. */
+    inline int get_num_disk_levels(){return 2 + deep_levels.size();}
+    /** @return Cn, for 3 <= n <= get_num_disk_levels(). */
+    inline disk_level * get_disk_level(int n){return deep_levels[n-3];}
+    /** @return Cn's tree, for 2 <= n <= get_num_disk_levels(). */
+    inline diskTreeComponent * get_disk_level_tree(int n){return n == 2 ? tree_c2 : deep_levels[n-3]->tree;}
+    inline void set_disk_level_tree(int n, diskTreeComponent *t){if(n == 2) { tree_c2=t; } else { deep_levels[n-3]->tree=t; } bump_epoch(); }
+    inline void set_disk_level_mergeable(int n, diskTreeComponent *t){deep_levels[n-3]->mergeable=t; bump_epoch(); }
+    /** Append the components below C2 to out, newest first.  Call with header_mut held. */
+    void get_deep_components(std::vector<diskTreeComponent*> * out);
+    /** @return the target size of Cn over that of C(n-1); see level_size_ratios. */
+    double get_level_size_ratio(int n);
     pthread_cond_t c0_needed;
     pthread_cond_t c0_ready;
     pthread_cond_t c1_needed;
     pthread_cond_t c1_ready;
 
-    inline memTreeComponent::rbtree_ptr_t get_tree_c0(){return tree_c0;}
+    /**
+     * One hash partition of an rbtree C0; see c0_partitions.  Each shard has
+     * its own tree (and arena), so writers to different shards never contend.
+     * Shard 0's mutex is rb_mut.
+     */
+    struct c0_shard {
+      memTreeComponent::rbtree_ptr_t tree;
+      pthread_mutex_t * mut;
+    };
+    inline int get_num_c0_shards(){return c0_shards.size();}
+    inline c0_shard * get_c0_shard(int i){return &c0_shards[i];}
+    /** @return the index of the shard that holds t's key. */
+    int c0_shard_of(const dataTuple * t);
+    /** @return the number of tuples in C0, summed over the shards.  Does not lock them, so this is only an estimate. */
+    int64_t get_c0_tuple_count();
+
+    inline memTreeComponent::rbtree_ptr_t get_tree_c0(){return c0_shards.empty() ? NULL : c0_shards[0].tree;}
+    inline memTreeComponent::skiplist_ptr_t get_skiplist_c0(){return skiplist_c0;}
     inline memTreeComponent::rbtree_ptr_t get_tree_c0_mergeable(){return tree_c0_mergeable;}
-    void set_tree_c0(memTreeComponent::rbtree_ptr_t newtree){tree_c0 = newtree;                     bump_epoch(); }
 
     bool get_c0_is_merging() { return c0_is_merging; }
     void set_c0_is_merging(bool is_merging) { c0_is_merging = is_merging; }
@@ -114,6 +190,16 @@ public:
     void update_persistent_header(int xid, lsn_t log_trunc = INVALID_LSN);
 
     inline tupleMerger * gettuplemerger(){return tmerger;}
+    /**
+     * Apply filter in the merges that start from now on; see compactionFilter.
+     * The table deletes it.  While there are filters, C1-C2 merges rewrite
+     * all of C2, whatever c2_merge_ranges says.
+     */
+    void add_compaction_filter(compactionFilter * filter);
+    /** Copy the compaction filters into *filters, in the order they were added. */
+    void get_compaction_filters(std::vector<compactionFilter*> * filters);
+    /** @return the id the next dropRange() will give its range tombstone.  Ids only increase. */
+    inline uint64_t get_next_range_tombstone_id() { return next_range_tombstone_id; }
     
 public:
 
@@ -126,10 +212,15 @@ public:
         recordid c1_dp_state;
         recordid merge_manager;
         lsn_t    log_trunc;
+        pageid_t c2_bloom;    //first page of c2's bloom filter, or INVALID_PAGE
+        pageid_t c1_bloom;
+        recordid c2_dead_ranges; //c2's range tombstones, or NULLRID
+        recordid c1_dead_ranges;
+        recordid deep_levels;    //C3 through Cn; see persist_deep_levels(), or NULLRID
     };
     rwlc * header_mut;
     pthread_mutex_t tick_mut;
-    pthread_mutex_t rb_mut;
+    pthread_mutex_t rb_mut; // guards C0 shard 0 and `its`, the list of open iterators.
     int64_t max_c0_size;
     // these track the effectiveness of snowshoveling
     int64_t mean_c0_run_length;
@@ -138,7 +229,8 @@ public:
     mergeManager * merge_mgr;
 
     stasis_log_t * log_file;
-    int log_mode;
+    groupCommitter * log_committer;
+    int log_mode; // 0: no logging, 1: force before every write returns, n: force every n writes (asynchronously).
     int batch_size;
     bool recovering;
 
@@ -151,6 +243,7 @@ public:
         flushTable();
         c0_flushing = true;
         c1_flushing = true;
+        for(size_t i = 0; i < deep_levels.size(); i++) { deep_levels[i]->flushing = true; }
       }
       rwlc_unlock(header_mut);
       // XXX must need to do other things! (join the threads?)
@@ -161,14 +254,31 @@ private:
     recordid table_rec;
     struct table_header tbl_header;
     uint64_t epoch;
+    uint64_t next_range_tombstone_id; // guarded by header_mut.
     diskTreeComponent *tree_c2; //big tree
     diskTreeComponent *tree_c1; //small tree
     diskTreeComponent *tree_c1_mergeable; //small tree: ready to be merged with c2
     diskTreeComponent *tree_c1_prime; //small tree: ready to be merged with c2
-    memTreeComponent::rbtree_ptr_t tree_c0; // in-mem red black tree
+    std::vector<disk_level*> deep_levels; // C3 through Cn.
+    std::vector<c0_shard> c0_shards; // in-mem red black trees.  Empty if concurrent_c0 is set.
     memTreeComponent::rbtree_ptr_t tree_c0_mergeable; // in-mem red black tree: ready to be merged with c1.
+    memTreeComponent::skiplist_ptr_t skiplist_c0; // replaces c0_shards if concurrent_c0 is set.
+    bool concurrent_c0;
     bool c0_is_merging;
 
+    /** Create an empty C0, and point the level 0 mergeStats at its arenas. */
+    void create_c0();
+    /** Add empty levels until there are disk_levels of them. */
+    void create_deep_levels(int xid);
+    /** Read table_rec into tbl_header, leaving the fields it is too short for at their defaults. */
+    void read_header(int xid);
+    /** Move tbl_header to a new, full sized table_rec, and point root at it; see openTable(). */
+    void migrate_header(int xid, recordid root);
+    /** Load the levels below C2 from tbl_header. */
+    void open_deep_levels(int xid);
+    /** Write the levels below C2 out.  @return the record that tbl_header should point to. */
+    recordid persist_deep_levels(int xid);
+
 public:
     bool c0_flushing;
     bool c1_flushing; // this needs to be set to true at shutdown, or when the c0-c1 merger is waiting for c1-c2 to finish its merge
@@ -180,8 +290,16 @@ public:
     pageid_t internal_region_size; // in number of pages
     pageid_t datapage_region_size; // "
     pageid_t datapage_size;        // "
+    int c2_merge_partitions;       // Number of threads (key ranges) used by each C1-C2 merge.
+    int c2_merge_ranges;           // If more than one, C1-C2 merges split C2 into this many key ranges, and only rewrite the ones C1_mergeable overlaps.  The others keep their datapages (and the regions that hold them) as they are, unless those regions are mostly garbage.
+    pageid_t merge_prefetch_bytes;     // If non-zero, a thread per disk input of each merge reads and decodes its datapages ahead of the merge, by up to this many bytes of tuples.
+    pageid_t merge_write_behind_bytes; // If non-zero, a thread per merge builds its output's datapages and index, up to this many bytes of tuples behind the merge.
+    int c0_partitions;             // Number of independently locked hash partitions of C0.  Set before allocTable() / openTable().  Ignored if concurrent_c0 is set.
+    int disk_levels;               // Number of disk levels, C1 through Cn (at least 2).  Set before allocTable() / openTable(), which never drops levels the table already has.
+    std::vector<double> level_size_ratios; // level_size_ratios[n-2] is the target size of Cn over that of C(n-1), for 2 <= n < disk_levels.  Missing entries use R().  The last level has no target size.
 private:
     tupleMerger *tmerger;
+    std::vector<compactionFilter*> compaction_filters; // protected by header_mut.
 
     std::vector<iterator *> its;
 
@@ -191,11 +309,11 @@ public:
     bool mightBeOnDisk(dataTuple * t) {
       if(tree_c1) {
         if(!tree_c1->bloom_filter) { DEBUG("no c1 bloom filter\n"); return true; }
-        if(stasis_bloom_filter_lookup(tree_c1->bloom_filter,           (const char*)t->strippedkey(), t->strippedkeylen())) { DEBUG("in c1\n"); return true; }
+        if(tree_c1->bloom_filter->lookup(t->strippedkey(), t->strippedkeylen())) { DEBUG("in c1\n"); return true; }
       }
       if(tree_c1_prime) {
         if(!tree_c1_prime->bloom_filter) { DEBUG("no c1' bloom filter\n");  return true; }
-        if(stasis_bloom_filter_lookup(tree_c1_prime->bloom_filter,     (const char*)t->strippedkey(), t->strippedkeylen())) { DEBUG("in c1'\n"); return true; }
+        if(tree_c1_prime->bloom_filter->lookup(t->strippedkey(), t->strippedkeylen())) { DEBUG("in c1'\n"); return true; }
       }
       return mightBeAfterMemMerge(t);
     }
@@ -204,17 +322,38 @@ public:
 
       if(tree_c1_mergeable) {
         if(!tree_c1_mergeable->bloom_filter) { DEBUG("no c1m bloom filter\n"); return true; }
-        if(stasis_bloom_filter_lookup(tree_c1_mergeable->bloom_filter,     (const char*)t->strippedkey(), t->strippedkeylen())) { DEBUG("in c1m'\n");return true; }
+        if(tree_c1_mergeable->bloom_filter->lookup(t->strippedkey(), t->strippedkeylen())) { DEBUG("in c1m'\n");return true; }
       }
 
 
       if(tree_c2) {
         if(!tree_c2->bloom_filter) { DEBUG("no c2 bloom filter\n");  return true; }
-        if(stasis_bloom_filter_lookup(tree_c2->bloom_filter,           (const char*)t->strippedkey(), t->strippedkeylen())) { DEBUG("in c2\n");return true; }
+        if(tree_c2->bloom_filter->lookup(t->strippedkey(), t->strippedkeylen())) { DEBUG("in c2\n");return true; }
+      }
+      for(size_t i = 0; i < deep_levels.size(); i++) {
+        diskTreeComponent * c[] = { deep_levels[i]->mergeable, deep_levels[i]->tree };
+        for(int j = 0; j < 2; j++) {
+          if(!c[j]) { continue; }
+          if(!c[j]->bloom_filter) { DEBUG("no c%d bloom filter\n", (int)i+3); return true; }
+          if(c[j]->bloom_filter->lookup(t->strippedkey(), t->strippedkeylen())) { DEBUG("in c%d\n", (int)i+3); return true; }
+        }
       }
       return false;
     }
 
+    /**
+     * k-way merge of a ITRA and num_iters ITRNs.  The ITRA is the newest
+     * source, followed by iters[0], iters[1], and so on.
+     *
+     * The sources are kept in a loser (tournament) tree, so each tuple costs
+     * O(log k) comparisons.  When several sources hold the same key, the
+     * newest one wins.  The older versions are discarded if merge is NULL.
+     * Otherwise they are combined with merge(older, newer), oldest first, with
+     * tombstones hiding everything older than them (as in bLSM::findTuple).
+     *
+     * Every source must return its tuples in cmp order, so a merge of
+     * descending sources uses dataTuple::compare_obj_desc.
+     */
     template<class ITRA, class ITRN>
     class mergeManyIterator {
     public:
@@ -223,100 +362,133 @@ public:
         first_iter_(a),
         iters_((ITRN**)malloc(sizeof(*iters_) * num_iters)),          // exactly the number passed in
         current_((dataTuple**)malloc(sizeof(*current_) * (num_iters_))),  // one more than was passed in
-        last_iter_(-1),
+        tree_((int*)malloc(sizeof(*tree_) * num_iters_)),
+        peeked_(NULL),
         cmp_(cmp),
         merge_(merge),
-        dups((int*)malloc(sizeof(*dups)*num_iters_))
+        dups((dataTuple**)malloc(sizeof(*dups)*num_iters_))
         {
         current_[0] = first_iter_->next_callerFrees();
         for(int i = 1; i < num_iters_; i++) {
           iters_[i-1] = iters[i-1];
           current_[i] = iters_[i-1] ? iters_[i-1]->next_callerFrees() : NULL;
         }
+        tree_[0] = num_iters_ == 1 ? 0 : play(1);
       }
       ~mergeManyIterator() {
         delete(first_iter_);
         for(int i = 0; i < num_iters_; i++) {
-            if(i != last_iter_) {
-                if(current_[i]) dataTuple::freetuple(current_[i]);
-            }
+          if(current_[i]) dataTuple::freetuple(current_[i]);
         }
+        if(peeked_) dataTuple::freetuple(peeked_);
         for(int i = 1; i < num_iters_; i++) {
           delete iters_[i-1];
         }
         free(current_);
         free(iters_);
+        free(tree_);
         free(dups);
       }
+      /** @return the tuple the next call to next_callerFrees() will return.  The caller must not free it. */
       dataTuple * peek() {
-          dataTuple * ret = next_callerFrees();
-          last_iter_ = -1; // don't advance iterator on next peek() or getnext() call.
-          return ret;
+          if(!peeked_) { peeked_ = next_callerFrees(); }
+          return peeked_;
       }
       dataTuple * next_callerFrees() {
+        if(peeked_) {
+          dataTuple * ret = peeked_;
+          peeked_ = NULL;
+          return ret;
+        }
+        int min = tree_[0];
+        if(!current_[min]) { return NULL; }
+        dataTuple * ret = current_[min];
+        advance(min);
+        // The remaining copies of this key come out next, newest first.
         int num_dups = 0;
-        if(last_iter_ != -1) {
-          // get the value after the one we just returned to the user
-          //datatuple::freetuple(current_[last_iter_]); // should never be null
-          if(last_iter_ == 0) {
-              current_[last_iter_] = first_iter_->next_callerFrees();
-          } else if(last_iter_ != -1){
-              current_[last_iter_] = iters_[last_iter_-1]->next_callerFrees();
+        while(current_[tree_[0]] && !cmp_(current_[tree_[0]], ret)) {
+          int d = tree_[0];
+          if(merge_) {
+            assert(num_dups < num_iters_);
+            dups[num_dups++] = current_[d];
           } else {
-              // last call was 'peek'
+            dataTuple::freetuple(current_[d]);
           }
+          advance(d);
         }
-        // find the first non-empty iterator.  (Don't need to special-case ITRA since we're looking at current.)
-        int min = 0;
-        while(min < num_iters_ && !current_[min]) {
-          min++;
-        }
-        if(min == num_iters_) { return NULL; }
-        // examine current to decide which tuple to return.
-        for(int i = min+1; i < num_iters_; i++) {
-          if(current_[i]) {
-            int res = cmp_(current_[min], current_[i]);
-            if(res > 0) { // min > i
-              min = i;
-              num_dups = 0;
-            } else if(res == 0) { // min == i
-              dups[num_dups] = i;
-              num_dups++;
-            }
+        if(num_dups) {
+          dataTuple * acc = dups[num_dups-1];
+          for(int i = num_dups-2; i >= -1; i--) {
+            dataTuple * newer = i == -1 ? ret : dups[i];
+            dataTuple * m = (acc->isDelete() || newer->isDelete()) ? newer->create_copy() : merge_(acc, newer);
+            dataTuple::freetuple(acc);
+            dataTuple::freetuple(newer);
+            acc = m;
           }
+          ret = acc;
         }
-        dataTuple * ret;
-        if(!merge_) {
-            ret = current_[min];
+        return ret;
+      }
+    private:
+      /** @return true if source a's tuple comes before source b's.  Exhausted sources sort last; ties go to the newer source. */
+      inline bool beats(int a, int b) {
+        if(!current_[a]) { return !current_[b] && a < b; }
+        if(!current_[b]) { return true; }
+        int res = cmp_(current_[a], current_[b]);
+        return res < 0 || (res == 0 && a < b);
+      }
+      /** Build the subtree rooted at node (leaves are num_iters_..2*num_iters_-1), recording losers.  @return its winner. */
+      int play(int node) {
+        if(node >= num_iters_) { return node - num_iters_; }
+        int a = play(2*node);
+        int b = play(2*node+1);
+        if(beats(a, b)) {
+          tree_[node] = b;
+          return a;
         } else {
-            // XXX use merge function to build a new ret.
-            abort();
+          tree_[node] = a;
+          return b;
         }
-        // advance the iterators that match the tuple we're returning.
-        for(int i = 0; i < num_dups; i++) {
-            dataTuple::freetuple(current_[dups[i]]); // should never be null
-            current_[dups[i]] = iters_[dups[i]-1]->next_callerFrees();
+      }
+      /** Replace source i's tuple (which the caller now owns) with its next one, and replay i's path to the root. */
+      void advance(int i) {
+        current_[i] = i ? iters_[i-1]->next_callerFrees() : first_iter_->next_callerFrees();
+        int winner = i;
+        for(int node = (i + num_iters_) / 2; node > 0; node /= 2) {
+          if(beats(tree_[node], winner)) {
+            int t = tree_[node];
+            tree_[node] = winner;
+            winner = t;
+          }
         }
-        last_iter_ = min; // mark the min iter to be advance at the next invocation of next().  This saves us a copy in the non-merging case.
-        return ret;
-
+        tree_[0] = winner;
       }
-    private:
+
       int      num_iters_;
       ITRA  *  first_iter_;
       ITRN  ** iters_;
       dataTuple ** current_;
-      int      last_iter_;
+      int   *  tree_;     // tree_[0] is the winner; tree_[1..num_iters_-1] hold the loser of each match.
+      dataTuple * peeked_;
 
 
       int  (*cmp_)(const dataTuple*,const dataTuple*);
       dataTuple*(*merge_)(const dataTuple*,const dataTuple*);
 
       // temporary variables initiaized once for effiency
-      int * dups;
+      dataTuple ** dups;
 
     };
 
+    /** Merges the C0 shards.  Their keys are disjoint, so nothing needs to be combined. */
+    typedef mergeManyIterator<
+       memTreeComponent::batchedRevalidatingIterator,
+       memTreeComponent::batchedRevalidatingIterator> c0_iterator_t;
+
+    /** A snapshot-free scan of C0 from key, for bLSM::iterator.  If reverse, returns the tuples <= key in descending order. */
+    c0_iterator_t * open_c0_iterator(dataTuple * key, bool reverse);
+    /** Scan all of C0 for the C0-C1 merge.  Blocks until C0 is nearly full; see memTreeComponent::batchedRevalidatingIterator. */
+    c0_iterator_t * open_c0_merge_iterator();
 
     class iterator {
   public:
@@ -327,6 +499,7 @@ public:
         last_returned(NULL),
         key(NULL),
         valid(false),
+        reverse(false),
         reval_count(0) {
         rwlc_readlock(ltable->header_mut);
         pthread_mutex_lock(&ltable->rb_mut);
@@ -336,13 +509,18 @@ public:
         //        rwlc_unlock(ltable->header_mut);
       }
 
-      explicit iterator(bLSM* ltable,dataTuple *key)
+      /**
+       * Start at key.  If reverse, return the tuples <= key in descending
+       * order instead; a NULL key starts at the end of the table.
+       */
+      explicit iterator(bLSM* ltable,dataTuple *key, bool reverse = false)
       : ltable(ltable),
         epoch(ltable->get_epoch()),
         merge_it_(NULL),
         last_returned(NULL),
         key(key),
         valid(false),
+        reverse(reverse),
         reval_count(0)
       {
         rwlc_readlock(ltable->header_mut);
@@ -369,7 +547,7 @@ public:
           dataTuple * tmp = merge_it_->next_callerFrees();
           if(last_returned && tmp) {
               int res = dataTuple::compare(last_returned->strippedkey(), last_returned->strippedkeylen(), tmp->strippedkey(), tmp->strippedkeylen());
-              if(res >= 0) {
+              if(reverse ? res <= 0 : res >= 0) {
 		  int al = last_returned->strippedkeylen();
                   char * a =(char*)malloc(al + 1);
                   memcpy(a, last_returned->strippedkey(), al);
@@ -378,7 +556,7 @@ public:
                   char * b =(char*)malloc(bl + 1);
                   memcpy(b, tmp->strippedkey(), bl);
                   b[bl] = 0;
-                  printf("blsm.h assert fail: out of order tuples %d should be < 0.  %s <=> %s\n", res, a, b);
+                  printf("blsm.h assert fail: out of order tuples %d should be %s 0.  %s <=> %s\n", res, reverse ? ">" : "<", a, b);
                   free(a);
                   free(b);
               }
@@ -398,13 +576,22 @@ public:
           return ret;
       }
 
-      dataTuple * getnext() {
+      /**
+       * Like getnext(), but without the copy.  The tuple belongs to the
+       * iterator, and is valid until the next call to getnext*() or until the
+       * iterator is deleted.
+       */
+      dataTuple * getnext_borrowed() {
           dataTuple * ret;
           while((ret = getnextHelper()) && ret->isDelete()) { }  // getNextHelper handles its own memory.
-          ret = ret ? ret->create_copy() : NULL; // XXX hate making copy!  Caller should not manage our memory.
           return ret;
       }
 
+      dataTuple * getnext() {
+          dataTuple * ret = getnext_borrowed();
+          return ret ? ret->create_copy() : NULL;
+      }
+
       void invalidate() {
 //        assert(!trywritelock(ltable->header_lock,0));
         if(valid) {
@@ -428,7 +615,7 @@ public:
       bLSM * ltable;
       uint64_t epoch;
       typedef mergeManyIterator<
-         memTreeComponent::batchedRevalidatingIterator,
+         c0_iterator_t,
          memTreeComponent::iterator> inner_merge_it_t;
       typedef mergeManyIterator<
         inner_merge_it_t,
@@ -439,6 +626,7 @@ public:
       dataTuple * last_returned;
       dataTuple * key;
       bool valid;
+      bool reverse;
       int reval_count;
       static const int reval_period = 100;
       void revalidate() {
@@ -457,10 +645,14 @@ public:
       }
 
 
+      diskTreeComponent::iterator * open_disk_iterator(diskTreeComponent * c, dataTuple * t) {
+        return reverse ? c->open_reverse_iterator(t) : c->open_iterator(t);
+      }
+
       void validate() {
-         memTreeComponent::batchedRevalidatingIterator * c0_it;
+         c0_iterator_t * c0_it;
          memTreeComponent::iterator *c0_mergeable_it[1];
-        diskTreeComponent::iterator * disk_it[4];
+        std::vector<diskTreeComponent::iterator*> disk_it(4);
         epoch = ltable->get_epoch();
 
         dataTuple *t;
@@ -472,24 +664,30 @@ public:
           t = NULL;
         }
 
-        c0_it              = new  memTreeComponent::batchedRevalidatingIterator(ltable->get_tree_c0(), 100, &ltable->rb_mut,  t);
-        c0_mergeable_it[0] = new  memTreeComponent::iterator            (ltable->get_tree_c0_mergeable(),                            t);
+        c0_it              = ltable->open_c0_iterator(t, reverse);
+        c0_mergeable_it[0] = new  memTreeComponent::iterator            (ltable->get_tree_c0_mergeable(),                            t, reverse);
         if(ltable->get_tree_c1_prime()) {
-          disk_it[0] = ltable->get_tree_c1_prime()->open_iterator(t);
+          disk_it[0] = open_disk_iterator(ltable->get_tree_c1_prime(), t);
         } else {
           disk_it[0] = NULL;
         }
-        disk_it[1]         = ltable->get_tree_c1()->open_iterator(t);
+        disk_it[1]         = open_disk_iterator(ltable->get_tree_c1(), t);
         if(ltable->get_tree_c1_mergeable()) {
-          disk_it[2]         = ltable->get_tree_c1_mergeable()->open_iterator(t);
+          disk_it[2]         = open_disk_iterator(ltable->get_tree_c1_mergeable(), t);
         } else {
           disk_it[2] = NULL;
         }
-        disk_it[3]         = ltable->get_tree_c2()->open_iterator(t);
+        disk_it[3]         = open_disk_iterator(ltable->get_tree_c2(), t);
+        std::vector<diskTreeComponent*> deep;
+        ltable->get_deep_components(&deep);
+        for(size_t i = 0; i < deep.size(); i++) {
+          disk_it.push_back(open_disk_iterator(deep[i], t));
+        }
 
+        int (*cmp)(const dataTuple*,const dataTuple*) = reverse ? dataTuple::compare_obj_desc : dataTuple::compare_obj;
         inner_merge_it_t * inner_merge_it =
-               new inner_merge_it_t(c0_it, c0_mergeable_it, 1, NULL, dataTuple::compare_obj);
-        merge_it_ = new merge_it_t(inner_merge_it, disk_it, 4, NULL, dataTuple::compare_obj); // XXX Hardcodes comparator, and does not handle merges
+               new inner_merge_it_t(c0_it, c0_mergeable_it, 1, NULL, cmp);
+        merge_it_ = new merge_it_t(inner_merge_it, &disk_it[0], disk_it.size(), NULL, cmp); // XXX Hardcodes comparator, and does not handle merges
         if(last_returned) {
           dataTuple * junk = merge_it_->peek();
           if(junk && !dataTuple::compare(junk->strippedkey(), junk->strippedkeylen(), last_returned->strippedkey(), last_returned->strippedkeylen())) {
@@ -0,0 +1,225 @@
+/*
+ * bloomFilter.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "bloomFilter.h"
+#include "dataPage.h"
+#include "dataTuple.h"
+#include <math.h>
+#include <stdio.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/** MurmurHash64A, by Austin Appleby (public domain). */
+static uint64_t hash64(const byte * key, size_t len) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = 0x8445d61a4e774912ULL ^ (len * m);
+
+  const byte * end = key + (len & ~(size_t)7);
+  for(; key != end; key += 8) {
+    uint64_t k;
+    memcpy(&k, key, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  switch(len & 7) {
+  case 7: h ^= (uint64_t)key[6] << 48;
+  case 6: h ^= (uint64_t)key[5] << 40;
+  case 5: h ^= (uint64_t)key[4] << 32;
+  case 4: h ^= (uint64_t)key[3] << 24;
+  case 3: h ^= (uint64_t)key[2] << 16;
+  case 2: h ^= (uint64_t)key[1] << 8;
+  case 1: h ^= (uint64_t)key[0];
+    h *= m;
+  }
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+// Odd constants used to derive a bit in each word of a block from the low 32 bits of the hash.
+static const uint32_t SALT[8] __attribute__((aligned(32))) = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+bloomFilter::bloomFilter(uint64_t num_expected_items, double false_positive_rate) :
+  num_expected_items_(num_expected_items),
+  false_positive_rate_(false_positive_rate),
+  num_items_(0) {
+  // An unblocked filter needs m = -n ln(p) / ln(2)^2 bits; confining each
+  // key to one block costs some accuracy, so pad that by 10%.
+  double bits = 1.1 * -((double)num_expected_items) * log(false_positive_rate) / (log(2.0) * log(2.0));
+  uint64_t num_blocks = (uint64_t)ceil(bits / (8 * sizeof(block)));
+  alloc_blocks(num_blocks ? num_blocks : 1);
+}
+
+bloomFilter::~bloomFilter() {
+  free(buckets_);
+}
+
+void bloomFilter::alloc_blocks(uint64_t num_blocks) {
+  num_blocks_ = num_blocks;
+  void * mem;
+  int err = posix_memalign(&mem, 64, num_blocks_ * sizeof(block));  // keep blocks inside cache lines.
+  if(err) { perror("Could not allocate bloom filter"); abort(); }
+  memset(mem, 0, num_blocks_ * sizeof(block));
+  buckets_ = (block*)mem;
+}
+
+void bloomFilter::insert(const byte * key, size_t keylen) {
+  uint64_t h = hash64(key, keylen);
+  block * b = &buckets_[((h >> 32) * num_blocks_) >> 32];
+  for(int i = 0; i < WORDS_PER_BLOCK; i++) {
+    uint32_t bit = 1U << ((((uint32_t)h) * SALT[i]) >> 27);
+    // Partitioned merges insert from several threads at once.  Most bits are
+    // already set once the filter fills up, so check before paying for the atomic.
+    if(!(b->word[i] & bit)) { __sync_fetch_and_or(&b->word[i], bit); }
+  }
+  __sync_fetch_and_add(&num_items_, 1);
+}
+
+bool bloomFilter::lookup(const byte * key, size_t keylen) const {
+  uint64_t h = hash64(key, keylen);
+  const block * b = &buckets_[((h >> 32) * num_blocks_) >> 32];
+#ifdef __AVX2__
+  __m256i bits = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32((uint32_t)h),
+                                                      _mm256_load_si256((const __m256i*)SALT)), 27);
+  bits = _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
+  return _mm256_testc_si256(_mm256_load_si256((const __m256i*)b), bits);
+#else
+  for(int i = 0; i < WORDS_PER_BLOCK; i++) {
+    if(!(b->word[i] & (1U << ((((uint32_t)h) * SALT[i]) >> 27)))) { return false; }
+  }
+  return true;
+#endif
+}
+
+void bloomFilter::print_stats() {
+  printf("Bloom filter: %lld bytes, %lld of %lld expected items, target false positive rate %f\n",
+         (long long)(num_blocks_ * sizeof(block)),
+         (long long)num_items_, (long long)num_expected_items_, false_positive_rate_);
+}
+
+/*
+ * On disk, the filter is a chain of datapages.  Each one starts with a
+ * tuple holding the header, followed by tuples holding CHUNK_SIZE byte
+ * pieces of buckets_, keyed by their offset.  A new datapage is started
+ * whenever the region allocator runs out of room; the header points back to
+ * the previous one.
+ */
+static const size_t CHUNK_SIZE = 16 * PAGE_SIZE;
+
+static dataTuple * create_chunk(uint64_t offset, const void * data, len_t datalen) {
+  byte key[sizeof(offset)];
+  for(size_t i = 0; i < sizeof(offset); i++) {  // big endian, so the tuples sort by offset.
+    key[i] = (byte)(offset >> (8 * (sizeof(offset) - i - 1)));
+  }
+  return dataTuple::create(key, sizeof(key), data, datalen);
+}
+
+static uint64_t chunk_offset(dataTuple * t) {
+  uint64_t offset = 0;
+  for(size_t i = 0; i < t->rawkeylen(); i++) {
+    offset = (offset << 8) | t->rawkey()[i];
+  }
+  return offset;
+}
+
+pageid_t bloomFilter::write(int xid, regionAllocator * alloc) {
+  size_t len = num_blocks_ * sizeof(block);
+  header h;
+  h.num_blocks = num_blocks_;
+  h.format = FORMAT;
+  h.num_items = num_items_;
+  h.prev_page = INVALID_PAGE;
+
+  dataPage * dp = 0;
+  bool empty = true; // dp does not hold any chunks yet.
+  size_t off = 0;
+  while(off < len) {
+    if(!dp) {
+      dp = new dataPage(xid, 1 + (sizeof(h) + len - off) / PAGE_SIZE, alloc);
+      dataTuple * t = create_chunk(0, &h, sizeof(h));
+      bool succ = dp->append(t);
+      dataTuple::freetuple(t);
+      empty = true;
+      if(!succ) { break; }
+    }
+    size_t chunk_len = len - off < CHUNK_SIZE ? len - off : CHUNK_SIZE;
+    dataTuple * t = create_chunk(1 + off, ((byte*)buckets_) + off, chunk_len);
+    bool succ = dp->append(t);
+    dataTuple::freetuple(t);
+    if(succ) {
+      off += chunk_len;
+      empty = false;
+    } else if(empty) {
+      break; // the chunk does not fit in a fresh region.
+    } else {
+      // out of room; continue in a new datapage (and region).
+      h.prev_page = dp->get_start_pid();
+      dp->writes_done();
+      delete dp;
+      dp = 0;
+    }
+  }
+  pageid_t ret = off == len ? dp->get_start_pid() : INVALID_PAGE;
+  if(dp) {
+    dp->writes_done();
+    delete dp;
+  }
+  return ret;
+}
+
+bloomFilter * bloomFilter::open(int xid, pageid_t pid) {
+  if(pid == INVALID_PAGE) { return NULL; }
+  bloomFilter * ret = new bloomFilter();
+  while(pid != INVALID_PAGE) {
+    dataPage dp(xid, 0, pid);
+    dataPage::iterator itr = dp.begin();
+    dataTuple * t = itr.getnext();
+    assert(t && !chunk_offset(t) && t->datalen() == sizeof(header));
+    header h;
+    memcpy(&h, t->data(), sizeof(h));
+    dataTuple::freetuple(t);
+    if(h.format != FORMAT) {
+      printf("Ignoring bloom filter at page %lld; it was written by an older version\n", (long long)pid);
+      delete ret;
+      return NULL;
+    }
+    if(!ret->buckets_) {
+      ret->alloc_blocks(h.num_blocks);
+      ret->num_items_ = h.num_items;
+      ret->num_expected_items_ = h.num_items;
+      ret->false_positive_rate_ = 0;
+    }
+    while((t = itr.getnext())) {
+      uint64_t off = chunk_offset(t) - 1;
+      assert(off + t->datalen() <= ret->num_blocks_ * sizeof(block));
+      memcpy(((byte*)ret->buckets_) + off, t->data(), t->datalen());
+      dataTuple::freetuple(t);
+    }
+    pid = h.prev_page;
+  }
+  return ret;
+}
@@ -0,0 +1,87 @@
+/*
+ * bloomFilter.h
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef BLOOMFILTER_H_
+#define BLOOMFILTER_H_
+
+#include <stasis/common.h>
+#include "regionAllocator.h"
+
+/**
+ * Bloom filter for the keys of a diskTreeComponent.
+ *
+ * This is a split block bloom filter: each key hashes (once, with a 64-bit
+ * hash) to a single 32 byte block, and sets one bit in each of the block's
+ * eight 32-bit words.  A probe therefore touches one cache line, and, when
+ * built with AVX2, checks all eight bits with a handful of vector
+ * instructions.
+ *
+ * Filters can be written to (and read back from) the component's datapage
+ * regions, so that they survive restarts.
+ */
+class bloomFilter {
+public:
+  bloomFilter(uint64_t num_expected_items, double false_positive_rate);
+  ~bloomFilter();
+
+  /** Safe to call from several threads at once. */
+  void insert(const byte * key, size_t keylen);
+  /** @return false if key is definitely not in the filter. */
+  bool lookup(const byte * key, size_t keylen) const;
+  uint64_t num_items() const { return num_items_; }
+  void print_stats();
+
+  /**
+   * Write the filter into datapages allocated from alloc.  The caller is
+   * responsible for forcing alloc's regions.
+   * @return the page to pass to open(), or INVALID_PAGE if alloc ran out of space.
+   */
+  pageid_t write(int xid, regionAllocator * alloc);
+  /**
+   * @return the filter written by write() at pid, or NULL if pid is
+   * INVALID_PAGE or holds a filter in an older format.
+   */
+  static bloomFilter * open(int xid, pageid_t pid);
+
+private:
+  bloomFilter() : buckets_(0) {}
+  bloomFilter(const bloomFilter&);
+  void operator=(const bloomFilter&);
+
+  static const int WORDS_PER_BLOCK = 8;
+  struct block {
+    uint32_t word[WORDS_PER_BLOCK];
+  };
+  struct header {
+    uint64_t num_blocks;
+    uint64_t format; // FORMAT.  (This was the number of hash functions in the old unblocked filters.)
+    uint64_t num_items;
+    pageid_t prev_page; // the previous datapage of a filter that did not fit in one region, or INVALID_PAGE.
+  };
+  static const uint64_t FORMAT = 0x626c6f636b656431ULL; // "blocked1"
+
+  void alloc_blocks(uint64_t num_blocks);
+
+  uint64_t num_expected_items_;
+  double false_positive_rate_;
+  uint64_t num_blocks_;
+  uint64_t num_items_;
+  block * buckets_;
+};
+
+#endif /* BLOOMFILTER_H_ */
@@ -0,0 +1,57 @@
+/*
+ * compactionFilter.h
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef COMPACTIONFILTER_H_
+#define COMPACTIONFILTER_H_
+
+struct dataTuple;
+
+/**
+ * An application-defined policy that merges apply to the tuples they
+ * write, so that tuples can be dropped or changed without a separate
+ * scan-and-delete pass.  Register filters with
+ * bLSM::add_compaction_filter().  They run, in the order they were added,
+ * on every tuple that a merge would otherwise write, in every merge
+ * (C0-C1, C1-C2, and the ones below that).  Tombstones are not filtered.
+ *
+ * A dropped tuple disappears for good.  Merges above the last level
+ * write a tombstone in its place if there might be older versions of it
+ * further down.  Filters are called concurrently by the merge threads, so
+ * they must be thread safe.
+ */
+class compactionFilter {
+public:
+  enum decision {
+    KEEP,    /// Write the tuple as is.
+    DROP,    /// Do not write the tuple.
+    REWRITE  /// Write *rewritten in its place.
+  };
+  virtual ~compactionFilter() {}
+
+  /** @return a short name for mergeStats. */
+  virtual const char * name() = 0;
+  /**
+   * Decide what to do with t, which a merge into C(level) is about to
+   * write.  last_level is true if nothing is older than that merge's
+   * output.  To rewrite t, set *rewritten to a new tuple with t's key
+   * (see dataTuple::create()); the merge frees it.
+   */
+  virtual decision filter(int level, bool last_level, const dataTuple * t, dataTuple ** rewritten) = 0;
+};
+
+#endif /* COMPACTIONFILTER_H_ */
@@ -0,0 +1,304 @@
+/*
+ * concurrentSkiplist.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "concurrentSkiplist.h"
+#include <new>
+#include <sched.h>
+
+/**
+ * The low bit of next[i] marks the node as deleted at level i; once it is
+ * set, next[i] never changes again.  The low bit of tuple is set by erase()
+ * to claim the node.  Claimed nodes are invisible to readers.
+ */
+struct concurrentSkiplist::node {
+  std::atomic<uintptr_t> tuple;
+  std::atomic<bool> fully_linked;
+  int height;
+  std::atomic<uintptr_t> next[1];
+};
+
+static const uintptr_t MARK = 1;
+static const size_t RECLAIM_BATCH = 1024;
+
+static inline bool is_marked(uintptr_t p) { return p & MARK; }
+static inline concurrentSkiplist::node * unmarked(uintptr_t p) {
+  return (concurrentSkiplist::node*)(p & ~MARK);
+}
+
+dataTuple * concurrentSkiplist::tuple_of(node * n) {
+  return (dataTuple*)(n->tuple.load() & ~MARK);
+}
+
+static inline int compare_node(concurrentSkiplist::node * n, const dataTuple * key) {
+  dataTuple * t = concurrentSkiplist::tuple_of(n);
+  return dataTuple::compare(t->strippedkey(), t->strippedkeylen(), key->strippedkey(), key->strippedkeylen());
+}
+
+concurrentSkiplist::node * concurrentSkiplist::alloc_node(dataTuple * t, int height) {
+  node * n = (node*)arena_.alloc(sizeof(*n) + (height - 1) * sizeof(n->next[0]));
+  new (&n->tuple) std::atomic<uintptr_t>((uintptr_t)t);
+  new (&n->fully_linked) std::atomic<bool>(false);
+  n->height = height;
+  for(int i = 0; i < height; i++) {
+    new (&n->next[i]) std::atomic<uintptr_t>(0);
+  }
+  return n;
+}
+
+concurrentSkiplist::concurrentSkiplist() : head_(alloc_node(NULL, MAX_HEIGHT)), count_(0), epoch_(0) {
+  head_->fully_linked.store(true);
+  readers_[0].store(0);
+  readers_[1].store(0);
+  pthread_mutex_init(&retire_mut_, 0);
+}
+
+concurrentSkiplist::~concurrentSkiplist() {
+  // The nodes and tuples (including anything still waiting in pending_ or
+  // limbo_) are freed in bulk along with arena_.
+  pthread_mutex_destroy(&retire_mut_);
+}
+
+int concurrentSkiplist::random_height() {
+  static __thread uint32_t seed = 0;
+  if(!seed) { seed = (uint32_t)(uintptr_t)pthread_self() | 1; }
+  int height = 1;
+  while(height < MAX_HEIGHT) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    if(seed & 3) { break; }  // branching factor of 4, as in leveldb.
+    height++;
+  }
+  return height;
+}
+
+uint64_t concurrentSkiplist::read_begin() {
+  while(true) {
+    uint64_t e = epoch_.load();
+    readers_[e & 1]++;
+    if(epoch_.load() == e) { return e; }
+    readers_[e & 1]--;  // raced with try_reclaim(); register with the new epoch instead.
+  }
+}
+
+void concurrentSkiplist::read_end(uint64_t e) {
+  readers_[e & 1]--;
+}
+
+void concurrentSkiplist::retire(void * p) {
+  pthread_mutex_lock(&retire_mut_);
+  pending_.push_back(p);
+  if(pending_.size() >= RECLAIM_BATCH) { try_reclaim(); }
+  pthread_mutex_unlock(&retire_mut_);
+}
+
+void concurrentSkiplist::try_reclaim() {
+  uint64_t e = epoch_.load();
+  if(readers_[(e - 1) & 1].load()) { return; }  // someone from epoch e-1 could still see limbo_.
+  for(size_t i = 0; i < limbo_.size(); i++) { arenaAllocator::release(limbo_[i]); }
+  limbo_.clear();
+  limbo_.swap(pending_);
+  epoch_.store(e + 1);
+}
+
+/**
+ * Fill in the last node < key and the first node >= key at each level,
+ * unlinking any deleted nodes found along the way.
+ * @return true if succs[0] has the same key as key.
+ */
+bool concurrentSkiplist::find_preds(const dataTuple * key, node ** preds, node ** succs) {
+retry:
+  node * pred = head_;
+  for(int level = MAX_HEIGHT - 1; level >= 0; level--) {
+    node * curr = unmarked(pred->next[level].load());
+    while(curr) {
+      uintptr_t succ = curr->next[level].load();
+      if(is_marked(succ)) {
+        uintptr_t expected = (uintptr_t)curr;
+        if(!pred->next[level].compare_exchange_strong(expected, succ & ~MARK)) { goto retry; }
+        curr = unmarked(succ);
+      } else if(compare_node(curr, key) < 0) {
+        pred = curr;
+        curr = unmarked(succ);
+      } else {
+        break;
+      }
+    }
+    preds[level] = pred;
+    succs[level] = curr;
+  }
+  return succs[0] && !compare_node(succs[0], key);
+}
+
+/** Read-only version of find_preds(); returns the first node >= key at level 0. */
+static concurrentSkiplist::node * lower_bound_node(concurrentSkiplist::node * head, int max_height, const dataTuple * key) {
+  concurrentSkiplist::node * pred = head;
+  concurrentSkiplist::node * curr = NULL;
+  for(int level = max_height - 1; level >= 0; level--) {
+    curr = unmarked(pred->next[level].load());
+    while(curr) {
+      uintptr_t succ = curr->next[level].load();
+      if(is_marked(succ)) {
+        curr = unmarked(succ);
+      } else if(key && compare_node(curr, key) < 0) {
+        pred = curr;
+        curr = unmarked(succ);
+      } else {
+        break;
+      }
+    }
+  }
+  return curr;
+}
+
+dataTuple * concurrentSkiplist::find(const dataTuple * key) {
+  node * n = lower_bound_node(head_, MAX_HEIGHT, key);
+  if(!n || compare_node(n, key)) { return NULL; }
+  uintptr_t t = n->tuple.load();
+  return is_marked(t) ? NULL : (dataTuple*)t;
+}
+
+concurrentSkiplist::node * concurrentSkiplist::seek(const dataTuple * key, bool include_key) {
+  node * n = lower_bound_node(head_, MAX_HEIGHT, key);
+  if(n && key && !include_key && !compare_node(n, key)) {
+    return next(n);
+  }
+  if(n && is_marked(n->tuple.load())) {
+    return next(n);
+  }
+  return n;
+}
+
+/**
+ * Read-only; returns the last node < key (<= key if inclusive) at level 0,
+ * or NULL.  Like lower_bound_node(), the node may have been claimed since.
+ */
+static concurrentSkiplist::node * last_before_node(concurrentSkiplist::node * head, int max_height, const dataTuple * key, bool inclusive) {
+  concurrentSkiplist::node * pred = head;
+  for(int level = max_height - 1; level >= 0; level--) {
+    concurrentSkiplist::node * curr = unmarked(pred->next[level].load());
+    while(curr) {
+      uintptr_t succ = curr->next[level].load();
+      if(is_marked(succ)) {
+        curr = unmarked(succ);
+        continue;
+      }
+      int cmp = key ? compare_node(curr, key) : -1;
+      if(cmp < 0 || (inclusive && cmp == 0)) {
+        pred = curr;
+        curr = unmarked(succ);
+      } else {
+        break;
+      }
+    }
+  }
+  return pred == head ? NULL : pred;
+}
+
+concurrentSkiplist::node * concurrentSkiplist::seek_back(const dataTuple * key, bool include_key) {
+  node * n = last_before_node(head_, MAX_HEIGHT, key, include_key);
+  // There are no back pointers, so step over a node that was erased under
+  // us by searching again from its key.
+  while(n && (is_marked(n->next[0].load()) || is_marked(n->tuple.load()))) {
+    n = last_before_node(head_, MAX_HEIGHT, tuple_of(n), false);
+  }
+  return n;
+}
+
+concurrentSkiplist::node * concurrentSkiplist::next(node * n) {
+  n = unmarked(n->next[0].load());
+  while(n && (is_marked(n->next[0].load()) || is_marked(n->tuple.load()))) {
+    n = unmarked(n->next[0].load());
+  }
+  return n;
+}
+
+bool concurrentSkiplist::insert(const dataTuple * t) {
+  readGuard g(this);
+  node * preds[MAX_HEIGHT];
+  node * succs[MAX_HEIGHT];
+  node * n = NULL;
+  int height = random_height();
+  while(true) {
+    if(find_preds(t, preds, succs)) {
+      if(!is_marked(succs[0]->tuple.load())) {
+        if(n) {  // never published
+          arenaAllocator::release(tuple_of(n));
+          arenaAllocator::release(n);
+        }
+        return false;
+      }
+      // an erase() of this key is in flight; wait for it to unlink the node.
+      sched_yield();
+      continue;
+    }
+    if(!n) { n = alloc_node(arena_.copy_tuple(t), height); }
+    for(int i = 0; i < height; i++) {
+      n->next[i].store((uintptr_t)succs[i]);
+    }
+    uintptr_t expected = (uintptr_t)succs[0];
+    if(preds[0]->next[0].compare_exchange_strong(expected, (uintptr_t)n)) { break; }
+  }
+  count_++;
+  for(int level = 1; level < height; level++) {
+    while(true) {
+      uintptr_t expected = (uintptr_t)succs[level];
+      if(preds[level]->next[level].compare_exchange_strong(expected, (uintptr_t)n)) { break; }
+      find_preds(t, preds, succs);
+      n->next[level].store((uintptr_t)succs[level]);  // safe; erase() cannot mark n until it is fully linked.
+    }
+  }
+  n->fully_linked.store(true);
+  return true;
+}
+
+dataTuple * concurrentSkiplist::replace(dataTuple * old_t, const dataTuple * new_t) {
+  node * n = lower_bound_node(head_, MAX_HEIGHT, old_t);
+  if(!n || compare_node(n, old_t)) { return NULL; }
+  dataTuple * copy = arena_.copy_tuple(new_t);
+  uintptr_t expected = (uintptr_t)old_t;
+  if(!n->tuple.compare_exchange_strong(expected, (uintptr_t)copy)) {
+    arenaAllocator::release(copy);
+    return NULL;
+  }
+  retire(old_t);
+  return copy;
+}
+
+bool concurrentSkiplist::erase(dataTuple * t) {
+  node * preds[MAX_HEIGHT];
+  node * succs[MAX_HEIGHT];
+  if(!find_preds(t, preds, succs)) { return false; }
+  node * n = succs[0];
+  uintptr_t expected = (uintptr_t)t;
+  if(!n->tuple.compare_exchange_strong(expected, (uintptr_t)t | MARK)) { return false; }
+  count_--;
+  // The node is now logically gone.  Wait for its insert() to link every
+  // level, so that nothing links it back in after we unlink it below.
+  while(!n->fully_linked.load()) { sched_yield(); }
+  for(int level = n->height - 1; level >= 0; level--) {
+    uintptr_t succ = n->next[level].load();
+    while(!is_marked(succ)) {
+      if(n->next[level].compare_exchange_weak(succ, succ | MARK)) { break; }
+    }
+  }
+  find_preds(t, preds, succs);  // unlinks n from every level.
+  retire(n);
+  retire(t);
+  return true;
+}
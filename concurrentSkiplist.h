@@ -0,0 +1,129 @@
+/*
+ * concurrentSkiplist.h
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef CONCURRENTSKIPLIST_H_
+#define CONCURRENTSKIPLIST_H_
+
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+#include "dataTuple.h"
+#include "arenaAllocator.h"
+
+/**
+ * Lock-free skiplist of dataTuples, ordered by key.  This is an alternative
+ * to memTreeComponent::rbtree_t for C0 that does not need rb_mut.
+ *
+ * Readers never block.  They must hold a readGuard while they dereference
+ * anything returned by the list; the guard keeps unlinked nodes and replaced
+ * tuples alive until every reader that could have seen them is gone.
+ *
+ * Writers are lock-free, with one exception: erase() waits for a concurrent
+ * insert of the same node to finish linking its upper levels before it
+ * unlinks it.
+ *
+ * Each key is stored at most once.  A node's tuple can be swapped out with
+ * replace(), which is how C0 folds a new write into an existing key.
+ *
+ * Nodes and tuples live in the list's arenaAllocator; the list copies
+ * tuples in, and never takes ownership of the caller's memory.
+ */
+class concurrentSkiplist {
+public:
+  struct node;
+
+  concurrentSkiplist();
+  ~concurrentSkiplist();
+
+  /** Pins the current reclamation epoch for as long as the guard lives. */
+  class readGuard {
+  public:
+    explicit readGuard(concurrentSkiplist * s) : s_(s), epoch_(s->read_begin()) { }
+    ~readGuard() { s_->read_end(epoch_); }
+  private:
+    readGuard(const readGuard&);
+    void operator=(const readGuard&);
+    concurrentSkiplist * s_;
+    uint64_t epoch_;
+  };
+
+  /** @return the tuple stored under key's key, or NULL.  Caller must hold a readGuard. */
+  dataTuple * find(const dataTuple * key);
+  /** @return the first live node with key >= key (or > key if !include_key).  NULL means the end of the list.  Caller must hold a readGuard. */
+  node * seek(const dataTuple * key, bool include_key);
+  /** @return the last live node with key <= key (or < key if !include_key).  A NULL key means the end of the list.  Caller must hold a readGuard. */
+  node * seek_back(const dataTuple * key, bool include_key);
+  /** @return the live node after n, or NULL.  Caller must hold a readGuard. */
+  node * next(node * n);
+  /** @return the tuple currently stored in n.  Caller must hold a readGuard. */
+  static dataTuple * tuple_of(node * n);
+
+  /**
+   * Insert a copy of t.
+   * @return false if the key is already present.
+   */
+  bool insert(const dataTuple * t);
+  /**
+   * Atomically swap old_t for a copy of new_t if old_t is still the tuple
+   * stored under its key.  On success, old_t will be freed once no readers
+   * can see it.  Caller must hold a readGuard.
+   * @return the copy of new_t, or NULL if old_t was not there.
+   */
+  dataTuple * replace(dataTuple * old_t, const dataTuple * new_t);
+  /**
+   * Remove t's node if t is still the tuple stored under its key.  On
+   * success, t and its node will be freed once no readers can see them.
+   * Caller must hold a readGuard.
+   */
+  bool erase(dataTuple * t);
+
+  /** Number of keys in the list.  Approximate while writers are active. */
+  int64_t size() { return count_.load(); }
+  arenaAllocator * get_arena() { return &arena_; }
+
+private:
+  static const int MAX_HEIGHT = 12;
+
+  uint64_t read_begin();
+  void read_end(uint64_t epoch);
+  void retire(void * p);
+  void try_reclaim();
+
+  node * alloc_node(dataTuple * t, int height);
+  bool find_preds(const dataTuple * key, node ** preds, node ** succs);
+  static int random_height();
+
+  concurrentSkiplist(const concurrentSkiplist&);
+  void operator=(const concurrentSkiplist&);
+
+  arenaAllocator arena_; // declared first, so it outlives everything allocated from it.
+  node * head_;
+  std::atomic<int64_t> count_;
+
+  // Two-epoch reclamation.  Readers register with the counter for the
+  // current epoch's parity.  Things retired during epoch e go in pending_;
+  // when the counter for epoch e-1 drains we free limbo_, move pending_
+  // into limbo_ and advance to e+1.
+  std::atomic<uint64_t> epoch_;
+  std::atomic<int64_t> readers_[2];
+  pthread_mutex_t retire_mut_;
+  std::vector<void*> pending_;
+  std::vector<void*> limbo_;
+};
+
+#endif /* CONCURRENTSKIPLIST_H_ */
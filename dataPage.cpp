@@ -82,7 +82,11 @@ dataPage::dataPage(int xid, regionAllocator * alloc, pageid_t pid):  // XXX Hack
   initial_page_count_(-1), // used by append.
   alloc_(alloc),  // read-only, and we don't free data pages one at a time.
   first_page_(pid),
-  write_offset_(-1)
+  write_offset_(-1),
+  data_start_(0),
+  index_offset_(0),
+  restart_count_(0),
+  record_count_(0)
   {
   assert(pid!=0);
   Page *p = alloc_ ? alloc_->load_page(xid, first_page_) : loadPage(xid, first_page_);
@@ -91,7 +95,18 @@ dataPage::dataPage(int xid, regionAllocator * alloc, pageid_t pid):  // XXX Hack
     abort();
   }
   assert(*is_another_page_ptr(p) == 0 || *is_another_page_ptr(p) == 2); // would be 1 for page in the middle of a datapage
+  index_header h;
+  memcpy(&h, data_at_offset_ptr(p, 0), sizeof(h));
   releasePage(p);
+  if(h.magic == INDEX_MAGIC) {
+    data_start_ = sizeof(h);
+    if(h.index_offset) {
+      // the datapage is complete, so we know where it ends.
+      index_offset_ = h.index_offset;
+      restart_count_ = h.restart_count;
+      page_count_ = h.page_count;
+    }
+  } // otherwise, this datapage predates the index; fall back on linear scans.
 }
 
 dataPage::dataPage(int xid, pageid_t page_count, regionAllocator *alloc) :
@@ -100,7 +115,11 @@ dataPage::dataPage(int xid, pageid_t page_count, regionAllocator *alloc) :
   initial_page_count_(page_count),
   alloc_(alloc),
   first_page_(alloc_->alloc_extent(xid_, page_count_)),
-  write_offset_(0)
+  write_offset_(0),
+  data_start_(sizeof(index_header)),
+  index_offset_(0),
+  restart_count_(0),
+  record_count_(0)
 {
   DEBUG("Datapage page count: %lld pid = %lld\n", (long long int)initial_page_count_, (long long int)first_page_);
   assert(page_count_ >= 1);
@@ -109,6 +128,59 @@ dataPage::dataPage(int xid, pageid_t page_count, regionAllocator *alloc) :
 
 void dataPage::initialize() {
   initialize_page(first_page_);
+
+  // writes_done() fills in the rest of the header once it has written the index.
+  index_header h;
+  memset(&h, 0, sizeof(h));
+  h.magic = INDEX_MAGIC;
+  bool succ = write_data((const byte*)&h, sizeof(h), false);
+  assert(succ);
+}
+
+void dataPage::writes_done() {
+  if(write_offset_ != -1) {
+    len_t dat_len = 0; // write terminating zero.
+
+    // if writing the zero fails, later reads will fail as well, and assume EOF.
+    if(write_data((const byte*)&dat_len, sizeof(dat_len), false)) {
+      write_index();
+    }
+
+    write_offset_ = -1;
+  }
+}
+
+void dataPage::write_index() {
+  index_header h;
+  h.magic = INDEX_MAGIC;
+  h.restart_count = restarts_.size();
+  h.index_offset = write_offset_;
+  if(!restarts_.empty()
+     && !write_data((const byte*)&restarts_[0], restarts_.size() * sizeof(restarts_[0]))) {
+    return; // the region is full.  Leave index_offset at zero; readers will scan the datapage instead.
+  }
+  h.page_count = page_count_;
+
+  Page *p = alloc_ ? alloc_->load_page(xid_, first_page_) : loadPage(xid_, first_page_);
+  memcpy(data_at_offset_ptr(p, 0), &h, sizeof(h));
+  stasis_page_lsn_write(xid_, p, alloc_->get_lsn(xid_));
+  releasePage(p);
+  restarts_.clear();
+}
+
+pageid_t dataPage::copy_to(int xid, regionAllocator * alloc) {
+  if(!index_offset_ || page_count_ > alloc->region_page_count()) { return INVALID_PAGE; }
+  pageid_t ret = alloc->alloc_extent(xid, page_count_);
+  for(pageid_t i = 0; i < page_count_; i++) {
+    Page * src = alloc_ ? alloc_->load_page(xid, first_page_ + i) : loadPage(xid, first_page_ + i);
+    Page * dst = loadUninitializedPage(xid, ret + i);
+    memcpy(dst->memAddr, src->memAddr, PAGE_SIZE);
+    dst->pageType = DATA_PAGE;
+    stasis_page_lsn_write(xid, dst, alloc->get_lsn(xid));
+    releasePage(dst);
+    releasePage(src);
+  }
+  return ret;
 }
 
 void dataPage::initialize_page(pageid_t pageid) {
@@ -301,7 +373,7 @@ bool dataPage::append(dataTuple const * dat)
     if(write_offset_ + tup_len < (initial_page_count_ * PAGE_SIZE)) {
       // tuple fits.  contractually obligated to accept it.
       accept_tuple = true;
-    } else if(write_offset_ == 0) {
+    } else if(record_count_ == 0) {
       // datapage is empty.  contractually obligated to accept tuple.
       accept_tuple = true;
     } else {
@@ -330,6 +402,7 @@ bool dataPage::append(dataTuple const * dat)
   // datapage.
   byte * buf = dat->to_bytes();
   len_t dat_len = dat->byte_length();
+  off_t rec_offset = write_offset_;
 
   Page * p = write_data_and_latch((const byte*)&dat_len, sizeof(dat_len));
   bool succ = false;
@@ -341,11 +414,92 @@ bool dataPage::append(dataTuple const * dat)
 
   free(buf);
 
+  if(succ) {
+    if(record_count_ % RESTART_INTERVAL == 0) {
+      restarts_.push_back(rec_offset);
+    }
+    record_count_++;
+  }
+
   return succ;
 }
 
+/**
+ * Compare the key of the record at offset with key, without decoding the
+ * rest of the tuple.
+ * @return the length of the record, or 0 at the end of the datapage.
+ */
+dataPage::len_t dataPage::compare_record_key(off_t offset, const byte * key, size_t keylen, int * cmp) {
+  len_t hdr[3]; // record length, then the tuple's key length and data length.
+  if(!read_data((byte*)hdr, offset, sizeof(hdr[0])) || hdr[0] == 0) {
+    return 0;
+  }
+  if(!read_data((byte*)&hdr[1], offset + sizeof(hdr[0]), 2 * sizeof(hdr[0]))) {
+    return 0;
+  }
+  byte stack_buf[256];
+  byte * buf = hdr[1] <= sizeof(stack_buf) ? stack_buf : (byte*)malloc(hdr[1]);
+  if(hdr[1] && !read_data(buf, offset + sizeof(hdr), hdr[1])) {
+    hdr[0] = 0;
+  } else {
+    *cmp = dataTuple::compare(buf, hdr[1], key, keylen);
+  }
+  if(buf != stack_buf) { free(buf); }
+  return hdr[0];
+}
+
+/**
+ * Binary search the restart points for the last one before key, then scan
+ * forward from there.  Only valid once the index has been written.
+ * @return the offset of the first record >= key, or -1 if there is none.
+ * *match is the result of comparing that record with key.
+ */
+off_t dataPage::find_record(const byte * key, size_t keylen, int * match) {
+  assert(index_offset_);
+  off_t off = data_start_;
+  int64_t lo = 0;
+  int64_t hi = restart_count_;
+  while(lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    off_t restart = restart_offset(mid);
+    int cmp;
+    if(compare_record_key(restart, key, keylen, &cmp) && cmp < 0) {
+      off = restart;
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  while(true) {
+    len_t len = compare_record_key(off, key, keylen, match);
+    if(!len) { return -1; }
+    if(*match >= 0) { return off; }
+    off += sizeof(len) + len;
+  }
+}
+
+/** @return the offset of the i'th restart point.  Only valid once the index has been written. */
+off_t dataPage::restart_offset(int64_t i) {
+  assert(index_offset_ && i < restart_count_);
+  int64_t restart;
+  bool succ = read_data((byte*)&restart, index_offset_ + i * sizeof(restart), sizeof(restart));
+  assert(succ);
+  return restart;
+}
+
 bool dataPage::recordRead(const dataTuple::key_t key, size_t keySize,  dataTuple ** buf)
 {
+  if(index_offset_) {
+    int match;
+    off_t off = find_record(key, keySize, &match);
+    *buf = 0;
+    if(off == -1 || match != 0) { return false; }
+    iterator itr(this, NULL);
+    itr.read_offset_ = off;
+    *buf = itr.getnext();
+    return *buf != 0;
+  }
+
   iterator itr(this, NULL);
 
   int match = -1;
@@ -372,6 +526,62 @@ bool dataPage::recordRead(const dataTuple::key_t key, size_t keySize,  dataTuple
 
 
 dataTuple* dataPage::iterator::getnext() {
+  if(!reverse_) { return read_next(); }
+  while(stash_.empty()) {
+    if(restart_ <= 0) { return NULL; }
+    restart_--;
+    stash_interval(NULL);
+  }
+  dataTuple * ret = stash_.back();
+  stash_.pop_back();
+  return ret;
+}
+
+/** Position a reverse iterator at the last restart interval that can hold tuples <= key. */
+void dataPage::iterator::seek_back(dataTuple * key) {
+  if(dp == NULL) { return; }
+  if(!dp->index_offset_) {
+    restart_ = 0;
+  } else if(!dp->restart_count_) {
+    return;
+  } else {
+    // Binary search for the first restart point > key.
+    int64_t lo = 0;
+    int64_t hi = dp->restart_count_;
+    while(lo < hi) {
+      int64_t mid = lo + (hi - lo) / 2;
+      int cmp = -1;
+      if(!key || (dp->compare_record_key(dp->restart_offset(mid), key->strippedkey(), key->strippedkeylen(), &cmp) && cmp <= 0)) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    restart_ = lo ? lo - 1 : 0;
+  }
+  stash_interval(key);
+}
+
+/** Decode restart interval restart_ into stash_, stopping at the first tuple > key. */
+void dataPage::iterator::stash_interval(dataTuple * key) {
+  off_t end = -1;
+  if(dp->index_offset_) {
+    read_offset_ = dp->restart_offset(restart_);
+    if(restart_ + 1 < dp->restart_count_) { end = dp->restart_offset(restart_ + 1); }
+  } else {
+    read_offset_ = dp->data_start_;
+  }
+  dataTuple * t;
+  while(read_offset_ != end && (t = read_next())) {
+    if(key && dataTuple::compare(t->strippedkey(), t->strippedkeylen(), key->strippedkey(), key->strippedkeylen()) > 0) {
+      dataTuple::freetuple(t);
+      break;
+    }
+    stash_.push_back(t);
+  }
+}
+
+dataTuple* dataPage::iterator::read_next() {
   len_t len;
   bool succ;
   if(dp == NULL) { return NULL; }
@@ -387,20 +597,23 @@ dataTuple* dataPage::iterator::getnext() {
   }
   read_offset_ += sizeof(len);
 
-  byte * buf = (byte*)malloc(len);
-  succ = dp->read_data(buf, read_offset_, len);
+  // Read the record's header, then copy the key and data straight into the
+  // tuple, instead of staging them in a temporary buffer.
+  len_t hdr[2];
+  dataTuple *ret = 0;
+  succ = dp->read_data((byte*)hdr, read_offset_, sizeof(hdr));
+  if(succ) {
+    ret = dataTuple::alloc(hdr[0], hdr[1]);
+    succ = dp->read_data(ret->rawkey(), read_offset_ + sizeof(hdr), len - sizeof(hdr));
+  }
 
   // release hacky latch
   unlock(p->rwlatch);
   releasePage(p);
 
-  if(!succ) { read_offset_ -= sizeof(len); free(buf); return NULL; }
+  if(!succ) { read_offset_ -= sizeof(len); if(ret) { dataTuple::freetuple(ret); } return NULL; }
 
   read_offset_ += len;
 
-  dataTuple *ret = dataTuple::from_bytes(buf);
-
-  free(buf);
-
   return ret;
 }
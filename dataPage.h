@@ -21,6 +21,7 @@
 #define DATA_PAGE_H_
 
 #include <limits.h>
+#include <vector>
 
 #include <stasis/page.h>
 #include <stasis/constants.h>
@@ -36,7 +37,14 @@ public:
   {
   private:
     void scan_to_key(dataTuple * key) {
-      if(key) {
+      if(key && dp->index_offset_) {
+        int match;
+        read_offset_ = dp->find_record(key->strippedkey(), key->strippedkeylen(), &match);
+        if(read_offset_ == -1) {
+          DEBUG("datapage key not found.\n");
+          dp = NULL;
+        }
+      } else if(key) {
         len_t old_off = read_offset_;
         dataTuple * t = getnext();
         while(t && dataTuple::compare(key->strippedkey(), key->strippedkeylen(), t->strippedkey(), t->strippedkeylen()) > 0) {
@@ -54,22 +62,46 @@ public:
         }
       }
     }
+    void seek_back(dataTuple * key);
+    void stash_interval(dataTuple * key);
+    dataTuple * read_next();
   public:
-    iterator(dataPage *dp, dataTuple * key=NULL) : read_offset_(0), dp(dp) {
-      scan_to_key(key);
+    /**
+     * If reverse, getnext() returns the tuples <= key in descending order,
+     * and a NULL key starts at the end of the page.  Reverse iterators must
+     * not be copied.
+     */
+    iterator(dataPage *dp, dataTuple * key=NULL, bool reverse=false) : read_offset_(dp ? dp->data_start_ : 0), dp(dp), reverse_(reverse), restart_(-1) {
+      if(reverse) {
+        seek_back(key);
+      } else {
+        scan_to_key(key);
+      }
+    }
+    ~iterator() {
+      for(size_t i = 0; i < stash_.size(); i++) { dataTuple::freetuple(stash_[i]); }
     }
 
     void operator=(const iterator &rhs) {
       this->read_offset_ = rhs.read_offset_;
       this->dp = rhs.dp;
+      this->reverse_ = rhs.reverse_;
+      this->restart_ = rhs.restart_;
+      assert(rhs.stash_.empty());
     }
 
     //returns the next tuple and also advances the iterator
     dataTuple *getnext();
 
   private:
+    friend class dataPage;
     off_t read_offset_;
     dataPage *dp;
+    bool reverse_;
+    // Reverse iterators decode one restart interval at a time (the whole
+    // page if it has no index), and hand its tuples out back to front.
+    int64_t restart_; // the restart interval in stash_.
+    std::vector<dataTuple*> stash_;
   };
 
 public:
@@ -86,18 +118,7 @@ public:
     assert(write_offset_ == -1);
   }
 
-  void writes_done() {
-    if(write_offset_ != -1) {
-      len_t dat_len = 0; // write terminating zero.
-
-      write_data((const byte*)&dat_len, sizeof(dat_len), false);
-
-      // if writing the zero fails, later reads will fail as well, and assume EOF.
-
-      write_offset_ = -1;
-    }
-
-  }
+  void writes_done();
 
   bool append(dataTuple const * dat);
   bool recordRead(const  dataTuple::key_t key, size_t keySize,  dataTuple ** buf);
@@ -108,6 +129,17 @@ public:
 
   pageid_t get_start_pid(){return first_page_;}
   int get_page_count(){return page_count_;}
+  /** @return true if writes_done() indexed this datapage.  Only those know how long they are, and can be copied. */
+  bool has_index(){return index_offset_ != 0;}
+
+  /**
+   * Copy this datapage, page by page, into a new extent from alloc.  The
+   * offsets in a datapage are relative to its first page, so the copy is
+   * readable as is, and the tuples are not decoded.  @return the copy's
+   * first page, or INVALID_PAGE if the datapage has no index, or does not
+   * fit in one of alloc's regions.
+   */
+  pageid_t copy_to(int xid, regionAllocator * alloc);
 
   static void register_stasis_page_impl();
 
@@ -119,6 +151,23 @@ private:
   static const uint16_t DATA_PAGE_SIZE = USABLE_SIZE_OF_PAGE - DATA_PAGE_HEADER_SIZE;
   typedef uint32_t len_t;
 
+  /**
+   * Datapages written by this version start with an index_header, and
+   * writes_done() appends an array of restart points (the offsets of every
+   * RESTART_INTERVAL'th record) after the terminating zero, so that lookups
+   * can binary search instead of decoding every tuple.  Older datapages
+   * start directly with the first record; a record length can never be
+   * INDEX_MAGIC, so they are still readable.
+   */
+  struct index_header {
+    len_t magic;
+    len_t restart_count;
+    int64_t index_offset; // 0 until writes_done() has written the index.
+    int64_t page_count;
+  };
+  static const len_t INDEX_MAGIC = 0xfffffffe;
+  static const int RESTART_INTERVAL = 16;
+
   static inline int32_t* is_another_page_ptr(Page *p) {
       return stasis_page_int32_ptr_from_start(p,0);
   }
@@ -145,6 +194,10 @@ private:
   bool read_data(byte * buf, off_t offset, size_t len);
   bool initialize_next_page();
   void initialize_page(pageid_t pageid);
+  void write_index();
+  len_t compare_record_key(off_t offset, const byte * key, size_t keylen, int * cmp);
+  off_t restart_offset(int64_t i);
+  off_t find_record(const byte * key, size_t keylen, int * match);
 
   int xid_;
   pageid_t page_count_;
@@ -152,5 +205,10 @@ private:
   regionAllocator *alloc_;
   const pageid_t first_page_;
   off_t write_offset_; // points to the next free byte (ignoring page boundaries)
+  off_t data_start_; // offset of the first record
+  off_t index_offset_; // offset of the restart points, or 0 for a linear scan
+  len_t restart_count_;
+  int64_t record_count_; // appended so far
+  std::vector<int64_t> restarts_; // not yet written by writes_done()
 };
 #endif
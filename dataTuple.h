@@ -139,6 +139,10 @@ public:
     static int compare_obj(const dataTuple * a, const dataTuple* b) {
       return compare(a->strippedkey(), a->strippedkeylen(), b->strippedkey(), b->strippedkeylen());
     }
+    /** compare_obj() for descending scans. */
+    static int compare_obj_desc(const dataTuple * a, const dataTuple* b) {
+      return compare_obj(b, a);
+    }
 
     inline void setDelete() {
 		datalen_ = DELETE;
@@ -164,6 +168,19 @@ public:
         return create(rawkey(), rawkeylen(), data(), datalen_);
     }
 
+    //length of the in-memory representation, including the dataTuple header.
+    size_t mem_length() const {
+        return sizeof(dataTuple) + length_from_header(rawkeylen(), datalen_);
+    }
+    //deep copy into buf, which must be at least mem_length() bytes long.  (for custom allocators)
+    dataTuple* copy_to(void * buf) const {
+        dataTuple *ret = (dataTuple*)buf;
+        memcpy(ret->rawkey(), rawkey(), length_from_header(rawkeylen(), datalen_));
+        ret->data_ = ret->rawkey() + rawkeylen();
+        ret->datalen_ = datalen_;
+        return ret;
+    }
+
 
     static dataTuple* create(const void* key, len_t keylen) {
       return create(key, keylen, 0, DELETE);
@@ -195,6 +212,13 @@ public:
     }
 
     //format of buf: key _ data.  The caller needs to 'peel' off key length and data length for this call.
+    //allocate a tuple with an uninitialized key and data.  The caller fills them in through rawkey().
+    static dataTuple* alloc(len_t keylen, len_t datalen) {
+    	dataTuple *dt = (dataTuple*) malloc(sizeof(dataTuple) + length_from_header(keylen,datalen));
+    	dt->datalen_ = datalen;
+    	dt->data_ = dt->rawkey() + keylen;
+    	return dt;
+    }
     static dataTuple* from_bytes(len_t keylen, len_t datalen, byte* buf) {
     	dataTuple *dt = (dataTuple*) malloc(sizeof(dataTuple) + length_from_header(keylen,datalen));
     	dt->datalen_ = datalen;
@@ -213,6 +237,20 @@ public:
     	return dt->sanity_check();
     }
 
+    //length of the in-memory representation of a tuple serialized by to_bytes().
+    static size_t mem_length_from_bytes(const byte* buf) {
+      return sizeof(dataTuple) + length_from_header(((const len_t*)buf)[0], ((const len_t*)buf)[1]);
+    }
+    //like from_bytes(), but decodes into mem, which must be at least mem_length_from_bytes() bytes long.  (for custom allocators)
+    static dataTuple* from_bytes_to(void * mem, const byte* buf) {
+      len_t keylen = ((const len_t*)buf)[0];
+      dataTuple *dt = (dataTuple*)mem;
+      dt->datalen_ = ((const len_t*)buf)[1];
+      memcpy(dt->rawkey(), ((const len_t*)buf)+2, length_from_header(keylen, dt->datalen_));
+      dt->data_ = dt->rawkey() + keylen;
+      return dt->sanity_check();
+    }
+
     static inline void freetuple(dataTuple* dt) {
         free(dt);
     }
@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <math.h>
 #include <ctype.h>
+#include <algorithm>
 
 #include "mergeScheduler.h"
 #include "diskTreeComponent.h"
@@ -53,12 +54,53 @@ recordid diskTreeComponent::get_internal_node_allocator_rid() { return ltree->ge
 
 
 void diskTreeComponent::force(int xid) {
+  if(bloom_filter && owns_bloom_filter && bloom_pid == INVALID_PAGE) {
+    // The component is complete; save the filter alongside it, so openTable() does not have to rebuild it.
+    bloom_pid = bloom_filter->write(xid, ltree->get_datapage_alloc());
+  }
   ltree->get_datapage_alloc()->force_regions(xid);
   ltree->get_internal_node_alloc()->force_regions(xid);
 }
 void diskTreeComponent::dealloc(int xid) {
   ltree->get_datapage_alloc()->dealloc_regions(xid);
   ltree->get_internal_node_alloc()->dealloc_regions(xid);
+  if(dead_ranges_rid.size != NULLRID.size) {
+    Tdealloc(xid, dead_ranges_rid);
+    dead_ranges_rid = NULLRID;
+  }
+}
+
+void diskTreeComponent::dealloc(int xid, diskTreeComponent * heir, std::vector<pageid_t> linked) {
+  std::sort(linked.begin(), linked.end());
+  ltree->get_datapage_alloc()->dealloc_regions(xid, heir->ltree->get_datapage_alloc(), linked);
+  ltree->get_internal_node_alloc()->dealloc_regions(xid);
+  if(dead_ranges_rid.size != NULLRID.size) {
+    Tdealloc(xid, dead_ranges_rid);
+    dead_ranges_rid = NULLRID;
+  }
+}
+
+void diskTreeComponent::load_dead_ranges(int xid) {
+  if(dead_ranges_rid.size == NULLRID.size) { return; }
+  byte * buf = (byte*)malloc(dead_ranges_rid.size);
+  Tread(xid, dead_ranges_rid, buf);
+  dead_ranges.unmarshal(buf, dead_ranges_rid.size);
+  free(buf);
+}
+
+recordid diskTreeComponent::persist_dead_ranges(int xid) {
+  if(dead_ranges.empty()) { return dead_ranges_rid; }
+  size_t len = dead_ranges.marshalled_length();
+  byte * buf = (byte*)malloc(len);
+  dead_ranges.marshal(buf);
+  if(dead_ranges_rid.size != (int64_t)len) {
+    // ranges are only ever added, so the record only grows.
+    if(dead_ranges_rid.size != NULLRID.size) { Tdealloc(xid, dead_ranges_rid); }
+    dead_ranges_rid = Talloc(xid, len);
+  }
+  Tset(xid, dead_ranges_rid, buf);
+  free(buf);
+  return dead_ranges_rid;
 }
 void diskTreeComponent::list_regions(int xid, pageid_t *internal_node_region_length, pageid_t *internal_node_region_count, pageid_t **internal_node_regions,
           pageid_t *datapage_region_length, pageid_t *datapage_region_count, pageid_t **datapage_regions) {
@@ -67,6 +109,30 @@ void diskTreeComponent::list_regions(int xid, pageid_t *internal_node_region_len
 }
 
 
+diskTreeComponent * diskTreeComponent::open_partition(int xid, pageid_t internal_region_size, pageid_t datapage_region_size) {
+  diskTreeComponent * part = new diskTreeComponent(xid, internal_region_size, datapage_region_size, datapage_size, (mergeStats*)stats);
+  part->bloom_filter = bloom_filter;
+  part->owns_bloom_filter = false;
+  return part;
+}
+
+void diskTreeComponent::append_partition(int xid, diskTreeComponent * part) {
+  assert(!part->dp);
+  internalNodes::iterator * it = new internalNodes::iterator(xid, part->ltree->get_internal_node_alloc(), part->ltree->get_root_rec());
+  while(it->next()) {
+    byte * key;
+    pageid_t * pid;
+    size_t keylen = it->key(&key);
+    it->value((byte**)&pid);
+    ltree->appendPage(xid, key, keylen, *pid);
+  }
+  it->close();
+  delete it;
+  ltree->get_datapage_alloc()->adopt_regions(xid, part->ltree->get_datapage_alloc());
+  part->ltree->get_internal_node_alloc()->dealloc_regions(xid);
+  delete part;
+}
+
 void diskTreeComponent::writes_done() {
   if(dp) {
     ((mergeStats*)stats)->wrote_datapage(dp);
@@ -79,7 +145,7 @@ void diskTreeComponent::writes_done() {
 int diskTreeComponent::insertTuple(int xid, dataTuple *t)
 {
   if(bloom_filter) {
-    stasis_bloom_filter_insert(bloom_filter, (const char*)t->strippedkey(), t->strippedkeylen());
+    bloom_filter->insert(t->strippedkey(), t->strippedkeylen());
   }
   int ret = 0; // no error.
   if(dp==0) {
@@ -96,6 +162,76 @@ int diskTreeComponent::insertTuple(int xid, dataTuple *t)
   return ret;
 }
 
+bool diskTreeComponent::append_datapage(int xid, dataPage * dp, const std::vector<dataTuple*> & tuples) {
+  writes_done(); // the next insertTuple() starts a new datapage after this one.
+  pageid_t pid = dp->copy_to(xid, ltree->get_datapage_alloc());
+  if(pid == INVALID_PAGE) { return false; }
+  ltree->appendPage(xid, tuples[0]->strippedkey(), tuples[0]->strippedkeylen(), pid);
+  if(bloom_filter) {
+    for(size_t i = 0; i < tuples.size(); i++) {
+      bloom_filter->insert(tuples[i]->strippedkey(), tuples[i]->strippedkeylen());
+    }
+  }
+  ((mergeStats*)stats)->copied_datapage(dp);
+  return true;
+}
+
+void diskTreeComponent::link_datapages(int xid, diskTreeComponent * src, dataTuple * start, dataTuple * end,
+                                       std::vector<pageid_t> * linked, int64_t * tuple_count, pageid_t * byte_count) {
+  writes_done(); // the next insertTuple() starts a new datapage after these.
+  regionAllocator ro_alloc; // our own filehandle; other partitions may be linking src's datapages, too.
+  internalNodes::iterator * it = start
+      ? new internalNodes::iterator(xid, &ro_alloc, src->ltree->get_root_rec(), start->strippedkey(), start->strippedkeylen())
+      : new internalNodes::iterator(xid, &ro_alloc, src->ltree->get_root_rec());
+  while(it->next()) {
+    byte * key;
+    pageid_t * pid;
+    size_t keylen = it->key(&key);
+    it->value((byte**)&pid);
+    if(start && dataTuple::compare(key, keylen, start->strippedkey(), start->strippedkeylen()) < 0) { continue; }
+    if(end && dataTuple::compare(key, keylen, end->strippedkey(), end->strippedkeylen()) >= 0) { break; }
+    ltree->appendPage(xid, key, keylen, *pid);
+    linked->push_back(*pid);
+
+    dataPage * dp = new dataPage(xid, &ro_alloc, *pid);
+    dataPage::iterator itr(dp->begin());
+    dataTuple * t;
+    while((t = itr.getnext())) {
+      if(bloom_filter) {
+        bloom_filter->insert(t->strippedkey(), t->strippedkeylen());
+      }
+      (*tuple_count)++;
+      *byte_count += t->byte_length();
+      dataTuple::freetuple(t);
+    }
+    ((mergeStats*)stats)->linked_datapage(dp);
+    delete dp;
+  }
+  it->close();
+  delete it;
+}
+
+void diskTreeComponent::list_datapages(int xid, dataTuple * start, dataTuple * end,
+                                       std::vector<std::pair<pageid_t, pageid_t> > * pages) {
+  regionAllocator ro_alloc;
+  internalNodes::iterator * it = start
+      ? new internalNodes::iterator(xid, &ro_alloc, ltree->get_root_rec(), start->strippedkey(), start->strippedkeylen())
+      : new internalNodes::iterator(xid, &ro_alloc, ltree->get_root_rec());
+  while(it->next()) {
+    byte * key;
+    pageid_t * pid;
+    size_t keylen = it->key(&key);
+    it->value((byte**)&pid);
+    if(start && dataTuple::compare(key, keylen, start->strippedkey(), start->strippedkeylen()) < 0) { continue; }
+    if(end && dataTuple::compare(key, keylen, end->strippedkey(), end->strippedkeylen()) >= 0) { break; }
+    dataPage * dp = new dataPage(xid, &ro_alloc, *pid);
+    pages->push_back(std::make_pair(*pid, (pageid_t)dp->get_page_count()));
+    delete dp;
+  }
+  it->close();
+  delete it;
+}
+
 dataPage* diskTreeComponent::insertDataPage(int xid, dataTuple *tuple) {
     //create a new data page -- either the last region is full, or the last data page doesn't want our tuple.  (or both)
 
@@ -135,7 +271,7 @@ dataTuple * diskTreeComponent::findTuple(int xid, dataTuple::key_t key, size_t k
     dataTuple * tup=0;
 
     if(bloom_filter) {
-      if(!stasis_bloom_filter_lookup(bloom_filter, (const char*)key, keySize)) {
+      if(!bloom_filter->lookup(key, keySize)) {
         return NULL;
       }
     }
@@ -152,6 +288,37 @@ dataTuple * diskTreeComponent::findTuple(int xid, dataTuple::key_t key, size_t k
     return tup;
 }
 
+void diskTreeComponent::findTuples(int xid, dataTuple ** keys, int n, dataTuple ** results) {
+  std::vector<int> todo;
+  std::vector<const byte*> todo_keys;
+  std::vector<size_t> todo_sizes;
+  for(int i = 0; i < n; i++) {
+    if(results[i]) { continue; }
+    if(bloom_filter && !bloom_filter->lookup(keys[i]->strippedkey(), keys[i]->strippedkeylen())) { continue; }
+    todo.push_back(i);
+    todo_keys.push_back(keys[i]->strippedkey());
+    todo_sizes.push_back(keys[i]->strippedkeylen());
+  }
+  if(todo.empty()) { return; }
+
+  std::vector<pageid_t> pids(todo.size());
+  ltree->findPages(xid, &todo_keys[0], &todo_sizes[0], todo.size(), &pids[0]);
+
+  // The keys are sorted, so keys that share a datapage are adjacent.
+  dataPage * dp = 0;
+  for(size_t i = 0; i < todo.size(); i++) {
+    if(pids[i] == -1) { continue; }
+    if(!dp || dp->get_start_pid() != pids[i]) {
+      delete dp;
+      dp = new dataPage(xid, 0, pids[i]);
+    }
+    dataTuple * tup = 0;
+    dp->recordRead((dataTuple::key_t)todo_keys[i], todo_sizes[i], &tup);
+    results[todo[i]] = tup;
+  }
+  delete dp;
+}
+
 recordid diskTreeComponent::internalNodes::create(int xid) {
 
   pageid_t root = internal_node_alloc->alloc_extent(xid, 1);
@@ -621,6 +788,36 @@ pageid_t diskTreeComponent::internalNodes::lookupLeafPageFromRid(int xid, record
   return pid;
 }
 
+/**
+ * @return the last slot in [lo-1, numslots) whose key is <= key.  This is
+ * lo-1 if every slot from lo on is > key.  The slots are appended in key
+ * order, so this is a binary search.  Caller must hold node's latch.
+ */
+slotid_t diskTreeComponent::internalNodes::find_slot(int xid, Page *node, slotid_t lo, slotid_t numslots,
+                                                     const byte *key, size_t keySize) {
+  // Everything below lo is <= key; everything at or above hi is > key.
+  slotid_t hi = numslots;
+  recordid rid;
+  rid.page = node->id;
+  while(lo < hi) {
+    rid.slot = lo + (hi - lo) / 2;
+    rid.size = stasis_record_length_read(xid, node, rid);
+
+    const indexnode_rec *rec = (const indexnode_rec*)stasis_record_read_begin(xid,node,rid);
+    int cmpval = dataTuple::compare((dataTuple::key_t) (rec+1), rid.size-sizeof(*rec),
+                                    (dataTuple::key_t) key, keySize);
+    stasis_record_read_done(xid,node,rid,(const byte*)rec);
+
+    // key of current node is too big; there can be no matches under it.
+    if(cmpval>0) {
+      hi = rid.slot;
+    } else {
+      lo = rid.slot + 1;
+    }
+  }
+  return lo - 1;
+}
+
 recordid diskTreeComponent::internalNodes::lookup(int xid,
                             Page *node,
                             int64_t depth,
@@ -636,25 +833,9 @@ recordid diskTreeComponent::internalNodes::lookup(int xid,
   }
   assert(numslots > FIRST_SLOT);
 
-  // don't need to compare w/ first item in tree, since we need to position ourselves at the the max tree value <= key.
-  // positioning at FIRST_SLOT puts us "before" the first value
-  int match = FIRST_SLOT; // (so match is now < key)
+  int match = find_slot(xid, node, FIRST_SLOT+1, numslots, key, keySize);
   recordid rid;
   rid.page = node->id;
-  rid.size = 0;
-  for(rid.slot = FIRST_SLOT+1; rid.slot < numslots; rid.slot++) {
-    rid.size = stasis_record_length_read(xid, node, rid);
-
-    const indexnode_rec *rec = (const indexnode_rec*)stasis_record_read_begin(xid,node,rid);
-    int cmpval = dataTuple::compare((dataTuple::key_t) (rec+1), rid.size-sizeof(*rec),
-                                    (dataTuple::key_t) key, keySize);
-    stasis_record_read_done(xid,node,rid,(const byte*)rec);
-
-    // key of current node is too big; there can be no matches under it.
-    if(cmpval>0) break;
-
-    match = rid.slot; // only increment match after comparing with the current node.
-  }
   rid.slot = match;
   rid.size = 0;
 
@@ -676,6 +857,125 @@ recordid diskTreeComponent::internalNodes::lookup(int xid,
   }
 }
 
+/** Batched version of lookup().  keys must be sorted.  Fills in the leaf page of each key, like findPage(). */
+void diskTreeComponent::internalNodes::lookup_batch(int xid, Page *node, int64_t depth,
+                                                    const byte * const *keys, const size_t *keySizes,
+                                                    int n, pageid_t *pids) {
+  readlock(node->rwlatch,0);
+  slotid_t numslots = stasis_record_last(xid, node).slot + 1;
+
+  if(numslots == FIRST_SLOT) {
+    unlock(node->rwlatch);
+    for(int i = 0; i < n; i++) { pids[i] = -1; }
+    return;
+  }
+  assert(numslots > FIRST_SLOT);
+
+  struct child_range { pageid_t child_id; int start; int count; };
+  std::vector<child_range> children;
+
+  recordid rid;
+  rid.page = node->id;
+  rid.size = 0;
+  slotid_t lo = FIRST_SLOT+1;
+  for(int i = 0; i < n; i++) {
+    // the keys are sorted, so each search can start where the last one left off.
+    slotid_t match = find_slot(xid, node, lo, numslots, keys[i], keySizes[i]);
+    if(i && match + 1 == lo) {
+      if(depth) { children.back().count++; } else { pids[i] = pids[i-1]; }
+      continue;
+    }
+    lo = match + 1;
+    rid.slot = match;
+    const indexnode_rec* nr = (const indexnode_rec*)stasis_record_read_begin(xid, node, rid);
+    pageid_t ptr = nr->ptr;
+    stasis_record_read_done(xid, node, rid, (const byte*)nr);
+    if(depth) {
+      child_range c = { ptr, i, 1 };
+      children.push_back(c);
+    } else {
+      pids[i] = ptr;
+    }
+  }
+  unlock(node->rwlatch);
+
+  for(size_t i = 0; i < children.size(); i++) {
+    Page* child_page = loadPage(xid, children[i].child_id);
+    lookup_batch(xid, child_page, depth-1, keys + children[i].start, keySizes + children[i].start,
+                 children[i].count, pids + children[i].start);
+    releasePage(child_page);
+  }
+}
+
+void diskTreeComponent::internalNodes::findPages(int xid, const byte * const *keys, const size_t *keySizes,
+                                                 int n, pageid_t *pids) {
+  if(!n) { return; }
+  Page *p = loadPage(xid, root_rec.page);
+
+  recordid depth_rid = {p->id, DEPTH, 0};
+  readlock(p->rwlatch,0);
+  const int64_t * depthp = (const int64_t*)stasis_record_read_begin(xid, p, depth_rid);
+  int64_t depth = *depthp;
+  stasis_record_read_done(xid, p, depth_rid, (const byte*)depthp);
+  unlock(p->rwlatch);
+
+  lookup_batch(xid, p, depth, keys, keySizes, n, pids);
+  releasePage(p);
+}
+
+std::vector<dataTuple*> diskTreeComponent::internalNodes::split_keys(int xid, int n) {
+  std::vector<dataTuple*> ret;
+  if(n < 2) { return ret; }
+
+  Page *p = loadPage(xid, root_rec.page);
+  recordid depth_rid = {p->id, DEPTH, 0};
+  readlock(p->rwlatch,0);
+  const int64_t * depthp = (const int64_t*)stasis_record_read_begin(xid, p, depth_rid);
+  int64_t depth = *depthp;
+  stasis_record_read_done(xid, p, depth_rid, (const byte*)depthp);
+  unlock(p->rwlatch);
+  releasePage(p);
+
+  // Walk down one level at a time until there are enough keys.  Every level
+  // above that one has fewer than n keys, so this reads fewer than n pages
+  // per level.
+  std::vector<pageid_t> level(1, root_rec.page);
+  std::vector<dataTuple*> keys;
+  while(true) {
+    std::vector<pageid_t> children;
+    for(size_t i = 0; i < keys.size(); i++) { dataTuple::freetuple(keys[i]); }
+    keys.clear();
+    for(size_t i = 0; i < level.size(); i++) {
+      Page *node = loadPage(xid, level[i]);
+      readlock(node->rwlatch,0);
+      slotid_t numslots = stasis_record_last(xid, node).slot + 1;
+      for(slotid_t slot = FIRST_SLOT; slot < numslots; slot++) {
+        recordid rid = {node->id, slot, 0};
+        rid.size = stasis_record_length_read(xid, node, rid);
+        const indexnode_rec *nr = (const indexnode_rec*)stasis_record_read_begin(xid, node, rid);
+        keys.push_back(dataTuple::create((const byte*)(nr+1), rid.size - sizeof(indexnode_rec)));
+        children.push_back(nr->ptr);
+        stasis_record_read_done(xid, node, rid, (const byte*)nr);
+      }
+      unlock(node->rwlatch);
+      releasePage(node);
+    }
+    if((int)keys.size() >= n || depth == 0) { break; }
+    level.swap(children);
+    depth--;
+  }
+
+  // keys[0] is the smallest key in the tree, so it never splits anything.
+  for(int i = 1; i < n; i++) {
+    size_t idx = (i * keys.size()) / n;
+    if(idx == 0) { continue; }
+    if(!ret.empty() && !dataTuple::compare_obj(ret.back(), keys[idx])) { continue; }
+    ret.push_back(keys[idx]->create_copy());
+  }
+  for(size_t i = 0; i < keys.size(); i++) { dataTuple::freetuple(keys[i]); }
+  return ret;
+}
+
 void diskTreeComponent::internalNodes::print_tree(int xid) {
   Page *p = loadPage(xid, root_rec.page);
   readlock(p->rwlatch,0);
@@ -752,7 +1052,7 @@ void diskTreeComponent::internalNodes::print_tree(int xid, pageid_t pid, int64_t
 //diskTreeComponentIterator implementation
 /////////////////////////////////////////////////
 
-diskTreeComponent::internalNodes::iterator::iterator(int xid, regionAllocator* ro_alloc, recordid root) {
+diskTreeComponent::internalNodes::iterator::iterator(int xid, regionAllocator* ro_alloc, recordid root, bool reverse) {
   ro_alloc_ = ro_alloc;
   if(root.page == 0 && root.slot == 0 && root.size == -1) abort();
   p = ro_alloc_->load_page(xid,root.page);
@@ -774,7 +1074,8 @@ diskTreeComponent::internalNodes::iterator::iterator(int xid, regionAllocator* r
   // and reacquire the latches if need be.
   if(!justOnePage) unlock(p->rwlatch);
 
-  pageid_t leafid = diskTreeComponent::internalNodes::findFirstLeaf(xid, p, depth);
+  pageid_t leafid = reverse ? diskTreeComponent::internalNodes::findLastLeaf(xid, p, depth)
+                            : diskTreeComponent::internalNodes::findFirstLeaf(xid, p, depth);
   if(leafid != root.page) {
 
     releasePage(p);
@@ -796,9 +1097,13 @@ diskTreeComponent::internalNodes::iterator::iterator(int xid, regionAllocator* r
   done = false;
   t = 0;
   if(!justOnePage) readlock(p->rwlatch,0);
+  if(reverse) {
+    // Position just after the last slot; prev() will step back onto it.
+    current.slot = stasis_record_last(xid, p).slot + 1;
+  }
 }
 
-diskTreeComponent::internalNodes::iterator::iterator(int xid, regionAllocator* ro_alloc, recordid root, const byte* key, len_t keylen) {
+diskTreeComponent::internalNodes::iterator::iterator(int xid, regionAllocator* ro_alloc, recordid root, const byte* key, len_t keylen, bool reverse) {
   if(root.page == NULLRID.page && root.slot == NULLRID.slot) abort();
   ro_alloc_ = ro_alloc;
   p = ro_alloc_->load_page(xid,root.page);
@@ -837,6 +1142,7 @@ diskTreeComponent::internalNodes::iterator::iterator(int xid, regionAllocator* r
     done = false;
     current.page = lsm_entry_rid.page;
     current.slot = lsm_entry_rid.slot-1;  // this is current rid, which is one less than the first thing next will return (so subtract 1)
+    if(reverse) { current.slot = lsm_entry_rid.slot+1; } // ... or one more than the first thing prev will return.
     current.size = lsm_entry_rid.size;
 
     xid_ = xid;
@@ -883,6 +1189,48 @@ int diskTreeComponent::internalNodes::iterator::next()
 
   }
 
+  return copy_current();
+}
+
+/**
+ * move to the previous page
+ **/
+int diskTreeComponent::internalNodes::iterator::prev()
+{
+  if(done) return 0;
+
+  if(current.slot > diskTreeComponent::internalNodes::FIRST_SLOT) {
+    current.slot--;
+    current.size = stasis_record_length_read(xid_, p, current);
+  } else {
+    pageid_t prev_rec = -1;
+    if(!justOnePage) {
+      recordid prev_leaf_rid = {p->id, diskTreeComponent::internalNodes::PREV_LEAF,0};
+      const indexnode_rec *nr = (const indexnode_rec*)stasis_record_read_begin(xid_, p, prev_leaf_rid);
+      prev_rec = nr->ptr;
+      stasis_record_read_done(xid_,p,prev_leaf_rid,(const byte*)nr);
+    }
+
+    unlock(p->rwlatch);
+    releasePage(p);
+
+    if(prev_rec != -1) {
+      p = ro_alloc_->load_page(xid_, prev_rec);
+      readlock(p->rwlatch,0);
+      current = stasis_record_last(xid_, p);
+      current.size = stasis_record_length_read(xid_, p, current);
+    } else {
+      p = 0;
+      current.size = INVALID_SLOT;
+    }
+  }
+
+  return copy_current();
+}
+
+/** Copy the record at current into t.  @return 0 if we ran off the end of the tree. */
+int diskTreeComponent::internalNodes::iterator::copy_current()
+{
   if(current.size != INVALID_SLOT) {
     if(t != NULL) { free(t); t = NULL; }
 
@@ -923,30 +1271,40 @@ void diskTreeComponent::iterator::init_iterators(dataTuple * key1, dataTuple * k
         lsmIterator_ = NULL;
     } else {
         if(key1) {
-            lsmIterator_ = new diskTreeComponent::internalNodes::iterator(-1, ro_alloc_, tree_, key1->strippedkey(), key1->strippedkeylen());
+            lsmIterator_ = new diskTreeComponent::internalNodes::iterator(-1, ro_alloc_, tree_, key1->strippedkey(), key1->strippedkeylen(), reverse_);
         } else {
-            lsmIterator_ = new diskTreeComponent::internalNodes::iterator(-1, ro_alloc_, tree_);
+            lsmIterator_ = new diskTreeComponent::internalNodes::iterator(-1, ro_alloc_, tree_, reverse_);
         }
     }
   }
 
-diskTreeComponent::iterator::iterator(diskTreeComponent::internalNodes *tree, mergeManager * mgr, double target_progress_delta, bool * flushing) :
+diskTreeComponent::iterator::iterator(diskTreeComponent::internalNodes *tree, mergeManager * mgr, double target_progress_delta, bool * flushing, rangeTombstones * dead, int level) :
     ro_alloc_(new regionAllocator()),
     tree_(tree ? tree->get_root_rec() : NULLRID),
     mgr_(mgr),
     target_progress_delta_(target_progress_delta),
-    flushing_(flushing)
+    flushing_(flushing),
+    level_(level),
+    dead_(dead),
+    reverse_(false),
+    fresh_page_(false),
+    at_page_start_(false)
 {
     init_iterators(NULL, NULL);
     init_helper(NULL);
 }
 
-diskTreeComponent::iterator::iterator(diskTreeComponent::internalNodes *tree, dataTuple* key) :
+diskTreeComponent::iterator::iterator(diskTreeComponent::internalNodes *tree, dataTuple* key, mergeManager * mgr, double target_progress_delta, bool * flushing, rangeTombstones * dead, bool reverse, int level) :
     ro_alloc_(new regionAllocator()),
     tree_(tree ? tree->get_root_rec() : NULLRID),
-    mgr_(NULL),
-    target_progress_delta_(0.0),
-    flushing_(NULL)
+    mgr_(mgr),
+    target_progress_delta_(target_progress_delta),
+    flushing_(flushing),
+    level_(level),
+    dead_(dead),
+    reverse_(reverse),
+    fresh_page_(false),
+    at_page_start_(false)
 {
     init_iterators(key,NULL);
     init_helper(key);
@@ -959,12 +1317,30 @@ diskTreeComponent::iterator::~iterator() {
       delete lsmIterator_;
   }
 
+  delete dp_itr; // a reverse dp_itr holds tuples.
   delete curr_page;
   curr_page = 0;
 
   delete ro_alloc_;
 }
 
+void diskTreeComponent::iterator::seek(dataTuple * key) {
+  if(lsmIterator_) {
+      lsmIterator_->close();
+      delete lsmIterator_;
+      lsmIterator_ = NULL;
+  }
+  delete dp_itr;
+  dp_itr = 0;
+  delete curr_page;
+  curr_page = 0;
+
+  if(key) {
+    init_iterators(key, NULL);
+    init_helper(key);
+  }
+}
+
 void diskTreeComponent::iterator::init_helper(dataTuple* key1)
 {
     if(!lsmIterator_)
@@ -975,7 +1351,7 @@ void diskTreeComponent::iterator::init_helper(dataTuple* key1)
     }
     else
     {
-        if(lsmIterator_->next() == 0)
+        if(next_page() == 0)
         {
             DEBUG("diskTreeIterator:\t__error__ init_helper():\tlogtreeIteratr::next returned 0." );
             curr_page = 0;
@@ -991,13 +1367,40 @@ void diskTreeComponent::iterator::init_helper(dataTuple* key1)
             curr_page = new dataPage(-1, ro_alloc_, curr_pageid);
 
             DEBUG("opening datapage iterator %lld at key %s\n.", curr_pageid, key1 ? (char*)key1->key() : "NULL");
-            dp_itr = new DPITR_T(curr_page, key1);
+            dp_itr = new DPITR_T(curr_page, key1, reverse_);
+            fresh_page_ = !key1 && !reverse_;
         }
 
     }
 }
 
 dataTuple * diskTreeComponent::iterator::next_callerFrees()
+{
+    dataTuple * readTuple = next_helper();
+    // Skip over anything dropRange() deleted, a whole range at a time.
+    dataTuple * end;
+    dataTuple * start;
+    while(readTuple && dead_ && reverse_ && dead_->covers(readTuple, NULL, &start)) {
+        dataTuple::freetuple(readTuple);
+        seek(start);
+        readTuple = next_helper();
+        if(readTuple && !dataTuple::compare_obj(readTuple, start)) {
+            // seek() is inclusive, so it lands on start, which is dead too.
+            dataTuple::freetuple(readTuple);
+            readTuple = next_helper();
+        }
+        dataTuple::freetuple(start);
+    }
+    while(readTuple && dead_ && !reverse_ && dead_->covers(readTuple, &end)) {
+        dataTuple::freetuple(readTuple);
+        seek(end); // NULL: the range is unbounded, so we are done.
+        if(end) { dataTuple::freetuple(end); }
+        readTuple = next_helper();
+    }
+    return readTuple;
+}
+
+dataTuple * diskTreeComponent::iterator::next_helper()
 {
     if(!this->lsmIterator_) { return NULL; }
 
@@ -1005,45 +1408,83 @@ dataTuple * diskTreeComponent::iterator::next_callerFrees()
         return 0;
 
     dataTuple* readTuple = dp_itr->getnext();
-
+    at_page_start_ = readTuple && fresh_page_;
+    fresh_page_ = false;
 
     if(!readTuple)
     {
-        delete dp_itr;
-        dp_itr = 0;
-        delete curr_page;
-        curr_page = 0;
-
-        if(lsmIterator_->next())
+        if(open_next_page())
         {
-            pageid_t *pid_tmp;
-
-            pageid_t **hack = &pid_tmp;
-            size_t ret = lsmIterator_->value((byte**)hack);
-            assert(ret == sizeof(pageid_t));
-            curr_pageid = *pid_tmp;
-            curr_page = new dataPage(-1, ro_alloc_, curr_pageid);
-            DEBUG("opening datapage iterator %lld at beginning\n.", curr_pageid);
-            dp_itr = new DPITR_T(curr_page->begin());
-
-
             readTuple = dp_itr->getnext();
             assert(readTuple);
+            at_page_start_ = fresh_page_;
+            fresh_page_ = false;
         }
       // else readTuple is null.  We're done.
     }
 
     if(readTuple && mgr_) {
-      // c1_c2_progress_delta() is c1's out progress - c2's in progress.  We want to stop processing c2 if we are too far ahead (ie; c2 >> c1; delta << 0).
-      while(mgr_->c1_c2_progress_delta() < -target_progress_delta_ && ((!flushing_) || (! *flushing_))) {  // TODO: how to pick this threshold?
-        DEBUG("Input is too far behind.  Delta is %f\n", mgr_->c1_c2_progress_delta());
+      // progress_delta(1) is c1's out progress - c2's in progress.  We want to stop processing c2 if we are too far ahead (ie; c2 >> c1; delta << 0).
+      while(mgr_->progress_delta(level_) < -target_progress_delta_ && ((!flushing_) || (! *flushing_))) {  // TODO: how to pick this threshold?
+        DEBUG("Input is too far behind.  Delta is %f\n", mgr_->progress_delta(level_));
         struct timespec ts;
         mergeManager::double_to_ts(&ts, 0.01);
         nanosleep(&ts, 0);
-        mgr_->update_progress(mgr_->get_merge_stats(1), 0);
+        mgr_->update_progress(mgr_->get_merge_stats(level_), 0);
       }
     }
 
     return readTuple;
 }
 
+bool diskTreeComponent::iterator::open_next_page()
+{
+    delete dp_itr;
+    dp_itr = 0;
+    delete curr_page;
+    curr_page = 0;
+
+    if(!next_page()) { return false; }
+
+    pageid_t *pid_tmp;
+
+    pageid_t **hack = &pid_tmp;
+    size_t ret = lsmIterator_->value((byte**)hack);
+    assert(ret == sizeof(pageid_t));
+    curr_pageid = *pid_tmp;
+    curr_page = new dataPage(-1, ro_alloc_, curr_pageid);
+    DEBUG("opening datapage iterator %lld at beginning\n.", curr_pageid);
+    dp_itr = reverse_ ? new DPITR_T(curr_page, NULL, true) : new DPITR_T(curr_page->begin());
+    fresh_page_ = !reverse_;
+    return true;
+}
+
+dataPage * diskTreeComponent::iterator::take_page(dataTuple * bound, bool live_only, std::vector<dataTuple*> * tuples)
+{
+    if(!at_page_start_ || !curr_page->has_index()) { return NULL; }
+    if(bound) {
+        // Check the last tuple first; that only decodes one restart interval.
+        DPITR_T last_itr(curr_page, NULL, true);
+        dataTuple * last = last_itr.getnext();
+        bool before = last && dataTuple::compare_obj(last, bound) < 0;
+        if(last) { dataTuple::freetuple(last); }
+        if(!before) { return NULL; }
+    }
+    DPITR_T itr(curr_page->begin());
+    dataTuple * t;
+    bool ok = true;
+    while(ok && (t = itr.getnext())) {
+        tuples->push_back(t);
+        ok = !(live_only && t->isDelete()) && !(dead_ && dead_->covers(t));
+    }
+    if(!ok) {
+        for(size_t i = 0; i < tuples->size(); i++) { dataTuple::freetuple((*tuples)[i]); }
+        tuples->clear();
+        return NULL;
+    }
+    dataPage * ret = curr_page;
+    curr_page = 0;
+    open_next_page(); // at the end, this leaves dp_itr NULL, so next_helper() returns NULL.
+    at_page_start_ = false;
+    return ret;
+}
@@ -25,18 +25,10 @@
 #include "dataPage.h"
 #include "dataTuple.h"
 #include "mergeStats.h"
-#include <stasis/util/bloomFilter.h>
-#include <stasis/util/crc32.h>
+#include "bloomFilter.h"
+#include "rangeTombstones.h"
+#include <vector>
 
-extern "C" {
-  static uint64_t diskTreeComponent_hash_func_a(const char* a, int len) {
-    return stasis_crc32(a,len,0xcafebabe);
-  }
-
-  static uint64_t diskTreeComponent_hash_func_b(const char* a, int len) {
-    return stasis_crc32(a,len,0xdeadbeef);
-  }
-}
 class diskTreeComponent {
  public:
   class internalNodes;
@@ -48,24 +40,31 @@ class diskTreeComponent {
     dp(0),
     datapage_size(datapage_size),
     stats(stats),
+    bloom_pid(INVALID_PAGE),
+    owns_bloom_filter(true),
+    dead_ranges_rid(NULLRID),
     bloom_filter(bloom_filter_size == 0
                 ? 0
-                : stasis_bloom_filter_create(diskTreeComponent_hash_func_a,
-                                      diskTreeComponent_hash_func_b,
-                                      bloom_filter_size, 0.01))  {
-    if(bloom_filter) stasis_bloom_filter_print_stats(bloom_filter);
+                : new bloomFilter(bloom_filter_size, 0.01))  {
+    if(bloom_filter) bloom_filter->print_stats();
   }
 
   diskTreeComponent(int xid, recordid root, recordid internal_node_state,
-                    recordid datapage_state, mergeStats* stats) :
+                    recordid datapage_state, mergeStats* stats, pageid_t bloom_pid = INVALID_PAGE,
+                    recordid dead_ranges_rid = NULLRID) :
     ltree(new diskTreeComponent::internalNodes(xid, root, internal_node_state, datapage_state)),
     dp(0),
     datapage_size(-1),
     stats(stats),
-    bloom_filter(0) {}
+    bloom_pid(bloom_pid),
+    owns_bloom_filter(true),
+    dead_ranges_rid(dead_ranges_rid),
+    bloom_filter(bloomFilter::open(xid, bloom_pid)) {
+    load_dead_ranges(xid);
+  }
 
   ~diskTreeComponent() {
-    if(bloom_filter) stasis_bloom_filter_destroy(bloom_filter);
+    if(owns_bloom_filter) delete bloom_filter;
     delete dp;
     delete ltree;
   }
@@ -73,25 +72,92 @@ class diskTreeComponent {
   recordid get_root_rid();
   recordid get_datapage_allocator_rid();
   recordid get_internal_node_allocator_rid();
+  /** @return where force() wrote the bloom filter, or INVALID_PAGE. */
+  pageid_t get_bloom_filter_pid() { return bloom_pid; }
+  /** @return the number of tuples in this component, or -1 if it was recovered without a bloom filter. */
+  int64_t get_tuple_count() { return bloom_filter ? (int64_t)bloom_filter->num_items() : -1; }
   internalNodes * get_internal_nodes() { return ltree; }
+  /** The ranges of this component that bLSM::dropRange() has deleted.  Iterators skip them. */
+  rangeTombstones * get_dead_ranges() { return &dead_ranges; }
+  /** Write get_dead_ranges() to the store.  @return where, or NULLRID if there are none. */
+  recordid persist_dead_ranges(int xid);
   dataTuple* findTuple(int xid, dataTuple::key_t key, size_t keySize);
+  /**
+   * Look up a sorted batch of keys.  Fills in results[i] for each key that
+   * is in this component, skipping keys whose result is already non-NULL.
+   */
+  void findTuples(int xid, dataTuple ** keys, int n, dataTuple ** results);
   int insertTuple(int xid, dataTuple *t);
+  /**
+   * Append a copy of dp, a complete datapage of another component, without
+   * re-encoding its tuples.  tuples are dp's tuples, in order; their keys go
+   * into the bloom filter.  Everything already in this component must come
+   * before them.  @return false, and leave this component alone, if dp
+   * cannot be copied (see dataPage::copy_to()).
+   */
+  bool append_datapage(int xid, dataPage * dp, const std::vector<dataTuple*> & tuples);
+  /**
+   * Index src's datapages whose first keys are in [start, end) (NULL bounds
+   * are unbounded) where they are, without copying them.  Their keys go into
+   * the bloom filter.  Everything already in this component must come before
+   * them.  Appends the datapages' ids to *linked, and adds their tuple and
+   * byte counts to *tuple_count and *byte_count.  src must be deallocated
+   * with dealloc(xid, heir, linked), where heir is this component (or the
+   * one it was opened from with open_partition()).
+   */
+  void link_datapages(int xid, diskTreeComponent * src, dataTuple * start, dataTuple * end,
+                      std::vector<pageid_t> * linked, int64_t * tuple_count, pageid_t * byte_count);
+  /**
+   * Append the first page and page count of each of our datapages whose
+   * first keys are in [start, end) to *pages; these are the datapages that
+   * link_datapages() would link.
+   */
+  void list_datapages(int xid, dataTuple * start, dataTuple * end,
+                      std::vector<std::pair<pageid_t, pageid_t> > * pages);
   void writes_done();
 
+  /**
+   * Create an empty component that builds one key range of this one, so
+   * that several threads can write this component at once.  Partitions
+   * add their keys to this component's bloom filter.  Once a partition's
+   * writes are done, hand it back with append_partition().
+   */
+  diskTreeComponent * open_partition(int xid, pageid_t internal_region_size, pageid_t datapage_region_size);
+  /**
+   * Index part's datapages, and take over the regions that hold them.  part
+   * must come after everything already in this component, and is deleted.
+   */
+  void append_partition(int xid, diskTreeComponent * part);
+  /** @return up to n-1 keys that split this component into n similarly sized ranges.  The caller frees them. */
+  std::vector<dataTuple*> get_split_keys(int xid, int n) {
+    return ltree->split_keys(xid, n);
+  }
 
-  iterator * open_iterator(mergeManager * mgr = NULL, double target_size = 0, bool * flushing = NULL) {
-    return new iterator(ltree, mgr, target_size, flushing);
+
+  /**
+   * If mgr is set, this is the small input of the merge into C(level+1), and
+   * it waits for the merge into C(level) to catch up when it gets too far
+   * ahead; see mergeManager::progress_delta().
+   */
+  iterator * open_iterator(mergeManager * mgr = NULL, double target_size = 0, bool * flushing = NULL, int level = 1) {
+    return new iterator(ltree, mgr, target_size, flushing, &dead_ranges, level);
   }
-  iterator * open_iterator(dataTuple * key) {
+  iterator * open_iterator(dataTuple * key, mergeManager * mgr = NULL, double target_size = 0, bool * flushing = NULL, int level = 1) {
     if(key != NULL) {
-      return new iterator(ltree, key);
+      return new iterator(ltree, key, mgr, target_size, flushing, &dead_ranges, false, level);
     } else {
-      return new iterator(ltree);
+      return new iterator(ltree, mgr, target_size, flushing, &dead_ranges, level);
     }
   }
+  /** @return an iterator over the tuples <= key, in descending order.  A NULL key starts at the end. */
+  iterator * open_reverse_iterator(dataTuple * key = NULL) {
+    return new iterator(ltree, key, NULL, 0, NULL, &dead_ranges, true);
+  }
 
   void force(int xid);
   void dealloc(int xid);
+  /** Like dealloc(), but heir takes over the regions that hold the datapages heir linked; see link_datapages(). */
+  void dealloc(int xid, diskTreeComponent * heir, std::vector<pageid_t> linked);
   void list_regions(int xid, pageid_t *internal_node_region_length, pageid_t *internal_node_region_count, pageid_t **internal_node_regions,
 		    pageid_t *datapage_region_length, pageid_t *datapage_region_count, pageid_t **datapage_regions);
 
@@ -101,11 +167,16 @@ class diskTreeComponent {
 
  private:
   dataPage* insertDataPage(int xid, dataTuple *tuple);
+  void load_dead_ranges(int xid);
 
   internalNodes * ltree;
   dataPage* dp;
   pageid_t datapage_size;
   /*mergeManager::mergeStats*/ void *stats; // XXX hack to work around circular includes.
+  pageid_t bloom_pid;
+  bool owns_bloom_filter; // false for partitions, which share their parent's filter.
+  rangeTombstones dead_ranges;
+  recordid dead_ranges_rid;
 
  public:
   class internalNodes{
@@ -118,9 +189,13 @@ class diskTreeComponent {
 
     //returns the id of the data page that could contain the given key
     pageid_t findPage(int xid, const byte *key, size_t keySize);
+    //findPage() for a sorted batch of keys; visits each internal node at most once
+    void findPages(int xid, const byte * const *keys, const size_t *keySizes, int n, pageid_t *pids);
 
     //appends a leaf page, val_page is the id of the leaf page
     recordid appendPage(int xid, const byte *key,size_t keySize, pageid_t val_page);
+    //returns up to n-1 evenly spaced separator keys from the highest level of the tree that has n of them
+    std::vector<dataTuple*> split_keys(int xid, int n);
 
     inline regionAllocator* get_datapage_alloc() { return datapage_alloc; }
     inline regionAllocator* get_internal_node_alloc() { return internal_node_alloc; }
@@ -156,6 +231,10 @@ class diskTreeComponent {
     //returns a record that stores the pageid where the given key should be in, i.e. if it exists
     static recordid lookup(int xid, Page *node, int64_t depth, const byte *key,
                            size_t keySize);
+    static void lookup_batch(int xid, Page *node, int64_t depth, const byte * const *keys,
+                             const size_t *keySizes, int n, pageid_t *pids);
+    static slotid_t find_slot(int xid, Page *node, slotid_t lo, slotid_t numslots,
+                              const byte *key, size_t keySize);
 
     const static int64_t DEPTH;
     const static int64_t COMPARATOR;
@@ -178,9 +257,11 @@ class diskTreeComponent {
   public:
     class iterator {
     public:
-      iterator(int xid, regionAllocator *ro_alloc, recordid root);
-      iterator(int xid, regionAllocator *ro_alloc, recordid root, const byte* key, len_t keylen);
+      /** If reverse, start after the last leaf entry (the one that covers key), and move with prev(). */
+      iterator(int xid, regionAllocator *ro_alloc, recordid root, bool reverse = false);
+      iterator(int xid, regionAllocator *ro_alloc, recordid root, const byte* key, len_t keylen, bool reverse = false);
       int next();
+      int prev();
       void close();
 
       inline size_t key (byte **key) {
@@ -197,6 +278,8 @@ class diskTreeComponent {
       inline void releaseLock() { }
 
     private:
+      int copy_current();
+
       regionAllocator * ro_alloc_;
       Page * p;
       int xid_;
@@ -208,23 +291,40 @@ class diskTreeComponent {
     };
   };
 
-  stasis_bloom_filter_t * bloom_filter;
+  bloomFilter * bloom_filter;
 
   class iterator
   {
 
   public:
-      explicit iterator(diskTreeComponent::internalNodes *tree, mergeManager * mgr = NULL, double target_size = 0, bool * flushing = NULL);
+      explicit iterator(diskTreeComponent::internalNodes *tree, mergeManager * mgr = NULL, double target_size = 0, bool * flushing = NULL, rangeTombstones * dead = NULL, int level = 1);
 
-      explicit iterator(diskTreeComponent::internalNodes *tree,dataTuple *key);
+      /** If reverse, return the tuples <= key in descending order; a NULL key starts at the end. */
+      explicit iterator(diskTreeComponent::internalNodes *tree,dataTuple *key, mergeManager * mgr = NULL, double target_size = 0, bool * flushing = NULL, rangeTombstones * dead = NULL, bool reverse = false, int level = 1);
 
       ~iterator();
 
       dataTuple * next_callerFrees();
 
+      /**
+       * For merges that copy whole datapages.  If the tuple next_callerFrees()
+       * last returned is the first one of an indexed datapage, and all of the
+       * datapage's tuples are live and come before bound (NULL: no bound),
+       * move past the datapage, and @return it, along with its tuples.  The
+       * caller frees both.  Tombstones count as live unless live_only is set.
+       * Otherwise, @return NULL and leave the iterator alone.
+       */
+      dataPage * take_page(dataTuple * bound, bool live_only, std::vector<dataTuple*> * tuples);
+
   private:
     void init_iterators(dataTuple * key1, dataTuple * key2);
     inline void init_helper(dataTuple * key1);
+    dataTuple * next_helper();
+    /** Close the current datapage, and open the next one (if any) at its start. */
+    bool open_next_page();
+    /** Reposition the iterator at the first tuple >= key (the last tuple <= key, if reverse_). */
+    void seek(dataTuple * key);
+    int next_page() { return reverse_ ? lsmIterator_->prev() : lsmIterator_->next(); }
 
     explicit iterator() { abort(); }
     void operator=(iterator & t) { abort(); }
@@ -235,6 +335,11 @@ class diskTreeComponent {
     mergeManager * mgr_;
     double   target_progress_delta_;
     bool * flushing_;
+    int level_;          // see open_iterator().
+    rangeTombstones * dead_;
+    bool reverse_;
+    bool fresh_page_;    // dp_itr is at the start of curr_page.
+    bool at_page_start_; // the last tuple we returned was the first one of curr_page.
 
     diskTreeComponent::internalNodes::iterator* lsmIterator_;
 
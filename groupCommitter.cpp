@@ -0,0 +1,117 @@
+/*
+ * groupCommitter.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "groupCommitter.h"
+#include "mergeManager.h"
+#include <sys/time.h>
+
+groupCommitter::groupCommitter(stasis_log_t * log) :
+  log_(log),
+  running_(true),
+  requested_lsn_(0),
+  durable_lsn_(0),
+  waiting_(0),
+  expected_group_(1.0),
+  last_force_secs_(0.0),
+  num_forces_(0),
+  num_commits_(0) {
+  pthread_mutex_init(&mut_, 0);
+  pthread_cond_init(&work_cond_, 0);
+  pthread_cond_init(&done_cond_, 0);
+  pthread_create(&thread_, 0, log_thread, this);
+}
+
+groupCommitter::~groupCommitter() {
+  pthread_mutex_lock(&mut_);
+  running_ = false;
+  pthread_cond_signal(&work_cond_);
+  pthread_mutex_unlock(&mut_);
+  pthread_join(thread_, 0);
+
+  pthread_mutex_destroy(&mut_);
+  pthread_cond_destroy(&work_cond_);
+  pthread_cond_destroy(&done_cond_);
+}
+
+void groupCommitter::wait_durable(lsn_t lsn) {
+  pthread_mutex_lock(&mut_);
+  num_commits_++;
+  if(lsn > requested_lsn_) { requested_lsn_ = lsn; }
+  waiting_++;
+  pthread_cond_signal(&work_cond_);
+  while(durable_lsn_ < lsn) {
+    pthread_cond_wait(&done_cond_, &mut_);
+  }
+  waiting_--;
+  pthread_mutex_unlock(&mut_);
+}
+
+void groupCommitter::request_force(lsn_t lsn) {
+  pthread_mutex_lock(&mut_);
+  if(lsn > requested_lsn_) {
+    requested_lsn_ = lsn;
+    pthread_cond_signal(&work_cond_);
+  }
+  pthread_mutex_unlock(&mut_);
+}
+
+void * groupCommitter::log_thread(void * arg) {
+  ((groupCommitter*)arg)->run();
+  return 0;
+}
+
+void groupCommitter::run() {
+  pthread_mutex_lock(&mut_);
+  while(true) {
+    while(running_ && requested_lsn_ <= durable_lsn_) {
+      pthread_cond_wait(&work_cond_, &mut_);
+    }
+    if(requested_lsn_ <= durable_lsn_) { break; } // shutting down, and nothing left to force.
+
+    // If recent groups were large, give the rest of this one a chance to
+    // arrive.  The wait is bounded by the cost of the force it saves.
+    if(running_ && waiting_ && waiting_ < expected_group_ - 0.5) {
+      struct timeval now;
+      gettimeofday(&now, 0);
+      struct timespec deadline;
+      mergeManager::double_to_ts(&deadline, mergeManager::tv_to_double(&now) + last_force_secs_ / 2);
+      while(running_ && waiting_ < expected_group_ - 0.5) {
+        if(pthread_cond_timedwait(&work_cond_, &mut_, &deadline)) { break; }
+      }
+    }
+
+    lsn_t target = requested_lsn_;
+    int group = waiting_;
+    pthread_mutex_unlock(&mut_);
+
+    // Every entry up to target was written before its LSN was handed to us,
+    // so this covers all of them (and possibly some later ones).
+    struct timeval start, done;
+    gettimeofday(&start, 0);
+    log_->force_tail(log_, LOG_FORCE_COMMIT);
+    gettimeofday(&done, 0);
+
+    pthread_mutex_lock(&mut_);
+    num_forces_++;
+    if(target > durable_lsn_) { durable_lsn_ = target; }
+    last_force_secs_ = mergeManager::tv_to_double(&done) - mergeManager::tv_to_double(&start);
+    expected_group_ = 0.75 * expected_group_ + 0.25 * (group ? group : 1);
+    pthread_cond_broadcast(&done_cond_);
+  }
+  pthread_mutex_unlock(&mut_);
+}
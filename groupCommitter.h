@@ -0,0 +1,77 @@
+/*
+ * groupCommitter.h
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef GROUPCOMMITTER_H_
+#define GROUPCOMMITTER_H_
+
+#include <pthread.h>
+#include <stasis/common.h>
+#include <stasis/logger/logger2.h>
+
+/**
+ * Group commit for bLSM's write-ahead log.
+ *
+ * Writers append their log entries as usual, then hand the entry's LSN to
+ * the committer.  A single log thread forces the log on behalf of everyone
+ * that is waiting, so N concurrent writers share one fsync instead of
+ * paying for N of them.
+ *
+ * Groups size themselves: while a force is in flight, new writers pile up
+ * behind it and are covered by the next one.  Under heavy load, the thread
+ * also holds a force back (for at most half as long as the last one took)
+ * until about as many writers as last time have shown up.
+ */
+class groupCommitter {
+public:
+  groupCommitter(stasis_log_t * log);
+  /** Forces anything that has been handed to the committer, then stops the log thread. */
+  ~groupCommitter();
+
+  /** Block until the log has been forced through lsn. */
+  void wait_durable(lsn_t lsn);
+  /** Ask the log thread to force through lsn, but do not wait for it. */
+  void request_force(lsn_t lsn);
+
+  uint64_t num_forces() { return num_forces_; }
+  uint64_t num_commits() { return num_commits_; }
+
+private:
+  groupCommitter(const groupCommitter&);
+  void operator=(const groupCommitter&);
+
+  static void * log_thread(void * arg);
+  void run();
+
+  stasis_log_t * log_;
+  pthread_t thread_;
+  pthread_mutex_t mut_;
+  pthread_cond_t work_cond_; // signalled when a writer wants a force.
+  pthread_cond_t done_cond_; // broadcast after each force.
+  bool running_;
+
+  lsn_t requested_lsn_; // the largest LSN anyone has asked to have forced.
+  lsn_t durable_lsn_;   // everything up to here is on disk.
+  int waiting_;         // writers blocked in wait_durable().
+  double expected_group_; // moving average of the number of writers covered by a force.
+  double last_force_secs_;
+
+  uint64_t num_forces_;
+  uint64_t num_commits_;
+};
+
+#endif /* GROUPCOMMITTER_H_ */
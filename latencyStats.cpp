@@ -0,0 +1,117 @@
+/*
+ * latencyStats.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "latencyStats.h"
+#include <pthread.h>
+#include <time.h>
+#include <vector>
+
+// Shards are never freed, so that the history of threads that have exited
+// stays in the report.
+static pthread_mutex_t shards_mut = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<void*> shards;
+static __thread void * thread_shard = 0;
+
+uint64_t latencyStats::now_usec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int latencyStats::bucket_of(uint64_t usec) {
+  if(usec < (uint64_t)SUB_BUCKETS) { return usec; }
+  if(usec >> MAX_VALUE_BITS) { return NUM_BUCKETS - 1; }
+  int shift = (63 - __builtin_clzll(usec)) - SUB_BUCKET_BITS;
+  return (shift + 1) * SUB_BUCKETS + (int)((usec >> shift) - SUB_BUCKETS);
+}
+
+uint64_t latencyStats::bucket_max(int bucket) {
+  if(bucket < SUB_BUCKETS) { return bucket; }
+  int shift = bucket / SUB_BUCKETS - 1;
+  uint64_t lower = (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+  return lower + (1ULL << shift) - 1;
+}
+
+latencyStats::shard * latencyStats::my_shard() {
+  if(!thread_shard) {
+    shard * s = new shard;
+    for(int i = 0; i < NUM_METRICS; i++) {
+      s->buckets[i].store(0);
+      s->max[i].store(0);
+    }
+    pthread_mutex_lock(&shards_mut);
+    shards.push_back(s);
+    pthread_mutex_unlock(&shards_mut);
+    thread_shard = s;
+  }
+  return (shard*)thread_shard;
+}
+
+void latencyStats::record(int metric, uint64_t usec) {
+  shard * s = my_shard();
+  std::atomic<uint64_t> * b = s->buckets[metric].load(std::memory_order_relaxed);
+  if(!b) {
+    b = new std::atomic<uint64_t>[NUM_BUCKETS];
+    for(int i = 0; i < NUM_BUCKETS; i++) { b[i].store(0, std::memory_order_relaxed); }
+    s->buckets[metric].store(b, std::memory_order_release);
+  }
+  // This thread is the only writer, so load + store is enough.
+  std::atomic<uint64_t> & c = b[bucket_of(usec)];
+  c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  if(usec > s->max[metric].load(std::memory_order_relaxed)) {
+    s->max[metric].store(usec, std::memory_order_relaxed);
+  }
+}
+
+latencyStats::summary latencyStats::summarize(int metric) {
+  std::vector<uint64_t> counts(NUM_BUCKETS, 0);
+  summary ret = { 0, 0, 0, 0, 0 };
+
+  pthread_mutex_lock(&shards_mut);
+  for(size_t i = 0; i < shards.size(); i++) {
+    shard * s = (shard*)shards[i];
+    std::atomic<uint64_t> * b = s->buckets[metric].load(std::memory_order_acquire);
+    if(!b) { continue; }
+    for(int j = 0; j < NUM_BUCKETS; j++) {
+      uint64_t c = b[j].load(std::memory_order_relaxed);
+      counts[j] += c;
+      ret.count += c;
+    }
+    uint64_t m = s->max[metric].load(std::memory_order_relaxed);
+    if(m > ret.max) { ret.max = m; }
+  }
+  pthread_mutex_unlock(&shards_mut);
+
+  if(!ret.count) { return ret; }
+  // The smallest value with at least 50% (99%, 99.9%) of the samples at or below it.
+  uint64_t rank50  = (ret.count * 500 + 999) / 1000;
+  uint64_t rank99  = (ret.count * 990 + 999) / 1000;
+  uint64_t rank999 = (ret.count * 999 + 999) / 1000;
+  uint64_t seen = 0;
+  bool have50 = false, have99 = false;
+  for(int j = 0; j < NUM_BUCKETS; j++) {
+    if(!counts[j]) { continue; }
+    seen += counts[j];
+    uint64_t v = bucket_max(j);
+    if(v > ret.max) { v = ret.max; }
+    if(!have50 && seen >= rank50) { ret.p50 = v; have50 = true; }
+    if(!have99 && seen >= rank99) { ret.p99 = v; have99 = true; }
+    if(seen >= rank999) { ret.p999 = v; break; }
+  }
+  return ret;
+}
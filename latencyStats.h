@@ -0,0 +1,86 @@
+/*
+ * latencyStats.h
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef LATENCYSTATS_H_
+#define LATENCYSTATS_H_
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * Process-wide latency histograms, reported through OP_STAT_PERF_REPORT.
+ *
+ * Buckets are log-linear, as in HdrHistogram: each power of two
+ * microseconds is split into SUB_BUCKETS linear buckets, so a reported
+ * percentile is at most 1/SUB_BUCKETS above the true value.
+ *
+ * Each thread records into its own shard with plain (relaxed) loads and
+ * stores; there are no locks or atomic read-modify-writes on the recording
+ * path.  summarize() adds the shards up on demand, so its answers are
+ * approximate while threads are recording.
+ */
+class latencyStats {
+public:
+  enum {
+    C0_BACKPRESSURE,     // writers sleeping in mergeManager::tick() because C0 is too full.
+    C1_BACKPRESSURE,     // the C0-C1 merge sleeping in tick() because the C1-C2 merge is behind.
+    DISK_BACKPRESSURE,   // a merge into C2 or below sleeping in tick() because the next merge down is behind.
+    FLUSH_STALL,         // flushTable() waiting for the previous C0-C1 merge.
+    FIRST_REQUEST_METRIC, // the native server records each opcode under FIRST_REQUEST_METRIC + opcode.
+    NUM_METRICS = FIRST_REQUEST_METRIC + 64
+  };
+
+  struct summary {
+    uint64_t count;
+    uint64_t p50;  // in microseconds, as are the rest.
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+  };
+
+  static uint64_t now_usec();
+  static void record(int metric, uint64_t usec);
+  static summary summarize(int metric);
+
+private:
+  static const int SUB_BUCKET_BITS = 4;
+  static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const int MAX_VALUE_BITS = 40; // about 12 days; longer values are clamped.
+  static const int NUM_BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  struct shard {
+    std::atomic<std::atomic<uint64_t>*> buckets[NUM_METRICS]; // allocated on first use.
+    std::atomic<uint64_t> max[NUM_METRICS];
+  };
+
+  static int bucket_of(uint64_t usec);
+  static uint64_t bucket_max(int bucket);
+  static shard * my_shard();
+};
+
+/** Records the time between its construction and destruction. */
+class latencyTimer {
+public:
+  explicit latencyTimer(int metric) : metric_(metric), start_(latencyStats::now_usec()) { }
+  ~latencyTimer() { latencyStats::record(metric_, latencyStats::now_usec() - start_); }
+private:
+  int metric_;
+  uint64_t start_;
+};
+
+#endif /* LATENCYSTATS_H_ */
@@ -19,7 +19,18 @@
 #include "memTreeComponent.h"
 #include "dataTuple.h"
 
+memTreeComponent::rbtree_ptr_t memTreeComponent::createTree() {
+    return new rbtree_t(dataTuple(), arenaAllocator::stl_allocator<dataTuple*>(new arenaAllocator));
+}
+
 void memTreeComponent::tearDownTree(rbtree_ptr_t tree) {
+    arenaAllocator * arena = get_arena(tree);
+    if(arena) {
+        // the tuples live in the arena, so we can free them all at once.
+        delete tree;
+        delete arena;
+        return;
+    }
     dataTuple * t = 0;
     rbtree_t::iterator old;
     for(rbtree_t::iterator delitr  = tree->begin();
@@ -39,3 +50,7 @@ void memTreeComponent::tearDownTree(rbtree_ptr_t tree) {
 	}
     delete tree;
 }
+
+void memTreeComponent::tearDownTree(skiplist_ptr_t tree) {
+    delete tree;  // frees any tuples still in the list, along with its arena.
+}
@@ -22,14 +22,23 @@
 #include <assert.h>
 #include <mergeStats.h>
 #include <stasis/util/stlslab.h>
+#include "concurrentSkiplist.h"
 
 class memTreeComponent {
 public:
 //  typedef std::set<datatuple*, datatuple, stlslab<datatuple*> > rbtree_t;
-  typedef std::set<dataTuple*, dataTuple> rbtree_t;
+  typedef std::set<dataTuple*, dataTuple, arenaAllocator::stl_allocator<dataTuple*> > rbtree_t;
   typedef rbtree_t* rbtree_ptr_t;
+  // Lock-free alternative to rbtree_t; used when bLSM is built with concurrent_c0.
+  typedef concurrentSkiplist skiplist_t;
+  typedef skiplist_t* skiplist_ptr_t;
 
+  /** Create a C0 tree whose nodes and tuples live in a new arenaAllocator. */
+  static rbtree_ptr_t createTree();
   static void tearDownTree(rbtree_ptr_t t);
+  static void tearDownTree(skiplist_ptr_t t);
+  /** @return the arena that holds t's nodes and tuples, or NULL if it uses malloc. */
+  static arenaAllocator * get_arena(rbtree_ptr_t t) { return t->get_allocator().arena; }
 
 ///////////////////////////////////////////////////////////////
 // Plain iterator; cannot cope with changes to underlying tree
@@ -43,15 +52,23 @@ public:
   public:
     iterator( rbtree_t *s )
       : first_(true),
-	done_(s == NULL) {
+	done_(s == NULL),
+        reverse_(false) {
       init_iterators(s, NULL, NULL);
     }
 
-    iterator( rbtree_t *s, dataTuple *&key )
-      : first_(true), done_(s == NULL) {
+    /** If reverse, return the tuples <= key in descending order; a NULL key starts at the end. */
+    iterator( rbtree_t *s, dataTuple *&key, bool reverse = false )
+      : first_(true), done_(s == NULL), reverse_(reverse) {
       init_iterators(s, key, NULL);
     }
 
+    /** Return the tuples from key1 to key2, inclusive.  If reverse, key1 is the largest, and they come out in descending order. */
+    iterator( rbtree_t *s, dataTuple *key1, dataTuple *key2, bool reverse )
+      : first_(true), done_(s == NULL), reverse_(reverse) {
+      init_iterators(s, key1, key2);
+    }
+
     ~iterator() {
       delete it_;
       delete itend_;
@@ -59,6 +76,12 @@ public:
 
     dataTuple* next_callerFrees() {
       if(done_) { return NULL; }
+      if(reverse_) {
+        // it_ is one past the tuple we return next.
+        if(*it_ == *itend_) { done_ = true; return NULL; }
+        (*it_)--;
+        return (*(*it_))->create_copy();
+      }
       if(first_) { first_ = 0;} else { (*it_)++; }
       if(*it_==*itend_) { done_= true; return NULL; }
 
@@ -68,7 +91,15 @@ public:
 
   private:
     void init_iterators(rbtree_t * s, dataTuple * key1, dataTuple * key2) {
-      if(s) {
+      if(s && key1 && key2 && (reverse_ ? dataTuple::compare_obj(key1, key2) < 0 : dataTuple::compare_obj(key1, key2) > 0)) {
+        // Empty range; the iterators below would walk past each other.
+        it_    = new MTITER(s->end());
+        itend_ = new MTITER(s->end());
+        done_ = true;
+      } else if(s && reverse_) {
+        it_    = key1 ? new MTITER(s->upper_bound(key1)) : new MTITER(s->end());
+        itend_ = key2 ? new MTITER(s->lower_bound(key2)) : new MTITER(s->begin());
+      } else if(s) {
         it_    = key1 ? new MTITER(s->lower_bound(key1))  : new MTITER(s->begin());
         itend_ = key2 ? new MTITER(s->upper_bound(key2)) : new MTITER(s->end());
         if(*it_ == *itend_) { done_ = true; }
@@ -90,6 +121,7 @@ public:
   private:
     bool first_;
     bool done_;
+    bool reverse_;
     MTITER *it_;
     MTITER *itend_;
   };
@@ -174,7 +206,7 @@ public:
     typedef rbtree_t::const_iterator MTITER;
 
 
-    void populate_next_ret_impl(std::set<dataTuple*>::iterator/*MTITER*/ it) {
+    void populate_next_ret_impl(MTITER it) {
       num_batched_ = 0;
       cur_off_ = 0;
       while(it != s_->end() && num_batched_ < batch_size_) {
@@ -183,19 +215,59 @@ public:
         it++;
       }
     }
+    void populate_next_ret_impl(rbtree_t::const_reverse_iterator it) {
+      num_batched_ = 0;
+      cur_off_ = 0;
+      while(it != s_->rend() && num_batched_ < batch_size_) {
+        next_ret_[num_batched_] = (*it)->create_copy();
+        num_batched_++;
+        it++;
+      }
+    }
+    void populate_next_ret_impl(skiplist_t::node * n) {
+      num_batched_ = 0;
+      cur_off_ = 0;
+      while(n && num_batched_ < batch_size_) {
+        next_ret_[num_batched_] = skiplist_t::tuple_of(n)->create_copy();
+        num_batched_++;
+        n = sl_->next(n);
+      }
+    }
+    // The skiplist has no back pointers, so each step of a reverse scan is a search.
+    void populate_prev_ret_impl(dataTuple * key, bool include_key) {
+      num_batched_ = 0;
+      cur_off_ = 0;
+      skiplist_t::node * n;
+      while(num_batched_ < batch_size_ && (n = sl_->seek_back(key, include_key))) {
+        key = next_ret_[num_batched_] = skiplist_t::tuple_of(n)->create_copy();
+        include_key = false;
+        num_batched_++;
+      }
+    }
     void populate_next_ret(dataTuple *key=NULL, bool include_key=false) {
       if(cur_off_ == num_batched_) {
         if(mut_) pthread_mutex_lock(mut_);
         if(mgr_) {
           while(mgr_->get_merge_stats(0)->get_current_size() < (0.8 * (double)target_size_) && ! *flushing_) {  // TODO: how to pick this threshold?  Too high, and the disk is idle.  Too low, and we waste ram.
-            pthread_mutex_unlock(mut_);
+            if(mut_) pthread_mutex_unlock(mut_);
             struct timespec ts;
             mergeManager::double_to_ts(&ts, 0.1);
             nanosleep(&ts, 0);
-            pthread_mutex_lock(mut_);
+            if(mut_) pthread_mutex_lock(mut_);
           }
         }
-        if(key) {
+        if(sl_) {
+          skiplist_t::readGuard g(sl_);  // the create_copy() calls have to happen before we drop the guard...
+          if(reverse_) {
+            populate_prev_ret_impl(key, include_key);
+          } else {
+            populate_next_ret_impl(sl_->seek(key, include_key));
+          }
+        } else if(reverse_) {
+          // A reverse_iterator built from it starts at the tuple before it.
+          populate_next_ret_impl(rbtree_t::const_reverse_iterator(
+              key ? (include_key ? s_->upper_bound(key) : s_->lower_bound(key)) : s_->end()));
+        } else if(key) {
           populate_next_ret_impl(include_key ? s_->lower_bound(key) : s_->upper_bound(key));
         } else {
           populate_next_ret_impl(s_->begin());
@@ -205,11 +277,21 @@ public:
     }
 
   public:
-    batchedRevalidatingIterator( rbtree_t *s, mergeManager * mgr, int64_t target_size, bool * flushing, int batch_size, pthread_mutex_t * rb_mut ) : s_(s), mgr_(mgr), target_size_(target_size), flushing_(flushing), batch_size_(batch_size), num_batched_(batch_size), cur_off_(batch_size), mut_(rb_mut) {
+    batchedRevalidatingIterator( rbtree_t *s, mergeManager * mgr, int64_t target_size, bool * flushing, int batch_size, pthread_mutex_t * rb_mut ) : s_(s), sl_(NULL), mgr_(mgr), target_size_(target_size), flushing_(flushing), batch_size_(batch_size), num_batched_(batch_size), cur_off_(batch_size), mut_(rb_mut), reverse_(false) {
+      next_ret_ = (dataTuple**)malloc(sizeof(next_ret_[0]) * batch_size_);
+      populate_next_ret();
+    }
+    /** If reverse, return the tuples <= key in descending order; a NULL key starts at the end. */
+      batchedRevalidatingIterator( rbtree_t *s, int batch_size, pthread_mutex_t * rb_mut, dataTuple *&key, bool reverse = false ) : s_(s), sl_(NULL), mgr_(NULL), target_size_(0), flushing_(0), batch_size_(batch_size), num_batched_(batch_size), cur_off_(batch_size), mut_(rb_mut), reverse_(reverse) {
+      next_ret_ = (dataTuple**)malloc(sizeof(next_ret_[0]) * batch_size_);
+      populate_next_ret(key, true);
+    }
+    // The skiplist variants do not take a mutex; readers are protected by skiplist_t::readGuard.
+    batchedRevalidatingIterator( skiplist_t *s, mergeManager * mgr, int64_t target_size, bool * flushing, int batch_size ) : s_(NULL), sl_(s), mgr_(mgr), target_size_(target_size), flushing_(flushing), batch_size_(batch_size), num_batched_(batch_size), cur_off_(batch_size), mut_(NULL), reverse_(false) {
       next_ret_ = (dataTuple**)malloc(sizeof(next_ret_[0]) * batch_size_);
       populate_next_ret();
     }
-      batchedRevalidatingIterator( rbtree_t *s, int batch_size, pthread_mutex_t * rb_mut, dataTuple *&key ) : s_(s), mgr_(NULL), target_size_(0), flushing_(0), batch_size_(batch_size), num_batched_(batch_size), cur_off_(batch_size), mut_(rb_mut) {
+    batchedRevalidatingIterator( skiplist_t *s, int batch_size, dataTuple *&key, bool reverse = false ) : s_(NULL), sl_(s), mgr_(NULL), target_size_(0), flushing_(0), batch_size_(batch_size), num_batched_(batch_size), cur_off_(batch_size), mut_(NULL), reverse_(reverse) {
       next_ret_ = (dataTuple**)malloc(sizeof(next_ret_[0]) * batch_size_);
       populate_next_ret(key, true);
     }
@@ -235,6 +317,7 @@ public:
     int  operator-(batchedRevalidatingIterator & t) { abort(); }
 
     rbtree_t *s_;
+    skiplist_t *sl_;
     dataTuple ** next_ret_;
     mergeManager * mgr_;
     int64_t target_size_; // the low-water size for the tree.  If cur_size_ is not null, and *cur_size_ < C * target_size_, we sleep.
@@ -243,6 +326,7 @@ public:
     int num_batched_;
     int cur_off_;
     pthread_mutex_t * mut_;
+    bool reverse_;
   };
 
 };
@@ -22,8 +22,10 @@
 #include "mergeManager.h"
 #include "mergeStats.h"
 #include "bLSM.h"
+#include "latencyStats.h"
 #include "math.h"
 #include "time.h"
+#include <algorithm>
 #include <stasis/transactional.h>
 
 #define LEGACY_BACKPRESSURE
@@ -35,6 +37,8 @@ mergeStats* mergeManager:: get_merge_stats(int mergeLevel) {
     return c1;
   } else if(mergeLevel == 2) {
     return c2;
+  } else if(mergeLevel > 2 && mergeLevel - 3 < (int)deep.size()) {
+    return deep[mergeLevel - 3];
   } else {
     abort();
   }
@@ -49,6 +53,9 @@ mergeManager::~mergeManager() {
   delete c0;
   delete c1;
   delete c2;
+  for(size_t i = 0; i < deep.size(); i++) {
+    delete deep[i];
+  }
 }
 
 void mergeManager::new_merge(int mergeLevel) {
@@ -60,8 +67,11 @@ void mergeManager::new_merge(int mergeLevel) {
     c1->target_size = (pageid_t)(*ltable->R() * (double)ltable->mean_c0_run_length);
     assert(c1->target_size);
     s->new_merge2();
-  } else if(s->merge_level == 2) {
-    // target_size is infinity...
+  } else if(s->merge_level >= 2) {
+    // The last level's target_size is infinity...
+    if(s->merge_level < 2 + (int)deep.size()) {
+      s->target_size = (pageid_t)(ltable->get_level_size_ratio(s->merge_level) * (double)get_merge_stats(s->merge_level-1)->target_size);
+    }
     s->new_merge2();
   } else { abort(); }
 #ifdef EXTENDED_STATS
@@ -78,15 +88,16 @@ void mergeManager::set_c0_size(int64_t size) {
   c0->target_size = size;
 }
 void mergeManager::update_progress(mergeStats * s, int delta) {
-  s->delta += delta;
+  // Partitioned C1-C2 merges report progress from several threads.
+  int cur_delta = __sync_add_and_fetch(&s->delta, delta);
 
-  if((!delta) || s->delta > UPDATE_PROGRESS_DELTA) {
+  if((!delta) || cur_delta > UPDATE_PROGRESS_DELTA) {
     rwlc_writelock(ltable->header_mut);
     if(delta) {
       s->delta = 0;
       if(!s->need_tick) { s->need_tick = 1; }
     }
-    if(s->merge_level == 2) {
+    if(s->merge_level >= 2) {
       if(s->active) {
         s->in_progress =  ((double)(s->bytes_in_large + s->bytes_in_small)) / (double)(get_merge_stats(s->merge_level-1)->mergeable_size + s->base_size);
       } else {
@@ -105,6 +116,24 @@ void mergeManager::update_progress(mergeStats * s, int delta) {
     if(s->target_size) {
       if(s->merge_level == 0) {
         s->out_progress = ((double)s->get_current_size()) / (double)ltable->mean_c0_run_length;
+      } else if(s->merge_level == 2 + (int)deep.size()) {
+        // The last level has no target size, and nothing downstream to keep up with.
+        s->out_progress = 0;
+      } else if(s->merge_level >= 2) {
+        // C2 and below.  This is the legacy C1 computation below, with
+        // C(n-1)'s target size standing in for the C0 run length.
+        mergeStats * up = get_merge_stats(s->merge_level - 1);
+        mergeStats * down = get_merge_stats(s->merge_level + 1);
+        int merge_count = (int)ceil(ltable->get_level_size_ratio(s->merge_level)-0.1);
+        int merge_number = up->target_size ? (int)floor(((double)s->base_size)/(double)up->target_size) : 0;
+
+        s->out_progress = ((double)merge_number + s->in_progress) / (double) merge_count;
+
+        if(down->active && s->mergeable_size) {
+          level_deltas[s->merge_level-2] = s->out_progress - down->in_progress;
+        } else {
+          level_deltas[s->merge_level-2] = -0.02;
+        }
       } else {
         // To see what's going on in the following code, consider a
         // system with R = 3 and |C0| = 1.  (R is the number of rounds that a
@@ -367,22 +396,26 @@ void mergeManager::update_progress(mergeStats * s, int delta) {
  * bytes_consumed_by_merger = sum(stats_bytes_in_small_delta)
  */
 void mergeManager::tick(mergeStats * s) {
-  if(s && s->merge_level == 1) { // apply backpressure based on merge progress.
+  if(s && s->merge_level >= 1) { // apply backpressure based on merge progress.
+    if(s->merge_level == 2 + (int)deep.size()) { return; } // the last level has nobody to wait for.
     if(s->need_tick) {
       s->need_tick = 0;
+      mergeStats * down = get_merge_stats(s->merge_level + 1);
       // Only apply back pressure if next thread is not waiting on us.
       rwlc_readlock(ltable->header_mut);
-      if(c1->mergeable_size && c2->active) {
-        if(c1_c2_delta > -0.01) {
-          DEBUG("Input is too far ahead.  Delta is %f\n", c1_c2_delta);
-          double delta = c1_c2_delta;
+      if(s->mergeable_size && down->active) {
+        double delta = progress_delta(s->merge_level);
+        if(delta > -0.01) {
+          DEBUG("Input is too far ahead.  Delta is %f\n", delta);
           rwlc_unlock(ltable->header_mut);
           delta += 0.01; // delta > 0;
           double slp = 0.001 + delta;
           struct timespec sleeptime;
           DEBUG("\ndisk sleeping %0.6f tree_megabytes %0.3f\n", slp, ((double)ltable->tree_bytes)/(1024.0*1024.0));
           double_to_ts(&sleeptime,slp);
+          uint64_t slept_since = latencyStats::now_usec();
           nanosleep(&sleeptime, 0);
+          latencyStats::record(s->merge_level == 1 ? latencyStats::C1_BACKPRESSURE : latencyStats::DISK_BACKPRESSURE, latencyStats::now_usec() - slept_since);
           update_progress(s, 0);
           s->need_tick = 1;
         } else {
@@ -396,12 +429,14 @@ void mergeManager::tick(mergeStats * s) {
     // Simple backpressure algorithm based on how full C0 is.
 
     pageid_t cur_c0_sz;
+    uint64_t stall_start = 0; // only read the clock if we sleep.
     if(s) {
       // Is C0 bigger than is allowed?
       while((cur_c0_sz = s->get_current_size()) > ltable->max_c0_size) {  // can't use s->current_size, since this is the thread that maintains that number...
 	printf("\nMEMORY OVERRUN!!!! SLEEP!!!!\n");
 	struct timespec ts;
 	double_to_ts(&ts, 0.1);
+	if(!stall_start) { stall_start = latencyStats::now_usec(); }
 	nanosleep(&ts, 0);
       }
       // Linear backpressure model
@@ -420,8 +455,12 @@ void mergeManager::tick(mergeStats * s) {
       struct timespec sleeptime;
       double_to_ts(&sleeptime, slp);
       DEBUG("%d Sleep C %f\n", s->merge_level, slp);
+      if(!stall_start) { stall_start = latencyStats::now_usec(); }
       nanosleep(&sleeptime, 0);
     }
+    if(stall_start) {
+      latencyStats::record(latencyStats::C0_BACKPRESSURE, latencyStats::now_usec() - stall_start);
+    }
   }
 }
 
@@ -445,18 +484,18 @@ void mergeManager::read_tuple_from_small_component(int merge_level, dataTuple *
 void mergeManager::read_tuple_from_large_component(int merge_level, int tuple_count, pageid_t byte_len) {
   if(tuple_count) {
     mergeStats * s = get_merge_stats(merge_level);
-    s->num_tuples_in_large += tuple_count;
-    s->bytes_in_large += byte_len;
+    __sync_fetch_and_add(&s->num_tuples_in_large, tuple_count);
+    __sync_fetch_and_add(&s->bytes_in_large, byte_len);
     if(merge_level != 0) {
       update_progress(s, byte_len);
     }
   }
 }
 
-void mergeManager::wrote_tuple(int merge_level, dataTuple * tup) {
+void mergeManager::wrote_tuples(int merge_level, int64_t tuple_count, pageid_t byte_len) {
   mergeStats * s = get_merge_stats(merge_level);
-  (s->num_tuples_out)++;
-  (s->bytes_out) += tup->byte_length();
+  __sync_fetch_and_add(&s->num_tuples_out, tuple_count);
+  __sync_fetch_and_add(&s->bytes_out, byte_len);
 }
 
 void mergeManager::finished_merge(int merge_level) {
@@ -530,15 +569,23 @@ double mergeManager::c1_c2_progress_delta() {
   return c1_c2_delta;
 }
 
+double mergeManager::progress_delta(int level) {
+  return level == 1 ? c1_c2_delta : level_deltas[level-2];
+}
+
 void mergeManager::init_helper(void) {
   struct timeval tv;
   c1_c2_delta = -0.02; // XXX move this magic number somewhere.  It's also in update_progress.
+  level_deltas.assign(deep.size(), -0.02);
   gettimeofday(&tv, 0);
 
 #if EXTENDED_STATS
   double_to_ts(&c0->stats_last_tick, tv_to_double(&tv));
   double_to_ts(&c1->stats_last_tick, tv_to_double(&tv));
   double_to_ts(&c2->stats_last_tick, tv_to_double(&tv));
+  for(size_t i = 0; i < deep.size(); i++) {
+    double_to_ts(&deep[i]->stats_last_tick, tv_to_double(&tv));
+  }
 #endif
   still_running = true;
   pthread_cond_init(&pp_cond, 0);
@@ -552,16 +599,30 @@ mergeManager::mergeManager(bLSM *ltable):
   c0 = new mergeStats(0, ltable ? ltable->max_c0_size : 10000000);
   c1 = new mergeStats(1, (int64_t)(ltable ? ((double)(ltable->max_c0_size) * *ltable->R()) : 100000000.0) );
   c2 = new mergeStats(2, 0);
+  for(int n = 3; ltable && n <= ltable->disk_levels; n++) {
+    deep.push_back(new mergeStats(n, 0));
+  }
   init_helper();
 }
 mergeManager::mergeManager(bLSM *ltable, int xid, recordid rid):
   UPDATE_PROGRESS_PERIOD(0.005),
   ltable(ltable) {
   marshalled_header h;
+  h.deep = NULLRID; // Headers written before there were deep levels are shorter, and leave this alone.
   Tread(xid, rid, &h);
   c0 = new mergeStats(xid, h.c0);
   c1 = new mergeStats(xid, h.c1);
   c2 = new mergeStats(xid, h.c2);
+  if(h.deep.size != NULLRID.size) {
+    std::vector<recordid> rids(h.deep.size / sizeof(recordid));
+    Tread(xid, h.deep, &rids[0]);
+    for(size_t i = 0; i < rids.size(); i++) {
+      deep.push_back(new mergeStats(xid, rids[i]));
+    }
+  }
+  for(int n = 3 + deep.size(); n <= ltable->disk_levels; n++) {
+    deep.push_back(new mergeStats(n, 0));
+  }
   init_helper();
 }
 recordid mergeManager::talloc(int xid) {
@@ -570,15 +631,38 @@ recordid mergeManager::talloc(int xid) {
   h.c0 = c0->talloc(xid);
   h.c1 = c1->talloc(xid);
   h.c2 = c2->talloc(xid);
+  h.deep = NULLRID; // marshal() allocates this.
   Tset(xid, ret, &h);
   return ret;
 }
 void mergeManager::marshal(int xid, recordid rid) {
   marshalled_header h;
+  h.deep = NULLRID;
   Tread(xid, rid, &h);
   c0->marshal(xid, h.c0);
   c1->marshal(xid, h.c1);
   c2->marshal(xid, h.c2);
+  // Headers written before there were deep levels have nowhere to put them;
+  // those levels' statistics start over each time the table is opened.
+  if(deep.empty() || rid.size < (int64_t)sizeof(h)) { return; }
+  std::vector<recordid> rids(deep.size(), NULLRID);
+  if(h.deep.size != NULLRID.size) {
+    // levels are only ever added, so the old array is a prefix of the new one.
+    std::vector<recordid> old(h.deep.size / sizeof(recordid));
+    Tread(xid, h.deep, &old[0]);
+    std::copy(old.begin(), old.end(), rids.begin());
+  }
+  for(size_t i = 0; i < deep.size(); i++) {
+    if(rids[i].size == NULLRID.size) { rids[i] = deep[i]->talloc(xid); }
+    deep[i]->marshal(xid, rids[i]);
+  }
+  size_t len = rids.size() * sizeof(recordid);
+  if(h.deep.size != (int64_t)len) {
+    if(h.deep.size != NULLRID.size) { Tdealloc(xid, h.deep); }
+    h.deep = Talloc(xid, len);
+    Tset(xid, rid, &h);
+  }
+  Tset(xid, h.deep, &rids[0]);
 }
 
 void mergeManager::pretty_print(FILE * out) {
@@ -591,7 +675,7 @@ void mergeManager::pretty_print(FILE * out) {
   bool have_c1m = false;
   bool have_c2  = false;
   if(lt) {
-    have_c0  = NULL != lt->get_tree_c0();
+    have_c0  = NULL != lt->get_tree_c0() || NULL != lt->get_skiplist_c0();
     have_c0m = NULL != lt->get_tree_c0_mergeable();
     have_c1  = NULL != lt->get_tree_c1();
     have_c1m = NULL != lt->get_tree_c1_mergeable() ;
@@ -607,6 +691,12 @@ void mergeManager::pretty_print(FILE * out) {
       have_c1m ? "C1'" : "...",
       c2->active ? "RUN" : "---", 100.0 * c2->in_progress, c2->stats_bps/((double)mb), c2->stats_lifetime_consumed/(((double)mb)*c2->stats_lifetime_elapsed),
       have_c2 ? "C2" : "..");
+  for(size_t i = 0; i < deep.size(); i++) {
+    mergeStats * s = deep[i];
+    fprintf(out, "[%s %3.0f%% ~ %3.0f%% %4.1f (%4.1f)] C%d ",
+        s->active ? "RUN" : "---", 100.0 * s->in_progress, 100.0 * s->out_progress, s->stats_bps/((double)mb), s->stats_lifetime_consumed/(((double)mb)*s->stats_lifetime_elapsed),
+        s->merge_level);
+  }
 #endif
 //#define PP_SIZES
 #ifdef PP_SIZES
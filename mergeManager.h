@@ -26,6 +26,7 @@
 #include <sys/time.h>
 #include <stdio.h>
 #include <dataTuple.h>
+#include <vector>
 
 class bLSM;
 class mergeStats;
@@ -59,6 +60,8 @@ public:
   void set_c0_size(int64_t size);
   void update_progress(mergeStats *s, int delta);
   double c1_c2_progress_delta();
+  /** @return progress_delta(1) is c1_c2_progress_delta(); the others are the same thing for the Cn-C(n+1) merges. */
+  double progress_delta(int level);
 
   void tick(mergeStats * s);
   mergeStats* get_merge_stats(int mergeLevel);
@@ -69,7 +72,10 @@ public:
   }
   void read_tuple_from_large_component(int merge_level, int tuple_count, pageid_t byte_len);
 
-  void wrote_tuple(int merge_level, dataTuple * tup);
+  void wrote_tuple(int merge_level, dataTuple * tup) {
+    wrote_tuples(merge_level, 1, tup->byte_length());
+  }
+  void wrote_tuples(int merge_level, int64_t tuple_count, pageid_t byte_len);
   void pretty_print(FILE * out);
   void *pretty_print_thread();
   void *update_progress_thread();
@@ -86,6 +92,8 @@ private:
    * TODO remove c1_c2_delta, which is derived, but difficult (from a synchronization perspective) to compute?
    */
   double c1_c2_delta;
+  /** level_deltas[n-2] is c1_c2_delta for the C(n-1)-Cn and Cn-C(n+1) mergers, for n >= 2. */
+  std::vector<double> level_deltas;
   /** Helper method for the constructors */
   void init_helper(void);
   /**
@@ -99,6 +107,7 @@ private:
     recordid c0; // Probably redundant, but included for symmetry.
     recordid c1;
     recordid c2;
+    recordid deep; // An array of recordids for C3 and beyond, or NULLRID.
   };
   /**
    * A pointer to the logtable that we manage statistics for.  Most usages of
@@ -110,6 +119,7 @@ private:
   mergeStats * c0;   /// Per-tree component statistics for c0 and c0_mergeable (the latter should always be null...)
   mergeStats * c1;   /// Per-tree component statistics for c1 and c1_mergeable.
   mergeStats * c2;   /// Per-tree component statistics for c2.
+  std::vector<mergeStats*> deep; /// Per-tree component statistics for c3 and beyond (see bLSM::disk_levels).
 
   // The following fields are used to shut down the pretty print thread.
   bool still_running;
@@ -0,0 +1,144 @@
+/*
+ * mergePipeline.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "mergePipeline.h"
+
+mergeWriter::mergeWriter(int xid, diskTreeComponent * out, pageid_t max_bytes) :
+    xid_(xid), out_(out), max_bytes_(max_bytes),
+    queued_bytes_(0), enqueued_(0), written_(0), stop_(false) {
+  if(max_bytes_) {
+    pthread_mutex_init(&mut_, 0);
+    pthread_cond_init(&cond_, 0);
+    pthread_create(&thread_, 0, write_thr, this);
+  }
+}
+
+mergeWriter::~mergeWriter() {
+  if(max_bytes_) {
+    sync();
+    pthread_mutex_lock(&mut_);
+    stop_ = true;
+    pthread_cond_broadcast(&cond_);
+    pthread_mutex_unlock(&mut_);
+    pthread_join(thread_, 0);
+    pthread_cond_destroy(&cond_);
+    pthread_mutex_destroy(&mut_);
+  }
+}
+
+void mergeWriter::insertTuple(dataTuple * t, bool owned) {
+  op * o = new op;
+  o->t = t;
+  o->owned = owned;
+  o->dp = NULL;
+  o->bytes = t->byte_length();
+  enqueue(o);
+}
+
+void mergeWriter::append_datapage(dataPage * dp, std::vector<dataTuple*> * tuples) {
+  op * o = new op;
+  o->t = NULL;
+  o->owned = true;
+  o->dp = dp;
+  o->tuples.swap(*tuples);
+  o->bytes = 0;
+  for(size_t i = 0; i < o->tuples.size(); i++) { o->bytes += o->tuples[i]->byte_length(); }
+  enqueue(o);
+}
+
+void mergeWriter::enqueue(op * o) {
+  if(!max_bytes_) {
+    write(o);
+    return;
+  }
+  pthread_mutex_lock(&mut_);
+  // Always let one op through, however big, so that the writer never waits on an empty queue.
+  while(queued_bytes_ && queued_bytes_ + o->bytes > max_bytes_) {
+    pthread_cond_wait(&cond_, &mut_);
+  }
+  queue_.push_back(o);
+  queued_bytes_ += o->bytes;
+  enqueued_++;
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&mut_);
+}
+
+void mergeWriter::sync() {
+  if(!max_bytes_) { return; }
+  pthread_mutex_lock(&mut_);
+  uint64_t target = enqueued_;
+  while(written_ < target) {
+    pthread_cond_wait(&cond_, &mut_);
+  }
+  pthread_mutex_unlock(&mut_);
+}
+
+void mergeWriter::writes_done() {
+  sync();
+  out_->writes_done();
+}
+
+void * mergeWriter::write_thr(void * arg) {
+  ((mergeWriter*)arg)->write_ops();
+  return 0;
+}
+
+void mergeWriter::write_ops() {
+  std::deque<op*> batch;
+  pthread_mutex_lock(&mut_);
+  while(true) {
+    while(queue_.empty() && !stop_) {
+      pthread_cond_wait(&cond_, &mut_);
+    }
+    if(queue_.empty()) { break; }
+    // Take everything that is queued, so that the merge thread only waits
+    // for the lock once per batch.
+    batch.swap(queue_);
+    pthread_mutex_unlock(&mut_);
+
+    pageid_t bytes = 0;
+    for(size_t i = 0; i < batch.size(); i++) {
+      bytes += batch[i]->bytes;
+      write(batch[i]);
+    }
+    uint64_t n = batch.size();
+    batch.clear();
+
+    pthread_mutex_lock(&mut_);
+    queued_bytes_ -= bytes;
+    written_ += n;
+    pthread_cond_broadcast(&cond_);
+  }
+  pthread_mutex_unlock(&mut_);
+}
+
+void mergeWriter::write(op * o) {
+  if(!o->dp) {
+    out_->insertTuple(xid_, o->t);
+    if(o->owned) { dataTuple::freetuple(o->t); }
+  } else {
+    if(!out_->append_datapage(xid_, o->dp, o->tuples)) {
+      for(size_t i = 0; i < o->tuples.size(); i++) {
+        out_->insertTuple(xid_, o->tuples[i]);
+      }
+    }
+    for(size_t i = 0; i < o->tuples.size(); i++) { dataTuple::freetuple(o->tuples[i]); }
+    delete o->dp;
+  }
+  delete o;
+}
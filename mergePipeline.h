@@ -0,0 +1,258 @@
+/*
+ * mergePipeline.h
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef MERGEPIPELINE_H_
+#define MERGEPIPELINE_H_
+
+#include <assert.h>
+#include <pthread.h>
+#include <deque>
+#include <vector>
+#include "dataTuple.h"
+#include "dataPage.h"
+#include "diskTreeComponent.h"
+
+/**
+ * Reads ahead of one disk input of a merge, on its own thread, so that
+ * the merge thread does not wait for reads, or spend its time decoding
+ * datapages.  The thread decodes whole datapages where it can (see
+ * diskTreeComponent::iterator::take_page()), and queues up to max_bytes
+ * of tuples.  With max_bytes == 0, there is no thread, and calls go
+ * straight to the wrapped iterator.
+ *
+ * ITR is diskTreeComponent::iterator, or something that wraps one.  The
+ * merge must not be reading C0 through it: C0 tuples have to be read when
+ * the merge gets to them.
+ */
+template<class ITR>
+class prefetchIterator {
+public:
+  /** Takes over itr.  live_only is what the merge passes to take_page(). */
+  prefetchIterator(ITR * itr, pageid_t max_bytes, bool live_only) :
+      itr_(itr), max_bytes_(max_bytes), live_only_(live_only),
+      queued_bytes_(0), stop_(false), at_end_(false), page_(NULL), next_rest_(0) {
+    if(max_bytes_) {
+      pthread_mutex_init(&mut_, 0);
+      pthread_cond_init(&cond_, 0);
+      pthread_create(&thread_, 0, prefetch_thr, this);
+    }
+  }
+  ~prefetchIterator() {
+    if(max_bytes_) {
+      pthread_mutex_lock(&mut_);
+      stop_ = true;
+      pthread_cond_broadcast(&cond_);
+      pthread_mutex_unlock(&mut_);
+      pthread_join(thread_, 0);
+      while(!queue_.empty()) {
+        free_item(queue_.front());
+        queue_.pop_front();
+      }
+      if(page_) { free_item(page_); }
+      for(size_t i = next_rest_; i < rest_.size(); i++) { dataTuple::freetuple(rest_[i]); }
+      pthread_cond_destroy(&cond_);
+      pthread_mutex_destroy(&mut_);
+    }
+    delete itr_;
+  }
+
+  dataTuple * next_callerFrees() {
+    if(!max_bytes_) { return itr_->next_callerFrees(); }
+    if(page_) {
+      // The merge did not take the datapage, so hand out the rest of its tuples.
+      rest_.swap(page_->tuples);
+      dataTuple::freetuple(rest_[0]); // the merge already has this one.
+      next_rest_ = 1;
+      delete page_->dp;
+      delete page_;
+      page_ = NULL;
+    }
+    if(next_rest_ < rest_.size()) { return rest_[next_rest_++]; }
+    rest_.clear();
+    next_rest_ = 0;
+    if(at_end_) { return NULL; }
+
+    pthread_mutex_lock(&mut_);
+    while(queue_.empty()) {
+      pthread_cond_wait(&cond_, &mut_);
+    }
+    item * it = queue_.front();
+    queue_.pop_front();
+    queued_bytes_ -= it->bytes;
+    pthread_cond_signal(&cond_);
+    pthread_mutex_unlock(&mut_);
+
+    dataTuple * ret = it->t;
+    if(!ret) { at_end_ = true; }
+    if(it->dp) {
+      page_ = it;
+    } else {
+      delete it;
+    }
+    return ret;
+  }
+
+  /** See diskTreeComponent::iterator::take_page(). */
+  dataPage * take_page(dataTuple * bound, bool live_only, std::vector<dataTuple*> * tuples) {
+    if(!max_bytes_) { return itr_->take_page(bound, live_only, tuples); }
+    if(!page_) { return NULL; }
+    if(bound && dataTuple::compare_obj(page_->tuples.back(), bound) >= 0) { return NULL; }
+    if(live_only && !live_only_) {
+      for(size_t i = 0; i < page_->tuples.size(); i++) {
+        if(page_->tuples[i]->isDelete()) { return NULL; }
+      }
+    }
+    tuples->insert(tuples->end(), page_->tuples.begin(), page_->tuples.end());
+    dataPage * ret = page_->dp;
+    delete page_;
+    page_ = NULL;
+    return ret;
+  }
+
+private:
+  prefetchIterator(const prefetchIterator&);
+  void operator=(const prefetchIterator&);
+
+  /** A tuple, or (if dp is set) the first tuple of a datapage, along with all of the datapage's tuples.  t == NULL is the end. */
+  struct item {
+    dataTuple * t;
+    dataPage * dp;
+    std::vector<dataTuple*> tuples;
+    pageid_t bytes;
+  };
+
+  static void free_item(item * it) {
+    if(it->t) { dataTuple::freetuple(it->t); }
+    for(size_t i = 0; i < it->tuples.size(); i++) { dataTuple::freetuple(it->tuples[i]); }
+    delete it->dp;
+    delete it;
+  }
+
+  static void * prefetch_thr(void * arg) {
+    ((prefetchIterator*)arg)->prefetch();
+    return 0;
+  }
+
+  void prefetch() {
+    while(true) {
+      item * it = new item;
+      it->t = itr_->next_callerFrees();
+      it->dp = it->t ? itr_->take_page(NULL, live_only_, &it->tuples) : NULL;
+      it->bytes = 0;
+      if(it->dp) {
+        for(size_t i = 0; i < it->tuples.size(); i++) { it->bytes += it->tuples[i]->byte_length(); }
+      } else if(it->t) {
+        it->bytes = it->t->byte_length();
+      }
+      bool last = !it->t;
+
+      pthread_mutex_lock(&mut_);
+      // Always let one item through, however big, so that we never wait on an empty queue.
+      while(!stop_ && queued_bytes_ && queued_bytes_ + it->bytes > max_bytes_) {
+        pthread_cond_wait(&cond_, &mut_);
+      }
+      if(stop_) {
+        pthread_mutex_unlock(&mut_);
+        free_item(it);
+        return;
+      }
+      queue_.push_back(it);
+      queued_bytes_ += it->bytes;
+      pthread_cond_signal(&cond_);
+      pthread_mutex_unlock(&mut_);
+      if(last) { return; }
+    }
+  }
+
+  ITR * itr_;
+  pageid_t max_bytes_;
+  bool live_only_;
+
+  pthread_t thread_;
+  pthread_mutex_t mut_;
+  pthread_cond_t cond_;   // signaled when the queue changes.
+  std::deque<item*> queue_;
+  pageid_t queued_bytes_;
+  bool stop_;
+
+  // Only the merge thread uses these.
+  bool at_end_;
+  item * page_;           // the datapage whose first tuple next_callerFrees() just returned.
+  std::vector<dataTuple*> rest_;
+  size_t next_rest_;
+};
+
+/**
+ * Writes a merge's output.  With max_bytes != 0, a thread of its own
+ * builds the datapages, index entries and bloom filter, up to max_bytes of
+ * tuples behind the merge thread.  Otherwise, the calls write to out
+ * directly.  Either way, nothing else may write to out until
+ * writes_done().
+ */
+class mergeWriter {
+public:
+  mergeWriter(int xid, diskTreeComponent * out, pageid_t max_bytes);
+  ~mergeWriter();
+
+  /** See diskTreeComponent::insertTuple().  If owned, t is freed once it has been written. */
+  void insertTuple(dataTuple * t, bool owned);
+  /**
+   * See diskTreeComponent::append_datapage().  If dp cannot be copied, its
+   * tuples are inserted one at a time instead.  Frees dp and tuples.
+   */
+  void append_datapage(dataPage * dp, std::vector<dataTuple*> * tuples);
+  /** Wait until everything passed in so far is in out.  Tuples that were not owned can be freed after this. */
+  void sync();
+  /** sync(), then finish out's last datapage. */
+  void writes_done();
+  /** @return true if writes happen on another thread. */
+  bool async() { return max_bytes_ != 0; }
+
+private:
+  mergeWriter(const mergeWriter&);
+  void operator=(const mergeWriter&);
+
+  /** A tuple (dp == NULL) or a datapage to write. */
+  struct op {
+    dataTuple * t;
+    bool owned;
+    dataPage * dp;
+    std::vector<dataTuple*> tuples;
+    pageid_t bytes;
+  };
+
+  static void * write_thr(void * arg);
+  void write_ops();
+  void write(op * o);
+  void enqueue(op * o);
+
+  int xid_;
+  diskTreeComponent * out_;
+  pageid_t max_bytes_;
+
+  pthread_t thread_;
+  pthread_mutex_t mut_;
+  pthread_cond_t cond_;  // signaled when the queue changes, or the writer finishes a batch.
+  std::deque<op*> queue_;
+  pageid_t queued_bytes_;
+  uint64_t enqueued_;
+  uint64_t written_;
+  bool stop_;
+};
+
+#endif /* MERGEPIPELINE_H_ */
@@ -18,6 +18,7 @@
  */
 #include <math.h>
 #include "mergeScheduler.h"
+#include "mergePipeline.h"
 
 #include <stasis/transactional.h>
 
@@ -125,6 +126,10 @@ static void* memMerge_thr(void* arg) {
 static void* diskMerge_thr(void* arg) {
 	return ((mergeScheduler*) arg)->diskMergeThread();
 }
+static void* levelMerge_thr(void* arg) {
+	std::pair<mergeScheduler*, int> * a = (std::pair<mergeScheduler*, int>*) arg;
+	return a->first->levelMergeThread(a->second);
+}
 
 mergeScheduler::mergeScheduler(bLSM *ltable) :
 		ltable_(ltable), MIN_R(3.0) {
@@ -136,11 +141,23 @@ void mergeScheduler::shutdown() {
 	ltable_->stop();
 	pthread_join(mem_merge_thread_, 0);
 	pthread_join(disk_merge_thread_, 0);
+	// Each merge thread wakes the next one down on its way out.
+	for (size_t i = 0; i < level_merge_threads_.size(); i++) {
+		pthread_join(level_merge_threads_[i], 0);
+	}
 }
 
 void mergeScheduler::start() {
 	pthread_create(&mem_merge_thread_, 0, memMerge_thr, this);
 	pthread_create(&disk_merge_thread_, 0, diskMerge_thr, this);
+	int n = ltable_->get_num_disk_levels() - 2;
+	level_merge_args_.resize(n);
+	level_merge_threads_.resize(n);
+	for (int i = 0; i < n; i++) {
+		level_merge_args_[i] = std::make_pair(this, i + 3);
+		pthread_create(&level_merge_threads_[i], 0, levelMerge_thr,
+				&level_merge_args_[i]);
+	}
 }
 
 bool insert_filter(bLSM * ltable, dataTuple * t, bool dropDeletes) {
@@ -158,11 +175,417 @@ bool insert_filter(bLSM * ltable, dataTuple * t, bool dropDeletes) {
 	return true;
 }
 
+/** The compaction filters that one merge runs, and how often each one dropped or rewrote a tuple. */
+struct merge_filters {
+	std::vector<compactionFilter*> filters;
+	std::vector<pageid_t> dropped;
+	std::vector<pageid_t> rewritten;
+};
+
+/**
+ * Run t through the compaction filters.  @return t, or what to write in
+ * its place: a tuple with a rewritten value, a tombstone for a dropped
+ * tuple that might have older versions below this merge, or NULL.
+ * Anything but t is a new tuple.
+ */
+static dataTuple * compaction_filter(bLSM * ltable, merge_filters * f,
+		int level, dataTuple * t, bool dropDeletes) {
+	if (t->isDelete()) {
+		return t;
+	}
+	dataTuple * ret = t;
+	for (size_t i = 0; i < f->filters.size(); i++) {
+		dataTuple * rewritten = NULL;
+		compactionFilter::decision d = f->filters[i]->filter(level, dropDeletes,
+				ret, &rewritten);
+		if (d == compactionFilter::DROP) {
+			f->dropped[i]++;
+			if (ret != t) {
+				dataTuple::freetuple(ret);
+			}
+			if (dropDeletes || !ltable->mightBeAfterMemMerge(t)) {
+				return NULL;
+			}
+			return dataTuple::create(t->strippedkey(), t->strippedkeylen());
+		} else if (d == compactionFilter::REWRITE) {
+			assert(rewritten && !dataTuple::compare_obj(rewritten, t));
+			f->rewritten[i]++;
+			if (ret != t) {
+				dataTuple::freetuple(ret);
+			}
+			ret = rewritten;
+		}
+	}
+	return ret;
+}
+
 template<class ITA, class ITB>
 void merge_iterators(int xid, diskTreeComponent * forceMe, ITA *itrA, ITB *itrB,
 		bLSM *ltable, diskTreeComponent *scratch_tree, mergeStats * stats,
 		bool dropDeletes);
 
+/** Passes tuples through from an iterator until it reaches end (exclusive).  NULL means no end. */
+template<class ITR>
+class boundedIterator {
+public:
+	boundedIterator(ITR * itr, dataTuple * end) :
+			itr_(itr), end_(end) {
+	}
+	~boundedIterator() {
+		delete itr_;
+	}
+	dataTuple * next_callerFrees() {
+		if (!itr_) {
+			return NULL;
+		}
+		dataTuple * t = itr_->next_callerFrees();
+		if (t && end_ && dataTuple::compare_obj(t, end_) >= 0) {
+			dataTuple::freetuple(t);
+			t = NULL;
+		}
+		if (!t) {
+			delete itr_;
+			itr_ = NULL;
+		}
+		return t;
+	}
+	/** See diskTreeComponent::iterator::take_page().  The datapage has to end before end, too. */
+	dataPage * take_page(dataTuple * bound, bool live_only,
+			std::vector<dataTuple*> * tuples) {
+		if (!itr_) {
+			return NULL;
+		}
+		if (end_ && (!bound || dataTuple::compare_obj(end_, bound) < 0)) {
+			bound = end_;
+		}
+		return itr_->take_page(bound, live_only, tuples);
+	}
+private:
+	ITR * itr_;
+	dataTuple * end_;
+};
+
+typedef prefetchIterator<diskTreeComponent::iterator> diskPrefetchIterator;
+typedef prefetchIterator<boundedIterator<diskTreeComponent::iterator> > boundedPrefetchIterator;
+
+/** One key range, [start, end), of a partitioned C1-C2 merge.  NULL bounds are unbounded. */
+struct c2_partition {
+	int xid;
+	bLSM * ltable;
+	mergeStats * stats;
+	diskTreeComponent * c2;
+	diskTreeComponent * c1_mergeable;
+	diskTreeComponent * c2_prime;
+	bool drop_deletes;
+	dataTuple * start;
+	dataTuple * end;
+	int64_t overlap;  // C1_mergeable datapages in this range; zero if none of its tuples are.
+	bool link;        // nothing to merge here; link C2's datapages into c2_prime as they are.
+	std::vector<pageid_t> linked;
+	diskTreeComponent * out;
+};
+
+/** The partitions of one merge, which a fixed number of threads take in order. */
+struct c2_partition_queue {
+	pthread_mutex_t mut;
+	std::vector<c2_partition*> todo;
+	size_t next;
+};
+
+static void c2_partition_merge(c2_partition * p) {
+	bLSM * ltable_ = p->ltable;
+
+	// The partitions write under the merge's transaction (Stasis serializes
+	// a transaction's log entries), so if the merge does not commit, their
+	// regions are freed along with the rest of c2_prime's.
+	int xid = p->xid;
+	p->out = p->c2_prime->open_partition(xid, ltable_->internal_region_size,
+			ltable_->datapage_region_size);
+
+	if (p->link) {
+		int64_t tuples = 0;
+		pageid_t bytes = 0;
+		p->out->link_datapages(xid, p->c2, p->start, p->end, &p->linked,
+				&tuples, &bytes);
+		// Linked tuples count as read and written, so that merge progress
+		// (and thus backpressure) is the same as if they had been copied.
+		ltable_->merge_mgr->read_tuple_from_large_component(
+				p->stats->merge_level, tuples, bytes);
+		ltable_->merge_mgr->wrote_tuples(p->stats->merge_level, tuples, bytes);
+		return;
+	}
+
+	boundedPrefetchIterator itrA(
+			new boundedIterator<diskTreeComponent::iterator>(
+					p->c2->open_iterator(p->start), p->end),
+			ltable_->merge_prefetch_bytes, p->drop_deletes);
+	boundedPrefetchIterator itrB(
+			new boundedIterator<diskTreeComponent::iterator>(
+					p->c1_mergeable->open_iterator(p->start,
+							ltable_->merge_mgr, 0.05, &ltable_->c1_flushing),
+					p->end), ltable_->merge_prefetch_bytes, false);
+
+	merge_iterators<boundedPrefetchIterator, boundedPrefetchIterator>(xid,
+			p->out, &itrA, &itrB, ltable_, p->out, p->stats, p->drop_deletes);
+}
+
+static void* c2_partition_thr(void* arg) {
+	c2_partition_queue * q = (c2_partition_queue*) arg;
+	while (true) {
+		pthread_mutex_lock(&q->mut);
+		c2_partition * p = q->next < q->todo.size() ? q->todo[q->next++] : NULL;
+		pthread_mutex_unlock(&q->mut);
+		if (!p) {
+			return 0;
+		}
+		c2_partition_merge(p);
+	}
+}
+
+/**
+ * @return the number of C1_mergeable datapages that hold tuples in
+ * [start, end), or zero if it has none there.  Dropped ranges do not count.
+ */
+static int64_t c2_partition_overlap(int xid, diskTreeComponent * c1_mergeable,
+		dataTuple * start, dataTuple * end) {
+	diskTreeComponent::iterator * it = c1_mergeable->open_iterator(start);
+	dataTuple * first = it->next_callerFrees();
+	delete it;
+	if (!first) {
+		return 0;
+	}
+	bool in_range = !end || dataTuple::compare_obj(first, end) < 0;
+	dataTuple::freetuple(first);
+	if (!in_range) {
+		return 0;
+	}
+	// The datapage that holds first, plus any others that start in the range.
+	int64_t ret = 1;
+	regionAllocator ro_alloc;
+	recordid root = c1_mergeable->get_root_rid();
+	diskTreeComponent::internalNodes::iterator * nit = start ?
+			new diskTreeComponent::internalNodes::iterator(xid, &ro_alloc, root,
+					start->strippedkey(), start->strippedkeylen()) :
+			new diskTreeComponent::internalNodes::iterator(xid, &ro_alloc, root);
+	while (nit->next()) {
+		byte * key;
+		size_t keylen = nit->key(&key);
+		if (end && dataTuple::compare(key, keylen, end->strippedkey(),
+						end->strippedkeylen()) >= 0) {
+			break;
+		}
+		if (start && dataTuple::compare(key, keylen, start->strippedkey(),
+						start->strippedkeylen()) <= 0) {
+			continue;
+		}
+		ret++;
+	}
+	nit->close();
+	delete nit;
+	return ret;
+}
+
+static bool denser(const c2_partition * a, const c2_partition * b) {
+	return a->overlap > b->overlap;
+}
+
+/** A linked region of C2 has to be at least this full of linked datapages; see limit_linked_garbage(). */
+static const double MIN_LINKED_REGION_FILL = 0.5;
+
+/** @return the index of the region (in sorted regions) that holds pid. */
+static pageid_t region_of(pageid_t * regions, pageid_t region_count,
+		pageid_t pid) {
+	pageid_t * r = std::upper_bound(regions, regions + region_count, pid);
+	assert(r != regions);
+	return r - regions - 1;
+}
+
+/**
+ * c2_prime keeps every region that holds a datapage it links, along with
+ * the rest of that region, which is garbage once the merge commits.  Under
+ * skewed writes, a few cold datapages would keep regions of dead ones
+ * around for good.  So a linked range is rewritten instead if any region
+ * that it links pages of would be less than MIN_LINKED_REGION_FILL live.
+ * Each such range frees up space in other regions, so this repeats until
+ * no such region is left.  The regions c2_prime keeps then take up at
+ * most 1 / MIN_LINKED_REGION_FILL times the space of what it links.
+ */
+static void limit_linked_garbage(int xid, diskTreeComponent * c2,
+		std::vector<c2_partition>& parts) {
+	pageid_t internal_region_length, internal_region_count;
+	pageid_t region_length, region_count;
+	pageid_t * internal_regions;
+	pageid_t * regions;
+	c2->list_regions(xid, &internal_region_length, &internal_region_count,
+			&internal_regions, &region_length, &region_count, &regions);
+	free(internal_regions);
+	std::sort(regions, regions + region_count);
+
+	// Pages of each region that the linked ranges would keep.
+	std::vector<pageid_t> live(region_count, 0);
+	std::vector<std::vector<std::pair<pageid_t, pageid_t> > > pages(
+			parts.size());
+	for (size_t i = 0; i < parts.size(); i++) {
+		if (!parts[i].link) {
+			continue;
+		}
+		c2->list_datapages(xid, parts[i].start, parts[i].end, &pages[i]);
+		for (size_t j = 0; j < pages[i].size(); j++) {
+			live[region_of(regions, region_count, pages[i][j].first)] +=
+					pages[i][j].second;
+		}
+	}
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (size_t i = 0; i < parts.size(); i++) {
+			if (!parts[i].link) {
+				continue;
+			}
+			bool sparse = false;
+			for (size_t j = 0; j < pages[i].size() && !sparse; j++) {
+				pageid_t r = region_of(regions, region_count,
+						pages[i][j].first);
+				sparse = live[r] < MIN_LINKED_REGION_FILL * region_length;
+			}
+			if (!sparse) {
+				continue;
+			}
+			parts[i].link = false;
+			changed = true;
+			for (size_t j = 0; j < pages[i].size(); j++) {
+				live[region_of(regions, region_count, pages[i][j].first)] -=
+						pages[i][j].second;
+			}
+		}
+	}
+	free(regions);
+}
+
+/**
+ * Merge C1_mergeable into C2 one key range at a time, on up to threads
+ * threads.  The ranges come from C2's internal nodes, so they are about
+ * the same size.  If partial is set, ranges that C1_mergeable has no
+ * tuples in are not rewritten; c2_prime links their datapages where they
+ * are, and *linked lists them (see diskTreeComponent::link_datapages()).
+ * Ranges whose regions are mostly garbage are rewritten anyway; see
+ * limit_linked_garbage().
+ * The other ranges go first, most heavily updated first, so the merge
+ * spends its writes where they reclaim the most space.  Either way, each
+ * range writes its own datapages, which are then indexed by c2_prime in
+ * key order.
+ */
+static void merge_c2_partitions(int xid, bLSM * ltable_,
+		diskTreeComponent * c2_prime, std::vector<dataTuple*>& splits,
+		int threads, bool partial, mergeStats * stats, bool dropDeletes,
+		std::vector<pageid_t> * linked) {
+	int n = splits.size() + 1;
+	std::vector<c2_partition> parts(n);
+	c2_partition_queue q;
+	pthread_mutex_init(&q.mut, 0);
+	q.next = 0;
+	// Dropped ranges, expired tuples and compaction filters have to see
+	// every tuple.  Ranges that overlap a dropped range are always
+	// rewritten, and nothing is linked if there is expiry or a filter.
+	std::vector<compactionFilter*> filters;
+	ltable_->get_compaction_filters(&filters);
+	partial = partial && !ltable_->expiry && filters.empty();
+	for (int i = 0; i < n; i++) {
+		parts[i].xid = xid;
+		parts[i].ltable = ltable_;
+		parts[i].stats = stats;
+		parts[i].c2 = ltable_->get_tree_c2();
+		parts[i].c1_mergeable = ltable_->get_tree_c1_mergeable();
+		parts[i].c2_prime = c2_prime;
+		parts[i].drop_deletes = dropDeletes;
+		parts[i].start = i ? splits[i - 1] : NULL;
+		parts[i].end = i < n - 1 ? splits[i] : NULL;
+		parts[i].overlap = partial ?
+				c2_partition_overlap(xid, parts[i].c1_mergeable,
+						parts[i].start, parts[i].end) : 1;
+		parts[i].link = !parts[i].overlap
+				&& !parts[i].c2->get_dead_ranges()->overlaps(parts[i].start,
+						parts[i].end);
+		parts[i].out = NULL;
+		q.todo.push_back(&parts[i]);
+	}
+	if (partial) {
+		limit_linked_garbage(xid, ltable_->get_tree_c2(), parts);
+	}
+	// Linked ranges have no overlap, so they sort last.
+	std::stable_sort(q.todo.begin(), q.todo.end(), denser);
+
+	threads = std::max(1, std::min(threads, n));
+	std::vector<pthread_t> thread_ids(threads);
+	for (int i = 0; i < threads; i++) {
+		pthread_create(&thread_ids[i], 0, c2_partition_thr, &q);
+	}
+	for (int i = 0; i < threads; i++) {
+		pthread_join(thread_ids[i], 0);
+	}
+	pthread_mutex_destroy(&q.mut);
+	int linked_count = 0;
+	for (int i = 0; i < n; i++) {
+		c2_prime->append_partition(xid, parts[i].out);
+		linked->insert(linked->end(), parts[i].linked.begin(),
+				parts[i].linked.end());
+		if (parts[i].link) {
+			linked_count++;
+		}
+	}
+	printf("C1-C2 merge rewrote %d of %d key ranges; linked %lld datapages\n",
+			n - linked_count, n, (long long) linked->size());
+}
+
+/**
+ * The number of tuples we expect the C0-C1 merge to write: everything in C1,
+ * plus one C0's worth of tuples.  The latter is extrapolated from what C0
+ * holds right now.  Falls back on estimating from byte counts when C1 was
+ * recovered without a bloom filter, or C0 is empty.
+ */
+static uint64_t c1_bloom_size(bLSM * ltable_, mergeStats * stats) {
+	const int64_t min_bloom_target = ltable_->max_c0_size;
+	uint64_t heuristic = (stats->target_size < min_bloom_target ?
+			min_bloom_target : stats->target_size) / 100;
+
+	int64_t c1_tuples = ltable_->get_tree_c1()->get_tuple_count();
+	int64_t c0_tuples = ltable_->get_c0_tuple_count();
+	pageid_t c0_bytes = ltable_->merge_mgr->get_merge_stats(0)->get_live_size();
+	if (c1_tuples == -1 || c0_tuples == 0 || c0_bytes == 0) {
+		return heuristic;
+	}
+	if (c0_bytes < ltable_->max_c0_size) {
+		c0_tuples = (int64_t) (((double) c0_tuples) * ltable_->max_c0_size / c0_bytes);
+	}
+	return c1_tuples + c0_tuples;
+}
+
+/**
+ * The number of tuples the C1-C2 merge will write is at most the number of
+ * tuples in its inputs.
+ */
+static uint64_t c2_bloom_size(bLSM * ltable_, mergeStats * stats) {
+	int64_t c1_tuples = ltable_->get_tree_c1_mergeable()->get_tuple_count();
+	int64_t c2_tuples = ltable_->get_tree_c2()->get_tuple_count();
+	if (c1_tuples == -1 || c2_tuples == -1) {
+		return (uint64_t) (ltable_->max_c0_size * *ltable_->R()
+				+ stats->base_size) / 1000;
+	}
+	return c1_tuples + c2_tuples + 1;
+}
+
+/** Like c2_bloom_size(), for the merges below C2. */
+static uint64_t level_bloom_size(bLSM * ltable_, int level, mergeStats * stats) {
+	bLSM::disk_level * l = ltable_->get_disk_level(level);
+	int64_t small_tuples = l->mergeable->get_tuple_count();
+	int64_t large_tuples = l->tree->get_tuple_count();
+	if (small_tuples == -1 || large_tuples == -1) {
+		return (uint64_t) (ltable_->merge_mgr->get_merge_stats(level - 1)->target_size
+				+ stats->base_size) / 1000;
+	}
+	return small_tuples + large_tuples + 1;
+}
+
 /**
  *  Merge algorithm: Outsider's view
  *<pre>
@@ -219,33 +642,27 @@ void * mergeScheduler::memMergeThread() {
 		// 4: Merge
 
 		//create the iterators
-		diskTreeComponent::iterator *itrA =
-				ltable_->get_tree_c1()->open_iterator();
-		const int64_t min_bloom_target = ltable_->max_c0_size;
+		diskPrefetchIterator *itrA = new diskPrefetchIterator(
+				ltable_->get_tree_c1()->open_iterator(),
+				ltable_->merge_prefetch_bytes, false);
 
 		//create a new tree
 		diskTreeComponent * c1_prime = new diskTreeComponent(xid,
 				ltable_->internal_region_size, ltable_->datapage_region_size,
-				ltable_->datapage_size, stats,
-				(stats->target_size < min_bloom_target ?
-						min_bloom_target : stats->target_size) / 100);
+				ltable_->datapage_size, stats, c1_bloom_size(ltable_, stats));
 
 		ltable_->set_tree_c1_prime(c1_prime);
 
 		rwlc_unlock(ltable_->header_mut);
 
 		// needs to be past the rwlc_unlock...
-		memTreeComponent::batchedRevalidatingIterator *itrB =
-				new memTreeComponent::batchedRevalidatingIterator(
-						ltable_->get_tree_c0(), ltable_->merge_mgr,
-						ltable_->max_c0_size, &ltable_->c0_flushing, 100,
-						&ltable_->rb_mut);
+		bLSM::c0_iterator_t *itrB = ltable_->open_c0_merge_iterator();
 
 		//: do the merge
 		DEBUG("mmt:\tMerging:\n");
 
-		merge_iterators<diskTreeComponent::iterator,
-				memTreeComponent::batchedRevalidatingIterator>(xid, c1_prime,
+		merge_iterators<diskPrefetchIterator, bLSM::c0_iterator_t>(
+				xid, c1_prime,
 				itrA, itrB, ltable_, c1_prime, stats, false);
 
 		delete itrA;
@@ -365,6 +782,8 @@ void * mergeScheduler::diskMergeThread() {
 
 	int merge_count = 0;
 	mergeStats * stats = ltable_->merge_mgr->get_merge_stats(2);
+	// Tombstones can only go once nothing older is left beneath them.
+	bool last = ltable_->get_num_disk_levels() == 2;
 
 	while (true) {
 
@@ -388,29 +807,45 @@ void * mergeScheduler::diskMergeThread() {
 			DEBUG("dmt:\tblock ready\n");
 		}
 		if (done == 1) {
+			if (!last) {
+				pthread_cond_signal(&ltable_->get_disk_level(3)->ready);
+			}
 			rwlc_unlock(ltable_->header_mut);
 			break;
 		}
 
 		stats->starting_merge();
+		// range tombstones from here on are also c2_prime's; see below.
+		uint64_t first_range_tombstone = ltable_->get_next_range_tombstone_id();
 
 		// 3: begin
 		xid = Tbegin();
 
 		// 4: do the merge.
+		std::vector<dataTuple*> splits;
+		int ranges = std::max(ltable_->c2_merge_partitions,
+				ltable_->c2_merge_ranges);
+		if (ranges > 1) {
+			splits = ltable_->get_tree_c2()->get_split_keys(xid, ranges);
+		}
+		std::vector<pageid_t> linked;
 		//create the iterators
-		diskTreeComponent::iterator *itrA =
-				ltable_->get_tree_c2()->open_iterator();
-		diskTreeComponent::iterator *itrB =
-				ltable_->get_tree_c1_mergeable()->open_iterator(
-						ltable_->merge_mgr, 0.05, &ltable_->c1_flushing);
+		diskPrefetchIterator *itrA = NULL;
+		diskPrefetchIterator *itrB = NULL;
+		if (splits.empty()) {
+			itrA = new diskPrefetchIterator(
+					ltable_->get_tree_c2()->open_iterator(),
+					ltable_->merge_prefetch_bytes, last);
+			itrB = new diskPrefetchIterator(
+					ltable_->get_tree_c1_mergeable()->open_iterator(
+							ltable_->merge_mgr, 0.05, &ltable_->c1_flushing),
+					ltable_->merge_prefetch_bytes, false);
+		}
 
 		//create a new tree
 		diskTreeComponent * c2_prime = new diskTreeComponent(xid,
 				ltable_->internal_region_size, ltable_->datapage_region_size,
-				ltable_->datapage_size, stats,
-				(uint64_t) (ltable_->max_c0_size * *ltable_->R()
-						+ stats->base_size) / 1000);
+				ltable_->datapage_size, stats, c2_bloom_size(ltable_, stats));
 //        diskTreeComponent * c2_prime = new diskTreeComponent(xid, ltable_->internal_region_size, ltable_->datapage_region_size, ltable_->datapage_size, stats);
 
 		rwlc_unlock(ltable_->header_mut);
@@ -418,11 +853,20 @@ void * mergeScheduler::diskMergeThread() {
 		//do the merge
 		DEBUG("dmt:\tMerging:\n");
 
-		merge_iterators<diskTreeComponent::iterator, diskTreeComponent::iterator>(
-				xid, c2_prime, itrA, itrB, ltable_, c2_prime, stats, true);
+		if (splits.empty()) {
+			merge_iterators<diskPrefetchIterator, diskPrefetchIterator>(xid,
+					c2_prime, itrA, itrB, ltable_, c2_prime, stats, last);
 
-		delete itrA;
-		delete itrB;
+			delete itrA;
+			delete itrB;
+		} else {
+			merge_c2_partitions(xid, ltable_, c2_prime, splits,
+					ltable_->c2_merge_partitions, ltable_->c2_merge_ranges > 1,
+					stats, last, &linked);
+			for (size_t i = 0; i < splits.size(); i++) {
+				dataTuple::freetuple(splits[i]);
+			}
+		}
 
 		//5: force write the new region to disk
 		c2_prime->force(xid);
@@ -430,8 +874,11 @@ void * mergeScheduler::diskMergeThread() {
 		// (skip 6, 7, 8, 8.5, 9))
 
 		rwlc_writelock(ltable_->header_mut);
-		//12
-		ltable_->get_tree_c2()->dealloc(xid);
+		// Ranges dropped during the merge hide what it copied before the drop.
+		c2_prime->get_dead_ranges()->add_since(
+				ltable_->get_tree_c2()->get_dead_ranges(), first_range_tombstone);
+		//12: c2_prime keeps the regions that hold the datapages it linked.
+		ltable_->get_tree_c2()->dealloc(xid, c2_prime, linked);
 		delete ltable_->get_tree_c2();
 		//11.5
 		ltable_->get_tree_c1_mergeable()->dealloc(xid);
@@ -445,23 +892,21 @@ void * mergeScheduler::diskMergeThread() {
 
 		merge_count++;
 		//update the current optimal R value
-		*(ltable_->R()) = std::max(MIN_R,
-				sqrt(
-						((double) stats->output_size())
-								/ ((double) ltable_->mean_c0_run_length)));
-
-		DEBUG("\nR = %f\n", *(ltable_->R()));
+		if (last) {
+			update_R(stats);
+		}
 
 		DEBUG("dmt:\tmerge_count %lld\t#written bytes: %lld\n optimal r %.2f", stats.stats_merge_count, stats.output_size(), *(a->r_i));
-		// 10: C2 is never too big
+		// 10: C2 is never too big, unless there are levels below it
 		ltable_->set_tree_c2(c2_prime);
-		stats->handed_off_tree();
 
 		DEBUG("dmt:\tUpdated C2's position on disk to %lld\n",(long long)-1);
 		// 13
 		ltable_->update_persistent_header(xid);
 		Tcommit(xid);
 
+		hand_off_level(2, stats);
+
 		rwlc_unlock(ltable_->header_mut);
 //        stats->pretty_print(stdout);
 		ltable_->merge_mgr->finished_merge(2);
@@ -470,6 +915,142 @@ void * mergeScheduler::diskMergeThread() {
 	return 0;
 }
 
+void mergeScheduler::update_R(mergeStats * stats) {
+	// Each level is (about) R times bigger than the one above it, so with n
+	// disk levels, |Cn| = R^n * |C0|.  (For the usual C1 and C2, R is
+	// sqrt(|C2| / |C0|).)
+	*(ltable_->R()) = std::max(MIN_R,
+			pow(((double) stats->output_size())
+					/ ((double) ltable_->mean_c0_run_length),
+					1.0 / ltable_->get_num_disk_levels()));
+
+	DEBUG("\nR = %f\n", *(ltable_->R()));
+}
+
+void mergeScheduler::hand_off_level(int level, mergeStats * stats) {
+	if (level >= ltable_->get_num_disk_levels()
+			|| 1.05 * (double) stats->output_size()
+					<= (double) stats->target_size) {
+		return;
+	}
+	bLSM::disk_level * next = ltable_->get_disk_level(level + 1);
+	while (next->mergeable) {
+		if (!ltable_->is_still_running()) {
+			// The next merge may have exited already.  Hand off next time.
+			return;
+		}
+		next->flushing = true;
+		rwlc_cond_wait(&next->needed, ltable_->header_mut);
+		next->flushing = !ltable_->is_still_running(); // stop() leaves it set.
+	}
+
+	int xid = Tbegin();
+
+	// C(level+1)_mergeable = C(level); C(level) = new empty.
+	ltable_->set_disk_level_mergeable(level + 1,
+			ltable_->get_disk_level_tree(level));
+	stats->handed_off_tree();
+	ltable_->set_disk_level_tree(level,
+			new diskTreeComponent(xid, ltable_->internal_region_size,
+					ltable_->datapage_region_size, ltable_->datapage_size,
+					stats, 10));
+
+	pthread_cond_signal(&next->ready);
+	ltable_->update_persistent_header(xid);
+	Tcommit(xid);
+}
+
+void * mergeScheduler::levelMergeThread(int level) {
+	int xid;
+
+	bLSM::disk_level * l = ltable_->get_disk_level(level);
+	mergeStats * stats = ltable_->merge_mgr->get_merge_stats(level);
+	bool last = level == ltable_->get_num_disk_levels();
+
+	while (true) {
+
+		// 2: wait for input
+		rwlc_writelock(ltable_->header_mut);
+		ltable_->merge_mgr->new_merge(level);
+		int done = 0;
+		while (!l->mergeable) {
+			pthread_cond_signal(&l->needed);
+
+			if (!ltable_->is_still_running()) {
+				done = 1;
+				break;
+			}
+
+			rwlc_cond_wait(&l->ready, ltable_->header_mut);
+		}
+		if (done == 1) {
+			if (!last) {
+				pthread_cond_signal(&ltable_->get_disk_level(level + 1)->ready);
+			}
+			rwlc_unlock(ltable_->header_mut);
+			break;
+		}
+
+		stats->starting_merge();
+		// range tombstones from here on are also prime's; see diskMergeThread().
+		uint64_t first_range_tombstone = ltable_->get_next_range_tombstone_id();
+
+		// 3: begin
+		xid = Tbegin();
+
+		// 4: do the merge.
+		diskPrefetchIterator *itrA = new diskPrefetchIterator(
+				l->tree->open_iterator(), ltable_->merge_prefetch_bytes, last);
+		diskPrefetchIterator *itrB = new diskPrefetchIterator(
+				l->mergeable->open_iterator(ltable_->merge_mgr, 0.05,
+						&l->flushing, level - 1),
+				ltable_->merge_prefetch_bytes, false);
+
+		diskTreeComponent * prime = new diskTreeComponent(xid,
+				ltable_->internal_region_size, ltable_->datapage_region_size,
+				ltable_->datapage_size, stats,
+				level_bloom_size(ltable_, level, stats));
+
+		rwlc_unlock(ltable_->header_mut);
+
+		merge_iterators<diskPrefetchIterator, diskPrefetchIterator>(xid, prime,
+				itrA, itrB, ltable_, prime, stats, last);
+
+		delete itrA;
+		delete itrB;
+
+		//5: force write the new region to disk
+		prime->force(xid);
+
+		rwlc_writelock(ltable_->header_mut);
+		prime->get_dead_ranges()->add_since(l->tree->get_dead_ranges(),
+				first_range_tombstone);
+		//12
+		l->tree->dealloc(xid);
+		delete l->tree;
+		//11.5
+		l->mergeable->dealloc(xid);
+		//11
+		delete l->mergeable;
+		ltable_->set_disk_level_mergeable(level, 0);
+
+		if (last) {
+			update_R(stats);
+		}
+		ltable_->set_disk_level_tree(level, prime);
+
+		// 13
+		ltable_->update_persistent_header(xid);
+		Tcommit(xid);
+
+		hand_off_level(level, stats);
+
+		rwlc_unlock(ltable_->header_mut);
+		ltable_->merge_mgr->finished_merge(level);
+	}
+	return 0;
+}
+
 static void periodically_force(int xid, int *i, diskTreeComponent * forceMe,
 		stasis_log_t * log) {
 	if (bLSM::limit && *i > mergeManager::FORCE_INTERVAL) {
@@ -479,40 +1060,158 @@ static void periodically_force(int xid, int *i, diskTreeComponent * forceMe,
 
 }
 
+/**
+ * Remove the C0 tuples the merge has written out.  A tuple that a
+ * dropRange() has hidden in the merge's output is left alone: if C0 still
+ * has it, it was written again after the drop.
+ */
 static int garbage_collect(bLSM * ltable_, dataTuple ** garbage,
-		int garbage_len, int next_garbage, bool force = false) {
-	if (next_garbage == garbage_len || force) {
-		pthread_mutex_lock(&ltable_->rb_mut);
+		int garbage_len, int next_garbage, rangeTombstones * dead,
+		mergeWriter * out, bool force = false) {
+	if ((next_garbage == garbage_len || force) && next_garbage) {
+		// Lookups have to find these in C0 until they are in the merge's output.
+		out->sync();
+	}
+	if ((next_garbage == garbage_len || force) && ltable_->get_skiplist_c0()) {
+		memTreeComponent::skiplist_ptr_t c0 = ltable_->get_skiplist_c0();
+		memTreeComponent::skiplist_t::readGuard g(c0);
 		for (int i = 0; i < next_garbage; i++) {
-			dataTuple * t2tmp = NULL;
-			{
-				memTreeComponent::rbtree_t::iterator rbitr =
-						ltable_->get_tree_c0()->find(garbage[i]);
-				if (rbitr != ltable_->get_tree_c0()->end()) {
-					t2tmp = *rbitr;
-					if ((t2tmp->datalen() == garbage[i]->datalen())
-							&& !memcmp(t2tmp->data(), garbage[i]->data(),
-									garbage[i]->datalen())) {
-						// they match, delete t2tmp
-					} else {
-						t2tmp = NULL;
+			dataTuple * t2tmp = dead->covers(garbage[i]) ? NULL : c0->find(garbage[i]);
+			if (t2tmp && (t2tmp->datalen() == garbage[i]->datalen())
+					&& !memcmp(t2tmp->data(), garbage[i]->data(),
+							garbage[i]->datalen())) {
+				// they match.  erase() fails (and leaves the tuple alone) if a writer replaced it since find().
+				c0->erase(t2tmp);
+			}
+			dataTuple::freetuple(garbage[i]);
+		}
+		return 0;
+	} else if (next_garbage == garbage_len || force) {
+		// Take each shard's mutex once per batch.
+		int num_shards = ltable_->get_num_c0_shards();
+		std::vector<int> shard(next_garbage, 0);
+		if (num_shards > 1) {
+			for (int i = 0; i < next_garbage; i++) {
+				shard[i] = ltable_->c0_shard_of(garbage[i]);
+			}
+		}
+		for (int s = 0; s < num_shards; s++) {
+			bLSM::c0_shard * c0 = ltable_->get_c0_shard(s);
+			pthread_mutex_lock(c0->mut);
+			for (int i = 0; i < next_garbage; i++) {
+				if (shard[i] != s) {
+					continue;
+				}
+				dataTuple * t2tmp = NULL;
+				if (!dead->covers(garbage[i])) {
+					memTreeComponent::rbtree_t::iterator rbitr = c0->tree->find(
+							garbage[i]);
+					if (rbitr != c0->tree->end()) {
+						t2tmp = *rbitr;
+						if ((t2tmp->datalen() == garbage[i]->datalen())
+								&& !memcmp(t2tmp->data(), garbage[i]->data(),
+										garbage[i]->datalen())) {
+							// they match, delete t2tmp
+						} else {
+							t2tmp = NULL;
+						}
 					}
+				} // close rbitr before touching the tree.
+				if (t2tmp) {
+					c0->tree->erase(garbage[i]);
+					//ltable_->merge_mgr->get_merge_stats(0)->current_size -= garbage[i]->byte_length();
+					arenaAllocator::release(t2tmp);
 				}
-			} // close rbitr before touching the tree.
-			if (t2tmp) {
-				ltable_->get_tree_c0()->erase(garbage[i]);
-				//ltable_->merge_mgr->get_merge_stats(0)->current_size -= garbage[i]->byte_length();
-				dataTuple::freetuple(t2tmp);
 			}
+			pthread_mutex_unlock(c0->mut);
+		}
+		for (int i = 0; i < next_garbage; i++) {
 			dataTuple::freetuple(garbage[i]);
 		}
-		pthread_mutex_unlock(&ltable_->rb_mut);
 		return 0;
 	} else {
 		return next_garbage;
 	}
 }
 
+/**
+ * Write t, or what the compaction filters replace it with, unless
+ * insert_filter() or a filter drops it.  If owned, t is the caller's to
+ * give away, and is freed if it is not written.  Otherwise,
+ * garbage_collect() frees it.
+ */
+static void write_tuple(bLSM * ltable, mergeWriter * out, merge_filters * f,
+		mergeStats * stats, dataTuple * t, bool owned, bool dropDeletes,
+		int * i) {
+	dataTuple * w = insert_filter(ltable, t, dropDeletes) ?
+			compaction_filter(ltable, f, stats->merge_level, t, dropDeletes) :
+			NULL;
+	if (w) {
+		*i += w->byte_length();
+		ltable->merge_mgr->wrote_tuple(stats->merge_level, w);
+		out->insertTuple(w, owned || w != t);
+	}
+	if (owned && w != t) {
+		dataTuple::freetuple(t);
+	}
+}
+
+/**
+ * If *t1 is the first tuple of a datapage of itrA whose keys all come
+ * before bound (the next tuple from the small input, or NULL), there is
+ * nothing to merge into that datapage, so copy it into scratch_tree as is.
+ * The compaction filters still see each tuple; if they change any of
+ * them, the datapage's tuples are written one at a time instead.
+ * @return true if it did; *t1 is then the first tuple of the next datapage.
+ */
+template<class ITA>
+static bool copy_datapage(ITA * itrA, dataTuple ** t1, dataTuple * bound,
+		bLSM * ltable, mergeWriter * out, merge_filters * f, mergeStats * stats,
+		bool dropDeletes, int * i) {
+	std::vector<dataTuple*> tuples;
+	dataPage * dp = itrA->take_page(bound, dropDeletes, &tuples);
+	if (!dp) {
+		return false;
+	}
+	std::vector<dataTuple*> filtered(tuples.size());
+	bool unchanged = true;
+	for (size_t j = 0; j < tuples.size(); j++) {
+		dataTuple * t = tuples[j];
+		if (j) {  // the caller already counted *t1.
+			ltable->merge_mgr->read_tuple_from_large_component(
+					stats->merge_level, t);
+		}
+		filtered[j] = compaction_filter(ltable, f, stats->merge_level, t,
+				dropDeletes);
+		unchanged = unchanged && filtered[j] == t;
+	}
+	for (size_t j = 0; j < tuples.size(); j++) {
+		dataTuple * w = filtered[j];
+		if (w) {
+			ltable->merge_mgr->wrote_tuple(stats->merge_level, w);
+			*i += w->byte_length();
+		}
+		if (!unchanged) {
+			if (w) {
+				out->insertTuple(w, true);
+			}
+			if (w != tuples[j]) {
+				dataTuple::freetuple(tuples[j]);
+			}
+		}
+	}
+	if (unchanged) {
+		out->append_datapage(dp, &tuples);
+	} else {
+		delete dp;
+	}
+	dataTuple::freetuple(*t1);
+	*t1 = itrA->next_callerFrees();
+	ltable->merge_mgr->read_tuple_from_large_component(stats->merge_level,
+			*t1);
+	return true;
+}
+
 template<class ITA, class ITB>
 void merge_iterators(int xid, diskTreeComponent * forceMe,
 		ITA *itrA, //iterator on c1 or c2
@@ -522,21 +1221,42 @@ void merge_iterators(int xid, diskTreeComponent * forceMe,
 		) {
 	stasis_log_t * log = (stasis_log_t*) stasis_log();
 
+	mergeWriter out(xid, scratch_tree, ltable->merge_write_behind_bytes);
+	merge_filters f;
+	ltable->get_compaction_filters(&f.filters);
+	f.dropped.resize(f.filters.size());
+	f.rewritten.resize(f.filters.size());
+
 	dataTuple *t1 = itrA->next_callerFrees();
 	ltable->merge_mgr->read_tuple_from_large_component(stats->merge_level, t1);
 	dataTuple *t2 = 0;
 
-	int garbage_len = 100;
+	// Collecting garbage waits for the writer to catch up, so do it less
+	// often when there is one.
+	int garbage_len = out.async() ? 1000 : 100;
 	int next_garbage = 0;
 	dataTuple ** garbage = (dataTuple**) malloc(
 			sizeof(garbage[0]) * garbage_len);
 
 	int i = 0;
 
+	// insert_filter() drops expired tuples, so with expiry on, every tuple
+	// has to be looked at.
+	bool copy_pages = !ltable->expiry;
+
 	while ((t2 = itrB->next_callerFrees()) != 0) {
 		ltable->merge_mgr->read_tuple_from_small_component(stats->merge_level,
 				t2);
 
+		if (stats->merge_level == 1
+				&& scratch_tree->get_dead_ranges()->covers(t2)) {
+			// A dropRange() ran after this merge started.  It erased the older
+			// C0 tuples in its range, so this one is either a stale copy, or was
+			// written after the drop.  Leave the latter in C0 for the next merge.
+			dataTuple::freetuple(t2);
+			continue;
+		}
+
 		DEBUG("tuple\t%lld: keylen %d datalen %d\n",
 				ntuples, *(t2->keylen),*(t2->datalen) );
 
@@ -544,13 +1264,14 @@ void merge_iterators(int xid, diskTreeComponent * forceMe,
 				&& dataTuple::compare(t1->rawkey(), t1->rawkeylen(),
 						t2->rawkey(), t2->rawkeylen()) < 0) // t1 is less than t2
 		{
-			//insert t1
-			if (insert_filter(ltable, t1, dropDeletes)) {
-				scratch_tree->insertTuple(xid, t1);
-				i += t1->byte_length();
-				ltable->merge_mgr->wrote_tuple(stats->merge_level, t1);
+			if (copy_pages
+					&& copy_datapage(itrA, &t1, t2, ltable, &out, &f, stats,
+							dropDeletes, &i)) {
+				periodically_force(xid, &i, forceMe, log);
+				continue;
 			}
-			dataTuple::freetuple(t1);
+			//insert t1
+			write_tuple(ltable, &out, &f, stats, t1, true, dropDeletes, &i);
 
 			//advance itrA
 			t1 = itrA->next_callerFrees();
@@ -560,6 +1281,9 @@ void merge_iterators(int xid, diskTreeComponent * forceMe,
 			periodically_force(xid, &i, forceMe, log);
 		}
 
+		// The writer frees t2 once it is written, except for C0's tuples,
+		// which garbage_collect() frees.
+		bool t2_owned = stats->merge_level != 1;
 		if (t1 != 0
 				&& dataTuple::compare(t1->strippedkey(), t1->strippedkeylen(),
 						t2->strippedkey(), t2->strippedkeylen()) == 0) {
@@ -567,24 +1291,16 @@ void merge_iterators(int xid, diskTreeComponent * forceMe,
 			stats->merged_tuples(mtuple, t2, t1); // this looks backwards, but is right.
 
 			//insert merged tuple, drop deletes
-			if (insert_filter(ltable, mtuple, dropDeletes)) {
-				scratch_tree->insertTuple(xid, mtuple);
-				i += mtuple->byte_length();
-				ltable->merge_mgr->wrote_tuple(stats->merge_level, mtuple);
-			}
+			write_tuple(ltable, &out, &f, stats, mtuple, true, dropDeletes, &i);
 			dataTuple::freetuple(t1);
 			t1 = itrA->next_callerFrees();  //advance itrA
 			ltable->merge_mgr->read_tuple_from_large_component(
 					stats->merge_level, t1);
-			dataTuple::freetuple(mtuple);
 			periodically_force(xid, &i, forceMe, log);
 		} else {
 			//insert t2
-			if (insert_filter(ltable, t2, dropDeletes)) {
-				scratch_tree->insertTuple(xid, t2);
-				i += t2->byte_length();
-				ltable->merge_mgr->wrote_tuple(stats->merge_level, t2);
-			}
+			write_tuple(ltable, &out, &f, stats, t2, t2_owned, dropDeletes, &i);
+			t2_owned = false;
 			periodically_force(xid, &i, forceMe, log);
 			// cannot free any tuples here; they may still be read through a lookup
 		}
@@ -593,23 +1309,24 @@ void merge_iterators(int xid, diskTreeComponent * forceMe,
 			ltable->merge_mgr->wrote_tuple(0, t2);
 
 			next_garbage = garbage_collect(ltable, garbage, garbage_len,
-					next_garbage);
+					next_garbage, scratch_tree->get_dead_ranges(), &out);
 			garbage[next_garbage] = t2;
 			next_garbage++;
 		}
-		if (stats->merge_level != 1) {
+		if (t2_owned) {
 			dataTuple::freetuple(t2);
 		}
 
 	}
 
 	while (t1 != 0) {  // t2 is empty, but t1 still has stuff in it.
-		if (insert_filter(ltable, t1, dropDeletes)) {
-			scratch_tree->insertTuple(xid, t1);
-			ltable->merge_mgr->wrote_tuple(stats->merge_level, t1);
-			i += t1->byte_length();
+		if (copy_pages
+				&& copy_datapage(itrA, &t1, NULL, ltable, &out, &f,
+						stats, dropDeletes, &i)) {
+			periodically_force(xid, &i, forceMe, log);
+			continue;
 		}
-		dataTuple::freetuple(t1);
+		write_tuple(ltable, &out, &f, stats, t1, true, dropDeletes, &i);
 
 		//advance itrA
 		t1 = itrA->next_callerFrees();
@@ -619,8 +1336,15 @@ void merge_iterators(int xid, diskTreeComponent * forceMe,
 	}DEBUG("dpages: %d\tnpages: %d\tntuples: %d\n", dpages, npages, ntuples);
 
 	next_garbage = garbage_collect(ltable, garbage, garbage_len, next_garbage,
-			true);
+			scratch_tree->get_dead_ranges(), &out, true);
 	free(garbage);
 
-	scratch_tree->writes_done();
+	out.writes_done();
+
+	for (size_t j = 0; j < f.filters.size(); j++) {
+		if (f.dropped[j] || f.rewritten[j]) {
+			stats->filtered_tuples(f.filters[j]->name(), f.dropped[j],
+					f.rewritten[j]);
+		}
+	}
 }
@@ -23,6 +23,8 @@
 
 #include <stasis/common.h>
 #include <mutex>
+#include <utility>
+#include <vector>
 
 class RateLimiter {
 public:
@@ -58,10 +60,19 @@ public:
 
   void * memMergeThread();
   void * diskMergeThread();
+  /** Merge C(level-1) into C(level) each time it is handed off, for level >= 3. */
+  void * levelMergeThread(int level);
 
 private:
+  /** Hand C(level) off to the merge into C(level+1), if there is one, and C(level) outgrew its target size.  Call with header_mut held. */
+  void hand_off_level(int level, mergeStats * stats);
+  /** Recompute R from the size of the last level.  Call with header_mut held. */
+  void update_R(mergeStats * stats);
+
   pthread_t mem_merge_thread_;
   pthread_t disk_merge_thread_;
+  std::vector<std::pair<mergeScheduler*, int> > level_merge_args_; // (this, level) for levelMergeThread().
+  std::vector<pthread_t> level_merge_threads_; // one per level below C2.
   bLSM * ltable_;
   const double MIN_R;
 };
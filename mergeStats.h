@@ -28,8 +28,13 @@
 
 #include <sys/time.h>
 #include <stdio.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
 #include "dataTuple.h"
 #include "dataPage.h"
+#include "arenaAllocator.h"
 
 #include <mergeManager.h> // XXX for double_to_ts, etc... create a util class.
 
@@ -80,6 +85,8 @@ class mergeStats {
       stats_merge_count(0),
       stats_bytes_out_with_overhead(0),
       stats_num_datapages_out(0),
+      stats_num_datapages_copied(0),
+      stats_num_datapages_linked(0),
       stats_bytes_in_small_delta(0),
       stats_lifetime_elapsed(0),
       stats_lifetime_active(0),
@@ -114,6 +121,8 @@ class mergeStats {
       stats_merge_count = 0;
       stats_bytes_out_with_overhead = 0;
       stats_num_datapages_out = 0;
+      stats_num_datapages_copied = 0;
+      stats_num_datapages_linked = 0;
       stats_bytes_in_small_delta = 0;
       stats_lifetime_elapsed = 0;
       stats_lifetime_active = 0;
@@ -154,6 +163,8 @@ class mergeStats {
       stats_merge_count++;
       stats_bytes_out_with_overhead = 0;
       stats_num_datapages_out = 0;
+      stats_num_datapages_copied = 0;
+      stats_num_datapages_linked = 0;
       stats_bytes_in_small_delta = 0;
 #endif
     }
@@ -166,8 +177,17 @@ class mergeStats {
       mergeManager::double_to_ts(&stats_last_tick, mergeManager::tv_to_double(&last));
 #endif
     }
+    /** For C0: report what the C0 arenas (one per shard) hold instead of estimating tree overheads. */
+    void add_arena(arenaAllocator * a) {
+      arenas.push_back(a);
+    }
     pageid_t get_current_size() {
       if(merge_level == 0) {
+        if(!arenas.empty()) {
+          pageid_t ret = 0;
+          for(size_t i = 0; i < arenas.size(); i++) { ret += arenas[i]->bytes_held(); }
+          return ret;
+        }
         return rb_size_estimator(base_size + bytes_in_small - bytes_in_large - bytes_out,
                                  /*num_tuples_base + */ num_tuples_in_small - num_tuples_in_large - num_tuples_out);;
       } else {
@@ -175,24 +195,60 @@ class mergeStats {
         return base_size + bytes_out - bytes_in_large;
       }
     }
-    void handed_off_tree() {
-      if(merge_level == 2) {
-      } else {
-        mergeable_size = get_current_size();
-        just_handed_off = true;
+    /** Like get_current_size(), but C0 only counts its live tuples and nodes, not the chunks they pin. */
+    pageid_t get_live_size() {
+      if(merge_level == 0 && !arenas.empty()) {
+        pageid_t ret = 0;
+        for(size_t i = 0; i < arenas.size(); i++) { ret += arenas[i]->bytes_in_use(); }
+        return ret;
       }
+      return get_current_size();
+    }
+    void handed_off_tree() {
+      mergeable_size = get_current_size();
+      just_handed_off = true;
     }
     void merged_tuples(dataTuple * merged, dataTuple * small, dataTuple * large) {
     }
     void wrote_datapage(dataPage *dp) {
 #if EXTENDED_STATS
-      stats_num_datapages_out++;
-      stats_bytes_out_with_overhead += (PAGE_SIZE * dp->get_page_count());
+      __sync_fetch_and_add(&stats_num_datapages_out, 1);
+      __sync_fetch_and_add(&stats_bytes_out_with_overhead, (PAGE_SIZE * dp->get_page_count()));
+#endif
+    }
+    /** A merge copied dp into its output without decoding it.  (dp also counts as written.) */
+    void copied_datapage(dataPage *dp) {
+      wrote_datapage(dp);
+#if EXTENDED_STATS
+      __sync_fetch_and_add(&stats_num_datapages_copied, 1);
+#endif
+    }
+    /** A merge indexed dp, a datapage of the large input, where it is.  (dp does not count as written.) */
+    void linked_datapage(dataPage *dp) {
+#if EXTENDED_STATS
+      __sync_fetch_and_add(&stats_num_datapages_linked, 1);
 #endif
     }
     pageid_t output_size() {
       return bytes_out;
     }
+    /** What a compaction filter did to this level's tuples, over the life of the table. */
+    struct filter_counts {
+      pageid_t dropped;
+      pageid_t rewritten;
+    };
+    /** A merge's compaction filter called name dropped and rewrote these many tuples. */
+    void filtered_tuples(const char * name, pageid_t dropped, pageid_t rewritten) {
+      std::lock_guard<std::mutex> g(filter_mut);
+      filter_counts & c = filters[name];
+      c.dropped += dropped;
+      c.rewritten += rewritten;
+    }
+    /** @return the counts for each compaction filter, by name.  Filters that never did anything are missing. */
+    std::map<std::string, filter_counts> get_filter_counts() {
+      std::lock_guard<std::mutex> g(filter_mut);
+      return filters;
+    }
   protected:
 
     double float_tv(struct timeval& tv) {
@@ -208,7 +264,7 @@ class mergeStats {
       pageid_t target_size; // Needed?
     };
   public: // XXX eliminate public fields; these are still required because various bits of calculation (bloom filter size, estimated c0 run length, etc...) are managed outside of mergeManager.
-    int merge_level;               /// The tree component / merge level that we're tracking.  1 => C0->C1, 2 => C1->C2
+    int merge_level;               /// The tree component / merge level that we're tracking.  1 => C0->C1, 2 => C1->C2, n => C(n-1)->Cn
     pageid_t base_size;            /// size of existing tree component (c[merge_level]') at beginning of current merge.
   protected:
     pageid_t mergeable_size;       /// The size of c[merge_level]_mergeable, assuming it exists.  Protected by mutex.
@@ -237,6 +293,10 @@ class mergeStats {
     double out_progress;
 
     bool active;                    /// True if this merger is running, or blocked by rate limiting.  False if the upstream input does not exist.
+
+    std::vector<arenaAllocator*> arenas; /// For C0, the allocators that hold the trees (if any).  Not stored on disk.
+    std::mutex filter_mut;
+    std::map<std::string, filter_counts> filters; /// See filtered_tuples().  Not stored on disk.
 #if EXTENDED_STATS
     pageid_t stats_merge_count;          /// This is the stats_merge_count'th merge
     struct timeval stats_sleep;          /// When did we go to sleep waiting for input?
@@ -245,6 +305,8 @@ class mergeStats {
     struct timespec stats_last_tick;
     pageid_t stats_bytes_out_with_overhead;/// How many bytes did we write (including internal tree nodes)?
     pageid_t stats_num_datapages_out;    /// How many datapages?
+    pageid_t stats_num_datapages_copied; /// How many of them were copied from the large input as is?
+    pageid_t stats_num_datapages_linked; /// How many datapages of the large input were kept where they were?
     pageid_t stats_bytes_in_small_delta; /// How many bytes from the small input tree during this tick (for C0, we ignore tree overheads)?
     double stats_lifetime_elapsed;       /// How long has this tree existed, in seconds?
     double stats_lifetime_active;        /// How long has this tree been running (i.e.; active = true), in seconds?
@@ -281,6 +343,7 @@ class mergeStats {
           "Read (large) %7lld %7lld      -   " " %6.1f %6.1f" " %8.1f %8.1f"   "\n"
           "Disk         %7lld %7lld      -   " " %6.1f %6.1f" " %8.1f %8.1f"   "\n"
           ".....................................................................\n"
+          "datapages copied verbatim: %lld linked in place: %lld\n"
           "avg tuple len: %6.2fKB w/ disk ovehead: %6.2fKB\n"
           "effective throughput: (mb/s ; nsec/byte): (%.2f; %.2f) active"      "\n"
           "                                          (%.2f; %.2f) wallclock"   "\n"
@@ -293,9 +356,15 @@ class mergeStats {
           (long long)mb_ins, (long long)kt_ins,                    mb_ins / work_time, mb_ins / total_time, kt_ins / work_time,  kt_ins / total_time,
           (long long)mb_inl, (long long)kt_inl,                    mb_inl / work_time, mb_inl / total_time, kt_inl / work_time,  kt_inl / total_time,
           (long long)mb_hdd, (long long)kt_hdd,                    mb_hdd / work_time, mb_hdd / total_time, kt_hdd / work_time,  kt_hdd / total_time,
+          (long long)stats_num_datapages_copied, (long long)stats_num_datapages_linked,
           mb_out / kt_out, phys_mb_out / kt_out,
           mb_ins / work_time, 1000.0 * work_time / mb_ins, mb_ins / total_time, 1000.0 * total_time / mb_ins
           );
+      std::map<std::string, filter_counts> f = get_filter_counts();
+      for(std::map<std::string, filter_counts>::iterator it = f.begin(); it != f.end(); ++it) {
+        fprintf(fd, "compaction filter %s: dropped %lld rewrote %lld\n", it->first.c_str(),
+                (long long)it->second.dropped, (long long)it->second.rewritten);
+      }
 #endif
     }
   };
@@ -0,0 +1,161 @@
+/*
+ * rangeTombstones.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "rangeTombstones.h"
+
+rangeTombstones::rangeTombstones() : count_(0) {
+  pthread_mutex_init(&mut_, 0);
+}
+
+rangeTombstones::~rangeTombstones() {
+  for(size_t i = 0; i < ranges_.size(); i++) {
+    dataTuple::freetuple(ranges_[i].start);
+    if(ranges_[i].end) { dataTuple::freetuple(ranges_[i].end); }
+  }
+  pthread_mutex_destroy(&mut_);
+}
+
+void rangeTombstones::add(const dataTuple * start, const dataTuple * end, uint64_t id) {
+  range r;
+  r.start = dataTuple::create(start->strippedkey(), start->strippedkeylen());
+  r.end = end ? dataTuple::create(end->strippedkey(), end->strippedkeylen()) : NULL;
+  r.id = id;
+  pthread_mutex_lock(&mut_);
+  ranges_.push_back(r);
+  count_ = ranges_.size();
+  pthread_mutex_unlock(&mut_);
+}
+
+void rangeTombstones::add_since(rangeTombstones * other, uint64_t min_id) {
+  std::vector<range> copies;
+  pthread_mutex_lock(&other->mut_);
+  for(size_t i = 0; i < other->ranges_.size(); i++) {
+    if(other->ranges_[i].id >= min_id) {
+      range r = other->ranges_[i];
+      r.start = r.start->create_copy();
+      r.end = r.end ? r.end->create_copy() : NULL;
+      copies.push_back(r);
+    }
+  }
+  pthread_mutex_unlock(&other->mut_);
+  pthread_mutex_lock(&mut_);
+  ranges_.insert(ranges_.end(), copies.begin(), copies.end());
+  count_ = ranges_.size();
+  pthread_mutex_unlock(&mut_);
+}
+
+uint64_t rangeTombstones::max_id() {
+  uint64_t ret = 0;
+  pthread_mutex_lock(&mut_);
+  for(size_t i = 0; i < ranges_.size(); i++) {
+    if(ranges_[i].id > ret) { ret = ranges_[i].id; }
+  }
+  pthread_mutex_unlock(&mut_);
+  return ret;
+}
+
+bool rangeTombstones::covers_locked(const byte * key, size_t keylen, dataTuple ** end, dataTuple ** start) {
+  bool ret = false;
+  pthread_mutex_lock(&mut_);
+  for(size_t i = 0; i < ranges_.size(); i++) {
+    const range & r = ranges_[i];
+    if(dataTuple::compare(r.start->strippedkey(), r.start->strippedkeylen(), key, keylen) > 0) { continue; }
+    if(r.end && dataTuple::compare(key, keylen, r.end->strippedkey(), r.end->strippedkeylen()) >= 0) { continue; }
+    ret = true;
+    if(end) { *end = r.end ? r.end->create_copy() : NULL; }
+    if(start) { *start = r.start->create_copy(); }
+    break;
+  }
+  pthread_mutex_unlock(&mut_);
+  return ret;
+}
+
+bool rangeTombstones::overlaps(const dataTuple * start, const dataTuple * end) {
+  if(!count_) { return false; }
+  bool ret = false;
+  pthread_mutex_lock(&mut_);
+  for(size_t i = 0; i < ranges_.size(); i++) {
+    const range & r = ranges_[i];
+    if(end && dataTuple::compare_obj(r.start, end) >= 0) { continue; }
+    if(start && r.end && dataTuple::compare_obj(start, r.end) >= 0) { continue; }
+    ret = true;
+    break;
+  }
+  pthread_mutex_unlock(&mut_);
+  return ret;
+}
+
+// format: count _ (id _ start _ has end _ [end])*, with the keys in dataTuple::to_bytes() format.
+
+size_t rangeTombstones::marshalled_length() {
+  pthread_mutex_lock(&mut_);
+  size_t ret = sizeof(uint32_t);
+  for(size_t i = 0; i < ranges_.size(); i++) {
+    ret += sizeof(uint64_t) + ranges_[i].start->byte_length() + 1;
+    if(ranges_[i].end) { ret += ranges_[i].end->byte_length(); }
+  }
+  pthread_mutex_unlock(&mut_);
+  return ret;
+}
+
+void rangeTombstones::marshal(byte * buf) {
+  pthread_mutex_lock(&mut_);
+  *(uint32_t*)buf = ranges_.size();
+  buf += sizeof(uint32_t);
+  for(size_t i = 0; i < ranges_.size(); i++) {
+    *(uint64_t*)buf = ranges_[i].id;
+    buf += sizeof(uint64_t);
+    byte * b = ranges_[i].start->to_bytes();
+    memcpy(buf, b, ranges_[i].start->byte_length());
+    buf += ranges_[i].start->byte_length();
+    free(b);
+    *buf = ranges_[i].end ? 1 : 0;
+    buf++;
+    if(ranges_[i].end) {
+      b = ranges_[i].end->to_bytes();
+      memcpy(buf, b, ranges_[i].end->byte_length());
+      buf += ranges_[i].end->byte_length();
+      free(b);
+    }
+  }
+  pthread_mutex_unlock(&mut_);
+}
+
+void rangeTombstones::unmarshal(const byte * buf, size_t len) {
+  if(len < sizeof(uint32_t)) { return; }
+  uint32_t n = *(const uint32_t*)buf;
+  buf += sizeof(uint32_t);
+  pthread_mutex_lock(&mut_);
+  for(uint32_t i = 0; i < n; i++) {
+    range r;
+    r.id = *(const uint64_t*)buf;
+    buf += sizeof(uint64_t);
+    r.start = dataTuple::from_bytes((byte*)buf);
+    buf += r.start->byte_length();
+    bool has_end = *buf;
+    buf++;
+    r.end = NULL;
+    if(has_end) {
+      r.end = dataTuple::from_bytes((byte*)buf);
+      buf += r.end->byte_length();
+    }
+    ranges_.push_back(r);
+  }
+  count_ = ranges_.size();
+  pthread_mutex_unlock(&mut_);
+}
@@ -0,0 +1,93 @@
+/*
+ * rangeTombstones.h
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef RANGETOMBSTONES_H_
+#define RANGETOMBSTONES_H_
+
+#include <pthread.h>
+#include <vector>
+#include <stasis/common.h>
+#include "dataTuple.h"
+
+/**
+ * The key ranges of a diskTreeComponent whose contents have been deleted
+ * by bLSM::dropRange().
+ *
+ * A range tombstone is created after everything in the component was
+ * written, so it hides the component's tuples in [start, end) without
+ * touching them.  Every component that exists when a range is dropped gets
+ * a copy, so a key that is dead in one component is dead in all of the
+ * older ones too.  The tuples are discarded for real by the merges that
+ * read them, and the ranges go away with the components that hold them.
+ *
+ * Ranges are only ever added.  covers() does not take the lock while the
+ * set is empty, which is the common case.
+ */
+class rangeTombstones {
+public:
+  rangeTombstones();
+  ~rangeTombstones();
+
+  /** Add [start, end).  end == NULL means there is no upper bound.  Copies both keys. */
+  void add(const dataTuple * start, const dataTuple * end, uint64_t id);
+  /** Add each range of other whose id is at least min_id. */
+  void add_since(rangeTombstones * other, uint64_t min_id);
+
+  bool empty() { return !count_; }
+  /** @return the largest id in the set, or zero if it is empty. */
+  uint64_t max_id();
+
+  /**
+   * @return true if key is inside one of the ranges.  If so, and end is not
+   * NULL, *end is set to a (caller-freed) copy of that range's end, or to
+   * NULL if the range is unbounded.  Likewise for start, which is never NULL.
+   */
+  bool covers(const byte * key, size_t keylen, dataTuple ** end = NULL, dataTuple ** start = NULL) {
+    if(!count_) { return false; }
+    return covers_locked(key, keylen, end, start);
+  }
+  bool covers(const dataTuple * t, dataTuple ** end = NULL, dataTuple ** start = NULL) {
+    return covers(t->strippedkey(), t->strippedkeylen(), end, start);
+  }
+  /** @return true if one of the ranges intersects [start, end).  NULL bounds are unbounded. */
+  bool overlaps(const dataTuple * start, const dataTuple * end);
+
+  /** @return the number of bytes marshal() writes. */
+  size_t marshalled_length();
+  void marshal(byte * buf);
+  /** Add the ranges marshal() wrote to buf. */
+  void unmarshal(const byte * buf, size_t len);
+
+private:
+  rangeTombstones(const rangeTombstones&);
+  void operator=(const rangeTombstones&);
+
+  bool covers_locked(const byte * key, size_t keylen, dataTuple ** end, dataTuple ** start);
+
+  struct range {
+    dataTuple * start;
+    dataTuple * end;
+    uint64_t id;
+  };
+
+  pthread_mutex_t mut_;
+  std::vector<range> ranges_;
+  volatile int count_;
+};
+
+#endif /* RANGETOMBSTONES_H_ */
@@ -23,6 +23,8 @@
 #define REGIONALLOCATOR_H_
 
 #include <stasis/transactional.h>
+#include <algorithm>
+#include <vector>
 
 class regionAllocator
 {
@@ -114,6 +116,50 @@ public:
     TarrayListDealloc(xid, header_.region_list);
     Tdealloc(xid, rid_);
   }
+  // Like dealloc_regions(), but move the regions that hold any of pages
+  // (which must be sorted) to the end of heir's list instead of freeing them.
+  void dealloc_regions(int xid, regionAllocator * heir, const std::vector<pageid_t> & pages) {
+    pageid_t regionCount = TarrayListLength(xid, header_.region_list);
+    for(recordid list_entry = header_.region_list;
+        list_entry.slot < regionCount; list_entry.slot++) {
+      pageid_t pid;
+      Tread(xid, list_entry, &pid);
+      std::vector<pageid_t>::const_iterator it = std::lower_bound(pages.begin(), pages.end(), pid);
+      if(it != pages.end() && *it < pid + header_.region_page_count) {
+        TarrayListExtend(xid, heir->header_.region_list, 1);
+        recordid rid = heir->header_.region_list;
+        rid.slot = heir->regionCount_;
+        Tset(xid, rid, &pid);
+        heir->regionCount_++;
+      } else {
+#ifndef CHECK_FOR_SCRIBBLING
+        TregionDealloc(xid, pid);
+#endif
+      }
+    }
+    assert(heir->regionCount_ == TarrayListLength(xid, heir->header_.region_list));
+    TarrayListDealloc(xid, header_.region_list);
+    Tdealloc(xid, rid_);
+  }
+  // Move other's regions to the end of our list, and free other's
+  // persistent state.  other must not be used afterwards.
+  void adopt_regions(int xid, regionAllocator * other) {
+    pageid_t otherCount = TarrayListLength(xid, other->header_.region_list);
+    for(recordid list_entry = other->header_.region_list;
+        list_entry.slot < otherCount; list_entry.slot++) {
+      pageid_t pid;
+      Tread(xid, list_entry, &pid);
+      TarrayListExtend(xid, header_.region_list, 1);
+      recordid rid = header_.region_list;
+      rid.slot = regionCount_;
+      Tset(xid, rid, &pid);
+      regionCount_++;
+    }
+    assert(regionCount_ == TarrayListLength(xid, header_.region_list));
+    TarrayListDealloc(xid, other->header_.region_list);
+    Tdealloc(xid, other->rid_);
+    other->done();
+  }
   pageid_t * list_regions(int xid, pageid_t * region_length, pageid_t * region_count) {
       *region_count = TarrayListLength(xid, header_.region_list);
       pageid_t * ret = (pageid_t*)malloc(sizeof(pageid_t) * *region_count);
@@ -130,6 +176,7 @@ public:
     endOfRegion_ = INVALID_PAGE;
   }
   recordid header_rid() { return rid_; }
+  pageid_t region_page_count() { return header_.region_page_count; }
 
 
   lsn_t get_lsn(int xid) {
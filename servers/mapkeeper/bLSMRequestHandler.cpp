@@ -21,6 +21,7 @@
 #include <stasis/logger/safeWrites.h>
 
 #include <iostream>
+#include <set>
 #include <signal.h>
 #include "mergeScheduler.h"
 #include "bLSM.h"
@@ -110,6 +111,8 @@ LSMServerHandler::LSMServerHandler(int argc, char **argv) {
 	}
 
 	pthread_mutex_init(&mutex_, 0);
+	pthread_rwlock_init(&idCacheLock_, 0);
+	idCacheEpoch_ = 0;
 	bLSM::init_stasis();
 
 	int xid = Tbegin();
@@ -156,17 +159,15 @@ void LSMServerHandler::initNextDatabaseId() {
 	dataTuple* end = buildTuple(id + 1, "");
 	bLSM::iterator* itr = new bLSM::iterator(ltable_, start);
 	dataTuple* current;
-	while ((current = itr->getnext())) {
+	while ((current = itr->getnext_borrowed())) {
 		// are we at the end of range?
 		if (dataTuple::compare_obj(current, end) >= 0) {
-			dataTuple::freetuple(current);
 			break;
 		}
 		uint32_t currentId = *((uint32_t*) (current->data()));
 		if (currentId > nextDatabaseId_) {
 			nextDatabaseId_ = currentId;
 		}
-		dataTuple::freetuple(current);
 	}
 	nextDatabaseId_++;
 	delete itr;
@@ -232,7 +233,9 @@ ResponseCode::type LSMServerHandler::addMap(const std::string& databaseName) {
 		fprintf(trace, "Success = addMap(%s)\n", databaseName.c_str());
 		fflush(trace);
 	}
-	return insert(tup);
+	ResponseCode::type code = insert(tup);
+	invalidateDatabaseId(databaseName);
+	return code;
 }
 
 ResponseCode::type LSMServerHandler::dropMap(const std::string& databaseName) {
@@ -250,26 +253,16 @@ ResponseCode::type LSMServerHandler::dropMap(const std::string& databaseName) {
 	if (exists) {
 		dataTuple::freetuple(exists);
 
-		dataTuple * startKey = buildTuple(id, "");
-		bLSM::iterator * itr = new bLSM::iterator(ltable_, startKey);
-		dataTuple::freetuple(startKey);
-		dataTuple * current;
-
 		// insert tombstone; deletes metadata entry for map; frees tup
 		insert(tup);
+		invalidateDatabaseId(databaseName);
 
-		while (NULL != (current = itr->getnext())) {
-			if (*((uint32_t*) current->strippedkey()) != id) {
-				dataTuple::freetuple(current);
-				break;
-			}
-			dataTuple * del = dataTuple::create(current->strippedkey(),
-					current->strippedkeylen());
-			ltable_->insertTuple(del);
-			dataTuple::freetuple(del);
-			dataTuple::freetuple(current);
-		}
-		delete itr;
+		// one range tombstone for the map's records, however many there are.
+		dataTuple * startKey = buildTuple(id, "");
+		dataTuple * endKey = buildTuple(id + 1, "");
+		ltable_->dropRange(startKey, endKey);
+		dataTuple::freetuple(startKey);
+		dataTuple::freetuple(endKey);
 		if (trace) {
 			fprintf(trace, "Success = dropMap(%s)\n", databaseName.c_str());
 			fflush(trace);
@@ -290,15 +283,13 @@ void LSMServerHandler::listMaps(StringListResponse& _return) {
 	bLSM::iterator * itr = new bLSM::iterator(ltable_, startKey);
 	dataTuple::freetuple(startKey);
 	dataTuple * current;
-	while (NULL != (current = itr->getnext())) {
+	while (NULL != (current = itr->getnext_borrowed())) {
 		if (*((uint32_t*) current->strippedkey()) != 0) {
-			dataTuple::freetuple(current);
 			break;
 		}
 		_return.values.push_back(
 				std::string((char*) (current->strippedkey()) + sizeof(uint32_t),
 						current->strippedkeylen() - sizeof(uint32_t)));
-		dataTuple::freetuple(current);
 	}
 	delete itr;
 	if (trace) {
@@ -331,13 +322,16 @@ void LSMServerHandler::scan(RecordListResponse& _return,
 	} else {
 		end = buildTuple(id, endKey);
 	}
-	bLSM::iterator* itr = new bLSM::iterator(ltable_, start);
+	// Descending scans start at the end key and walk back to the start key.
+	bLSM::iterator* itr = (order == ScanOrder::Descending)
+			? new bLSM::iterator(ltable_, end, true)
+			: new bLSM::iterator(ltable_, start);
 
 	int32_t resultSize = 0;
 
 	while ((maxRecords == 0 || (int32_t) (_return.records.size()) < maxRecords)
 			&& (maxBytes == 0 || resultSize < maxBytes)) {
-		dataTuple* current = itr->getnext();
+		dataTuple* current = itr->getnext_borrowed(); // owned by itr
 		if (current == NULL) {
 			_return.responseCode = mapkeeper::ResponseCode::ScanEnded;
 			if (trace) {
@@ -347,22 +341,39 @@ void LSMServerHandler::scan(RecordListResponse& _return,
 			break;
 		}
 
-		int cmp = dataTuple::compare_obj(current, start);
-		if ((!startKeyIncluded) && cmp == 0) {
-			dataTuple::freetuple(current);
-			continue;
-		}
+		if (order == ScanOrder::Descending) {
+			// an empty end key stands for the next map, which is never included.
+			int cmp = dataTuple::compare_obj(current, end);
+			if ((!endKeyIncluded || endKey.empty()) && cmp == 0) {
+				continue;
+			}
 
-		// are we at the end of range?
-		cmp = dataTuple::compare_obj(current, end);
-		if ((!endKeyIncluded && cmp >= 0) || (endKeyIncluded && cmp > 0)) {
-			dataTuple::freetuple(current);
-			_return.responseCode = mapkeeper::ResponseCode::ScanEnded;
-			if (trace) {
-				fprintf(trace, "ScanEnded = scan(...)\n");
-				fflush(trace);
+			// are we past the start of range?
+			cmp = dataTuple::compare_obj(current, start);
+			if (cmp < 0 || ((!startKeyIncluded) && cmp == 0)) {
+				_return.responseCode = mapkeeper::ResponseCode::ScanEnded;
+				if (trace) {
+					fprintf(trace, "ScanEnded = scan(...)\n");
+					fflush(trace);
+				}
+				break;
+			}
+		} else {
+			int cmp = dataTuple::compare_obj(current, start);
+			if ((!startKeyIncluded) && cmp == 0) {
+				continue;
+			}
+
+			// are we at the end of range?
+			cmp = dataTuple::compare_obj(current, end);
+			if ((!endKeyIncluded && cmp >= 0) || (endKeyIncluded && cmp > 0)) {
+				_return.responseCode = mapkeeper::ResponseCode::ScanEnded;
+				if (trace) {
+					fprintf(trace, "ScanEnded = scan(...)\n");
+					fflush(trace);
+				}
+				break;
 			}
-			break;
 		}
 
 		Record rec;
@@ -373,7 +384,6 @@ void LSMServerHandler::scan(RecordListResponse& _return,
 		rec.value.assign((char*) (current->data()), dataSize);
 		_return.records.push_back(rec);
 		resultSize += keySize + dataSize;
-		dataTuple::freetuple(current);
 	}
 	delete itr;
 }
@@ -422,19 +432,42 @@ void LSMServerHandler::get(BinaryResponse& _return,
 }
 
 uint32_t LSMServerHandler::getDatabaseId(const std::string& databaseName) {
+	pthread_rwlock_rdlock(&idCacheLock_);
+	std::map<std::string, uint32_t>::const_iterator it = idCache_.find(
+			databaseName);
+	if (it != idCache_.end()) {
+		uint32_t id = it->second;
+		pthread_rwlock_unlock(&idCacheLock_);
+		return id;
+	}
+	uint64_t epoch = idCacheEpoch_;
+	pthread_rwlock_unlock(&idCacheLock_);
+
 	dataTuple* tup = buildTuple(0, databaseName);
 	dataTuple* databaseId = get(tup);
 	dataTuple::freetuple(tup);
 	if (databaseId == NULL) {
-		// database not found
-		std::cout << "db not found" << std::endl;
+		// database not found.  Misses are not cached; addMap() is rare.
 		return 0;
 	}
 	uint32_t id = *((uint32_t*) (databaseId->data()));
 	dataTuple::freetuple(databaseId);
+
+	pthread_rwlock_wrlock(&idCacheLock_);
+	if (epoch == idCacheEpoch_) {
+		idCache_[databaseName] = id;
+	}
+	pthread_rwlock_unlock(&idCacheLock_);
 	return id;
 }
 
+void LSMServerHandler::invalidateDatabaseId(const std::string& databaseName) {
+	pthread_rwlock_wrlock(&idCacheLock_);
+	idCache_.erase(databaseName);
+	idCacheEpoch_++;
+	pthread_rwlock_unlock(&idCacheLock_);
+}
+
 dataTuple* LSMServerHandler::get(uint32_t databaseId,
 		const std::string& recordName) {
 	dataTuple* recordKey = buildTuple(databaseId, recordName);
@@ -502,12 +535,56 @@ ResponseCode::type LSMServerHandler::insert(const std::string& databaseName,
 
 ResponseCode::type LSMServerHandler::insertMany(const std::string& databaseName,
 		const std::vector<Record> & records) {
+	uint32_t id = getDatabaseId(databaseName);
+	if (id == 0) {
+		if (trace) {
+			fprintf(trace, "MapNotFound = insertMany(%s, ...)\n",
+					databaseName.c_str());
+			fflush(trace);
+		}
+		return mapkeeper::ResponseCode::MapNotFound;
+	}
+	if (!blind_update) {
+		// check the whole batch first, so that a conflict inserts nothing.
+		// A key that appears twice in the batch conflicts with itself.
+		std::set<std::string> batchKeys;
+		for (size_t i = 0; i < records.size(); i++) {
+			bool exists = !batchKeys.insert(records[i].key).second;
+			if (!exists) {
+				dataTuple* oldRecordBody = get(id, records[i].key);
+				if (oldRecordBody != NULL) {
+					exists = !oldRecordBody->isDelete();
+					dataTuple::freetuple(oldRecordBody);
+				}
+			}
+			if (exists) {
+				if (trace) {
+					fprintf(trace, "RecordExists = insertMany(%s, ...) (%s)\n",
+							databaseName.c_str(), records[i].key.c_str());
+					fflush(trace);
+				}
+				return mapkeeper::ResponseCode::RecordExists;
+			}
+		}
+	}
+
+	// insertManyTuples() logs the batch and then commits it once.
+	std::vector<dataTuple*> tups(records.size());
+	for (size_t i = 0; i < records.size(); i++) {
+		tups[i] = buildTuple(id, records[i].key, records[i].value);
+	}
+	if (!tups.empty()) {
+		ltable_->insertManyTuples(&tups[0], tups.size());
+	}
+	for (size_t i = 0; i < tups.size(); i++) {
+		dataTuple::freetuple(tups[i]);
+	}
 	if (trace) {
-		fprintf(trace, "Error = insertMany(%s, ...) (not supported)\n",
-				databaseName.c_str());
+		fprintf(trace, "Success = insertMany(%s, %d records)\n",
+				databaseName.c_str(), (int) records.size());
 		fflush(trace);
 	}
-	return mapkeeper::ResponseCode::Error;
+	return mapkeeper::ResponseCode::Success;
 }
 
 ResponseCode::type LSMServerHandler::update(const std::string& databaseName,
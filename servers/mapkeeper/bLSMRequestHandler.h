@@ -16,6 +16,7 @@
  * limitations under the License.
  */
 #include "MapKeeper.h"
+#include <map>
 #include <protocol/TBinaryProtocol.h>
 #include <transport/TServerSocket.h>
 #include <transport/TBufferTransports.h>
@@ -50,6 +51,7 @@ public:
 private:
     ResponseCode::type insert(dataTuple* tuple);
     uint32_t getDatabaseId(const std::string& databaseName);
+    void invalidateDatabaseId(const std::string& databaseName);
     uint32_t nextDatabaseId();
     dataTuple* get(uint32_t databaseId, const std::string& recordName);
     dataTuple* get(dataTuple* tuple);
@@ -60,4 +62,10 @@ private:
     bLSM* ltable_;
     uint32_t nextDatabaseId_;
     pthread_mutex_t mutex_;
+    // name -> id for maps that exist.  Guarded by idCacheLock_; idCacheEpoch_
+    // is bumped on each invalidation so that a lookup that raced with
+    // dropMap() does not put a stale id back.
+    std::map<std::string, uint32_t> idCache_;
+    uint64_t idCacheEpoch_;
+    pthread_rwlock_t idCacheLock_;
 };
@@ -124,6 +124,24 @@ int main(int argc, char **argv) {
         cout << itr->key << " " << itr->value << endl;
     }
 
+    std::cout << std::endl;
+
+    // A batch that repeats a key.  Without --blind-update the server
+    // answers RecordExists, and inserts none of it.
+    std::vector<mapkeeper::Record> batch(3);
+    batch[0].key = "kkkkkkkkkkkkk5"; batch[0].value = "v5";
+    batch[1].key = "kkkkkkkkkkkkk6"; batch[1].value = "v6";
+    batch[2].key = "kkkkkkkkkkkkk5"; batch[2].value = "v55";
+    cout << client.insertMany(db, batch) << endl;
+    client.get(getResponse, db, "kkkkkkkkkkkkk6");
+    cout << getResponse.responseCode << endl;
+
+    batch.pop_back();
+    cout << client.insertMany(db, batch) << endl;
+    client.get(getResponse, db, "kkkkkkkkkkkkk5");
+    cout << getResponse.responseCode << endl;
+    cout << getResponse.value << endl;
+
     cout<< "prepare shut down..."<<endl;
     client.shutdown();
     cout<< "shut down..."<<endl;
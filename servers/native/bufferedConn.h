@@ -0,0 +1,221 @@
+/*
+ * bufferedConn.h
+ *
+ * Copyright 2010-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef BUFFEREDCONN_H_
+#define BUFFEREDCONN_H_
+
+#include "network.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+
+/**
+ * A non-blocking socket with its own read and write buffers, for
+ * epollServer.  The network.h style functions below let requestDispatch run
+ * against one of these, just like it runs against an int or a FILE*.
+ *
+ * epollServer only hands a connection to requestDispatch once a whole
+ * request header is in the read buffer (see requestheaderlength()), so
+ * ordinary requests never touch the socket until their response is
+ * complete.  Bulk requests, whose tuples are streamed after the server
+ * answers, fall back to blocking on the socket with poll().
+ */
+struct bufferedConn {
+  int fd;
+  int epfd; // the epoll instance of the I/O thread that owns fd.
+  byte * in;
+  size_t in_start, in_end, in_cap;
+  byte * out;
+  size_t out_start, out_end, out_cap;
+};
+
+static const size_t BUFFEREDCONN_INITIAL_SIZE = 16 * 1024;
+// Responses (large scans, mostly) are pushed to the socket once this much is buffered.
+static const size_t BUFFEREDCONN_FLUSH_SIZE = 1024 * 1024;
+
+static inline bufferedConn * bufferedconn_open(int fd, int epfd) {
+  bufferedConn * c = (bufferedConn*)malloc(sizeof(*c));
+  c->fd = fd;
+  c->epfd = epfd;
+  c->in = (byte*)malloc(BUFFEREDCONN_INITIAL_SIZE);
+  c->in_start = c->in_end = 0;
+  c->in_cap = BUFFEREDCONN_INITIAL_SIZE;
+  c->out = (byte*)malloc(BUFFEREDCONN_INITIAL_SIZE);
+  c->out_start = c->out_end = 0;
+  c->out_cap = BUFFEREDCONN_INITIAL_SIZE;
+  return c;
+}
+static inline void bufferedconn_close(bufferedConn * c) {
+  close(c->fd);
+  free(c->in);
+  free(c->out);
+  free(c);
+}
+static inline size_t bufferedconn_readable(bufferedConn * c) {
+  return c->in_end - c->in_start;
+}
+static inline size_t bufferedconn_unflushed(bufferedConn * c) {
+  return c->out_end - c->out_start;
+}
+/** @return true if the read buffer holds the start of a complete request. */
+static inline bool bufferedconn_has_request(bufferedConn * c) {
+  return requestheaderlength(c->in + c->in_start, bufferedconn_readable(c)) != 0;
+}
+/** Make room for len more bytes at the end of buf, sliding consumed bytes out of the way first. */
+static inline void bufferedconn_reserve(byte ** buf, size_t * start, size_t * end, size_t * cap, size_t len) {
+  if(*start == *end) { *start = *end = 0; }
+  if(*end + len <= *cap) { return; }
+  if(*start) {
+    memmove(*buf, *buf + *start, *end - *start);
+    *end -= *start;
+    *start = 0;
+  }
+  if(*end + len > *cap) {
+    while(*end + len > *cap) { *cap *= 2; }
+    *buf = (byte*)realloc(*buf, *cap);
+  }
+}
+/**
+ * Read whatever the socket has to offer without blocking.
+ * @return 0 if the socket has been drained, or EOF / an errno if it is closed.
+ */
+static inline int bufferedconn_fill(bufferedConn * c) {
+  while(true) {
+    bufferedconn_reserve(&c->in, &c->in_start, &c->in_end, &c->in_cap, BUFFEREDCONN_INITIAL_SIZE);
+    ssize_t n = read(c->fd, c->in + c->in_end, c->in_cap - c->in_end);
+    if(n > 0) {
+      c->in_end += n;
+    } else if(n == 0) {
+      return EOF;
+    } else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    } else if(errno != EINTR) {
+      return errno;
+    }
+  }
+}
+/**
+ * Write buffered output.  If block is false, stop as soon as the socket is full.
+ * @return 0 on success, or an errno.
+ */
+static inline int bufferedconn_flush(bufferedConn * c, bool block) {
+  while(c->out_start < c->out_end) {
+    ssize_t n = write(c->fd, c->out + c->out_start, c->out_end - c->out_start);
+    if(n >= 0) {
+      c->out_start += n;
+    } else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+      if(!block) { return 0; }
+      struct pollfd p = { c->fd, POLLOUT, 0 };
+      if(poll(&p, 1, -1) == -1 && errno != EINTR) { return errno; }
+    } else if(errno != EINTR) {
+      perror("writetosocket failed");
+      return errno;
+    }
+  }
+  c->out_start = c->out_end = 0;
+  return 0;
+}
+
+static inline int readfromsocket(bufferedConn * c, void *buf, ssize_t count) {
+  while(bufferedconn_readable(c) < (size_t)count) {
+    // The client may be waiting on us before it sends the rest.
+    int err = bufferedconn_flush(c, true);
+    if(err) { return err; }
+    struct pollfd p = { c->fd, POLLIN, 0 };
+    if(poll(&p, 1, -1) == -1 && errno != EINTR) { return errno; }
+    err = bufferedconn_fill(c);
+    if(err && bufferedconn_readable(c) < (size_t)count) {
+      errno = err;
+      return err;
+    }
+  }
+  memcpy(buf, c->in + c->in_start, count);
+  c->in_start += count;
+  return 0;
+}
+static inline int writetosocket(bufferedConn * c, const void *buf, ssize_t count) {
+  bufferedconn_reserve(&c->out, &c->out_start, &c->out_end, &c->out_cap, count);
+  memcpy(c->out + c->out_end, buf, count);
+  c->out_end += count;
+  if(bufferedconn_unflushed(c) >= BUFFEREDCONN_FLUSH_SIZE) {
+    return bufferedconn_flush(c, true);
+  }
+  return 0;
+}
+static inline network_op_t readopfromsocket(bufferedConn * c, logstore_opcode_type type) {
+  network_op_t ret;
+  int err = readfromsocket(c, &ret, sizeof(ret));
+  if(err == EOF) {
+    perror("Socket closed mid request.");
+    return LOGSTORE_CONN_CLOSED_ERROR;
+  } else if(err) {
+    perror("Could not read opcode from socket");
+    return LOGSTORE_SOCKET_ERROR;
+  }
+  return checkop(ret, type);
+}
+static inline int writeoptosocket(bufferedConn * c, network_op_t op) {
+  assert(opiserror(op) || opisrequest(op) || opisresponse(op));
+  int ret = writetosocket(c, &op, sizeof(network_op_t));
+  if(!ret && op == LOGSTORE_RESPONSE_RECEIVING_TUPLES) {
+    ret = bufferedconn_flush(c, true);
+  }
+  return ret;
+}
+static inline dataTuple* readtuplefromsocket(bufferedConn * c, int * err) {
+  len_t keylen, datalen;
+
+  if(( *err = readfromsocket(c, &keylen, sizeof(keylen))   )) return NULL;
+  if(keylen == DELETE) return NULL; // *err is zero.
+  if(( *err = readfromsocket(c, &datalen, sizeof(datalen)) )) return NULL;
+
+  dataTuple * ret = dataTuple::alloc(keylen, datalen);
+  if(( *err = readfromsocket(c, ret->rawkey(), dataTuple::length_from_header(keylen, datalen)) )) {
+    dataTuple::freetuple(ret);
+    return NULL;
+  }
+  return ret;
+}
+static inline int writeendofiteratortosocket(bufferedConn * c) {
+  return writetosocket(c, &DELETE, sizeof(DELETE));
+}
+static inline int writetupletosocket(bufferedConn * c, const dataTuple *tup) {
+  len_t keylen, datalen;
+  int err;
+
+  if(tup == NULL) {
+    if(( err = writeendofiteratortosocket(c)                                         )) return err;
+  } else {
+    const byte* buf = tup->get_bytes(&keylen, &datalen);
+    if(( err = writetosocket(c, &keylen, sizeof(keylen))                             )) return err;
+    if(( err = writetosocket(c, &datalen, sizeof(datalen))                           )) return err;
+    if(( err = writetosocket(c, buf, dataTuple::length_from_header(keylen, datalen)) )) return err;
+  }
+  return 0;
+}
+static inline uint64_t readcountfromsocket(bufferedConn * c, int *err) {
+  uint64_t ret;
+  *err = readfromsocket(c, &ret, sizeof(ret));
+  return ret;
+}
+static inline int writecounttosocket(bufferedConn * c, uint64_t count) {
+  return writetosocket(c, &count, sizeof(count));
+}
+
+#endif /* BUFFEREDCONN_H_ */
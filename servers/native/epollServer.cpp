@@ -0,0 +1,243 @@
+/*
+ * epollServer.cpp
+ *
+ * Copyright 2010-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "epollServer.h"
+#include "requestDispatch.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+typedef struct {
+ epollServer * obj;
+ int self;
+} epoll_worker_arg;
+
+static void * io_worker_wrap(void * arg) {
+  ((epoll_worker_arg*)arg)->obj->io_worker(((epoll_worker_arg*)arg)->self);
+  free(arg);
+  return 0;
+}
+static void * request_worker_wrap(void * arg) {
+  return ((epollServer*)arg)->request_worker();
+}
+
+epollServer::epollServer(bLSM * ltable, int io_threads, int worker_threads, int port):
+  ltable(ltable),
+  port(port),
+  io_threads(io_threads),
+  worker_threads(worker_threads),
+  epfd((int*)malloc(sizeof(*epfd)*io_threads)),
+  io_thread((pthread_t*)malloc(sizeof(*io_thread)*io_threads)),
+  worker_thread((pthread_t*)malloc(sizeof(*worker_thread)*worker_threads)),
+  running(true) {
+  pthread_mutex_init(&queue_mut, 0);
+  pthread_cond_init(&queue_cond, 0);
+  for(int i = 0; i < io_threads; i++) {
+    epfd[i] = epoll_create(1024);
+    if(epfd[i] == -1) {
+      perror("ERROR creating epoll instance");
+      abort();
+    }
+    epoll_worker_arg * arg = (epoll_worker_arg*)malloc(sizeof(epoll_worker_arg));
+    arg->obj = this;
+    arg->self = i;
+    pthread_create(&io_thread[i], 0, io_worker_wrap, (void*)arg);
+  }
+  for(int i = 0; i < worker_threads; i++) {
+    pthread_create(&worker_thread[i], 0, request_worker_wrap, (void*)this);
+  }
+}
+
+void epollServer::rearm(bufferedConn * c) {
+  struct epoll_event ev;
+  ev.events = (bufferedconn_unflushed(c) ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+  ev.data.ptr = c;
+  if(epoll_ctl(c->epfd, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+    perror("ERROR rearming connection; closing it");
+    bufferedconn_close(c);
+  }
+}
+
+void epollServer::enqueue(bufferedConn * c) {
+  pthread_mutex_lock(&queue_mut);
+  queue.push_back(c);
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_mut);
+}
+
+void epollServer::handle_event(bufferedConn * c, uint32_t events) {
+  if(bufferedconn_unflushed(c)) {
+    // Still sending the last response; don't read more requests until it is out.
+    if(bufferedconn_flush(c, false)) {
+      bufferedconn_close(c);
+    } else if(!bufferedconn_unflushed(c) && bufferedconn_has_request(c)) {
+      enqueue(c);
+    } else {
+      rearm(c);
+    }
+    return;
+  }
+  int err = bufferedconn_fill(c);
+  if(bufferedconn_has_request(c)) {
+    enqueue(c); // if err is set, the worker will see it once the buffered requests are done.
+  } else if(err || (events & (EPOLLERR | EPOLLHUP))) {
+    bufferedconn_close(c);
+  } else {
+    rearm(c);
+  }
+}
+
+void * epollServer::io_worker(int self) {
+  const int MAX_EVENTS = 64;
+  struct epoll_event events[MAX_EVENTS];
+  while(running) {
+    int n = epoll_wait(epfd[self], events, MAX_EVENTS, 1000);
+    if(n == -1 && errno != EINTR) {
+      perror("ERROR in epoll_wait");
+    }
+    for(int i = 0; i < n; i++) {
+      handle_event((bufferedConn*)events[i].data.ptr, events[i].events);
+    }
+  }
+  return 0;
+}
+
+void * epollServer::request_worker() {
+  while(true) {
+    pthread_mutex_lock(&queue_mut);
+    while(running && queue.empty()) {
+      pthread_cond_wait(&queue_cond, &queue_mut);
+    }
+    if(queue.empty()) {
+      pthread_mutex_unlock(&queue_mut);
+      return 0;
+    }
+    bufferedConn * c = queue.front();
+    queue.pop_front();
+    pthread_mutex_unlock(&queue_mut);
+
+    // Run every request the client has sent so far, then push the responses out.
+    int err = 0;
+    while(!err && bufferedconn_has_request(c)) {
+      err = requestDispatch<bufferedConn*>::dispatch_request(c, ltable);
+    }
+    if(!err) { err = bufferedconn_flush(c, false); }
+    if(err) {
+      bufferedconn_flush(c, true); // e.g., the reply to OP_SHUTDOWN.
+      bufferedconn_close(c);
+    } else {
+      rearm(c);
+    }
+  }
+}
+
+bool epollServer::acceptLoop() {
+
+  int sockfd;
+  struct sockaddr_in serv_addr;
+  struct sockaddr_in cli_addr;
+  int newsockfd;
+
+  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  if(sockfd == -1) {
+    perror("ERROR opening socket");
+    return false;
+  }
+  int flag = 1;
+  setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (char*)&flag, sizeof(int));
+  bzero((char *) &serv_addr, sizeof(serv_addr));
+  serv_addr.sin_family = AF_INET;
+  serv_addr.sin_addr.s_addr = htonl(INADDR_ANY); // XXX security...
+  serv_addr.sin_port = htons(port);
+
+  if(bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) == -1) {
+    perror("ERROR on binding");
+    return false;
+  }
+  if(listen(sockfd,SOMAXCONN)==-1) {
+    perror("ERROR on listen");
+    return false;
+  }
+  printf("LSM Server listening (epoll, %d I/O threads, %d workers)....\n", io_threads, worker_threads);
+
+  int next_io_thread = 0;
+  while(ltable->accepting_new_requests) {
+    // wake up once in a while to notice OP_SHUTDOWN.
+    struct pollfd p = { sockfd, POLLIN, 0 };
+    if(poll(&p, 1, 1000) <= 0) { continue; }
+
+    socklen_t clilen = sizeof(cli_addr);
+    newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
+    if(newsockfd == -1) {
+      perror("ERROR on accept");
+      continue;
+    }
+#ifdef LOGSTORE_NODELAY
+    flag = 1;
+    if(setsockopt(newsockfd, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(int)) == -1) {
+      perror("ERROR on setting socket option TCP_NODELAY");
+      // ignore the error.
+    }
+#endif
+    if(fcntl(newsockfd, F_SETFL, fcntl(newsockfd, F_GETFL, 0) | O_NONBLOCK) == -1) {
+      perror("ERROR making socket non-blocking");
+      close(newsockfd);
+      continue;
+    }
+    bufferedConn * c = bufferedconn_open(newsockfd, epfd[next_io_thread]);
+    next_io_thread = (next_io_thread + 1) % io_threads;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = c;
+    if(epoll_ctl(c->epfd, EPOLL_CTL_ADD, newsockfd, &ev) == -1) {
+      perror("ERROR registering connection");
+      bufferedconn_close(c);
+    }
+  }
+  close(sockfd);
+  return true;
+}
+
+epollServer::~epollServer() {
+  pthread_mutex_lock(&queue_mut);
+  running = false;
+  pthread_cond_broadcast(&queue_cond);
+  pthread_mutex_unlock(&queue_mut);
+  for(int i = 0; i < io_threads; i++) {
+    pthread_join(io_thread[i], 0);
+    close(epfd[i]);
+  }
+  for(int i = 0; i < worker_threads; i++) {
+    pthread_join(worker_thread[i], 0);
+  }
+  pthread_mutex_destroy(&queue_mut);
+  pthread_cond_destroy(&queue_cond);
+  free(worker_thread);
+  free(io_thread);
+  free(epfd);
+}
@@ -0,0 +1,71 @@
+/*
+ * epollServer.h
+ *
+ * Copyright 2010-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef EPOLLSERVER_H_
+#define EPOLLSERVER_H_
+#include "blsm.h"
+#include "simpleServer.h"
+#include "bufferedConn.h"
+#include <atomic>
+#include <deque>
+
+/**
+ * Event driven alternative to simpleServer, for large numbers of
+ * connections.
+ *
+ * A fixed pool of I/O threads, each with its own epoll instance, reads
+ * from non-blocking sockets until a connection has a complete request
+ * header buffered.  The connection is then queued for a pool of worker
+ * threads, which run requestDispatch against its buffers, so a slow scan or
+ * a flush only ties up a worker, not the other connections on its I/O
+ * thread.
+ *
+ * Connections are registered with EPOLLONESHOT, and at any moment belong
+ * either to their I/O thread or to one worker, so they need no locking.
+ */
+class epollServer {
+public:
+  static const int DEFAULT_IO_THREADS = 4;
+  static const int DEFAULT_WORKER_THREADS = 64; // workers block on backpressure, flushes and bulk inserts.
+
+  epollServer(bLSM * ltable, int io_threads = DEFAULT_IO_THREADS, int worker_threads = DEFAULT_WORKER_THREADS, int port = simpleServer::DEFAULT_PORT);
+  bool acceptLoop();
+  ~epollServer();
+
+  void* io_worker(int self);
+  void* request_worker();
+private:
+  void handle_event(bufferedConn * c, uint32_t events);
+  void rearm(bufferedConn * c);
+  void enqueue(bufferedConn * c);
+
+  bLSM* ltable;
+  int port;
+  int io_threads;
+  int worker_threads;
+  int * epfd;
+  pthread_t * io_thread;
+  pthread_t * worker_thread;
+  pthread_mutex_t queue_mut;
+  pthread_cond_t queue_cond;
+  std::deque<bufferedConn*> queue;
+  std::atomic<bool> running; // io_worker() polls this without queue_mut.
+};
+
+#endif /* EPOLLSERVER_H_ */
@@ -29,6 +29,7 @@
 typedef unsigned char byte;
 #include <cstring>
 #include <assert.h>
+#include <poll.h>
 
 typedef uint8_t network_op_t;
 
@@ -42,7 +43,8 @@ static const network_op_t LOGSTORE_RESPONSE_SUCCESS = 1;
 static const network_op_t LOGSTORE_RESPONSE_FAIL = 2;
 static const network_op_t LOGSTORE_RESPONSE_SENDING_TUPLES = 3;
 static const network_op_t LOGSTORE_RESPONSE_RECEIVING_TUPLES = 4;
-static const network_op_t LOGSTORE_LAST_RESPONSE_CODE = 4;
+static const network_op_t LOGSTORE_RESPONSE_TAGGED = 5;  // Followed by the request id of an OP_TAGGED request, then its response.
+static const network_op_t LOGSTORE_LAST_RESPONSE_CODE = 5;
 
 //client codes
 static const network_op_t LOGSTORE_FIRST_REQUEST_CODE  = 8;
@@ -63,7 +65,11 @@ static const network_op_t OP_DBG_DROP_DATABASE        = 19;
 static const network_op_t OP_DBG_BLOCKMAP             = 20;
 static const network_op_t OP_DBG_NOOP                 = 21;
 static const network_op_t OP_DBG_SET_LOG_MODE         = 22;
-static const network_op_t LOGSTORE_LAST_REQUEST_CODE  = 22;
+
+static const network_op_t OP_FIND_MANY           = 23;  // Read a batch.  The keys follow the request, terminated by an end of iterator marker.
+static const network_op_t OP_TAGGED              = 24;  // Pipelined request: a 64-bit request id, then any request that does not stream tuples to the server.
+static const network_op_t OP_SCAN_REVERSE        = 25;  // Like OP_SCAN, but returns the range in descending order.
+static const network_op_t LOGSTORE_LAST_REQUEST_CODE  = 25;
 
 //error codes
 static const network_op_t LOGSTORE_FIRST_ERROR  = 27;
@@ -179,43 +185,58 @@ static inline bool opisresponse(network_op_t op) {
   return (LOGSTORE_FIRST_RESPONSE_CODE <= op && op <= LOGSTORE_LAST_RESPONSE_CODE);
 }
 
-static inline network_op_t readopfromsocket(FILE * sockf, logstore_opcode_type type) {
-  network_op_t ret;
-  MYFFLUSH(sockf); // our first read after a write is always (?) a readop, so fflush the write here.
-  ssize_t n = MYFREAD(&ret, sizeof(network_op_t), 1, sockf);
-  if(n == sizeof(network_op_t)) {
-    // done.
-  } else if(n == 0) { // EOF
-    perror("Socket closed mid request.");
-    return LOGSTORE_CONN_CLOSED_ERROR;
-  } else {
-    assert(n == -1); // sizeof(network_op_t) is 1, so short reads are impossible.
-    perror("Could not read opcode from socket");
-    return LOGSTORE_SOCKET_ERROR;
-  }
-  // sanity checking
+/** Sanity check an opcode read off the wire.  @return op, or LOGSTORE_PROTOCOL_ERROR. */
+static inline network_op_t checkop(network_op_t op, logstore_opcode_type type) {
   switch(type) {
   case LOGSTORE_CLIENT_REQUEST: {
-    if(!(opisrequest(ret) || opiserror(ret))) {
-      fprintf(stderr, "Read invalid request code %d\n", (int)ret);
-      if(opisresponse(ret)) {
+    if(!(opisrequest(op) || opiserror(op))) {
+      fprintf(stderr, "Read invalid request code %d\n", (int)op);
+      if(opisresponse(op)) {
         fprintf(stderr, "(also, the request code is a valid response code)\n");
       }
-      ret = LOGSTORE_PROTOCOL_ERROR;
+      op = LOGSTORE_PROTOCOL_ERROR;
     }
   } break;
   case LOGSTORE_SERVER_RESPONSE: {
-    if(!(opisresponse(ret) || opiserror(ret))) {
-      fprintf(stderr, "Read invalid response code %d\n", (int)ret);
-      if(opisrequest(ret)) {
+    if(!(opisresponse(op) || opiserror(op))) {
+      fprintf(stderr, "Read invalid response code %d\n", (int)op);
+      if(opisrequest(op)) {
         fprintf(stderr, "(also, the response code is a valid request code)\n");
       }
-      ret = LOGSTORE_PROTOCOL_ERROR;
+      op = LOGSTORE_PROTOCOL_ERROR;
     }
 
   }
   }
-  return ret;
+  return op;
+}
+/** @return true if reading from sockf would not block. */
+static inline bool socketreadable(FILE * sockf) {
+#ifdef __GLIBC__
+  if(sockf->_IO_read_ptr < sockf->_IO_read_end) { return true; } // already buffered by stdio.
+#endif
+  struct pollfd p = { fileno(sockf), POLLIN, 0 };
+  return poll(&p, 1, 0) == 1;
+}
+static inline network_op_t readopfromsocket(FILE * sockf, logstore_opcode_type type) {
+  network_op_t ret;
+  // Our first read after a write is always (?) a readop, so fflush the write
+  // here, unless the other side has already sent more.  In that case we will
+  // get back here without blocking, so pipelined requests (and responses)
+  // are written out in batches.
+  if(!socketreadable(sockf)) { MYFFLUSH(sockf); }
+  ssize_t n = MYFREAD(&ret, sizeof(network_op_t), 1, sockf);
+  if(n == sizeof(network_op_t)) {
+    // done.
+  } else if(n == 0) { // EOF
+    perror("Socket closed mid request.");
+    return LOGSTORE_CONN_CLOSED_ERROR;
+  } else {
+    assert(n == -1); // sizeof(network_op_t) is 1, so short reads are impossible.
+    perror("Could not read opcode from socket");
+    return LOGSTORE_SOCKET_ERROR;
+  }
+  return checkop(ret, type);
 }
 static inline network_op_t readopfromsocket(int sockd, logstore_opcode_type type) {
   network_op_t ret;
@@ -230,29 +251,7 @@ static inline network_op_t readopfromsocket(int sockd, logstore_opcode_type type
     perror("Could not read opcode from socket");
     return LOGSTORE_SOCKET_ERROR;
   }
-  // sanity checking
-  switch(type) {
-  case LOGSTORE_CLIENT_REQUEST: {
-    if(!(opisrequest(ret) || opiserror(ret))) {
-      fprintf(stderr, "Read invalid request code %d\n", (int)ret);
-      if(opisresponse(ret)) {
-        fprintf(stderr, "(also, the request code is a valid response code)\n");
-      }
-      ret = LOGSTORE_PROTOCOL_ERROR;
-    }
-  } break;
-  case LOGSTORE_SERVER_RESPONSE: {
-    if(!(opisresponse(ret) || opiserror(ret))) {
-      fprintf(stderr, "Read invalid response code %d\n", (int)ret);
-      if(opisrequest(ret)) {
-        fprintf(stderr, "(also, the response code is a valid request code)\n");
-      }
-      ret = LOGSTORE_PROTOCOL_ERROR;
-    }
-
-  }
-  }
-  return ret;
+  return checkop(ret, type);
 }
 static inline int writeoptosocket(FILE * sockf, network_op_t op) {
   assert(opiserror(op) || opisrequest(op) || opisresponse(op));
@@ -358,6 +357,44 @@ static inline int writetupletosocket(int sockd, const dataTuple* tup) {
 	return 0;
 
 }
+/**
+    Incremental parser for the fixed part of a request: the opcode, the two
+    tuples and, for OP_SCAN, OP_SCAN_REVERSE and OP_STAT_HISTOGRAM, the count.  This is
+    everything dispatch_request reads before the server starts responding;
+    bulk requests stream the rest of their tuples after that.
+
+    @return the length of the request header at the start of buf, or 0 if
+    buf does not hold all of it yet.
+ */
+static inline size_t requestheaderlength(const byte * buf, size_t len) {
+  if(len < sizeof(network_op_t)) { return 0; }
+  network_op_t op = buf[0];
+  size_t off = sizeof(network_op_t);
+  if(!opisrequest(op) || op == OP_DONE) { return off; } // the connection is about to be closed.
+  if(op == OP_TAGGED) {
+    off += sizeof(uint64_t);
+    if(len < off) { return 0; }
+    size_t inner = requestheaderlength(buf + off, len - off);
+    return inner ? off + inner : 0;
+  }
+  for(int i = 0; i < 2; i++) {
+    len_t keylen, datalen;
+    if(len < off + sizeof(keylen)) { return 0; }
+    memcpy(&keylen, buf + off, sizeof(keylen));
+    off += sizeof(keylen);
+    if(keylen == DELETE) { continue; }
+    if(len < off + sizeof(datalen)) { return 0; }
+    memcpy(&datalen, buf + off, sizeof(datalen));
+    off += sizeof(datalen) + dataTuple::length_from_header(keylen, datalen);
+    if(len < off) { return 0; }
+  }
+  if(op == OP_SCAN || op == OP_SCAN_REVERSE || op == OP_STAT_HISTOGRAM) {
+    off += sizeof(uint64_t);
+    if(len < off) { return 0; }
+  }
+  return off;
+}
+
 static inline uint64_t readcountfromsocket(FILE* sockf, int *err) {
 	uint64_t ret;
 	*err = readfromsocket(sockf, &ret, sizeof(ret));
@@ -27,6 +27,7 @@
 #include "merger.h"
 #include "blsm.h"
 #include "simpleServer.h"
+#include "epollServer.h"
 
 int main(int argc, char *argv[])
 {
@@ -35,6 +36,17 @@ int main(int argc, char *argv[])
     int log_mode = 0; // do not log by default.
     int64_t expiry_delta = 0;  // do not gc by default
     int port = simpleServer::DEFAULT_PORT;
+    int c2_merge_threads = 1;
+    int c2_merge_ranges = 1;
+    int64_t merge_prefetch_bytes = 0;
+    int64_t merge_write_behind_bytes = 0;
+    int c0_partitions = 1;
+    int disk_levels = 2;
+    std::vector<double> level_ratios;
+    int replay_threads = 1;
+    bool use_epoll = false;
+    int io_threads = epollServer::DEFAULT_IO_THREADS;
+    int worker_threads = epollServer::DEFAULT_WORKER_THREADS;
     stasis_buffer_manager_size = 1 * 1024 * 1024 * 1024 / PAGE_SIZE;  // 1.5GB total
 
     for(int i = 1; i < argc; i++) {
@@ -55,8 +67,41 @@ int main(int argc, char *argv[])
         } else if(!strcmp(argv[i], "--port")) {
             i++;
             port = atoi(argv[i]);
+        } else if(!strcmp(argv[i], "--c2-merge-threads")) {
+            i++;
+            c2_merge_threads = atoi(argv[i]);
+        } else if(!strcmp(argv[i], "--c2-merge-ranges")) {
+            i++;
+            c2_merge_ranges = atoi(argv[i]);
+        } else if(!strcmp(argv[i], "--merge-prefetch-bytes")) {
+            i++;
+            merge_prefetch_bytes = atoll(argv[i]);
+        } else if(!strcmp(argv[i], "--merge-write-behind-bytes")) {
+            i++;
+            merge_write_behind_bytes = atoll(argv[i]);
+        } else if(!strcmp(argv[i], "--c0-partitions")) {
+            i++;
+            c0_partitions = atoi(argv[i]);
+        } else if(!strcmp(argv[i], "--disk-levels")) {
+            i++;
+            disk_levels = atoi(argv[i]);
+        } else if(!strcmp(argv[i], "--level-ratio")) {
+            // once per level, starting with C2.
+            i++;
+            level_ratios.push_back(atof(argv[i]));
+        } else if(!strcmp(argv[i], "--replay-threads")) {
+            i++;
+            replay_threads = atoi(argv[i]);
+        } else if(!strcmp(argv[i], "--epoll")) {
+            use_epoll = true;
+        } else if(!strcmp(argv[i], "--io-threads")) {
+            i++;
+            io_threads = atoi(argv[i]);
+        } else if(!strcmp(argv[i], "--worker-threads")) {
+            i++;
+            worker_threads = atoi(argv[i]);
     	} else {
-    		fprintf(stderr, "Usage: %s [--test|--benchmark] [--log-mode <int>] [--expiry-delta <int>] [--port <int>]", argv[0]);
+    		fprintf(stderr, "Usage: %s [--test|--benchmark] [--log-mode <int>] [--expiry-delta <int>] [--port <int>] [--c2-merge-threads <int>] [--c2-merge-ranges <int>] [--merge-prefetch-bytes <int>] [--merge-write-behind-bytes <int>] [--c0-partitions <int>] [--disk-levels <int> [--level-ratio <double>]*] [--replay-threads <int>] [--epoll [--io-threads <int>] [--worker-threads <int>]]", argv[0]);
     		abort();
     	}
     }
@@ -70,6 +115,13 @@ int main(int argc, char *argv[])
     {
 		bLSM ltable(log_mode, c0_size);
 		ltable.expiry = expiry_delta;
+		ltable.c2_merge_partitions = c2_merge_threads;
+		ltable.c2_merge_ranges = c2_merge_ranges;
+		ltable.merge_prefetch_bytes = merge_prefetch_bytes;
+		ltable.merge_write_behind_bytes = merge_write_behind_bytes;
+		ltable.c0_partitions = c0_partitions;
+		ltable.disk_levels = disk_levels;
+		ltable.level_size_ratios = level_ratios;
 
 		if(TrecordType(xid, ROOT_RECORD) == INVALID_SLOT) {
 			printf("Creating empty logstore\n");
@@ -85,14 +137,23 @@ int main(int argc, char *argv[])
 		Tcommit(xid);
 		mergeScheduler * mscheduler = new mergeScheduler(&ltable);
 		mscheduler->start();
-		ltable.replayLog();
+		ltable.replayLog(replay_threads);
 
-		simpleServer *lserver = new simpleServer(&ltable, simpleServer::DEFAULT_THREADS, port);
+		if(use_epoll) {
+			epollServer *lserver = new epollServer(&ltable, io_threads, worker_threads, port);
 
-		lserver->acceptLoop();
+			lserver->acceptLoop();
 
-		printf ("Stopping server...\n");
-		delete lserver;
+			printf ("Stopping server...\n");
+			delete lserver;
+		} else {
+			simpleServer *lserver = new simpleServer(&ltable, simpleServer::DEFAULT_THREADS, port);
+
+			lserver->acceptLoop();
+
+			printf ("Stopping server...\n");
+			delete lserver;
+		}
 
 		printf("Stopping merge threads...\n");
 		mscheduler->shutdown();
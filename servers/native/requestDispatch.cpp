@@ -19,7 +19,9 @@
  *      Author: sears
  */
 #include "requestDispatch.h"
+#include "bufferedConn.h"
 #include "regionAllocator.h"
+#include "latencyStats.h"
 
 template<class HANDLE>
 inline int requestDispatch<HANDLE>::op_insert(bLSM * ltable, HANDLE fd, dataTuple * tuple) {
@@ -105,22 +107,67 @@ inline int requestDispatch<HANDLE>::op_find(bLSM * ltable, HANDLE fd, dataTuple
     return err;
 }
 template<class HANDLE>
-inline int requestDispatch<HANDLE>::op_scan(bLSM * ltable, HANDLE fd, dataTuple * tuple, dataTuple * tuple2, size_t limit) {
+inline int requestDispatch<HANDLE>::op_find_many(bLSM * ltable, HANDLE fd) {
+  int err = writeoptosocket(fd, LOGSTORE_RESPONSE_RECEIVING_TUPLES);
+  int keys_size = 100;
+  dataTuple ** keys = (dataTuple **) malloc(sizeof(keys[0]) * keys_size);
+  int key_count = 0;
+  while(!err && (keys[key_count] = readtuplefromsocket(fd, &err))) {
+    key_count++;
+    if(key_count == keys_size) {
+      keys_size *= 2;
+      keys = (dataTuple **) realloc(keys, sizeof(keys[0]) * keys_size);
+    }
+  }
+  dataTuple ** results = (dataTuple **) malloc(sizeof(results[0]) * keys_size);
+  if(!err) {
+    ltable->findTuples(-1, keys, key_count, results);
+    err = writeoptosocket(fd, LOGSTORE_RESPONSE_SENDING_TUPLES);
+    // Send one tuple per key, in request order.  Like op_find, missing keys come back as tombstones.
+    for(int i = 0; i < key_count; i++) {
+      if(!err) {
+        if(results[i]) {
+          err = writetupletosocket(fd, results[i]);
+        } else {
+          keys[i]->setDelete();
+          err = writetupletosocket(fd, keys[i]);
+        }
+      }
+      if(results[i]) { dataTuple::freetuple(results[i]); }
+    }
+    if(!err) { writeendofiteratortosocket(fd); }
+  }
+  for(int i = 0; i < key_count; i++) {
+    dataTuple::freetuple(keys[i]);
+  }
+  free(results);
+  free(keys);
+  return err;
+}
+/**
+ * Send the tuples in [tuple, tuple2), or at most limit of them.  A NULL
+ * tuple2 means there is no upper bound.  If reverse, the range is sent in
+ * descending order, starting below tuple2 (or at the end of the table).
+ */
+template<class HANDLE>
+inline int requestDispatch<HANDLE>::op_scan(bLSM * ltable, HANDLE fd, dataTuple * tuple, dataTuple * tuple2, size_t limit, bool reverse) {
     size_t count = 0;
     int err = writeoptosocket(fd, LOGSTORE_RESPONSE_SENDING_TUPLES);
 
     if(!err) {
-        bLSM::iterator * itr = new bLSM::iterator(ltable, tuple);
+        bLSM::iterator * itr = reverse ? new bLSM::iterator(ltable, tuple2, true) : new bLSM::iterator(ltable, tuple);
         dataTuple * t;
-        while(!err && (t = itr->getnext())) {
-            if(tuple2) {  // are we at the end of range?
+        // t belongs to itr, and is serialized straight from the iterator's buffer.
+        while(!err && (t = itr->getnext_borrowed())) {
+            if(reverse) {
+                if(tuple2 && !dataTuple::compare_obj(t, tuple2)) { continue; }  // the range does not include tuple2.
+                if(tuple && dataTuple::compare_obj(t, tuple) < 0) { break; }
+            } else if(tuple2) {  // are we at the end of range?
                 if(dataTuple::compare_obj(t, tuple2) >= 0) {
-                    dataTuple::freetuple(t);
                     break;
                 }
             }
             err = writetupletosocket(fd, t);
-            dataTuple::freetuple(t);
             count ++;
             if(count == limit) { break; }  // did we hit limit?
         }
@@ -237,9 +284,51 @@ inline int requestDispatch<HANDLE>::op_stat_space_usage(bLSM * ltable, HANDLE fd
 
     return err;
 }
+static const char * perf_metric_name(int metric) {
+  switch(metric) {
+  case latencyStats::C0_BACKPRESSURE: return "c0_backpressure";
+  case latencyStats::C1_BACKPRESSURE: return "c1_backpressure";
+  case latencyStats::DISK_BACKPRESSURE: return "disk_backpressure";
+  case latencyStats::FLUSH_STALL:     return "flush_stall";
+  }
+  switch(metric - latencyStats::FIRST_REQUEST_METRIC) {
+  case OP_INSERT:            return "insert";
+  case OP_TEST_AND_SET:      return "test_and_set";
+  case OP_FIND:              return "find";
+  case OP_FIND_MANY:         return "find_many";
+  case OP_SCAN:              return "scan";
+  case OP_SCAN_REVERSE:      return "scan_reverse";
+  case OP_BULK_INSERT:       return "bulk_insert";
+  case OP_FLUSH:             return "flush";
+  case OP_SHUTDOWN:          return "shutdown";
+  case OP_STAT_SPACE_USAGE:  return "stat_space_usage";
+  case OP_STAT_PERF_REPORT:  return "stat_perf_report";
+  case OP_STAT_HISTOGRAM:    return "stat_histogram";
+  case OP_DBG_DROP_DATABASE: return "dbg_drop_database";
+  case OP_DBG_BLOCKMAP:      return "dbg_blockmap";
+  case OP_DBG_NOOP:          return "dbg_noop";
+  case OP_DBG_SET_LOG_MODE:  return "dbg_set_log_mode";
+  }
+  return 0;
+}
+/**
+ * One tuple per metric that has been recorded.  The key is the metric's
+ * name (with its terminating \0), and the value is a latencyStats::summary.
+ */
 template<class HANDLE>
 inline int requestDispatch<HANDLE>::op_stat_perf_report(bLSM * ltable, HANDLE fd) {
-
+    int err = writeoptosocket(fd, LOGSTORE_RESPONSE_SENDING_TUPLES);
+    for(int i = 0; !err && i < latencyStats::NUM_METRICS; i++) {
+        const char * name = perf_metric_name(i);
+        if(!name) { continue; }
+        latencyStats::summary sum = latencyStats::summarize(i);
+        if(!sum.count) { continue; }
+        dataTuple * tup = dataTuple::create(name, strlen(name)+1, &sum, sizeof(sum));
+        err = writetupletosocket(fd, tup);
+        dataTuple::freetuple(tup);
+    }
+    if(!err) { err = writeendofiteratortosocket(fd); }
+    return err;
 }
 
 
@@ -407,27 +496,11 @@ inline int requestDispatch<HANDLE>::op_dbg_blockmap(bLSM * ltable, HANDLE fd) {
 
 template<class HANDLE>
 inline int requestDispatch<HANDLE>::op_dbg_drop_database(bLSM * ltable, HANDLE fd) {
-    bLSM::iterator * itr = new bLSM::iterator(ltable);
-    dataTuple * del;
+    // the empty key sorts first, so this covers everything.
+    dataTuple * start = dataTuple::create("", 0);
     fprintf(stderr, "DROPPING DATABASE...\n");
-    long long n = 0;
-    while((del = itr->getnext())) {
-      if(!del->isDelete()) {
-        del->setDelete();
-        ltable->insertTuple(del);
-        n++;
-        if(!(n % 1000)) {
-          printf("X %lld %s\n", n, (char*)del->rawkey()); fflush(stdout);
-        }
-      } else {
-        n++;
-        if(!(n % 1000)) {
-          printf("? %lld %s\n", n, (char*)del->rawkey()); fflush(stdout);
-        }
-      }
-      dataTuple::freetuple(del);
-    }
-    delete itr;
+    ltable->dropRange(start, NULL);
+    dataTuple::freetuple(start);
     fprintf(stderr, "...DROP DATABASE COMPLETE\n");
     return writeoptosocket(fd, LOGSTORE_RESPONSE_SUCCESS);
 }
@@ -458,6 +531,22 @@ int requestDispatch<HANDLE>::dispatch_request(HANDLE f, bLSM *ltable) {
 
   int err = opcode == OP_DONE || opiserror(opcode); //close the conn on failure
 
+  //step 1b: a pipelined request.  Echo its id, then handle the request it wraps.
+  if(!err && opcode == OP_TAGGED) {
+    uint64_t id = readcountfromsocket(f, &err);
+    if(!err) { err = writeoptosocket(f, LOGSTORE_RESPONSE_TAGGED); }
+    if(!err) { err = writecounttosocket(f, id); }
+    if(!err) {
+      opcode = readopfromsocket(f, LOGSTORE_CLIENT_REQUEST);
+      if(opcode == OP_TAGGED || opcode == OP_BULK_INSERT || opcode == OP_FIND_MANY) {
+        fprintf(stderr, "Opcode %d cannot be pipelined.  Closing connection.\n", (int)opcode);
+        writeoptosocket(f, LOGSTORE_PROTOCOL_ERROR);
+        opcode = LOGSTORE_PROTOCOL_ERROR;
+      }
+      err = opcode == OP_DONE || opiserror(opcode);
+    }
+  }
+
   //step 2: read the first tuple from client
   dataTuple *tuple = 0, *tuple2 = 0;
   if(!err) { tuple  = readtuplefromsocket(f, &err); }
@@ -486,6 +575,7 @@ int requestDispatch<HANDLE>::dispatch_request(HANDLE f, bLSM *ltable) {
 }
 template<class HANDLE>
 int requestDispatch<HANDLE>::dispatch_request(network_op_t opcode, dataTuple * tuple, dataTuple * tuple2, bLSM * ltable, HANDLE fd) {
+    latencyTimer timer(latencyStats::FIRST_REQUEST_METRIC + opcode);
     int err = 0;
 #if 0
     if(tuple) {
@@ -508,10 +598,19 @@ int requestDispatch<HANDLE>::dispatch_request(network_op_t opcode, dataTuple * t
     {
         err = op_find(ltable, fd, tuple);
     }
+    else if(opcode == OP_FIND_MANY)
+    {
+        err = op_find_many(ltable, fd);
+    }
     else if(opcode == OP_SCAN)
     {
         size_t limit = readcountfromsocket(fd, &err);
-        if(!err) {  err = op_scan(ltable, fd, tuple, tuple2, limit); }
+        if(!err) {  err = op_scan(ltable, fd, tuple, tuple2, limit, false); }
+    }
+    else if(opcode == OP_SCAN_REVERSE)
+    {
+        size_t limit = readcountfromsocket(fd, &err);
+        if(!err) {  err = op_scan(ltable, fd, tuple, tuple2, limit, true); }
     }
     else if(opcode == OP_BULK_INSERT) {
         err = op_bulk_insert(ltable, fd);
@@ -556,3 +655,4 @@ int requestDispatch<HANDLE>::dispatch_request(network_op_t opcode, dataTuple * t
 
 template class requestDispatch<int>;
 template class requestDispatch<FILE*>;
+template class requestDispatch<bufferedConn*>;
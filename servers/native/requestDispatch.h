@@ -30,7 +30,8 @@ private:
   static inline int op_insert(bLSM * ltable, HANDLE fd, dataTuple * tuple);
   static inline int op_test_and_set(bLSM * ltable, HANDLE fd, dataTuple * tuple, dataTuple * tuple2);
   static inline int op_find(bLSM * ltable, HANDLE fd, dataTuple * tuple);
-  static inline int op_scan(bLSM * ltable, HANDLE fd, dataTuple * tuple, dataTuple * tuple2, size_t limit);
+  static inline int op_find_many(bLSM * ltable, HANDLE fd);
+  static inline int op_scan(bLSM * ltable, HANDLE fd, dataTuple * tuple, dataTuple * tuple2, size_t limit, bool reverse);
   static inline int op_bulk_insert(bLSM * ltable, HANDLE fd);
   static inline int op_flush(bLSM * ltable, HANDLE fd);
   static inline int op_shutdown(bLSM * ltable, HANDLE fd);
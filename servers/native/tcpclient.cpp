@@ -45,6 +45,8 @@ struct logstore_handle_t {
 	struct hostent* server;
 	int server_socket;
   FILE * server_fsocket;
+  uint64_t last_request_id;
+  uint64_t outstanding; // pipelined requests that have not been answered yet.
 };
 
 logstore_handle_t * logstore_client_open(const char *host, int portnum, int timeout) {
@@ -55,6 +57,8 @@ logstore_handle_t * logstore_client_open(const char *host, int portnum, int time
 	ret->timeout = timeout;
         ret->server_socket = -1;
 	ret->server_fsocket = NULL;
+	ret->last_request_id = 0;
+	ret->outstanding = 0;
 
     ret->server = gethostbyname(ret->host);
     if (ret->server == NULL) {
@@ -79,12 +83,10 @@ static inline void close_conn(logstore_handle_t *l) {
   fclose(l->server_fsocket); //close the connection
   l->server_fsocket = NULL;
   l->server_socket = -1;
+  l->outstanding = 0;
 }
 
-uint8_t
-logstore_client_op_returns_many(logstore_handle_t *l,
-				uint8_t opcode,  dataTuple * tuple, dataTuple * tuple2, uint64_t count) {
-
+static network_op_t open_conn(logstore_handle_t *l) {
     if(l->server_socket < 0)
     {
       l->server_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -118,7 +120,11 @@ logstore_client_op_returns_many(logstore_handle_t *l,
 
         DEBUG("sock opened %d\n", l->server_socket);
     }
+    return 0;
+}
 
+static network_op_t send_request(logstore_handle_t *l,
+        uint8_t opcode,  dataTuple * tuple, dataTuple * tuple2, uint64_t count) {
     network_op_t err = 0;
 
     //send the opcode
@@ -133,6 +139,19 @@ logstore_client_op_returns_many(logstore_handle_t *l,
     if( (!err) && (count != (uint64_t)-1) ) {
                 err = writecounttosocket(l->server_fsocket, count);               }
 
+    return err;
+}
+
+uint8_t
+logstore_client_op_returns_many(logstore_handle_t *l,
+				uint8_t opcode,  dataTuple * tuple, dataTuple * tuple2, uint64_t count) {
+    assert(!l->outstanding); // collect pipelined responses first.
+
+    network_op_t err = open_conn(l);
+    if(err) { return err; }
+
+    err = send_request(l, opcode, tuple, tuple2, count);
+
     network_op_t rcode = LOGSTORE_CONN_CLOSED_ERROR;
     if( !err) {
       rcode = readopfromsocket(l->server_fsocket,LOGSTORE_SERVER_RESPONSE);
@@ -177,6 +196,104 @@ logstore_client_next_tuple(logstore_handle_t *l) {
 	}
 	return ret;
 }
+uint8_t
+logstore_client_find_many(logstore_handle_t *l, dataTuple ** keys, int n, dataTuple ** results) {
+  for(int i = 0; i < n; i++) { results[i] = NULL; }
+  network_op_t rcode = logstore_client_op_returns_many(l, OP_FIND_MANY);
+  if(rcode != LOGSTORE_RESPONSE_RECEIVING_TUPLES) { return opiserror(rcode) ? rcode : LOGSTORE_PROTOCOL_ERROR; }
+  for(int i = 0; i < n; i++) {
+    rcode = logstore_client_send_tuple(l, keys[i]);
+    if(opiserror(rcode)) { return rcode; }
+  }
+  rcode = logstore_client_send_tuple(l, NULL);
+  if(opiserror(rcode)) { return rcode; }
+  if(rcode != LOGSTORE_RESPONSE_SENDING_TUPLES) { return LOGSTORE_PROTOCOL_ERROR; }
+  for(int i = 0; i < n; i++) {
+    dataTuple * t = logstore_client_next_tuple(l);
+    if(!t) {
+      for(int j = 0; j < i; j++) { if(results[j]) { dataTuple::freetuple(results[j]); results[j] = NULL; } }
+      return LOGSTORE_CONN_CLOSED_ERROR;
+    }
+    if(t->isDelete()) {
+      dataTuple::freetuple(t);
+    } else {
+      results[i] = t;
+    }
+  }
+  dataTuple * nxt = logstore_client_next_tuple(l);  // end of results.
+  if(nxt) {
+    dataTuple::freetuple(nxt);
+    close_conn(l);
+    return LOGSTORE_PROTOCOL_ERROR;
+  }
+  return LOGSTORE_RESPONSE_SUCCESS;
+}
+
+uint64_t
+logstore_client_op_async(logstore_handle_t *l,
+          uint8_t opcode,  dataTuple * tuple, dataTuple * tuple2, uint64_t count) {
+  if(opcode == OP_TAGGED || opcode == OP_BULK_INSERT || opcode == OP_FIND_MANY) {
+    fprintf(stderr, "Opcode %d cannot be pipelined\n", (int)opcode);
+    return 0;
+  }
+  if(open_conn(l)) { return 0; }
+  uint64_t id = ++l->last_request_id;
+  network_op_t tag = OP_TAGGED;
+  int err = writetosocket(l->server_fsocket, &tag, sizeof(tag));
+  if(!err) { err = writecounttosocket(l->server_fsocket, id); }
+  if(!err) { err = send_request(l, opcode, tuple, tuple2, count); }
+  if(err) {
+    close_conn(l);
+    return 0;
+  }
+  l->outstanding++;
+  return id;
+}
+
+uint8_t
+logstore_client_op_async_result(logstore_handle_t *l, uint64_t * id, dataTuple ** result) {
+  *result = NULL;
+  if(!l->outstanding) { return LOGSTORE_PROTOCOL_ERROR; }
+  // readopfromsocket flushes any requests we have not sent yet.
+  network_op_t rcode = readopfromsocket(l->server_fsocket, LOGSTORE_SERVER_RESPONSE);
+  if(rcode != LOGSTORE_RESPONSE_TAGGED) {
+    close_conn(l);
+    return opiserror(rcode) ? rcode : LOGSTORE_PROTOCOL_ERROR;
+  }
+  int err;
+  *id = readcountfromsocket(l->server_fsocket, &err);
+  if(err) {
+    close_conn(l);
+    return LOGSTORE_CONN_CLOSED_ERROR;
+  }
+  l->outstanding--;
+  rcode = readopfromsocket(l->server_fsocket, LOGSTORE_SERVER_RESPONSE);
+  if(opiserror(rcode)) {
+    close_conn(l);
+    return rcode;
+  }
+  if(rcode == LOGSTORE_RESPONSE_SENDING_TUPLES) {
+    *result = logstore_client_next_tuple(l);
+    if(!l->server_fsocket) { return LOGSTORE_CONN_CLOSED_ERROR; }
+    if(*result) {
+      dataTuple * nxt = logstore_client_next_tuple(l);
+      if(nxt || !l->server_fsocket) {
+        fprintf(stderr, "Pipelined request %lld returned multiple tuples.  Closing connection.\n", (long long)*id);
+        if(nxt) { dataTuple::freetuple(nxt); }
+        dataTuple::freetuple(*result);
+        *result = NULL;
+        if(l->server_fsocket) { close_conn(l); }
+        return LOGSTORE_PROTOCOL_ERROR;
+      }
+    }
+  }
+  return rcode;
+}
+
+uint64_t logstore_client_outstanding(logstore_handle_t *l) {
+  return l->outstanding;
+}
+
 dataTuple *
 logstore_client_op(logstore_handle_t *l,
           uint8_t opcode,  dataTuple * tuple, dataTuple * tuple2, uint64_t count)
@@ -40,6 +40,38 @@ uint8_t logstore_client_op_returns_many(logstore_handle_t *l,
 
 dataTuple * logstore_client_next_tuple(logstore_handle_t *l);
 uint8_t logstore_client_send_tuple(logstore_handle_t *l, dataTuple *tuple = NULL);
+/**
+ * Look up n keys with a single OP_FIND_MANY round trip.  results[i] is set
+ * to the (caller-freed) tuple for keys[i], or NULL if there is no such key.
+ * @return LOGSTORE_RESPONSE_SUCCESS, or an error code.
+ */
+uint8_t logstore_client_find_many(logstore_handle_t *l, dataTuple ** keys, int n, dataTuple ** results);
+/**
+ * Pipelined requests.  logstore_client_op_async() sends a request without
+ * waiting for its response, so a caller can keep many inserts and finds in
+ * flight on one connection.  Requests are buffered, and are only pushed to
+ * the server when the buffer fills up, or when the caller asks for a result.
+ *
+ * Ops that stream tuples to the server (OP_BULK_INSERT, OP_FIND_MANY) cannot
+ * be pipelined, and neither can ops that return more than one tuple.
+ * Collect every outstanding result before using the synchronous API again.
+ *
+ * @return the id of the request, or 0 on error.
+ */
+uint64_t logstore_client_op_async(logstore_handle_t *l,
+					uint8_t opcode,
+					dataTuple *tuple = NULL, dataTuple *tuple2 = NULL,
+					uint64_t count = (uint64_t)-1);
+/**
+ * Wait for the response to the oldest outstanding pipelined request.
+ * @param id set to the id logstore_client_op_async() returned for the request.
+ * @param result set to the (caller-freed) tuple the request returned, if any.
+ * @return the server's response code (LOGSTORE_RESPONSE_SUCCESS, _FAIL, or
+ * _SENDING_TUPLES), or an error code.
+ */
+uint8_t logstore_client_op_async_result(logstore_handle_t *l, uint64_t * id, dataTuple ** result);
+/** @return the number of pipelined requests whose results have not been collected. */
+uint64_t logstore_client_outstanding(logstore_handle_t *l);
 int logstore_client_close(logstore_handle_t* l);
 
 
@@ -0,0 +1,54 @@
+/*
+ * perf_report.cpp
+ *
+ * Copyright 2010-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "../tcpclient.h"
+#include "../network.h"
+#include "../datatuple.h"
+
+void usage(char * argv[]) {
+	fprintf(stderr, "usage %s [host [port]]\n", argv[0]);
+}
+#include "util_main.h"
+int main(int argc, char * argv[]) {
+	logstore_handle_t * l = util_open_conn(argc, argv);
+
+    uint8_t rcode = logstore_client_op_returns_many(l, OP_STAT_PERF_REPORT);
+
+    if(opiserror(rcode)) {
+    	fprintf(stderr, "Perf report request returned logstore error code %d\n", rcode);
+    	perror("Perf report failed."); return 3;
+    } else {
+    	dataTuple *ret;
+    	printf("%-20s %12s %10s %10s %10s %10s\n", "metric (usec)", "count", "p50", "p99", "p999", "max");
+    	while(( ret = logstore_client_next_tuple(l) )) {
+    		// count, p50, p99, p999, max; see latencyStats::summary.
+    		uint64_t sum[5];
+    		assert(ret->strippedkey()[ret->strippedkeylen()-1] == 0); // check for null terminator.
+    		assert(ret->datalen() == sizeof(sum));
+    		memcpy(sum, ret->data(), sizeof(sum));
+    		printf("%-20s %12llu %10llu %10llu %10llu %10llu\n", (char*)ret->strippedkey(),
+    				(unsigned long long)sum[0], (unsigned long long)sum[1], (unsigned long long)sum[2],
+    				(unsigned long long)sum[3], (unsigned long long)sum[4]);
+    		dataTuple::freetuple(ret);
+    	}
+    }
+
+    logstore_client_close(l);
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * check_bloomfilter.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include <string>
+#include <vector>
+#include <bLSM.h>
+#include <bloomFilter.h>
+
+#include <assert.h>
+
+#include "check_util.h"
+#include "regionAllocator.h"
+
+#include <stasis/transactional.h>
+
+void writeAndReopen(size_t NUM_ENTRIES, pageid_t region_size) {
+  unlink("storefile.txt");
+  unlink("logfile.txt");
+  system("rm -rf stasis_log/");
+
+  sync();
+
+  bLSM::init_stasis();
+
+  int xid = Tbegin();
+
+  std::vector<std::string> key_arr;
+  preprandstr(NUM_ENTRIES, key_arr, 50, true);
+
+  printf("Stage 1: Filling filter with %llu keys\n", (unsigned long long)NUM_ENTRIES);
+
+  bloomFilter * bf = new bloomFilter(NUM_ENTRIES, 0.01);
+  for(size_t i = 0; i < key_arr.size(); i++) {
+    bf->insert((const byte*)key_arr[i].c_str(), key_arr[i].length()+1);
+  }
+  bf->print_stats();
+
+  regionAllocator * alloc = new regionAllocator(xid, region_size);
+  pageid_t pid = bf->write(xid, alloc);
+  assert(pid != INVALID_PAGE);
+  alloc->force_regions(xid);
+  Tcommit(xid);
+
+  printf("Stage 2: Reopening filter\n");
+
+  xid = Tbegin();
+  bloomFilter * bf2 = bloomFilter::open(xid, pid);
+  assert(bf2);
+  bf2->print_stats();
+
+  for(size_t i = 0; i < key_arr.size(); i++) {
+    assert(bf2->lookup((const byte*)key_arr[i].c_str(), key_arr[i].length()+1));
+  }
+  // the reopened filter has to give the same answers as the original.
+  for(size_t i = 0; i < NUM_ENTRIES; i++) {
+    std::string missing = key_arr[i] + "\x01";
+    bool a = bf->lookup((const byte*)missing.c_str(), missing.length()+1);
+    bool b = bf2->lookup((const byte*)missing.c_str(), missing.length()+1);
+    assert(a == b);
+  }
+  assert(bloomFilter::open(xid, INVALID_PAGE) == NULL);
+
+  delete bf;
+  delete bf2;
+  alloc->dealloc_regions(xid);
+  delete alloc;
+  Tcommit(xid);
+
+  bLSM::deinit_stasis();
+}
+
+/** @test
+ */
+int main()
+{
+  writeAndReopen(10000, 10000);
+
+  // small regions, so the filter has to be split across several of them.
+  writeAndReopen(200000, 64);
+
+  return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * check_c0shards.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "bLSM.h"
+#include "mergeScheduler.h"
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <stasis/transactional.h>
+#undef begin
+#undef end
+
+#include "check_util.h"
+
+static const int NUM_SHARDS = 4;
+
+void shardedC0(int NUM_ENTRIES) {
+  unlink("storefile.txt");
+  unlink("logfile.txt");
+  system("rm -rf stasis_log/");
+
+  bLSM::init_stasis();
+  int xid = Tbegin();
+  bLSM * ltable = new bLSM(0, 100 * 1024, 1000, 10000, 5);
+  ltable->c0_partitions = NUM_SHARDS;
+  mergeScheduler mscheduler(ltable);
+  ltable->allocTable(xid);
+  Tcommit(xid);
+  assert(ltable->get_num_c0_shards() == NUM_SHARDS);
+
+  printf("Stage 1: Size accounting\n");
+  for(int i = 0; i < 100; i++) {
+    dataTuple * t = value_tuple(i, 0);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+  pageid_t bytes = 0;
+  int64_t tuples = 0;
+  int nonempty = 0;
+  for(int s = 0; s < NUM_SHARDS; s++) {
+    memTreeComponent::rbtree_ptr_t tree = ltable->get_c0_shard(s)->tree;
+    bytes += memTreeComponent::get_arena(tree)->bytes_held();
+    tuples += tree->size();
+    if(tree->size()) { nonempty++; }
+    for(memTreeComponent::rbtree_t::iterator it = tree->begin(); it != tree->end(); ++it) {
+      assert(ltable->c0_shard_of(*it) == s);
+    }
+  }
+  assert(tuples == 100 && ltable->get_c0_tuple_count() == 100);
+  assert(nonempty == NUM_SHARDS);
+  assert(ltable->merge_mgr->get_merge_stats(0)->get_current_size() == bytes);
+
+  mscheduler.start();
+
+  printf("Stage 2: Inserting %d keys\n", NUM_ENTRIES);
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    dataTuple * t = value_tuple(i, 1);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+  for(int i = 0; i < NUM_ENTRIES; i += 3) {
+    dataTuple * t = value_tuple(i, 2);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+
+  printf("Stage 3: Lookups\n");
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    assert(find_version(ltable, i) == (i % 3 ? 1 : 2));
+  }
+  const int batch = 64;
+  dataTuple * keys[batch];
+  dataTuple * results[batch];
+  for(int i = 0; i < batch; i++) { keys[i] = key_tuple((i * 7919) % NUM_ENTRIES); }
+  ltable->findTuples(-1, keys, batch, results);
+  for(int i = 0; i < batch; i++) {
+    assert(results[i] && !dataTuple::compare_obj(results[i], keys[i]));
+    dataTuple::freetuple(results[i]);
+    dataTuple::freetuple(keys[i]);
+  }
+
+  printf("Stage 4: Scans\n");
+  assert(scan(ltable, false) == NUM_ENTRIES);
+  assert(scan(ltable, true) == NUM_ENTRIES);
+
+  printf("Stage 5: dropRange\n");
+  int lo = NUM_ENTRIES / 4;
+  int hi = NUM_ENTRIES / 2;
+  dataTuple * start = key_tuple(lo);
+  dataTuple * end = key_tuple(hi);
+  ltable->dropRange(start, end);
+  dataTuple::freetuple(start);
+  dataTuple::freetuple(end);
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    assert((find_version(ltable, i) == -1) == (i >= lo && i < hi));
+  }
+  assert(scan(ltable, false) == NUM_ENTRIES - (hi - lo));
+
+  printf("Stage 6: Overwrites\n");
+  // Each round overwrites a few hot keys, and leaves behind one cold key that
+  // pins the chunk it landed in.  C0 is charged for the pinned chunks, so
+  // backpressure keeps them within a chunk or so of its budget.
+  const int HOT = 100;
+  for(int r = 0; r < 500; r++) {
+    for(int i = 0; i < HOT; i++) {
+      dataTuple * t = value_tuple(i, r + 3);
+      ltable->insertTuple(t);
+      dataTuple::freetuple(t);
+    }
+    dataTuple * t = value_tuple(NUM_ENTRIES + r, 0);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+    pageid_t held = 0;
+    for(int s = 0; s < NUM_SHARDS; s++) {
+      held += memTreeComponent::get_arena(ltable->get_c0_shard(s)->tree)->bytes_held();
+    }
+    assert(held <= ltable->max_c0_size + 2 * (pageid_t)arenaAllocator::CHUNK_SIZE);
+  }
+  for(int i = 0; i < HOT; i++) {
+    assert(find_version(ltable, i) == 502);
+  }
+
+  mscheduler.shutdown();
+  delete ltable;
+  bLSM::deinit_stasis();
+}
+
+/** @test
+ */
+int main()
+{
+  shardedC0(20000);
+  return 0;
+}
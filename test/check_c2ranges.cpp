@@ -0,0 +1,179 @@
+/*
+ * check_c2ranges.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "bLSM.h"
+#include "mergeScheduler.h"
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <stasis/transactional.h>
+#undef begin
+#undef end
+
+#include "check_util.h"
+
+/** Write version v of keys [lo, hi). */
+static void insertRange(bLSM * ltable, int lo, int hi, int v) {
+  for(int i = lo; i < hi; i++) {
+    dataTuple * t = value_tuple(i, v);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+}
+
+void c2Ranges(int NUM_ENTRIES) {
+  unlink("storefile.txt");
+  unlink("logfile.txt");
+  system("rm -rf stasis_log/");
+
+  bLSM::init_stasis();
+  int xid = Tbegin();
+  // Small regions, so that a range spans several of them, and can be linked.
+  bLSM * ltable = new bLSM(0, 100 * 1024, 1000, 16, 2);
+  ltable->c2_merge_partitions = 2;
+  ltable->c2_merge_ranges = 16;
+  mergeScheduler mscheduler(ltable);
+  ltable->allocTable(xid);
+  Tcommit(xid);
+
+  mscheduler.start();
+
+  // Most merges after the first round only touch a few of C2's key ranges;
+  // the rest of C2 has to survive them unchanged.
+  const int ROUNDS = 6;
+  const int hot = NUM_ENTRIES / 20;
+  printf("Stage 1: Inserting %d keys, then updating %d of them %d times\n", NUM_ENTRIES, hot, ROUNDS - 1);
+  insertRange(ltable, 0, NUM_ENTRIES, 0);
+  for(int r = 1; r < ROUNDS; r++) {
+    int lo = (r * 7 * hot) % (NUM_ENTRIES - hot);
+    insertRange(ltable, lo, lo + hot, r);
+  }
+
+  printf("Stage 2: Lookups\n");
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    int v = 0;
+    for(int r = 1; r < ROUNDS; r++) {
+      int lo = (r * 7 * hot) % (NUM_ENTRIES - hot);
+      if(i >= lo && i < lo + hot) { v = r; }
+    }
+    assert(find_version(ltable, i) == v);
+  }
+  assert(scan(ltable) == NUM_ENTRIES);
+
+  printf("Stage 3: dropRange, then more updates\n");
+  // Ranges that overlap a dropped range have to be rewritten, even if
+  // nothing was written to them.
+  int dlo = NUM_ENTRIES / 2;
+  int dhi = dlo + hot;
+  dataTuple * start = key_tuple(dlo);
+  dataTuple * end = key_tuple(dhi);
+  ltable->dropRange(start, end);
+  dataTuple::freetuple(start);
+  dataTuple::freetuple(end);
+  for(int r = ROUNDS; r < 2 * ROUNDS; r++) {
+    insertRange(ltable, 0, hot, r);
+  }
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    int v = find_version(ltable, i);
+    if(i < hot) {
+      assert(v == 2 * ROUNDS - 1);
+    } else if(i >= dlo && i < dhi) {
+      assert(v == -1);
+    } else {
+      assert(v != -1);
+    }
+  }
+  assert(scan(ltable) == NUM_ENTRIES - (dhi - dlo));
+
+  mscheduler.shutdown();
+  delete ltable;
+  bLSM::deinit_stasis();
+}
+
+/**
+ * @return the pages of C2's datapage regions.  Sets *live to the pages of
+ * its datapages.
+ */
+static pageid_t c2_pages(bLSM * ltable, pageid_t * live) {
+  int xid = Tbegin();
+  rwlc_readlock(ltable->header_mut);
+  diskTreeComponent * c2 = ltable->get_tree_c2();
+  pageid_t internal_region_length, internal_region_count, region_length, region_count;
+  pageid_t * internal_regions;
+  pageid_t * regions;
+  c2->list_regions(xid, &internal_region_length, &internal_region_count, &internal_regions,
+                   &region_length, &region_count, &regions);
+  free(internal_regions);
+  free(regions);
+  std::vector<std::pair<pageid_t, pageid_t> > pages;
+  c2->list_datapages(xid, NULL, NULL, &pages);
+  rwlc_unlock(ltable->header_mut);
+  Tcommit(xid);
+  *live = 0;
+  for(size_t i = 0; i < pages.size(); i++) { *live += pages[i].second; }
+  return region_count * region_length;
+}
+
+void c2RangeSpace(int NUM_ENTRIES) {
+  unlink("storefile.txt");
+  unlink("logfile.txt");
+  system("rm -rf stasis_log/");
+
+  const int RANGES = 4;
+  const pageid_t REGION_PAGES = 16;
+  bLSM::init_stasis();
+  int xid = Tbegin();
+  bLSM * ltable = new bLSM(0, 100 * 1024, 1000, REGION_PAGES, 2);
+  ltable->c2_merge_partitions = 2;
+  ltable->c2_merge_ranges = RANGES;
+  mergeScheduler mscheduler(ltable);
+  ltable->allocTable(xid);
+  Tcommit(xid);
+
+  mscheduler.start();
+
+  // A hot spot that moves every round leaves a few cold datapages in
+  // regions that are otherwise dead.  Those regions must not pile up.
+  const int ROUNDS = 30;
+  const int hot = NUM_ENTRIES / 20;
+  printf("Stage 4: Space used by %d rounds of skewed updates\n", ROUNDS);
+  insertRange(ltable, 0, NUM_ENTRIES, 0);
+  for(int r = 1; r < ROUNDS; r++) {
+    int lo = (r * 7 * hot) % (NUM_ENTRIES - hot);
+    insertRange(ltable, lo, lo + hot, r);
+    pageid_t live;
+    pageid_t allocated = c2_pages(ltable, &live);
+    // Linked regions are at least half live, and each range the merge
+    // rewrote leaves at most one partly full region, as does the bloom filter.
+    assert(allocated <= 2 * live + 4 * RANGES * REGION_PAGES);
+  }
+
+  mscheduler.shutdown();
+  delete ltable;
+  bLSM::deinit_stasis();
+}
+
+/** @test
+ */
+int main()
+{
+  c2Ranges(50000);
+  c2RangeSpace(50000);
+  return 0;
+}
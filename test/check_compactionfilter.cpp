@@ -0,0 +1,210 @@
+/*
+ * check_compactionfilter.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "bLSM.h"
+#include "mergeScheduler.h"
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <stasis/transactional.h>
+#undef begin
+#undef end
+
+#include "check_util.h"
+
+/** Drops every third key, and changes the values of the keys after them from "vN" to "rN". */
+class testFilter : public compactionFilter {
+public:
+  const char * name() { return "test"; }
+  decision filter(int level, bool last_level, const dataTuple * t, dataTuple ** rewritten) {
+    int i = atoi((char*)t->strippedkey());
+    if(!(i % 3)) { return DROP; }
+    if(i % 3 == 1 && ((char*)t->data())[0] == 'v') {
+      char val[16];
+      strncpy(val, (char*)t->data(), sizeof(val));
+      val[sizeof(val) - 1] = 0;
+      val[0] = 'r';
+      *rewritten = dataTuple::create(t->strippedkey(), t->strippedkeylen(), val, strlen(val) + 1);
+      return REWRITE;
+    }
+    return KEEP;
+  }
+};
+
+/** @return the version of key i that the table holds, or -1.  Sets *rewritten if the filter changed it. */
+static int find_filtered_version(bLSM * ltable, int i, bool * rewritten) {
+  dataTuple * k = key_tuple(i);
+  dataTuple * t = ltable->findTuple(-1, k->strippedkey(), k->strippedkeylen());
+  dataTuple::freetuple(k);
+  *rewritten = false;
+  if(!t) { return -1; }
+  *rewritten = ((char*)t->data())[0] == 'r';
+  int ret = atoi((char*)t->data() + 1);
+  dataTuple::freetuple(t);
+  return ret;
+}
+
+void compactionFilters(int NUM_ENTRIES) {
+  unlink("storefile.txt");
+  unlink("logfile.txt");
+  system("rm -rf stasis_log/");
+
+  bLSM::init_stasis();
+  int xid = Tbegin();
+  bLSM * ltable = new bLSM(0, 100 * 1024, 1000, 10000, 5);
+  ltable->add_compaction_filter(new testFilter());
+  mergeScheduler mscheduler(ltable);
+  ltable->allocTable(xid);
+  Tcommit(xid);
+
+  mscheduler.start();
+
+  const int ROUNDS = 4;
+  printf("Stage 1: Inserting %d keys, %d times\n", NUM_ENTRIES, ROUNDS);
+  for(int r = 0; r < ROUNDS; r++) {
+    for(int i = 0; i < NUM_ENTRIES; i++) {
+      dataTuple * t = value_tuple(i, r);
+      ltable->insertTuple(t);
+      dataTuple::freetuple(t);
+    }
+  }
+
+  printf("Stage 2: Lookups and scans\n");
+  // Tuples that are still in C0 have not been filtered yet.  Older
+  // versions of dropped keys must not come back, though.
+  int live = 0;
+  int dropped = 0;
+  int rewrote = 0;
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    bool rewritten;
+    int v = find_filtered_version(ltable, i, &rewritten);
+    if(v == -1) {
+      assert(!(i % 3));
+      dropped++;
+    } else {
+      assert(v == ROUNDS - 1);
+      assert(!rewritten || i % 3 == 1);
+      if(rewritten) { rewrote++; }
+      live++;
+    }
+  }
+  assert(dropped && rewrote);
+  assert(scan(ltable) == live);
+
+  std::map<std::string, mergeStats::filter_counts> c1 = ltable->merge_mgr->get_merge_stats(1)->get_filter_counts();
+  assert(c1.count("test") && c1["test"].dropped && c1["test"].rewritten);
+  printf("C0-C1 merges: dropped %lld rewrote %lld\n", (long long)c1["test"].dropped, (long long)c1["test"].rewritten);
+
+  mscheduler.shutdown();
+  delete ltable;
+  bLSM::deinit_stasis();
+}
+
+/** Drops keys [lo, hi). */
+class rangeFilter : public compactionFilter {
+public:
+  rangeFilter(int lo, int hi) : lo_(lo), hi_(hi) {}
+  const char * name() { return "range"; }
+  decision filter(int level, bool last_level, const dataTuple * t, dataTuple ** rewritten) {
+    int i = atoi((char*)t->strippedkey());
+    return (i >= lo_ && i < hi_) ? DROP : KEEP;
+  }
+private:
+  int lo_;
+  int hi_;
+};
+
+static int64_t c2_tuple_count(bLSM * ltable) {
+  rwlc_readlock(ltable->header_mut);
+  int64_t ret = ltable->get_tree_c2()->get_tuple_count();
+  rwlc_unlock(ltable->header_mut);
+  return ret;
+}
+
+/**
+ * Update keys outside of [cold_lo, cold_hi), a different range each time,
+ * until C2 holds target tuples.
+ */
+static void update_until(bLSM * ltable, int NUM_ENTRIES, int cold_lo, int cold_hi, int64_t target, int * round) {
+  const int hot = NUM_ENTRIES / 20;
+  const int MAX_ROUNDS = 500;
+  for(int n = 0; c2_tuple_count(ltable) != target; n++) {
+    assert(n < MAX_ROUNDS);
+    (*round)++;
+    int lo = (*round * 7 * hot) % (NUM_ENTRIES - hot);
+    for(int i = lo; i < lo + hot; i++) {
+      if(i >= cold_lo && i < cold_hi) { continue; }
+      dataTuple * t = value_tuple(i, *round);
+      ltable->insertTuple(t);
+      dataTuple::freetuple(t);
+    }
+  }
+}
+
+void filterUntouchedRange(int NUM_ENTRIES) {
+  unlink("storefile.txt");
+  unlink("logfile.txt");
+  system("rm -rf stasis_log/");
+
+  bLSM::init_stasis();
+  int xid = Tbegin();
+  bLSM * ltable = new bLSM(0, 100 * 1024, 1000, 16, 2);
+  ltable->c2_merge_partitions = 2;
+  ltable->c2_merge_ranges = 16;
+  mergeScheduler mscheduler(ltable);
+  ltable->allocTable(xid);
+  Tcommit(xid);
+
+  mscheduler.start();
+
+  printf("Stage 3: A filter over a range of C2 that no merge writes to\n");
+  // The cold range only ever gets to C2 once, so C1-C2 merges could link
+  // it, which would get around the filter.
+  int cold_lo = NUM_ENTRIES / 2;
+  int cold_hi = cold_lo + 100;
+  int round = 0;
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    dataTuple * t = value_tuple(i, round);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+  update_until(ltable, NUM_ENTRIES, cold_lo, cold_hi, NUM_ENTRIES, &round);
+  ltable->add_compaction_filter(new rangeFilter(cold_lo, cold_hi));
+  update_until(ltable, NUM_ENTRIES, cold_lo, cold_hi, NUM_ENTRIES - (cold_hi - cold_lo), &round);
+
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    assert((find_version(ltable, i) == -1) == (i >= cold_lo && i < cold_hi));
+  }
+  assert(scan(ltable) == NUM_ENTRIES - (cold_hi - cold_lo));
+  std::map<std::string, mergeStats::filter_counts> c2 = ltable->merge_mgr->get_merge_stats(2)->get_filter_counts();
+  assert(c2["range"].dropped >= cold_hi - cold_lo);
+
+  mscheduler.shutdown();
+  delete ltable;
+  bLSM::deinit_stasis();
+}
+
+/** @test
+ */
+int main()
+{
+  compactionFilters(50000);
+  filterUntouchedRange(50000);
+  return 0;
+}
@@ -184,6 +184,7 @@ void insertProbeIter(size_t NUM_ENTRIES)
     dataPage *dp=0;
     int64_t datasize = 0;
     std::vector<pageid_t> dsp;
+    std::vector<size_t> dsp_first; // index of the first key on each datapage
     for(size_t i = 0; i < NUM_ENTRIES; i++)
     {
         //prepare the key
@@ -203,8 +204,10 @@ void insertProbeIter(size_t NUM_ENTRIES)
 			assert(succ);
 
             dsp.push_back(dp->get_start_pid());
+            dsp_first.push_back(i);
         }
     }
+    dsp_first.push_back(NUM_ENTRIES);
 
     gettimeofday(&stop, 0);
     if(dp) {
@@ -243,6 +246,36 @@ void insertProbeIter(size_t NUM_ENTRIES)
     }
     
     printf("Reads completed.\n");
+
+    printf("Stage 3: Probing %llu keys\n", (unsigned long long)NUM_ENTRIES);
+
+    for(int i = 0; i < dpages ; i++)
+    {
+        dataPage dp(xid, 0, dsp[i]);
+        for(size_t j = dsp_first[i]; j < dsp_first[i+1]; j++)
+        {
+            dataTuple *dt = 0;
+            bool found = dp.recordRead((dataTuple::key_t)key_arr[j].c_str(), key_arr[j].length()+1, &dt);
+            assert(found);
+            assert(dt->datalen() == data_arr[j].length()+1);
+            dataTuple::freetuple(dt);
+
+            dataTuple *key = dataTuple::create(key_arr[j].c_str(), key_arr[j].length()+1);
+            dataPage::iterator itr(&dp, key);
+            dt = itr.getnext();
+            assert(dt && !strcmp((char*)dt->rawkey(), key_arr[j].c_str()));
+            dataTuple::freetuple(dt);
+            dataTuple::freetuple(key);
+
+            // a key that sorts between key_arr[j] and key_arr[j+1] should not be found.
+            std::string missing = key_arr[j] + "\x01";
+            dt = 0;
+            found = dp.recordRead((dataTuple::key_t)missing.c_str(), missing.length()+1, &dt);
+            assert(!found && !dt);
+        }
+    }
+
+    printf("Probes completed.\n");
   
 	Tcommit(xid);
 
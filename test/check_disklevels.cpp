@@ -0,0 +1,162 @@
+/*
+ * check_disklevels.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "bLSM.h"
+#include "mergeScheduler.h"
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <stasis/transactional.h>
+#undef begin
+#undef end
+
+#include "check_util.h"
+
+static const int NUM_LEVELS = 4;
+
+/** @return the version of key i that findTuple_first() finds, or -1. */
+static int find_first_version(bLSM * ltable, int i) {
+  dataTuple * k = key_tuple(i);
+  dataTuple * t = ltable->findTuple_first(-1, k->strippedkey(), k->strippedkeylen());
+  dataTuple::freetuple(k);
+  if(!t) { return -1; }
+  int ret = atoi((char*)t->data() + 1);
+  dataTuple::freetuple(t);
+  return ret;
+}
+
+/** @return the version key i should have after round r of insertRound(). */
+static int expected_version(int i, int r) {
+  int v = -1;
+  for(int j = 0; j <= r; j++) {
+    if(j == 0 || i % (j + 1) == 0) { v = j; }
+  }
+  return v;
+}
+
+/** Round 0 writes every key; round r rewrites every (r+1)th one. */
+static void insertRound(bLSM * ltable, int NUM_ENTRIES, int r) {
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    if(r && i % (r + 1)) { continue; }
+    dataTuple * t = value_tuple(i, r);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+}
+
+void diskLevels(int NUM_ENTRIES) {
+  unlink("storefile.txt");
+  unlink("logfile.txt");
+  system("rm -rf stasis_log/");
+
+  bLSM::init_stasis();
+  int xid = Tbegin();
+  bLSM * ltable = new bLSM(0, 100 * 1024, 1000, 10000, 5);
+  ltable->disk_levels = NUM_LEVELS;
+  ltable->level_size_ratios.push_back(2.0);
+  ltable->level_size_ratios.push_back(2.0);
+  mergeScheduler mscheduler(ltable);
+  ltable->allocTable(xid);
+  Tcommit(xid);
+  assert(ltable->get_num_disk_levels() == NUM_LEVELS);
+  for(int n = 3; n <= NUM_LEVELS; n++) {
+    assert(ltable->get_disk_level(n)->tree && !ltable->get_disk_level(n)->mergeable);
+    assert(ltable->merge_mgr->get_merge_stats(n)->merge_level == n);
+  }
+  assert(ltable->get_level_size_ratio(2) == 2.0);
+  assert(ltable->get_level_size_ratio(NUM_LEVELS) == *ltable->R());
+
+  mscheduler.start();
+
+  const int ROUNDS = 4;
+  printf("Stage 1: Inserting %d keys, %d times\n", NUM_ENTRIES, ROUNDS);
+  for(int r = 0; r < ROUNDS; r++) {
+    insertRound(ltable, NUM_ENTRIES, r);
+  }
+  // Deletes have to hide the older versions, wherever they ended up.
+  for(int i = 0; i < NUM_ENTRIES; i += 11) {
+    dataTuple * k = key_tuple(i);
+    ltable->insertTuple(k);
+    dataTuple::freetuple(k);
+  }
+
+  printf("Stage 2: Lookups\n");
+  int live = 0;
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    int v = i % 11 ? expected_version(i, ROUNDS - 1) : -1;
+    assert(find_version(ltable, i) == v);
+    assert(find_first_version(ltable, i) == v);
+    if(v != -1) { live++; }
+  }
+  const int batch = 64;
+  dataTuple * keys[batch];
+  dataTuple * results[batch];
+  for(int i = 0; i < batch; i++) { keys[i] = key_tuple((i * 7919) % NUM_ENTRIES); }
+  ltable->findTuples(-1, keys, batch, results);
+  for(int i = 0; i < batch; i++) {
+    int k = (i * 7919) % NUM_ENTRIES;
+    if(k % 11) {
+      assert(results[i] && !dataTuple::compare_obj(results[i], keys[i]));
+      assert(atoi((char*)results[i]->data() + 1) == expected_version(k, ROUNDS - 1));
+      dataTuple::freetuple(results[i]);
+    } else {
+      assert(!results[i]);
+    }
+    dataTuple::freetuple(keys[i]);
+  }
+
+  printf("Stage 3: Scans\n");
+  assert(scan(ltable) == live);
+
+  printf("Stage 4: dropRange\n");
+  int lo = NUM_ENTRIES / 4;
+  int hi = NUM_ENTRIES / 2;
+  dataTuple * start = key_tuple(lo);
+  dataTuple * end = key_tuple(hi);
+  ltable->dropRange(start, end);
+  dataTuple::freetuple(start);
+  dataTuple::freetuple(end);
+  int dropped = 0;
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    if(i >= lo && i < hi) {
+      if(i % 11) { dropped++; }
+      assert(find_version(ltable, i) == -1);
+    }
+  }
+  assert(scan(ltable) == live - dropped);
+
+  rwlc_readlock(ltable->header_mut);
+  for(int n = 3; n <= NUM_LEVELS; n++) {
+    bLSM::disk_level * l = ltable->get_disk_level(n);
+    printf("C%d: %lld tuples, handed off C%d: %s\n", n, (long long)l->tree->get_tuple_count(), n - 1, l->mergeable ? "yes" : "no");
+  }
+  rwlc_unlock(ltable->header_mut);
+
+  mscheduler.shutdown();
+  delete ltable;
+  bLSM::deinit_stasis();
+}
+
+/** @test
+ */
+int main()
+{
+  diskLevels(50000);
+  return 0;
+}
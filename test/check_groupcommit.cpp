@@ -0,0 +1,86 @@
+/*
+ * check_groupcommit.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include <string.h>
+#include <unistd.h>
+#include "groupCommitter.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+static const int NUM_THREADS = 16;
+static const int COMMITS_PER_THREAD = 200;
+
+// A stand-in for the log: entries are "written" by bumping written_lsn, and a
+// force makes everything written before it started durable.
+static lsn_t written_lsn = 0;
+static lsn_t forced_lsn = 0;
+
+static void fake_force_tail(stasis_log_t * log, stasis_log_force_mode_t mode) {
+  lsn_t target = __sync_fetch_and_add(&written_lsn, 0);
+  usleep(2000);
+  lsn_t cur;
+  while((cur = __sync_fetch_and_add(&forced_lsn, 0)) < target) {
+    __sync_bool_compare_and_swap(&forced_lsn, cur, target);
+  }
+}
+
+static void * commit_worker(void * argp) {
+  groupCommitter * gc = (groupCommitter*)argp;
+  for(int i = 0; i < COMMITS_PER_THREAD; i++) {
+    lsn_t lsn = __sync_add_and_fetch(&written_lsn, 1);
+    gc->wait_durable(lsn);
+    assert(__sync_fetch_and_add(&forced_lsn, 0) >= lsn);
+  }
+  return 0;
+}
+
+void groupCommit() {
+  stasis_log_t log;
+  memset(&log, 0, sizeof(log));
+  log.force_tail = fake_force_tail;
+
+  groupCommitter * gc = new groupCommitter(&log);
+
+  printf("Stage 1: %d threads committing %d times each\n", NUM_THREADS, COMMITS_PER_THREAD);
+  pthread_t threads[NUM_THREADS];
+  for(int i = 0; i < NUM_THREADS; i++) {
+    pthread_create(&threads[i], 0, commit_worker, gc);
+  }
+  for(int i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], 0);
+  }
+  printf("%lld commits, %lld forces\n", (long long)gc->num_commits(), (long long)gc->num_forces());
+  assert(gc->num_commits() == NUM_THREADS * COMMITS_PER_THREAD);
+  // concurrent writers have to share forces.
+  assert(gc->num_forces() < gc->num_commits() / 2);
+
+  printf("Stage 2: Asynchronous force on shutdown\n");
+  lsn_t lsn = __sync_add_and_fetch(&written_lsn, 1);
+  gc->request_force(lsn);
+  delete gc;
+  assert(forced_lsn >= lsn);
+}
+
+/** @test
+ */
+int main()
+{
+  groupCommit();
+  return 0;
+}
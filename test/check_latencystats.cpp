@@ -0,0 +1,83 @@
+/*
+ * check_latencystats.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "latencyStats.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+static const int NUM_THREADS = 8;
+static const int SAMPLES_PER_THREAD = 100000;
+static const int METRIC = latencyStats::FIRST_REQUEST_METRIC;
+
+// Each thread records 1..SAMPLES_PER_THREAD microseconds once.
+static void * record_worker(void * arg) {
+  for(int i = 1; i <= SAMPLES_PER_THREAD; i++) {
+    latencyStats::record(METRIC, i);
+  }
+  return 0;
+}
+
+// Reported percentiles are bucket upper bounds, so they may be up to 1/16 too high.
+static void check_close(uint64_t got, uint64_t want) {
+  assert(got >= want);
+  assert(got <= want + want / 16 + 1);
+}
+
+void latencyHistograms() {
+  printf("Stage 1: Empty metric\n");
+  latencyStats::summary s = latencyStats::summarize(latencyStats::FLUSH_STALL);
+  assert(s.count == 0 && s.max == 0);
+
+  printf("Stage 2: Recording from %d threads\n", NUM_THREADS);
+  pthread_t threads[NUM_THREADS];
+  for(int i = 0; i < NUM_THREADS; i++) {
+    pthread_create(&threads[i], 0, record_worker, 0);
+  }
+  for(int i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], 0);
+  }
+  s = latencyStats::summarize(METRIC);
+  printf("count %lld p50 %lld p99 %lld p999 %lld max %lld\n", (long long)s.count,
+         (long long)s.p50, (long long)s.p99, (long long)s.p999, (long long)s.max);
+  assert(s.count == (uint64_t)NUM_THREADS * SAMPLES_PER_THREAD);
+  assert(s.max == (uint64_t)SAMPLES_PER_THREAD);
+  check_close(s.p50,  SAMPLES_PER_THREAD / 2);
+  check_close(s.p99,  SAMPLES_PER_THREAD * 99 / 100);
+  check_close(s.p999, SAMPLES_PER_THREAD * 999 / 1000);
+
+  printf("Stage 3: Small and huge values\n");
+  for(int i = 0; i < 99; i++) { latencyStats::record(METRIC + 1, 3); }
+  latencyStats::record(METRIC + 1, ~0ULL);
+  s = latencyStats::summarize(METRIC + 1);
+  assert(s.count == 100);
+  assert(s.p50 == 3 && s.p99 == 3);
+  assert(s.max == ~0ULL);
+  assert(s.p999 > 3);
+
+  { latencyTimer t(METRIC + 2); }
+  assert(latencyStats::summarize(METRIC + 2).count == 1);
+}
+
+/** @test
+ */
+int main()
+{
+  latencyHistograms();
+  return 0;
+}
@@ -131,6 +131,140 @@ void insertProbeIter(size_t NUM_ENTRIES)
     }
 
     printf("Random Reads completed.\n");
+
+    printf("Stage 4: Batch reads\n");
+
+    // every third key, each followed by a key that is not in the tree.
+    std::vector<dataTuple*> batch;
+    for(size_t i = 0; i < key_arr.size(); i += 3)
+    {
+        batch.push_back(dataTuple::create(key_arr[i].c_str(), key_arr[i].length()+1));
+        std::string missing = key_arr[i] + "\x01";
+        batch.push_back(dataTuple::create(missing.c_str(), missing.length()+1));
+    }
+    std::vector<dataTuple*> results(batch.size(), (dataTuple*)0);
+    ltable_c1->findTuples(xid, &batch[0], batch.size(), &results[0]);
+    for(size_t i = 0; i < batch.size(); i++)
+    {
+        if(i % 2) {
+            assert(results[i] == 0);
+        } else {
+            size_t ki = 3 * (i / 2);
+            assert(results[i] != 0);
+            assert(results[i]->rawkeylen() == key_arr[ki].length()+1);
+            assert(results[i]->datalen() == data_arr[ki].length()+1);
+            dataTuple::freetuple(results[i]);
+        }
+        dataTuple::freetuple(batch[i]);
+    }
+
+    printf("Batch Reads completed.\n");
+
+    printf("Stage 5: Rebuilding the tree from partitions\n");
+
+    std::vector<dataTuple*> splits = ltable_c1->get_split_keys(xid, 4);
+    assert(splits.size() < 4);
+    diskTreeComponent *rebuilt = new diskTreeComponent(xid, 1000, 10000, 5, stats, NUM_ENTRIES);
+    size_t ki = 0;
+    for(size_t p = 0; p <= splits.size(); p++)
+    {
+        diskTreeComponent * part = rebuilt->open_partition(xid, 1000, 10000);
+        for(; ki < NUM_ENTRIES; ki++)
+        {
+            dataTuple* newtuple = dataTuple::create(key_arr[ki].c_str(), key_arr[ki].length()+1, data_arr[ki].c_str(), data_arr[ki].length()+1);
+            bool in_range = p == splits.size() || dataTuple::compare_obj(newtuple, splits[p]) < 0;
+            if(in_range) { part->insertTuple(xid, newtuple); }
+            dataTuple::freetuple(newtuple);
+            if(!in_range) { break; }
+        }
+        part->writes_done();
+        rebuilt->append_partition(xid, part);
+    }
+    assert(ki == NUM_ENTRIES);
+    for(size_t i = 0; i < splits.size(); i++) { dataTuple::freetuple(splits[i]); }
+
+    tree_itr = rebuilt->open_iterator();
+    tuplenum = 0;
+    while( (dt=tree_itr->next_callerFrees()) != NULL)
+    {
+        assert(dt->rawkeylen() == key_arr[tuplenum].length()+1);
+        assert(!memcmp(dt->rawkey(), key_arr[tuplenum].c_str(), dt->rawkeylen()));
+        tuplenum++;
+        dataTuple::freetuple(dt);
+    }
+    delete tree_itr;
+    assert(tuplenum == NUM_ENTRIES);
+    for(size_t i = 0; i < NUM_ENTRIES; i += 7)
+    {
+        dt = rebuilt->findTuple(xid, (const dataTuple::key_t) key_arr[i].c_str(), (size_t)key_arr[i].length()+1);
+        assert(dt != 0);
+        assert(dt->datalen() == data_arr[i].length()+1);
+        dataTuple::freetuple(dt);
+    }
+    rebuilt->force(xid);
+    rebuilt->dealloc(xid);
+    delete rebuilt;
+
+    printf("Partitioned rebuild completed.\n");
+
+    printf("Stage 6: Copying datapages verbatim\n");
+
+    // Like a merge whose small input holds one key, in the middle: the
+    // datapages on either side of it are copied, the one that holds it is not.
+    diskTreeComponent *copy = new diskTreeComponent(xid, 1000, 10000, 5, stats, NUM_ENTRIES);
+    dataTuple * bound = dataTuple::create(key_arr[NUM_ENTRIES/2].c_str(), key_arr[NUM_ENTRIES/2].length()+1);
+    int copied = 0;
+    tree_itr = ltable_c1->open_iterator();
+    dt = tree_itr->next_callerFrees();
+    while(dt)
+    {
+        dataTuple * b = dataTuple::compare_obj(dt, bound) < 0 ? bound : NULL;
+        std::vector<dataTuple*> tuples;
+        dataPage * dp = tree_itr->take_page(b, true, &tuples);
+        if(dp) {
+            assert(!dataTuple::compare_obj(tuples[0], dt));
+            assert(!b || dataTuple::compare_obj(tuples.back(), b) < 0);
+            bool succ = copy->append_datapage(xid, dp, tuples);
+            assert(succ);
+            for(size_t i = 0; i < tuples.size(); i++) { dataTuple::freetuple(tuples[i]); }
+            delete dp;
+            copied++;
+        } else {
+            copy->insertTuple(xid, dt);
+        }
+        dataTuple::freetuple(dt);
+        dt = tree_itr->next_callerFrees();
+    }
+    delete tree_itr;
+    copy->writes_done();
+    dataTuple::freetuple(bound);
+    assert(copied > 1);
+    assert(copy->get_tuple_count() == (int64_t)NUM_ENTRIES);
+
+    tree_itr = copy->open_iterator();
+    tuplenum = 0;
+    while( (dt=tree_itr->next_callerFrees()) != NULL)
+    {
+        assert(dt->rawkeylen() == key_arr[tuplenum].length()+1);
+        assert(!memcmp(dt->rawkey(), key_arr[tuplenum].c_str(), dt->rawkeylen()));
+        assert(dt->datalen() == data_arr[tuplenum].length()+1);
+        tuplenum++;
+        dataTuple::freetuple(dt);
+    }
+    delete tree_itr;
+    assert(tuplenum == NUM_ENTRIES);
+    for(size_t i = 0; i < NUM_ENTRIES; i += 7)
+    {
+        dt = copy->findTuple(xid, (const dataTuple::key_t) key_arr[i].c_str(), (size_t)key_arr[i].length()+1);
+        assert(dt != 0);
+        assert(dt->datalen() == data_arr[i].length()+1);
+        dataTuple::freetuple(dt);
+    }
+    copy->force(xid);
+    copy->dealloc(xid);
+    delete copy;
+
+    printf("Copied %d datapages.\n", copied);
     Tcommit(xid);
     bLSM::deinit_stasis();
 }
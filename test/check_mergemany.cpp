@@ -0,0 +1,142 @@
+/*
+ * check_mergemany.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "bLSM.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <stasis/transactional.h>
+#undef begin
+#undef end
+
+#include "check_util.h"
+
+/** Hands out copies of a sorted list of tuples, like the tree iterators do. */
+class vectorIterator {
+public:
+  explicit vectorIterator(const std::vector<dataTuple*> &tuples) : tuples_(tuples), off_(0) {}
+  ~vectorIterator() {
+    for(size_t i = 0; i < tuples_.size(); i++) {
+      dataTuple::freetuple(tuples_[i]);
+    }
+  }
+  dataTuple * next_callerFrees() {
+    return off_ == tuples_.size() ? NULL : tuples_[off_++]->create_copy();
+  }
+private:
+  std::vector<dataTuple*> tuples_;
+  size_t off_;
+};
+
+typedef bLSM::mergeManyIterator<vectorIterator, vectorIterator> merge_t;
+
+static dataTuple * tup(int k, const char * v) {
+  dataTuple * key = key_tuple(k);
+  dataTuple * ret = v ? dataTuple::create(key->rawkey(), key->rawkeylen(), v, strlen(v) + 1)
+                      : dataTuple::create(key->rawkey(), key->rawkeylen());
+  dataTuple::freetuple(key);
+  return ret;
+}
+
+/** Concatenate the values, so the result records the order of the merges. */
+static dataTuple * concat(const dataTuple * older, const dataTuple * newer) {
+  std::string v = std::string((const char*)older->data()) + (const char*)newer->data();
+  return dataTuple::create(newer->rawkey(), newer->rawkeylen(), v.c_str(), v.length() + 1);
+}
+
+/** Source 0 is the newest. */
+static merge_t * open(dataTuple*(*merge)(const dataTuple*,const dataTuple*)) {
+  std::vector<dataTuple*> s[4];
+  // Key 1 is in every source.
+  s[0].push_back(tup(1, "d"));
+  s[1].push_back(tup(1, "c"));
+  s[2].push_back(tup(1, "b"));
+  s[3].push_back(tup(1, "a"));
+  // Key 2 was deleted, then written again.
+  s[0].push_back(tup(2, "x"));
+  s[1].push_back(tup(2, NULL));
+  s[2].push_back(tup(2, "y"));
+  s[3].push_back(tup(2, "z"));
+  // Key 3 was written, then deleted.
+  s[0].push_back(tup(3, NULL));
+  s[1].push_back(tup(3, "m"));
+  s[3].push_back(tup(3, "n"));
+  // Key 4 is in two of the older sources.
+  s[1].push_back(tup(4, "p"));
+  s[3].push_back(tup(4, "q"));
+  // Key 5 is only in one.
+  s[2].push_back(tup(5, "r"));
+
+  vectorIterator ** iters = new vectorIterator*[3];
+  for(int i = 1; i < 4; i++) {
+    iters[i-1] = new vectorIterator(s[i]);
+  }
+  merge_t * ret = new merge_t(new vectorIterator(s[0]), iters, 3, merge, dataTuple::compare_obj);
+  delete[] iters;
+  return ret;
+}
+
+/** Check the next tuple; a NULL value means a tombstone. */
+static void expect(merge_t * it, int k, const char * v) {
+  dataTuple * t = it->next_callerFrees();
+  assert(t);
+  dataTuple * key = key_tuple(k);
+  assert(!dataTuple::compare_obj(t, key));
+  dataTuple::freetuple(key);
+  if(v) {
+    assert(!t->isDelete());
+    assert(!strcmp((const char*)t->data(), v));
+  } else {
+    assert(t->isDelete());
+  }
+  dataTuple::freetuple(t);
+}
+
+void mergeCallback() {
+  printf("Merging with a merge function\n");
+  merge_t * it = open(concat);
+  expect(it, 1, "abcd");
+  expect(it, 2, "x");
+  assert(it->peek()->isDelete());
+  expect(it, 3, NULL);
+  expect(it, 4, "qp");
+  expect(it, 5, "r");
+  assert(!it->next_callerFrees());
+  delete it;
+
+  printf("Merging without one\n");
+  it = open(NULL);
+  expect(it, 1, "d");
+  expect(it, 2, "x");
+  expect(it, 3, NULL);
+  expect(it, 4, "p");
+  expect(it, 5, "r");
+  assert(!it->next_callerFrees());
+  delete it;
+}
+
+/** @test
+ */
+int main()
+{
+  mergeCallback();
+  return 0;
+}
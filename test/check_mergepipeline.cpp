@@ -0,0 +1,98 @@
+/*
+ * check_mergepipeline.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "bLSM.h"
+#include "mergeScheduler.h"
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <stasis/transactional.h>
+#undef begin
+#undef end
+
+#include "check_util.h"
+
+/** Round 0 writes every key; round r rewrites every (r+1)th one, and deletes every (r+2)th one. */
+static void insertRound(bLSM * ltable, int NUM_ENTRIES, int r) {
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    if(r && i % (r + 1) && i % (r + 2)) { continue; }
+    dataTuple * t = (r && !(i % (r + 2))) ? key_tuple(i) : value_tuple(i, r);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+}
+
+/** @return the version key i should have after round r of insertRound(), or -1 if it is deleted. */
+static int expected_version(int i, int r) {
+  int v = -1;
+  for(int j = 0; j <= r; j++) {
+    if(j && !(i % (j + 2))) { v = -1; }
+    else if(j == 0 || !(i % (j + 1))) { v = j; }
+  }
+  return v;
+}
+
+static void mergePipeline(int NUM_ENTRIES, pageid_t prefetch_bytes, pageid_t write_behind_bytes, int partitions) {
+  unlink("storefile.txt");
+  unlink("logfile.txt");
+  system("rm -rf stasis_log/");
+
+  bLSM::init_stasis();
+  int xid = Tbegin();
+  bLSM * ltable = new bLSM(0, 100 * 1024, 1000, 10000, 5);
+  ltable->merge_prefetch_bytes = prefetch_bytes;
+  ltable->merge_write_behind_bytes = write_behind_bytes;
+  ltable->c2_merge_partitions = partitions;
+  mergeScheduler mscheduler(ltable);
+  ltable->allocTable(xid);
+  Tcommit(xid);
+
+  mscheduler.start();
+
+  const int ROUNDS = 4;
+  printf("Stage 1: prefetch %lld bytes, write behind %lld bytes, %d partitions: %d keys, %d rounds\n",
+         (long long)prefetch_bytes, (long long)write_behind_bytes, partitions, NUM_ENTRIES, ROUNDS);
+  for(int r = 0; r < ROUNDS; r++) {
+    insertRound(ltable, NUM_ENTRIES, r);
+  }
+
+  printf("Stage 2: Lookups and scans\n");
+  int live = 0;
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    int v = expected_version(i, ROUNDS - 1);
+    assert(find_version(ltable, i) == v);
+    if(v != -1) { live++; }
+  }
+  assert(scan(ltable) == live);
+
+  mscheduler.shutdown();
+  delete ltable;
+  bLSM::deinit_stasis();
+}
+
+/** @test
+ */
+int main()
+{
+  // A one byte queue holds a single tuple or datapage at a time.
+  mergePipeline(50000, 1, 1, 1);
+  mergePipeline(50000, 64 * 1024, 256 * 1024, 1);
+  mergePipeline(50000, 64 * 1024, 256 * 1024, 4);
+  return 0;
+}
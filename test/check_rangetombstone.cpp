@@ -0,0 +1,215 @@
+/*
+ * check_rangetombstone.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "bLSM.h"
+#include "mergeScheduler.h"
+#include "rangeTombstones.h"
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <stasis/transactional.h>
+#undef begin
+#undef end
+
+#include "check_util.h"
+
+void tombstoneSet() {
+  printf("Stage 1: rangeTombstones\n");
+  rangeTombstones r;
+  dataTuple * k10 = key_tuple(10);
+  dataTuple * k20 = key_tuple(20);
+  dataTuple * k30 = key_tuple(30);
+  assert(r.empty() && !r.covers(k10));
+
+  r.add(k10, k20, 1);
+  r.add(k30, NULL, 2);
+  dataTuple * end;
+  assert(r.covers(k10, &end) && !dataTuple::compare_obj(end, k20));
+  dataTuple::freetuple(end);
+  assert(!r.covers(k20));
+  assert(r.covers(k30, &end) && end == NULL);
+  assert(r.max_id() == 2);
+
+  size_t len = r.marshalled_length();
+  byte * buf = (byte*)malloc(len);
+  r.marshal(buf);
+  rangeTombstones copy;
+  copy.unmarshal(buf, len);
+  free(buf);
+  for(int i = 0; i < 40; i++) {
+    dataTuple * k = key_tuple(i);
+    assert(copy.covers(k) == ((i >= 10 && i < 20) || i >= 30));
+    dataTuple::freetuple(k);
+  }
+
+  rangeTombstones since;
+  since.add_since(&r, 2);
+  assert(!since.covers(k10) && since.covers(k30));
+
+  dataTuple::freetuple(k10);
+  dataTuple::freetuple(k20);
+  dataTuple::freetuple(k30);
+}
+
+static void check_range(bLSM * ltable, int n, int lo, int hi, int reinserted) {
+  int xid = Tbegin();
+  for(int i = 0; i < n; i++) {
+    dataTuple * k = key_tuple(i);
+    dataTuple * t = ltable->findTuple(xid, k->strippedkey(), k->strippedkeylen());
+    bool should_exist = i < lo || i >= hi || i < lo + reinserted;
+    assert(should_exist == (t != NULL));
+    if(t) { dataTuple::freetuple(t); }
+    dataTuple::freetuple(k);
+  }
+  Tcommit(xid);
+
+  bLSM::iterator * it = new bLSM::iterator(ltable);
+  int count = 0;
+  dataTuple * t;
+  while((t = it->getnext_borrowed())) { count++; }
+  delete it;
+  assert(count == n - (hi - lo) + reinserted);
+}
+
+void dropRangeMerge(int NUM_ENTRIES) {
+  printf("Stage 2: dropRange\n");
+  unlink("storefile.txt");
+  unlink("logfile.txt");
+  system("rm -rf stasis_log/");
+
+  bLSM::init_stasis();
+  int xid = Tbegin();
+  bLSM * ltable = new bLSM(0, 100 * 1024, 1000, 10000, 5);
+  mergeScheduler mscheduler(ltable);
+  ltable->allocTable(xid);
+  Tcommit(xid);
+  mscheduler.start();
+
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    dataTuple * t = value_tuple(i, 1);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+
+  int lo = NUM_ENTRIES / 4;
+  int hi = NUM_ENTRIES / 2;
+  dataTuple * start = key_tuple(lo);
+  dataTuple * end = key_tuple(hi);
+  ltable->dropRange(start, end);
+  check_range(ltable, NUM_ENTRIES, lo, hi, 0);
+
+  // writes after the drop are not affected by it.
+  int reinserted = (hi - lo) / 10;
+  for(int i = lo; i < lo + reinserted; i++) {
+    dataTuple * t = value_tuple(i, 2);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+  check_range(ltable, NUM_ENTRIES, lo, hi, reinserted);
+
+  printf("Stage 3: Merging the tombstone down\n");
+  for(int round = 0; round < 4; round++) {
+    for(int i = NUM_ENTRIES; i < 2 * NUM_ENTRIES; i++) {
+      dataTuple * t = value_tuple(i, round);
+      ltable->insertTuple(t);
+      dataTuple::freetuple(t);
+    }
+  }
+  for(int i = NUM_ENTRIES; i < 2 * NUM_ENTRIES; i++) {
+    dataTuple * k = key_tuple(i);
+    ltable->insertTuple(k); // a point delete, so check_range() sees what it expects.
+    dataTuple::freetuple(k);
+  }
+  check_range(ltable, NUM_ENTRIES, lo, hi, reinserted);
+
+  dataTuple::freetuple(start);
+  dataTuple::freetuple(end);
+  mscheduler.shutdown();
+  delete ltable;
+  bLSM::deinit_stasis();
+}
+
+void dropRangeRestart(int NUM_ENTRIES) {
+  printf("Stage 4: dropRange, log truncation, and restart\n");
+  unlink("storefile.txt");
+  unlink("logfile.txt");
+  system("rm -rf stasis_log/ lsm_log/");
+
+  bLSM::init_stasis();
+  int xid = Tbegin();
+  bLSM * ltable = new bLSM(1, 20 * 1024, 1000, 10000, 5);
+  mergeScheduler * mscheduler = new mergeScheduler(ltable);
+  recordid rid = ltable->allocTable(xid);
+  Tcommit(xid);
+  mscheduler->start();
+  ltable->replayLog();
+
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    dataTuple * t = value_tuple(i, 1);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+  int lo = NUM_ENTRIES / 4;
+  int hi = NUM_ENTRIES / 2;
+  dataTuple * start = key_tuple(lo);
+  dataTuple * end = key_tuple(hi);
+  ltable->dropRange(start, end);
+  dataTuple::freetuple(start);
+  dataTuple::freetuple(end);
+  // Keep the merges going until the log no longer holds the drop.
+  for(int i = NUM_ENTRIES; i < 2 * NUM_ENTRIES; i++) {
+    dataTuple * t = value_tuple(i, 1);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+  mscheduler->shutdown();
+  delete mscheduler;
+  delete ltable;
+  bLSM::deinit_stasis();
+
+  // Only the persistent range tombstones can hide the range now.
+  bLSM::init_stasis();
+  xid = Tbegin();
+  ltable = new bLSM(1, 20 * 1024, 1000, 10000, 5);
+  rid.size = TrecordSize(xid, rid);
+  ltable->openTable(xid, rid);
+  Tcommit(xid);
+  mscheduler = new mergeScheduler(ltable);
+  mscheduler->start();
+  ltable->replayLog();
+  for(int i = 0; i < 2 * NUM_ENTRIES; i++) {
+    assert(find_version(ltable, i) == ((i >= lo && i < hi) ? -1 : 1));
+  }
+  assert(scan(ltable) == 2 * NUM_ENTRIES - (hi - lo));
+
+  mscheduler->shutdown();
+  delete mscheduler;
+  delete ltable;
+  bLSM::deinit_stasis();
+}
+
+/** @test
+ */
+int main()
+{
+  tombstoneSet();
+  dropRangeMerge(20000);
+  dropRangeRestart(5000);
+  return 0;
+}
@@ -104,6 +104,30 @@ void insertProbeIter(size_t NUM_ENTRIES)
         dataTuple::freetuple(search_tuple);
     }
     printf("found %d\n", found_tuples);    
+
+    printf("Stage 3: Bounded scans\n");
+    std::vector<dataTuple*> sorted(rbtree.begin(), rbtree.end());
+    size_t lo = sorted.size() / 4;
+    size_t hi = sorted.size() / 2;
+    memTreeComponent::iterator * it = new memTreeComponent::iterator(&rbtree, sorted[lo], sorted[hi], false);
+    for(size_t i = lo; i <= hi; i++) {
+        dataTuple * t = it->next_callerFrees();
+        assert(t && !dataTuple::compare_obj(t, sorted[i]));
+        dataTuple::freetuple(t);
+    }
+    assert(!it->next_callerFrees());
+    delete it;
+    it = new memTreeComponent::iterator(&rbtree, sorted[hi], sorted[lo], true);
+    for(size_t i = hi + 1; i > lo; i--) {
+        dataTuple * t = it->next_callerFrees();
+        assert(t && !dataTuple::compare_obj(t, sorted[i-1]));
+        dataTuple::freetuple(t);
+    }
+    assert(!it->next_callerFrees());
+    delete it;
+    it = new memTreeComponent::iterator(&rbtree, sorted[lo], sorted[hi], true);
+    assert(!it->next_callerFrees());
+    delete it;
 }
 
 
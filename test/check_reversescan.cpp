@@ -0,0 +1,129 @@
+/*
+ * check_reversescan.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "bLSM.h"
+#include "mergeScheduler.h"
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include <stasis/transactional.h>
+#undef begin
+#undef end
+
+#include "check_util.h"
+
+/** @return the keys and values of the tuples >= key (or all of them), in ascending order. */
+static std::vector<std::string> scan_forward(bLSM * ltable, dataTuple * key) {
+  std::vector<std::string> ret;
+  bLSM::iterator * it = key ? new bLSM::iterator(ltable, key) : new bLSM::iterator(ltable);
+  dataTuple * t;
+  while((t = it->getnext_borrowed())) {
+    ret.push_back(std::string((char*)t->strippedkey()) + "=" + std::string((char*)t->data()));
+  }
+  delete it;
+  return ret;
+}
+
+/** Check that a reverse scan from key returns what a forward scan does, backwards. */
+static void check_reverse(bLSM * ltable, dataTuple * key) {
+  std::vector<std::string> all = scan_forward(ltable, NULL);
+  size_t expected = all.size();
+  if(key) {
+    // everything <= key.
+    std::vector<std::string> above = scan_forward(ltable, key);
+    expected -= above.size();
+    if(!above.empty() && above[0].substr(0, above[0].find('=')) == (char*)key->strippedkey()) {
+      expected++;
+    }
+  }
+  bLSM::iterator * it = new bLSM::iterator(ltable, key, true);
+  dataTuple * t;
+  size_t i = expected;
+  while((t = it->getnext_borrowed())) {
+    assert(i > 0);
+    i--;
+    assert(all[i] == std::string((char*)t->strippedkey()) + "=" + std::string((char*)t->data()));
+  }
+  delete it;
+  assert(i == 0);
+}
+
+void reverseScan(int NUM_ENTRIES) {
+  unlink("storefile.txt");
+  unlink("logfile.txt");
+  system("rm -rf stasis_log/");
+
+  bLSM::init_stasis();
+  int xid = Tbegin();
+  bLSM * ltable = new bLSM(0, 100 * 1024, 1000, 10000, 5);
+  mergeScheduler mscheduler(ltable);
+  ltable->allocTable(xid);
+  Tcommit(xid);
+  mscheduler.start();
+
+  printf("Stage 1: Inserting %d keys\n", NUM_ENTRIES);
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    dataTuple * t = value_tuple(i, 1);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+  // Newer versions and tombstones, so that each key can come from several components.
+  for(int i = 0; i < NUM_ENTRIES; i += 5) {
+    dataTuple * t = value_tuple(i, 2);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+  for(int i = 0; i < NUM_ENTRIES; i += 7) {
+    dataTuple * k = key_tuple(i);
+    ltable->insertTuple(k);
+    dataTuple::freetuple(k);
+  }
+
+  printf("Stage 2: Scanning backwards\n");
+  check_reverse(ltable, NULL);
+  int starts[] = { -1, 0, 1, 7, NUM_ENTRIES / 3, NUM_ENTRIES - 1, NUM_ENTRIES + 1 };
+  for(size_t i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+    dataTuple * k = key_tuple(starts[i]);
+    check_reverse(ltable, k);
+    dataTuple::freetuple(k);
+  }
+
+  printf("Stage 3: Scanning backwards over a dropped range\n");
+  dataTuple * start = key_tuple(NUM_ENTRIES / 4);
+  dataTuple * end = key_tuple(NUM_ENTRIES / 2);
+  ltable->dropRange(start, end);
+  check_reverse(ltable, NULL);
+  check_reverse(ltable, end);
+  dataTuple::freetuple(start);
+  dataTuple::freetuple(end);
+
+  mscheduler.shutdown();
+  delete ltable;
+  bLSM::deinit_stasis();
+}
+
+/** @test
+ */
+int main()
+{
+  reverseScan(20000);
+  return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * check_skiplist.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "concurrentSkiplist.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "check_util.h"
+
+static const int NUM_THREADS = 8;
+
+struct worker_args {
+    concurrentSkiplist * list;
+    std::vector<std::string> * keys;
+    int id;
+};
+
+static void * insert_worker(void * argp) {
+    worker_args * a = (worker_args*)argp;
+    for(size_t i = a->id; i < a->keys->size(); i += NUM_THREADS) {
+        const std::string & k = (*a->keys)[i];
+        dataTuple * t = dataTuple::create(k.c_str(), k.length()+1, k.c_str(), k.length()+1);
+        bool ok = a->list->insert(t);
+        assert(ok);
+        dataTuple::freetuple(t); // the list made its own copy.
+    }
+    return 0;
+}
+
+static void * erase_worker(void * argp) {
+    worker_args * a = (worker_args*)argp;
+    for(size_t i = a->id; i < a->keys->size(); i += 2 * NUM_THREADS) {
+        const std::string & k = (*a->keys)[i];
+        dataTuple * search_tuple = dataTuple::create(k.c_str(), k.length()+1);
+        concurrentSkiplist::readGuard g(a->list);
+        dataTuple * t = a->list->find(search_tuple);
+        assert(t);
+        bool ok = a->list->erase(t);
+        assert(ok);
+        dataTuple::freetuple(search_tuple);
+    }
+    return 0;
+}
+
+// scans concurrently with the writers; keys must always come back in order.
+static void * scan_worker(void * argp) {
+    worker_args * a = (worker_args*)argp;
+    for(int pass = 0; pass < 20; pass++) {
+        concurrentSkiplist::readGuard g(a->list);
+        dataTuple * last = 0;
+        for(concurrentSkiplist::node * n = a->list->seek(NULL, true); n; n = a->list->next(n)) {
+            dataTuple * t = concurrentSkiplist::tuple_of(n);
+            if(last) { assert(dataTuple::compare_obj(last, t) < 0); }
+            last = t;
+        }
+        // ... and backwards.  Most passes only check the first step.
+        last = 0;
+        for(concurrentSkiplist::node * n = a->list->seek_back(NULL, true); n; n = a->list->seek_back(last, false)) {
+            dataTuple * t = concurrentSkiplist::tuple_of(n);
+            if(last) { assert(dataTuple::compare_obj(last, t) > 0); }
+            last = t;
+            if(pass % 4) { break; }
+        }
+    }
+    return 0;
+}
+
+void insertProbeIter(size_t NUM_ENTRIES)
+{
+    std::vector<std::string> key_arr;
+    preprandstr(NUM_ENTRIES, key_arr, 100, true);
+
+    std::sort(key_arr.begin(), key_arr.end(), &mycmp);
+    removeduplicates(key_arr);
+    NUM_ENTRIES = key_arr.size();
+
+    std::vector<std::string> shuffled(key_arr);
+    std::random_shuffle(shuffled.begin(), shuffled.end());
+
+    concurrentSkiplist list;
+
+    printf("Stage 1: Inserting %llu keys from %d threads\n", (unsigned long long)NUM_ENTRIES, NUM_THREADS);
+    pthread_t threads[NUM_THREADS+1];
+    worker_args args[NUM_THREADS+1];
+    for(int i = 0; i <= NUM_THREADS; i++) {
+        args[i].list = &list;
+        args[i].keys = &shuffled;
+        args[i].id = i;
+    }
+    for(int i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], 0, insert_worker, &args[i]);
+    }
+    pthread_create(&threads[NUM_THREADS], 0, scan_worker, &args[NUM_THREADS]);
+    for(int i = 0; i <= NUM_THREADS; i++) {
+        pthread_join(threads[i], 0);
+    }
+    assert(list.size() == (int64_t)NUM_ENTRIES);
+    pageid_t full_bytes = list.get_arena()->bytes_in_use();
+    assert(full_bytes > 0);
+
+    printf("Stage 2: Checking order and duplicate inserts\n");
+    {
+        concurrentSkiplist::readGuard g(&list);
+        size_t i = 0;
+        for(concurrentSkiplist::node * n = list.seek(NULL, true); n; n = list.next(n)) {
+            dataTuple * t = concurrentSkiplist::tuple_of(n);
+            assert(!strcmp((char*)t->rawkey(), key_arr[i].c_str()));
+            i++;
+        }
+        assert(i == NUM_ENTRIES);
+        for(concurrentSkiplist::node * n = list.seek_back(NULL, true); n; n = list.seek_back(concurrentSkiplist::tuple_of(n), false)) {
+            i--;
+            assert(!strcmp((char*)concurrentSkiplist::tuple_of(n)->rawkey(), key_arr[i].c_str()));
+        }
+        assert(i == 0);
+        dataTuple * mid = dataTuple::create(key_arr[NUM_ENTRIES/2].c_str(), key_arr[NUM_ENTRIES/2].length()+1);
+        assert(list.seek_back(mid, true) == list.seek(mid, true));
+        assert(list.next(list.seek_back(mid, false)) == list.seek(mid, true));
+        dataTuple::freetuple(mid);
+    }
+    dataTuple * dup = dataTuple::create(key_arr[0].c_str(), key_arr[0].length()+1);
+    bool inserted = list.insert(dup);
+    assert(!inserted);
+    dataTuple::freetuple(dup);
+
+    printf("Stage 3: Replacing values\n");
+    for(size_t i = 0; i < NUM_ENTRIES; i += 2) {
+        dataTuple * search_tuple = dataTuple::create(key_arr[i].c_str(), key_arr[i].length()+1);
+        concurrentSkiplist::readGuard g(&list);
+        dataTuple * t = list.find(search_tuple);
+        assert(t);
+        dataTuple * new_t = dataTuple::create(key_arr[i].c_str(), key_arr[i].length()+1, "x", 2);
+        dataTuple * copy = list.replace(t, new_t);
+        assert(copy);
+        bool ok = list.erase(t);
+        assert(!ok); // t was replaced, so erase must leave the key alone.
+        assert(list.find(search_tuple) == copy);
+        assert(copy->datalen() == 2);
+        dataTuple::freetuple(new_t);
+        dataTuple::freetuple(search_tuple);
+    }
+
+    printf("Stage 4: Erasing half the keys from %d threads\n", NUM_THREADS);
+    for(int i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], 0, erase_worker, &args[i]);
+    }
+    pthread_create(&threads[NUM_THREADS], 0, scan_worker, &args[NUM_THREADS]);
+    for(int i = 0; i <= NUM_THREADS; i++) {
+        pthread_join(threads[i], 0);
+    }
+
+    printf("Stage 5: Probing\n");
+    size_t found = 0;
+    for(size_t i = 0; i < NUM_ENTRIES; i++) {
+        dataTuple * search_tuple = dataTuple::create(shuffled[i].c_str(), shuffled[i].length()+1);
+        concurrentSkiplist::readGuard g(&list);
+        bool expected = (i % (2 * NUM_THREADS)) >= NUM_THREADS;
+        assert((list.find(search_tuple) != 0) == expected);
+        if(expected) { found++; }
+        dataTuple::freetuple(search_tuple);
+    }
+    assert(list.size() == (int64_t)found);
+    printf("found %llu\n", (unsigned long long)found);
+}
+
+/** @test
+ */
+int main()
+{
+    insertProbeIter(20000);
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * check_tableupgrade.cpp
+ *
+ * Copyright 2009-2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "bLSM.h"
+#include "mergeScheduler.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <stasis/transactional.h>
+#undef begin
+#undef end
+
+#include "check_util.h"
+
+// Headers written before this version stopped at c2_bloom.
+static const size_t OLD_HEADER_SIZE = offsetof(bLSM::table_header, c2_bloom);
+
+static void insertRange(bLSM * ltable, int lo, int hi, int v) {
+  for(int i = lo; i < hi; i++) {
+    dataTuple * t = value_tuple(i, v);
+    ltable->insertTuple(t);
+    dataTuple::freetuple(t);
+  }
+}
+
+/** Open the table at rid the way the servers do. */
+static bLSM * open_table(recordid rid, int disk_levels) {
+  bLSM::init_stasis();
+  int xid = Tbegin();
+  bLSM * ltable = new bLSM(1, 20 * 1024, 1000, 10000, 5);
+  ltable->disk_levels = disk_levels;
+  rid.size = TrecordSize(xid, rid);
+  ltable->openTable(xid, rid);
+  Tcommit(xid);
+  return ltable;
+}
+
+/** Start merging, and replay the log. */
+static mergeScheduler * start_table(bLSM * ltable) {
+  mergeScheduler * mscheduler = new mergeScheduler(ltable);
+  mscheduler->start();
+  ltable->replayLog();
+  return mscheduler;
+}
+
+static void close_table(bLSM * ltable, mergeScheduler * mscheduler) {
+  mscheduler->shutdown();
+  delete mscheduler;
+  delete ltable;
+  bLSM::deinit_stasis();
+}
+
+void tableUpgrade(int NUM_ENTRIES) {
+  unlink("storefile.txt");
+  unlink("logfile.txt");
+  system("rm -rf stasis_log/ lsm_log/");
+
+  printf("Stage 1: Writing a table, and giving it an old style header\n");
+  bLSM::init_stasis();
+  int xid = Tbegin();
+  bLSM * ltable = new bLSM(1, 20 * 1024, 1000, 10000, 5);
+  mergeScheduler * mscheduler = new mergeScheduler(ltable);
+  recordid rid = ltable->allocTable(xid);
+  Tcommit(xid);
+  mscheduler->start();
+  ltable->replayLog();
+  insertRange(ltable, 0, NUM_ENTRIES, 0);
+  mscheduler->shutdown();
+  delete mscheduler;
+
+  xid = Tbegin();
+  bLSM::table_header h;
+  Tread(xid, rid, &h);
+  recordid old = Talloc(xid, OLD_HEADER_SIZE);
+  Tset(xid, old, &h);
+  Tcommit(xid);
+  delete ltable;
+  bLSM::deinit_stasis();
+
+  printf("Stage 2: Opening it, and adding a level\n");
+  ltable = open_table(old, 3);
+  mscheduler = start_table(ltable);
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    assert(find_version(ltable, i) == 0);
+  }
+  assert(ltable->get_num_disk_levels() == 3);
+  for(int r = 1; r < 4; r++) {
+    insertRange(ltable, 0, NUM_ENTRIES, r);
+  }
+  int lo = NUM_ENTRIES / 4;
+  int hi = NUM_ENTRIES / 2;
+  dataTuple * start = key_tuple(lo);
+  dataTuple * end = key_tuple(hi);
+  ltable->dropRange(start, end);
+  dataTuple::freetuple(start);
+  dataTuple::freetuple(end);
+  // Enough to truncate the log past the drop.
+  insertRange(ltable, 0, lo, 4);
+  insertRange(ltable, hi, NUM_ENTRIES, 4);
+  mscheduler->shutdown();
+  pageid_t c2_bloom = ltable->get_tree_c2()->get_bloom_filter_pid();
+  pageid_t c1_bloom = ltable->get_tree_c1()->get_bloom_filter_pid();
+  assert(c2_bloom != INVALID_PAGE && c1_bloom != INVALID_PAGE);
+  delete mscheduler;
+  delete ltable;
+  bLSM::deinit_stasis();
+
+  printf("Stage 3: Reopening it\n");
+  ltable = open_table(old, 2);
+  xid = Tbegin();
+  assert(TrecordSize(xid, old) == (int)OLD_HEADER_SIZE);
+  Tcommit(xid);
+  // Nothing past the old header may have been cut off.
+  assert(ltable->get_num_disk_levels() == 3);
+  assert(ltable->get_tree_c2()->get_bloom_filter_pid() == c2_bloom);
+  assert(ltable->get_tree_c1()->get_bloom_filter_pid() == c1_bloom);
+  mscheduler = start_table(ltable);
+  for(int i = 0; i < NUM_ENTRIES; i++) {
+    assert(find_version(ltable, i) == ((i >= lo && i < hi) ? -1 : 4));
+  }
+  assert(scan(ltable) == NUM_ENTRIES - (hi - lo));
+  close_table(ltable, mscheduler);
+}
+
+/** @test
+ */
+int main()
+{
+  tableUpgrade(5000);
+  return 0;
+}
@@ -26,6 +26,8 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <string.h>
+#include <stdio.h>
+#include <assert.h>
 #include <vector>
 #include <string>
 bool mycmp(const std::string & k1,const std::string & k2)
@@ -185,4 +187,54 @@ static inline double tv_to_double(struct timeval tv)
       (static_cast<double>(tv.tv_usec) / 1000000.0);
 }
 
+#ifdef _LOGSTORE_H_
+// Helpers for the tests that run a bLSM.  Key i is "%08d", and version v
+// of its value is "v<v>".
+
+static inline dataTuple * key_tuple(int i) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%08d", i);
+  return dataTuple::create(buf, strlen(buf) + 1);
+}
+
+static inline dataTuple * value_tuple(int i, int version) {
+  char key[16];
+  char val[16];
+  snprintf(key, sizeof(key), "%08d", i);
+  snprintf(val, sizeof(val), "v%d", version);
+  return dataTuple::create(key, strlen(key) + 1, val, strlen(val) + 1);
+}
+
+/** @return the version of key i that the table holds, or -1. */
+static inline int find_version(bLSM * ltable, int i) {
+  dataTuple * k = key_tuple(i);
+  dataTuple * t = ltable->findTuple(-1, k->strippedkey(), k->strippedkeylen());
+  dataTuple::freetuple(k);
+  if(!t) { return -1; }
+  int ret = atoi((char*)t->data() + 1);
+  dataTuple::freetuple(t);
+  return ret;
+}
+
+/** Scan the table, checking that the tuples come out in order.  @return how many there were. */
+static inline int scan(bLSM * ltable, bool reverse = false) {
+  bLSM::iterator * it = new bLSM::iterator(ltable, NULL, reverse);
+  dataTuple * prev = NULL;
+  dataTuple * t;
+  int count = 0;
+  while((t = it->getnext())) {
+    if(prev) {
+      int res = dataTuple::compare_obj(prev, t);
+      assert(reverse ? res > 0 : res < 0);
+      dataTuple::freetuple(prev);
+    }
+    prev = t;
+    count++;
+  }
+  if(prev) { dataTuple::freetuple(prev); }
+  delete it;
+  return count;
+}
+#endif // _LOGSTORE_H_
+
 #endif /* CHECK_UTIL_H_ */